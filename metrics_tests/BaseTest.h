@@ -15,13 +15,39 @@
 #ifndef BASE_TEST_H
 #define BASE_TEST_H
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <ctime>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+#include "MemoryUsage.h"
+#include "PerfCounters.h"
+
+#ifdef METRICS_HAVE_GIT_HASH
+#include "metrics_git_hash.h"
+#endif
+
+#if defined(__has_include)
+#if __has_include("chrono/ChVersion.h")
+#include "chrono/ChVersion.h"
+#endif
+#endif
+
 class Object {
   public:
     Object() { m_content << "{"; }
@@ -74,7 +100,12 @@ class BaseTest {
   public:
     /// Constructor: Every test has to have a name and an associated project to it.
     BaseTest(const std::string& testName, const std::string& testProjectName)
-        : m_name(testName), m_projectName(testProjectName), m_outDir("."), m_verbose(false) {}
+        : m_name(testName), m_projectName(testProjectName), m_outDir("."), m_verbose(false),
+          m_perf(false),
+          m_numSteps(0),
+          m_stepAllocs(0),
+          m_stepBytes(0),
+          m_stepMaxAllocs(0) {}
 
     virtual ~BaseTest() {}
 
@@ -93,10 +124,74 @@ class BaseTest {
     /// Set output directory (default: current directory).
     void setOutDir(const std::string& outDir) { m_outDir = outDir; }
 
+    /// Enable/disable collection of hardware performance counters (default: false).
+    /// When enabled, cycles, instructions, cache misses and branch misses are counted around execute()
+    /// and around any sub-phase delimited by startPhase()/stopPhase(). Counters are only available on
+    /// Linux and only if the kernel grants access to the PMU; otherwise, "perf_available" is set to 0.
+    void setPerfCounters(bool val) { m_perf = val; }
+
+    /// Start the named sub-phase.
+    /// For each phase, the increase in resident set size and, if enabled, hardware performance counters
+    /// and heap allocations are recorded. A phase may be started and stopped repeatedly; values accumulate.
+    void startPhase(const std::string& phase) {
+        Phase* p = findPhase(phase);
+        if (!p) {
+            m_phases.emplace_back(new Phase(phase));
+            p = m_phases.back().get();
+        }
+        p->rss_start = metrics::GetCurrentRSS();
+        p->alloc_start = metrics::AllocationSnapshot::Take();
+        if (m_perf)
+            p->perf.start();
+    }
+
+    /// Stop the named sub-phase.
+    void stopPhase(const std::string& phase) {
+        Phase* p = findPhase(phase);
+        if (!p)
+            return;
+        if (m_perf)
+            p->perf.stop();
+        metrics::AllocationSnapshot alloc = metrics::AllocationSnapshot::Take();
+        p->num_allocs += alloc.num_allocs - p->alloc_start.num_allocs;
+        p->alloc_bytes += alloc.bytes - p->alloc_start.bytes;
+        p->rss_increase += (double)metrics::GetCurrentRSS() - (double)p->rss_start;
+    }
+
+    /// Mark the beginning of a simulation step (for per-step allocation statistics).
+    /// This is a no-op unless allocation counting is enabled (METRICS_COUNT_ALLOCATIONS).
+    void beginStep() {
+#ifdef METRICS_COUNT_ALLOCATIONS
+        m_stepStart = metrics::AllocationSnapshot::Take();
+#endif
+    }
+
+    /// Mark the end of a simulation step (see beginStep()).
+    void endStep() {
+#ifdef METRICS_COUNT_ALLOCATIONS
+        metrics::AllocationSnapshot alloc = metrics::AllocationSnapshot::Take();
+        uint64_t num_allocs = alloc.num_allocs - m_stepStart.num_allocs;
+        uint64_t bytes = alloc.bytes - m_stepStart.bytes;
+        m_numSteps++;
+        m_stepAllocs += num_allocs;
+        m_stepBytes += bytes;
+        m_stepMaxAllocs = std::max(m_stepMaxAllocs, num_allocs);
+#endif
+    }
+
     /// Main function for running the test.
     bool run() {
         // Execute the actual test and collect metrics
+        uint64_t rss_start = metrics::GetCurrentRSS();
+        metrics::AllocationSnapshot alloc_start = metrics::AllocationSnapshot::Take();
+        if (m_perf)
+            m_perfTotal.start();
         bool passed = execute();
+        if (m_perf) {
+            m_perfTotal.stop();
+            addPerfMetrics();
+        }
+        addMemoryMetrics(rss_start, alloc_start);
 
         // Populate output JSON string
         m_jsonTest.AddMember("name", m_name, false);
@@ -105,6 +200,12 @@ class BaseTest {
         m_jsonTest.AddMember("execution_time", getExecutionTime(), false);
         m_jsonTest.AddMember("metrics", m_jsonMetrics, false);
 
+        // Record the hardware and build configuration (after execute(), so that the
+        // OpenMP thread count reflects any setting made by the test itself)
+        Object fingerprint;
+        addFingerprint(fingerprint);
+        m_jsonTest.AddMember("fingerprint", fingerprint, false);
+
         // Write output file
         std::string fname = m_outDir + "/" + m_name + ".json";
         if (m_verbose)
@@ -158,11 +259,198 @@ class BaseTest {
     }
 
   private:
+    /// Add the performance counter values for the entire test and for each sub-phase as metrics.
+    void addPerfMetrics() {
+        bool available = m_perfTotal.available();
+        addMetric("perf_available", available ? 1 : 0);
+        if (!available) {
+            std::cout << "Hardware performance counters not available" << std::endl;
+            return;
+        }
+
+        addPerfMetrics("perf_", m_perfTotal);
+        for (auto& p : m_phases)
+            addPerfMetrics("perf_" + p->name + "_", p->perf);
+    }
+
+    void addPerfMetrics(const std::string& prefix, const PerfCounters& counters) {
+        for (int e = 0; e < PerfCounters::NUM_EVENTS; e++) {
+            auto event = static_cast<PerfCounters::Event>(e);
+            if (counters.supported(event))
+                addMetric(prefix + PerfCounters::name(event), counters.count(event));
+        }
+        uint64_t cycles = counters.count(PerfCounters::CYCLES);
+        if (cycles > 0 && counters.supported(PerfCounters::INSTRUCTIONS))
+            addMetric(prefix + "ipc", (double)counters.count(PerfCounters::INSTRUCTIONS) / cycles);
+    }
+
+    /// Add memory usage metrics for the entire test and for each sub-phase.
+    /// Note that the peak RSS is a process-wide high-water mark (including any previous test in the same program).
+    void addMemoryMetrics(uint64_t rss_start, const metrics::AllocationSnapshot& alloc_start) {
+        const double MB = 1024.0 * 1024.0;
+        addMetric("peak_rss (MB)", metrics::GetPeakRSS() / MB);
+        addMetric("rss_increase (MB)", ((double)metrics::GetCurrentRSS() - (double)rss_start) / MB);
+        for (auto& p : m_phases)
+            addMetric("mem_" + p->name + "_rss_increase (MB)", p->rss_increase / MB);
+
+        if (!metrics::AllocationCountingEnabled())
+            return;
+
+        metrics::AllocationSnapshot alloc = metrics::AllocationSnapshot::Take();
+        addMetric("num_allocs", alloc.num_allocs - alloc_start.num_allocs);
+        addMetric("alloc_bytes (MB)", (alloc.bytes - alloc_start.bytes) / MB);
+        for (auto& p : m_phases) {
+            addMetric("mem_" + p->name + "_num_allocs", p->num_allocs);
+            addMetric("mem_" + p->name + "_alloc_bytes (MB)", p->alloc_bytes / MB);
+        }
+        if (m_numSteps > 0) {
+            addMetric("avg_allocs_per_step", (double)m_stepAllocs / m_numSteps);
+            addMetric("avg_alloc_bytes_per_step", (double)m_stepBytes / m_numSteps);
+            addMetric("max_allocs_per_step", m_stepMaxAllocs);
+        }
+    }
+
+    /// Collect information identifying the machine and build that produced the results.
+    void addFingerprint(Object& obj) {
+        obj.AddMember("cpu_model", getCpuModel(), m_verbose);
+        obj.AddMember("num_cores", (int)std::thread::hardware_concurrency(), m_verbose);
+#ifdef _OPENMP
+        obj.AddMember("omp_threads", omp_get_max_threads(), m_verbose);
+#else
+        obj.AddMember("omp_threads", 1, m_verbose);
+#endif
+        obj.AddMember("simd", getSimdLevel(), m_verbose);
+        obj.AddMember("compiler", getCompiler(), m_verbose);
+        obj.AddMember("build_type", getBuildType(), m_verbose);
+        obj.AddMember("chrono_version", getChronoVersion(), m_verbose);
+#ifdef METRICS_GIT_HASH
+        obj.AddMember("git_hash", std::string(METRICS_GIT_HASH), m_verbose);
+#else
+        obj.AddMember("git_hash", std::string("unknown"), m_verbose);
+#endif
+        obj.AddMember("timestamp", getTimestamp(), m_verbose);
+    }
+
+    static std::string getCpuModel() {
+#if defined(__linux__)
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.compare(0, 10, "model name") == 0 || line.compare(0, 9, "Processor") == 0) {
+                auto pos = line.find(':');
+                if (pos != std::string::npos && pos + 2 <= line.size())
+                    return line.substr(pos + 2);
+            }
+        }
+#elif defined(__APPLE__)
+        char buf[256];
+        size_t len = sizeof(buf);
+        if (sysctlbyname("machdep.cpu.brand_string", buf, &len, NULL, 0) == 0)
+            return std::string(buf);
+#endif
+        return "unknown";
+    }
+
+    static std::string getSimdLevel() {
+#if defined(__AVX512F__)
+        return "AVX512";
+#elif defined(__AVX2__)
+        return "AVX2";
+#elif defined(__AVX__)
+        return "AVX";
+#elif defined(__SSE4_2__)
+        return "SSE4.2";
+#elif defined(__SSE4_1__)
+        return "SSE4.1";
+#elif defined(__SSE2__) || defined(_M_X64)
+        return "SSE2";
+#elif defined(__ARM_NEON)
+        return "NEON";
+#else
+        return "none";
+#endif
+    }
+
+    static std::string getCompiler() {
+        std::stringstream ss;
+#if defined(__INTEL_COMPILER)
+        ss << "Intel " << __INTEL_COMPILER;
+#elif defined(__clang__)
+        ss << "Clang " << __clang_major__ << "." << __clang_minor__ << "." << __clang_patchlevel__;
+#elif defined(__GNUC__)
+        ss << "GCC " << __GNUC__ << "." << __GNUC_MINOR__ << "." << __GNUC_PATCHLEVEL__;
+#elif defined(_MSC_VER)
+        ss << "MSVC " << _MSC_FULL_VER;
+#else
+        ss << "unknown";
+#endif
+        return ss.str();
+    }
+
+    static std::string getBuildType() {
+#if defined(METRICS_BUILD_TYPE)
+        std::string type(METRICS_BUILD_TYPE);
+        if (!type.empty())
+            return type;
+#endif
+#ifdef NDEBUG
+        return "Release";
+#else
+        return "Debug";
+#endif
+    }
+
+    static std::string getChronoVersion() {
+#if defined(CH_VERSION)
+        // CH_VERSION is encoded as 0x00MMmmpp
+        std::stringstream ss;
+        ss << ((CH_VERSION >> 16) & 0xFF) << "." << ((CH_VERSION >> 8) & 0xFF) << "." << (CH_VERSION & 0xFF);
+        return ss.str();
+#else
+        return "unknown";
+#endif
+    }
+
+    static std::string getTimestamp() {
+        std::time_t now = std::time(NULL);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        return std::string(buf);
+    }
+
+    /// Information collected for a named sub-phase of the test.
+    struct Phase {
+        explicit Phase(const std::string& n) : name(n), rss_start(0), rss_increase(0), num_allocs(0), alloc_bytes(0) {}
+        std::string name;
+        PerfCounters perf;
+        uint64_t rss_start;
+        double rss_increase;
+        metrics::AllocationSnapshot alloc_start;
+        uint64_t num_allocs;
+        uint64_t alloc_bytes;
+    };
+
+    Phase* findPhase(const std::string& phase) {
+        for (auto& p : m_phases) {
+            if (p->name == phase)
+                return p.get();
+        }
+        return nullptr;
+    }
+
     std::ofstream m_jsonfile;   ///< Output JSON file
     std::string m_name;         ///< Name of test
     std::string m_projectName;  ///< Name of the project
     std::string m_outDir;       ///< Name of output directory
     bool m_verbose;             ///< Verbose output
+    bool m_perf;                ///< Collect hardware performance counters?
+    PerfCounters m_perfTotal;   ///< counters around execute()
+    std::vector<std::unique_ptr<Phase>> m_phases;  ///< named sub-phases
+    metrics::AllocationSnapshot m_stepStart;        ///< allocation counters at beginning of current step
+    int m_numSteps;                                 ///< number of steps marked with beginStep()/endStep()
+    uint64_t m_stepAllocs;                          ///< total allocations during marked steps
+    uint64_t m_stepBytes;                           ///< total bytes allocated during marked steps
+    uint64_t m_stepMaxAllocs;                       ///< maximum allocations in a single step
     Object m_jsonMetrics;       ///< collected metrics
     Object m_jsonTest;          ///< JSON output of the test
 };
@@ -0,0 +1,175 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Replacement global allocation functions counting heap allocations (see
+// MemoryUsage.h). This file is only compiled into the metrics programs if the
+// project is configured with METRICS_COUNT_ALLOCATIONS=ON.
+//
+// All forms of operator new/delete are replaced, including the over-aligned
+// versions (C++17), so that allocations of over-aligned types are counted and
+// released with the matching deallocation function.
+//
+// =============================================================================
+
+#include "MemoryUsage.h"
+
+#ifdef METRICS_COUNT_ALLOCATIONS
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+static void* metrics_counted_alloc(std::size_t size) {
+    metrics::AllocationCounters& c = metrics::GetAllocationCounters();
+    c.num_allocs.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+static void metrics_counted_free(void* ptr) {
+    if (!ptr)
+        return;
+    metrics::GetAllocationCounters().num_frees.fetch_add(1, std::memory_order_relaxed);
+    std::free(ptr);
+}
+
+void* operator new(std::size_t size) {
+    void* ptr = metrics_counted_alloc(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](std::size_t size) {
+    void* ptr = metrics_counted_alloc(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return metrics_counted_alloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return metrics_counted_alloc(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    metrics_counted_free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    metrics_counted_free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    metrics_counted_free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    metrics_counted_free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    metrics_counted_free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    metrics_counted_free(ptr);
+}
+
+// -----------------------------------------------------------------------------
+// Over-aligned allocations (C++17)
+// -----------------------------------------------------------------------------
+
+#ifdef __cpp_aligned_new
+
+static void* metrics_counted_aligned_alloc(std::size_t size, std::align_val_t alignment) {
+    metrics::AllocationCounters& c = metrics::GetAllocationCounters();
+    c.num_allocs.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+    std::size_t align = static_cast<std::size_t>(alignment);
+    if (align < sizeof(void*))
+        align = sizeof(void*);
+#if defined(_WIN32)
+    return _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, align, size == 0 ? 1 : size) != 0)
+        return nullptr;
+    return ptr;
+#endif
+}
+
+static void metrics_counted_aligned_free(void* ptr) {
+    if (!ptr)
+        return;
+    metrics::GetAllocationCounters().num_frees.fetch_add(1, std::memory_order_relaxed);
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    void* ptr = metrics_counted_aligned_alloc(size, alignment);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    void* ptr = metrics_counted_aligned_alloc(size, alignment);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return metrics_counted_aligned_alloc(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return metrics_counted_aligned_alloc(size, alignment);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    metrics_counted_aligned_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    metrics_counted_aligned_free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    metrics_counted_aligned_free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    metrics_counted_aligned_free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    metrics_counted_aligned_free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+    metrics_counted_aligned_free(ptr);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,130 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Memory usage utilities for the metrics tests:
+// - peak and current resident set size of the process
+// - optional counting of heap allocations
+//
+// Allocation counting replaces the global operator new/delete and is therefore
+// only enabled if METRICS_COUNT_ALLOCATIONS is defined (see the CMake option
+// of the same name). The replacement operators are defined in MemoryUsage.cpp,
+// which is compiled into every metrics program when the option is set. Counting
+// uses relaxed atomic increments, which adds a small cost to every allocation.
+//
+// =============================================================================
+
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace metrics {
+
+/// Return the peak resident set size of the process (in bytes), or 0 if not available.
+inline uint64_t GetPeakRSS() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS info;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info)))
+        return (uint64_t)info.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return (uint64_t)usage.ru_maxrss;  // bytes
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;  // kilobytes
+#endif
+#endif
+}
+
+/// Return the current resident set size of the process (in bytes), or 0 if not available.
+inline uint64_t GetCurrentRSS() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS info;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info)))
+        return (uint64_t)info.WorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    long pages_total = 0;
+    long pages_resident = 0;
+    int n = fscanf(fp, "%ld %ld", &pages_total, &pages_resident);
+    fclose(fp);
+    if (n != 2)
+        return 0;
+    return (uint64_t)pages_resident * (uint64_t)sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+/// Heap allocation counters (only updated if METRICS_COUNT_ALLOCATIONS is defined).
+struct AllocationCounters {
+    std::atomic<uint64_t> num_allocs;  ///< number of calls to operator new
+    std::atomic<uint64_t> num_frees;   ///< number of calls to operator delete (non-null pointers)
+    std::atomic<uint64_t> bytes;       ///< total number of bytes requested
+};
+
+/// Return the process-wide allocation counters.
+inline AllocationCounters& GetAllocationCounters() {
+    static AllocationCounters counters = {{0}, {0}, {0}};
+    return counters;
+}
+
+/// Return true if allocation counting is compiled in.
+inline bool AllocationCountingEnabled() {
+#ifdef METRICS_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// Snapshot of the allocation counters.
+struct AllocationSnapshot {
+    AllocationSnapshot() : num_allocs(0), num_frees(0), bytes(0) {}
+
+    static AllocationSnapshot Take() {
+        AllocationSnapshot s;
+        const AllocationCounters& c = GetAllocationCounters();
+        s.num_allocs = c.num_allocs.load(std::memory_order_relaxed);
+        s.num_frees = c.num_frees.load(std::memory_order_relaxed);
+        s.bytes = c.bytes.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    uint64_t num_allocs;
+    uint64_t num_frees;
+    uint64_t bytes;
+};
+
+}  // end namespace metrics
+
+#endif
@@ -0,0 +1,223 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Hardware performance counters (Linux perf_event) for the metrics tests.
+//
+// A PerfCounters object opens one counter per hardware event for the calling
+// thread and for each worker thread of the OpenMP pool (the pool is created, if
+// needed, with the current maximum number of threads). Counters are per-thread
+// and not inherited, so that no thread is counted twice; worker threads created
+// after open() (e.g. after increasing the number of OpenMP threads) are not
+// counted. Counters can be started and stopped repeatedly and accumulate over
+// all active intervals.
+//
+// On platforms other than Linux, or if the kernel refuses access to the PMU
+// (e.g. perf_event_paranoid restrictions or containers/VMs without hardware
+// counters), the object reports itself as unavailable and all counts are 0.
+//
+// =============================================================================
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class PerfCounters {
+  public:
+    /// Hardware events collected by this class.
+    enum Event { CYCLES = 0, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, NUM_EVENTS };
+
+    PerfCounters() : m_open(false), m_running(false) {
+        for (int e = 0; e < NUM_EVENTS; e++) {
+            m_count[e] = 0;
+            m_supported[e] = false;
+        }
+    }
+
+    ~PerfCounters() { close(); }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /// Open the counters. Return false if no hardware counter is available.
+    bool open() {
+        if (m_open)
+            return available();
+        m_open = true;
+
+#if defined(__linux__)
+        // Counters for the calling thread.
+        openThread();
+
+        // Counters for the worker threads of the OpenMP pool.
+#ifdef _OPENMP
+        std::vector<std::vector<int>> worker_fds(omp_get_max_threads());
+#pragma omp parallel
+        {
+            int tid = omp_get_thread_num();
+            if (tid != 0 && tid < (int)worker_fds.size()) {
+                for (int e = 0; e < NUM_EVENTS; e++)
+                    worker_fds[tid].push_back(m_supported[e] ? openEvent(e) : -1);
+            }
+        }
+        for (const auto& fds : worker_fds) {
+            for (int e = 0; e < (int)fds.size(); e++) {
+                if (fds[e] >= 0)
+                    m_fds.push_back({e, fds[e], 0, 0, 0});
+            }
+        }
+#endif
+#endif
+
+        return available();
+    }
+
+    /// Close all counters.
+    void close() {
+#if defined(__linux__)
+        for (auto& c : m_fds)
+            ::close(c.fd);
+#endif
+        m_fds.clear();
+        m_running = false;
+    }
+
+    /// Return true if at least one hardware event can be counted.
+    bool available() const {
+        for (int e = 0; e < NUM_EVENTS; e++) {
+            if (m_supported[e])
+                return true;
+        }
+        return false;
+    }
+
+    /// Return true if the specified event can be counted.
+    bool supported(Event e) const { return m_supported[e]; }
+
+    /// Start (or resume) counting.
+    void start() {
+        if (!m_open)
+            open();
+        if (m_running)
+            return;
+#if defined(__linux__)
+        for (auto& c : m_fds) {
+            readCounter(c, c.start_value, c.start_enabled, c.start_running);
+            ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+        m_running = true;
+    }
+
+    /// Stop counting and accumulate the counts since the last call to start().
+    void stop() {
+        if (!m_running)
+            return;
+#if defined(__linux__)
+        for (auto& c : m_fds) {
+            ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t value, enabled, running;
+            readCounter(c, value, enabled, running);
+            uint64_t delta = value - c.start_value;
+            uint64_t d_enabled = enabled - c.start_enabled;
+            uint64_t d_running = running - c.start_running;
+            // Scale up if the kernel multiplexed the counter
+            if (d_running > 0 && d_running < d_enabled)
+                delta = (uint64_t)((double)delta * d_enabled / d_running);
+            m_count[c.event] += delta;
+        }
+#endif
+        m_running = false;
+    }
+
+    /// Return the accumulated count for the specified event.
+    uint64_t count(Event e) const { return m_count[e]; }
+
+    /// Return the metric name suffix for the specified event.
+    static const char* name(Event e) {
+        static const char* names[] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+        return names[e];
+    }
+
+  private:
+    struct Counter {
+        int event;
+        int fd;
+        uint64_t start_value;
+        uint64_t start_enabled;
+        uint64_t start_running;
+    };
+
+#if defined(__linux__)
+    static uint64_t config(int e) {
+        static const uint64_t configs[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                           PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        return configs[e];
+    }
+
+    static int openEvent(int e) {
+        struct perf_event_attr pe;
+        std::memset(&pe, 0, sizeof(pe));
+        pe.type = PERF_TYPE_HARDWARE;
+        pe.size = sizeof(pe);
+        pe.config = config(e);
+        pe.disabled = 1;
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+    }
+
+    void openThread() {
+        for (int e = 0; e < NUM_EVENTS; e++) {
+            int fd = openEvent(e);
+            if (fd < 0)
+                continue;
+            m_supported[e] = true;
+            m_fds.push_back({e, fd, 0, 0, 0});
+        }
+    }
+
+    static void readCounter(const Counter& c, uint64_t& value, uint64_t& enabled, uint64_t& running) {
+        uint64_t buf[3] = {0, 0, 0};
+        if (read(c.fd, buf, sizeof(buf)) != (ssize_t)sizeof(buf))
+            buf[0] = buf[1] = buf[2] = 0;
+        value = buf[0];
+        enabled = buf[1];
+        running = buf[2];
+    }
+#endif
+
+    bool m_open;
+    bool m_running;
+    bool m_supported[NUM_EVENTS];
+    uint64_t m_count[NUM_EVENTS];
+    std::vector<Counter> m_fds;
+};
+
+#endif
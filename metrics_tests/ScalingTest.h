@@ -0,0 +1,158 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Base class for strong/weak scaling studies.
+//
+// A ScalingTest runs the same scenario over a list of thread counts, either
+// with a fixed problem size (strong scaling) or with a problem size growing
+// proportionally to the number of threads (weak scaling). The scenario reports
+// the time spent in each phase of the simulation step; ScalingTest records the
+// average per-step times and the parallel efficiency of every phase, relative
+// to the first entry in the thread list, as metrics.
+//
+// Strong scaling is only meaningful if every thread count solves the same
+// problem: the scenario must be set up deterministically (seeded particle
+// generation, collision settings independent of run-time measurements). A
+// strong scaling test fails if the number of bodies changes between runs.
+//
+// =============================================================================
+
+#ifndef SCALING_TEST_H
+#define SCALING_TEST_H
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BaseTest.h"
+
+/// Cumulative timing information for one run of a scaling scenario.
+struct PhaseTimes {
+    PhaseTimes() : step(0), broad(0), narrow(0), update(0), solver(0), num_steps(0), num_bodies(0), num_contacts(0) {}
+
+    double step;        ///< total step time
+    double broad;       ///< broad-phase collision detection
+    double narrow;      ///< narrow-phase collision detection
+    double update;      ///< system update
+    double solver;      ///< solver and integration (advance)
+    int num_steps;      ///< number of measured steps
+    int num_bodies;     ///< number of bodies in the system
+    int num_contacts;   ///< cumulative number of contacts over all measured steps
+};
+
+class ScalingTest : public BaseTest {
+  public:
+    enum Mode {
+        STRONG,  ///< fixed problem size
+        WEAK     ///< problem size proportional to number of threads
+    };
+
+    ScalingTest(const std::string& testName,
+                const std::string& testProjectName,
+                Mode mode,
+                const std::vector<int>& threads)
+        : BaseTest(testName, testProjectName), m_mode(mode), m_threads(threads), m_execTime(0) {}
+
+    virtual ~ScalingTest() {}
+
+    /// Run the scenario for all thread counts and record per-phase times and efficiencies.
+    virtual bool execute() override {
+        if (m_threads.empty())
+            return false;
+
+        std::vector<PhaseTimes> results;
+        for (int nt : m_threads) {
+            // For weak scaling, the problem size grows with the number of threads.
+            double size_factor = (m_mode == WEAK) ? (double)nt / m_threads[0] : 1.0;
+
+            std::cout << "---- " << getTestName() << ": " << nt << " threads, size factor " << size_factor
+                      << std::endl;
+
+            PhaseTimes times;
+            if (!runScenario(nt, size_factor, times) || times.num_steps == 0)
+                return false;
+            if (m_mode == STRONG && !results.empty() && times.num_bodies != results[0].num_bodies) {
+                std::cout << "ERROR: " << getTestName() << ": " << times.num_bodies << " bodies with " << nt
+                          << " threads, " << results[0].num_bodies << " with " << m_threads[0] << std::endl;
+                return false;
+            }
+            results.push_back(times);
+            m_execTime += times.step;
+        }
+
+        const PhaseTimes& ref = results[0];
+        int ref_threads = m_threads[0];
+
+        printf("\n %7s | %7s | %9s | %9s | %9s | %9s | %9s | %9s\n", "THREADS", "BODIES", "STEP (ms)", "BROAD",
+               "NARROW", "UPDATE", "SOLVER", "EFF STEP");
+        for (size_t i = 0; i < results.size(); i++) {
+            const PhaseTimes& t = results[i];
+            int nt = m_threads[i];
+            std::string sfx = "_" + std::to_string(nt);
+
+            addMetric("num_bodies" + sfx, t.num_bodies);
+            addMetric("avg_num_contacts" + sfx, (double)t.num_contacts / t.num_steps);
+            addMetric("avg_sim_time_per_step" + sfx + " (ms)", 1000 * t.step / t.num_steps);
+            addMetric("avg_broad_time_per_step" + sfx + " (ms)", 1000 * t.broad / t.num_steps);
+            addMetric("avg_narrow_time_per_step" + sfx + " (ms)", 1000 * t.narrow / t.num_steps);
+            addMetric("avg_update_time_per_step" + sfx + " (ms)", 1000 * t.update / t.num_steps);
+            addMetric("avg_solve_time_per_step" + sfx + " (ms)", 1000 * t.solver / t.num_steps);
+
+            double eff_step = efficiency(ref.step / ref.num_steps, t.step / t.num_steps, ref_threads, nt);
+            addMetric("efficiency_sim" + sfx, eff_step);
+            addMetric("efficiency_broad" + sfx, efficiency(ref.broad / ref.num_steps, t.broad / t.num_steps,
+                                                           ref_threads, nt));
+            addMetric("efficiency_narrow" + sfx, efficiency(ref.narrow / ref.num_steps, t.narrow / t.num_steps,
+                                                            ref_threads, nt));
+            addMetric("efficiency_update" + sfx, efficiency(ref.update / ref.num_steps, t.update / t.num_steps,
+                                                            ref_threads, nt));
+            addMetric("efficiency_solve" + sfx, efficiency(ref.solver / ref.num_steps, t.solver / t.num_steps,
+                                                           ref_threads, nt));
+
+            printf(" %7d | %7d | %9.4f | %9.4f | %9.4f | %9.4f | %9.4f | %9.3f\n", nt, t.num_bodies,
+                   1000 * t.step / t.num_steps, 1000 * t.broad / t.num_steps, 1000 * t.narrow / t.num_steps,
+                   1000 * t.update / t.num_steps, 1000 * t.solver / t.num_steps, eff_step);
+        }
+        printf("\n");
+
+        return true;
+    }
+
+    virtual double getExecutionTime() const override { return m_execTime; }
+
+  protected:
+    /// Run the scenario with the given number of threads and problem size factor (relative to the
+    /// problem size used for the first thread count) and return the cumulative phase times.
+    /// A derived class must implement this function and return false on failure. For a given size factor,
+    /// the scenario must not depend on the number of threads or on timing measurements.
+    virtual bool runScenario(int num_threads, double size_factor, PhaseTimes& times) = 0;
+
+  private:
+    /// Parallel efficiency of a phase, given the per-step times for the reference and current runs.
+    /// Strong scaling: E = (T_ref * p_ref) / (T * p). Weak scaling: E = T_ref / T.
+    double efficiency(double t_ref, double t, int p_ref, int p) const {
+        if (t <= 0)
+            return 0;
+        if (m_mode == WEAK)
+            return t_ref / t;
+        return (t_ref * p_ref) / (t * p);
+    }
+
+    Mode m_mode;
+    std::vector<int> m_threads;
+    double m_execTime;
+};
+
+#endif
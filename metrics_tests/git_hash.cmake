@@ -0,0 +1,25 @@
+#=============================================================================
+# Write the current git revision of the source tree to a header file.
+#
+# Invoked in script mode at build time (see metrics_tests/CMakeLists.txt):
+#   cmake -DGIT_EXECUTABLE=<git> -DSOURCE_DIR=<dir> -DOUTPUT=<header> -P git_hash.cmake
+#
+# The header is only rewritten when the revision changes, so that the metrics
+# programs are not recompiled on every build.
+#=============================================================================
+
+set(METRICS_GIT_HASH "unknown")
+if(GIT_EXECUTABLE)
+  execute_process(COMMAND ${GIT_EXECUTABLE} describe --always --dirty
+                  WORKING_DIRECTORY ${SOURCE_DIR}
+                  OUTPUT_VARIABLE METRICS_GIT_HASH
+                  OUTPUT_STRIP_TRAILING_WHITESPACE
+                  ERROR_QUIET)
+  if("${METRICS_GIT_HASH}" STREQUAL "")
+    set(METRICS_GIT_HASH "unknown")
+  endif()
+endif()
+
+file(WRITE ${OUTPUT}.tmp "#define METRICS_GIT_HASH \"${METRICS_GIT_HASH}\"\n")
+configure_file(${OUTPUT}.tmp ${OUTPUT} COPYONLY)
+file(REMOVE ${OUTPUT}.tmp)
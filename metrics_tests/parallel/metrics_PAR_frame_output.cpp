@@ -0,0 +1,287 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Author: Radu Serban
+// =============================================================================
+//
+// Benchmark for visualization frame output: utils::WriteShapesPovray (one text
+// file per frame) versus the binary FrameWriter in projects/frame_writer.h,
+// uncompressed and (if built with zlib) compressed. The same frames of a
+// settling granular bed are written in all three formats; reported are the
+// bytes per frame and the write time per frame.
+//
+// The test passes if the last binary frame, converted back to text, matches the
+// last POV-Ray file (same lines, values within float32 rounding).
+//
+// Usage:
+//   metrics_PAR_frame_output [num_layers] [num_threads]
+//
+// The global reference frame has Z up.
+// All units SI.
+//
+// =============================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chrono/ChConfig.h"
+#include "chrono/core/ChTimer.h"
+#include "chrono/utils/ChUtilsCreators.h"
+#include "chrono/utils/ChUtilsInputOutput.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+#include "chrono_thirdparty/filesystem/path.h"
+
+#include "../../projects/bulk_generator.h"
+#include "../../projects/frame_writer.h"
+#include "../BaseTest.h"
+
+using namespace chrono;
+
+// --------------------------------------------------------------------------
+
+// Container half-dimensions
+double hdimX = 0.5;
+double hdimY = 0.5;
+double hdimZ = 0.5;
+double hthick = 0.05;
+
+// Granular material
+double radius_g = 0.005;
+double rho_g = 2500;
+
+// Output
+int num_frames = 20;
+int steps_per_frame = 20;
+double time_step = 1e-4;
+
+// Tolerance on the difference between converted and original text values (relative to max(1, |value|))
+double tolerance = 1e-4;
+
+// ====================================================================================
+
+class PARFrameOutputTest : public BaseTest {
+  public:
+    PARFrameOutputTest(const std::string& testName, const std::string& outDir, int num_layers, int num_threads)
+        : BaseTest(testName, "Chrono::Parallel"),
+          m_out_dir(outDir),
+          m_num_layers(num_layers),
+          m_num_threads(num_threads),
+          m_execTime(0) {}
+
+    virtual bool execute() override;
+    virtual double getExecutionTime() const override { return m_execTime; }
+
+  private:
+    std::string m_out_dir;
+    int m_num_layers;
+    int m_num_threads;
+    double m_execTime;
+};
+
+// Size of a file in bytes.
+static size_t FileSize(const std::string& filename) {
+    std::ifstream is(filename, std::ios::binary | std::ios::ate);
+    return is.is_open() ? (size_t)is.tellg() : 0;
+}
+
+// Split a text file in lines of numeric fields.
+static std::vector<std::vector<double>> ReadFields(std::istream& is) {
+    std::vector<std::vector<double>> lines;
+    std::string line;
+    while (std::getline(is, line)) {
+        std::vector<double> fields;
+        std::stringstream ss(line);
+        std::string field;
+        while (std::getline(ss, field, ','))
+            fields.push_back(std::stod(field));
+        lines.push_back(fields);
+    }
+    return lines;
+}
+
+// Largest difference between the values of two text frames (infinity if their layouts differ).
+static double CompareFrames(std::istream& a, std::istream& b) {
+    auto la = ReadFields(a);
+    auto lb = ReadFields(b);
+    if (la.size() != lb.size())
+        return INFINITY;
+    double err = 0;
+    for (size_t i = 0; i < la.size(); i++) {
+        if (la[i].size() != lb[i].size())
+            return INFINITY;
+        for (size_t k = 0; k < la[i].size(); k++)
+            err = std::max(err, std::abs(la[i][k] - lb[i][k]) / std::max(1.0, std::abs(la[i][k])));
+    }
+    return err;
+}
+
+bool PARFrameOutputTest::execute() {
+    ChSystemParallelSMC system;
+    system.Set_G_acc(ChVector<>(0, 0, -9.81));
+    system.SetParallelThreadNumber(m_num_threads);
+    CHOMPfunctions::SetNumThreads(m_num_threads);
+    system.GetSettings()->solver.contact_force_model = ChSystemSMC::Hertz;
+    system.GetSettings()->collision.narrowphase_algorithm = NarrowPhaseType::NARROWPHASE_HYBRID_MPR;
+    system.GetSettings()->collision.bins_per_axis = vec3(20, 20, 10);
+
+    auto material = chrono_types::make_shared<ChMaterialSurfaceSMC>();
+    material->SetFriction(0.5f);
+    material->SetYoungModulus(1e7f);
+
+    // Container (box shapes)
+    auto container = std::shared_ptr<ChBody>(system.NewBody());
+    container->SetIdentifier(-1);
+    container->SetBodyFixed(true);
+    container->SetCollide(true);
+    container->SetMaterialSurface(material);
+    container->GetCollisionModel()->ClearModel();
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hdimY, hthick), ChVector<>(0, 0, -hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hthick, hdimY, hdimZ), ChVector<>(hdimX + hthick, 0, hdimZ));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hthick, hdimY, hdimZ), ChVector<>(-hdimX - hthick, 0, hdimZ));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hthick, hdimZ), ChVector<>(0, hdimY + hthick, hdimZ));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hthick, hdimZ), ChVector<>(0, -hdimY - hthick, hdimZ));
+    container->GetCollisionModel()->BuildModel();
+    system.AddBody(container);
+
+    // Granular bed
+    BulkGenerator gen(&system);
+    gen.SetMaterial(material);
+    gen.SetRadius(radius_g);
+    gen.SetDensity(rho_g);
+    gen.SetBodyIdentifier(1);
+    double r = 1.01 * radius_g;
+    std::vector<ChVector<>> points;
+    for (int il = 0; il < m_num_layers; il++) {
+        auto layer = gen.SampleBox(ChVector<>(0, 0, (2 * il + 2) * r), ChVector<>(hdimX - r, hdimY - r, 0), 2 * r);
+        points.insert(points.end(), layer.begin(), layer.end());
+    }
+    gen.CreateSpheres(points);
+    size_t num_bodies = system.Get_bodylist().size();
+
+    // Output files
+    std::string text_dir = m_out_dir + "/FRAME_OUTPUT";
+    filesystem::create_directory(filesystem::path(text_dir));
+    std::string bin_file = m_out_dir + "/frames.bin";
+    std::string zip_file = m_out_dir + "/frames_compressed.bin";
+
+    FrameWriter bin_writer(&system, bin_file, true, 0);
+    FrameWriter zip_writer(&system, zip_file, true, 6);
+
+    double time_text = 0;
+    size_t bytes_text = 0;
+    std::string last_text;
+
+    ChTimer<double> timer;
+    timer.start();
+
+    for (int frame = 0; frame < num_frames; frame++) {
+        for (int i = 0; i < steps_per_frame; i++)
+            system.DoStepDynamics(time_step);
+
+        char filename[300];
+        sprintf(filename, "%s/data_%03d.dat", text_dir.c_str(), frame + 1);
+        ChTimer<double> text_timer;
+        text_timer.start();
+        utils::WriteShapesPovray(&system, filename, true);
+        text_timer.stop();
+        time_text += text_timer();
+        bytes_text += FileSize(filename);
+        last_text = filename;
+
+        bin_writer.Write();
+        zip_writer.Write();
+    }
+
+    timer.stop();
+    m_execTime = timer();
+
+    // Read back the last frame of each binary file and compare with the last text file.
+    double err_bin = INFINITY;
+    double err_zip = INFINITY;
+    for (int k = 0; k < 2; k++) {
+        frame_format::FileReader reader(k == 0 ? bin_file : zip_file);
+        frame_format::Frame frame;
+        int count = 0;
+        while (reader.ReadFrame(frame))
+            count++;
+        if (count != num_frames || !reader.GetError().empty()) {
+            std::cout << "Error reading " << (k == 0 ? bin_file : zip_file) << ": " << count << " frames "
+                      << reader.GetError() << std::endl;
+            continue;
+        }
+        std::stringstream converted;
+        frame_format::WritePovray(converted, reader.GetTable(), frame, reader.HasBodyInfo());
+        std::ifstream original(last_text);
+        (k == 0 ? err_bin : err_zip) = CompareFrames(original, converted);
+    }
+
+    double bpf_text = (double)bytes_text / num_frames;
+    double bpf_bin = (double)bin_writer.GetNumBytes() / num_frames;
+    double bpf_zip = (double)zip_writer.GetNumBytes() / num_frames;
+
+    std::cout << num_bodies << " bodies, " << num_frames << " frames" << std::endl;
+    std::cout << "  text:        " << bpf_text << " bytes/frame  " << 1e3 * time_text / num_frames << " ms/frame"
+              << std::endl;
+    std::cout << "  binary:      " << bpf_bin << " bytes/frame  " << 1e3 * bin_writer.GetTime() / num_frames
+              << " ms/frame  max error " << err_bin << std::endl;
+    std::cout << "  compressed:  " << bpf_zip << " bytes/frame  " << 1e3 * zip_writer.GetTime() / num_frames
+              << " ms/frame  max error " << err_zip << "  (zlib level " << zip_writer.GetCompression() << ")"
+              << std::endl;
+
+    addMetric("num_bodies", (int)num_bodies);
+    addMetric("num_threads", m_num_threads);
+    addMetric("compression_level", zip_writer.GetCompression());
+    addMetric("bytes_per_frame_text", bpf_text);
+    addMetric("bytes_per_frame_binary", bpf_bin);
+    addMetric("bytes_per_frame_compressed", bpf_zip);
+    addMetric("time_per_frame_text (ms)", 1e3 * time_text / num_frames);
+    addMetric("time_per_frame_binary (ms)", 1e3 * bin_writer.GetTime() / num_frames);
+    addMetric("time_per_frame_compressed (ms)", 1e3 * zip_writer.GetTime() / num_frames);
+    addMetric("size_ratio_binary", bpf_text / bpf_bin);
+    addMetric("size_ratio_compressed", bpf_text / bpf_zip);
+    addMetric("err_binary (rel)", err_bin);
+    addMetric("err_compressed (rel)", err_zip);
+
+    return err_bin < tolerance && err_zip < tolerance;
+}
+
+// ====================================================================================
+
+int main(int argc, char** argv) {
+    int num_layers = 10;
+    int num_threads = CHOMPfunctions::GetNumProcs();
+    if (argc > 1)
+        num_layers = std::stoi(argv[1]);
+    if (argc > 2)
+        num_threads = std::stoi(argv[2]);
+
+    std::string out_dir = "../METRICS";
+    if (!filesystem::create_directory(filesystem::path(out_dir))) {
+        std::cout << "Error creating directory " << out_dir << std::endl;
+        return 1;
+    }
+
+    PARFrameOutputTest test("metrics_PAR_frame_output", out_dir, num_layers, num_threads);
+    test.setOutDir(out_dir);
+    test.setVerbose(true);
+    bool passed = test.run();
+    test.print();
+
+    return passed ? 0 : 1;
+}
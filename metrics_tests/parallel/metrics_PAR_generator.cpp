@@ -0,0 +1,176 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Author: Radu Serban
+// =============================================================================
+//
+// Benchmark for the generation of a granular bed: utils::Generator (Poisson
+// disk sampling, one body at a time) versus the parallel bulk generator in
+// projects/bulk_generator.h. Both create the same bed of identical spheres,
+// layer by layer, in a box container.
+//
+// Usage:
+//   metrics_PAR_generator [num_layers] [num_threads]
+//
+// The global reference frame has Z up.
+// All units SI.
+//
+// =============================================================================
+
+#include <iostream>
+#include <string>
+
+#include "chrono/ChConfig.h"
+#include "chrono/core/ChTimer.h"
+#include "chrono/utils/ChUtilsCreators.h"
+#include "chrono/utils/ChUtilsGenerators.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+#include "chrono_thirdparty/filesystem/path.h"
+
+#include "../../projects/bulk_generator.h"
+#include "../BaseTest.h"
+
+using namespace chrono;
+
+// --------------------------------------------------------------------------
+
+// Container half-dimensions
+double hdimX = 1.0;
+double hdimY = 0.5;
+
+// Granular material
+double radius_g = 0.005;
+double rho_g = 2500;
+
+// ====================================================================================
+
+class PARGeneratorTest : public BaseTest {
+  public:
+    PARGeneratorTest(const std::string& testName, int num_layers, int num_threads)
+        : BaseTest(testName, "Chrono::Parallel"), m_num_layers(num_layers), m_num_threads(num_threads), m_execTime(0) {}
+
+    virtual bool execute() override;
+    virtual double getExecutionTime() const override { return m_execTime; }
+
+  private:
+    ChSystemParallelSMC* CreateSystem() const;
+
+    int m_num_layers;
+    int m_num_threads;
+    double m_execTime;
+};
+
+ChSystemParallelSMC* PARGeneratorTest::CreateSystem() const {
+    ChSystemParallelSMC* system = new ChSystemParallelSMC;
+    system->Set_G_acc(ChVector<>(0, 0, -9.81));
+    system->SetParallelThreadNumber(m_num_threads);
+    CHOMPfunctions::SetNumThreads(m_num_threads);
+    return system;
+}
+
+bool PARGeneratorTest::execute() {
+    auto material = chrono_types::make_shared<ChMaterialSurfaceSMC>();
+    material->SetFriction(0.9f);
+    material->SetYoungModulus(8e5f);
+
+    double r = 1.01 * radius_g;
+    ChVector<> hdims(hdimX - r, hdimY - r, 0);
+
+    // Current path: utils::Generator
+    startPhase("generator");
+    ChSystemParallelSMC* system1 = CreateSystem();
+    ChTimer<double> timer;
+    timer.start();
+    utils::Generator gen(system1);
+    std::shared_ptr<utils::MixtureIngredient> m1 = gen.AddMixtureIngredient(utils::SPHERE, 1.0);
+    m1->setDefaultMaterial(material);
+    m1->setDefaultDensity(rho_g);
+    m1->setDefaultSize(radius_g);
+    gen.setBodyIdentifier(1);
+    ChVector<> center(0, 0, 2 * r);
+    for (int il = 0; il < m_num_layers; il++) {
+        gen.createObjectsBox(utils::POISSON_DISK, 2 * r, center, hdims);
+        center.z() += 2 * r;
+    }
+    timer.stop();
+    double time_generator = timer();
+    int num_generator = system1->Get_bodylist().size();
+    delete system1;
+    stopPhase("generator");
+
+    // Bulk path: BulkGenerator
+    startPhase("bulk");
+    ChSystemParallelSMC* system2 = CreateSystem();
+    timer.reset();
+    timer.start();
+    BulkGenerator bulk(system2);
+    bulk.SetMaterial(material);
+    bulk.SetDensity(rho_g);
+    bulk.SetRadius(radius_g);
+    bulk.SetBodyIdentifier(1);
+    center = ChVector<>(0, 0, 2 * r);
+    for (int il = 0; il < m_num_layers; il++) {
+        bulk.CreateObjectsBox(center, hdims, 2 * r);
+        center.z() += 2 * r;
+    }
+    timer.stop();
+    double time_bulk = timer();
+    int num_bulk = system2->Get_bodylist().size();
+    delete system2;
+    stopPhase("bulk");
+
+    std::cout << "utils::Generator: " << num_generator << " bodies in " << time_generator << " s" << std::endl;
+    std::cout << "BulkGenerator:    " << num_bulk << " bodies in " << time_bulk << " s" << std::endl;
+    std::cout << "    sampling:     " << bulk.GetTimeSampling() << std::endl;
+    std::cout << "    creation:     " << bulk.GetTimeCreation() << std::endl;
+    std::cout << "    insertion:    " << bulk.GetTimeInsertion() << std::endl;
+
+    m_execTime = time_generator + time_bulk;
+    addMetric("num_threads", m_num_threads);
+    addMetric("num_bodies_generator", num_generator);
+    addMetric("num_bodies_bulk", num_bulk);
+    addMetric("time_generator (s)", time_generator);
+    addMetric("time_bulk (s)", time_bulk);
+    addMetric("time_bulk_sampling (s)", bulk.GetTimeSampling());
+    addMetric("time_bulk_creation (s)", bulk.GetTimeCreation());
+    addMetric("time_bulk_insertion (s)", bulk.GetTimeInsertion());
+    addMetric("time_per_body_generator (us)", 1e6 * time_generator / num_generator);
+    addMetric("time_per_body_bulk (us)", 1e6 * time_bulk / num_bulk);
+
+    return num_generator > 0 && num_bulk > 0;
+}
+
+// ====================================================================================
+
+int main(int argc, char** argv) {
+    int num_layers = 10;
+    int num_threads = CHOMPfunctions::GetNumProcs();
+    if (argc > 1)
+        num_layers = std::stoi(argv[1]);
+    if (argc > 2)
+        num_threads = std::stoi(argv[2]);
+
+    std::string out_dir = "../METRICS";
+    if (!filesystem::create_directory(filesystem::path(out_dir))) {
+        std::cout << "Error creating directory " << out_dir << std::endl;
+        return 1;
+    }
+
+    PARGeneratorTest test("metrics_PAR_generator", num_layers, num_threads);
+    test.setOutDir(out_dir);
+    test.setVerbose(true);
+    bool passed = test.run();
+    test.print();
+
+    return passed ? 0 : 1;
+}
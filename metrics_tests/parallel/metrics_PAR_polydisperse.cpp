@@ -0,0 +1,262 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Author: Radu Serban
+// =============================================================================
+//
+// Benchmark for polydisperse granular beds, across size ratios 1:1 to 1:10.
+//
+// For each size ratio, a bed with a power-law size distribution (equal solid
+// volume per radius class, i.e. small particles dominate by number) is sampled
+// with the polydisperse BulkGenerator (projects/bulk_generator.h) in a box
+// container. Then:
+//   1. the contact pairs of the initial bed are found with a uniform grid
+//      (cells sized from the largest sphere) and with the multi-level grid of
+//      projects/multilevel_grid.h; both must report the same pairs;
+//   2. the bed is simulated for a number of steps with Chrono::Parallel, with
+//      broad-phase bins sized from the median particle diameter (AutoBinning),
+//      and the broad-phase time is recorded.
+//
+// Usage:
+//   metrics_PAR_polydisperse [num_steps] [num_threads]
+//
+// The global reference frame has Z up.
+// All units SI.
+//
+// =============================================================================
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "chrono/ChConfig.h"
+#include "chrono/core/ChTimer.h"
+#include "chrono/utils/ChUtilsCreators.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+#include "chrono_thirdparty/filesystem/path.h"
+
+#include "../../projects/auto_binning.h"
+#include "../../projects/bulk_generator.h"
+#include "../../projects/multilevel_grid.h"
+#include "../../projects/size_distribution.h"
+#include "../../projects/step_profiler.h"
+#include "../BaseTest.h"
+
+using namespace chrono;
+
+// --------------------------------------------------------------------------
+
+// Container half-dimensions
+double hdimX = 0.25;
+double hdimY = 0.25;
+double hdimZ = 0.25;
+double hthick = 0.05;
+
+// Granular material
+double radius_min = 0.005;
+double rho_g = 2500;
+double solid_fraction = 0.3;
+int num_classes = 6;
+
+// Size ratios (largest / smallest radius)
+std::vector<int> size_ratios = {1, 2, 5, 10};
+
+// Simulation
+double time_step = 1e-4;
+
+// Number of repetitions of the (stand-alone) broad phase
+int num_reps = 5;
+
+// ====================================================================================
+
+class PARPolydisperseTest : public BaseTest {
+  public:
+    PARPolydisperseTest(const std::string& testName, int num_steps, int num_threads)
+        : BaseTest(testName, "Chrono::Parallel"), m_num_steps(num_steps), m_num_threads(num_threads), m_execTime(0) {}
+
+    virtual bool execute() override;
+    virtual double getExecutionTime() const override { return m_execTime; }
+
+  private:
+    bool Run(int ratio);
+
+    int m_num_steps;
+    int m_num_threads;
+    double m_execTime;
+};
+
+bool PARPolydisperseTest::Run(int ratio) {
+    std::string tag = "ratio_" + std::to_string(ratio) + "_";
+
+    ChSystemParallelSMC system;
+    system.Set_G_acc(ChVector<>(0, 0, -9.81));
+    system.SetParallelThreadNumber(m_num_threads);
+    CHOMPfunctions::SetNumThreads(m_num_threads);
+    system.GetSettings()->solver.contact_force_model = ChSystemSMC::Hertz;
+    system.GetSettings()->solver.tangential_displ_mode = ChSystemSMC::TangentialDisplacementModel::OneStep;
+    system.GetSettings()->solver.use_material_properties = true;
+    system.GetSettings()->collision.narrowphase_algorithm = NarrowPhaseType::NARROWPHASE_HYBRID_MPR;
+
+    auto material = chrono_types::make_shared<ChMaterialSurfaceSMC>();
+    material->SetFriction(0.5f);
+    material->SetRestitution(0.1f);
+    material->SetYoungModulus(1e7f);
+
+    // Container
+    auto container = std::shared_ptr<ChBody>(system.NewBody());
+    container->SetIdentifier(-1);
+    container->SetBodyFixed(true);
+    container->SetCollide(true);
+    container->SetMaterialSurface(material);
+    container->GetCollisionModel()->ClearModel();
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hdimY, hthick), ChVector<>(0, 0, -hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hthick, hdimY, hdimZ + hthick),
+                          ChVector<>(hdimX + hthick, 0, hdimZ - hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hthick, hdimY, hdimZ + hthick),
+                          ChVector<>(-hdimX - hthick, 0, hdimZ - hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hthick, hdimZ + hthick),
+                          ChVector<>(0, hdimY + hthick, hdimZ - hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hthick, hdimZ + hthick),
+                          ChVector<>(0, -hdimY - hthick, hdimZ - hthick));
+    container->GetCollisionModel()->BuildModel();
+    system.AddBody(container);
+
+    // Polydisperse bed
+    SizeDistribution dist = SizeDistribution::PowerLaw(radius_min, ratio * radius_min, 4, num_classes);
+
+    startPhase(tag + "generation");
+    BulkGenerator gen(&system, 1);
+    gen.SetMaterial(material);
+    gen.SetDensity(rho_g);
+    gen.SetBodyIdentifier(1);
+    auto points = gen.SampleBox(ChVector<>(0, 0, hdimZ), ChVector<>(hdimX, hdimY, hdimZ), dist, solid_fraction);
+    std::vector<MultiLevelGrid::Sphere> spheres;
+    for (int c = 0; c < dist.GetNumClasses(); c++) {
+        if (points[c].empty())
+            continue;
+        gen.CreateSpheres(points[c], dist.GetRadius(c));
+        for (const auto& p : points[c])
+            spheres.push_back({{p.x(), p.y(), p.z()}, dist.GetRadius(c)});
+    }
+    stopPhase(tag + "generation");
+
+    double volume = 0;
+    for (const auto& s : spheres)
+        volume += (4.0 / 3) * CH_C_PI * s.radius * s.radius * s.radius;
+
+    std::cout << "Size ratio 1:" << ratio << "   " << spheres.size() << " spheres   solid fraction "
+              << volume / (8 * hdimX * hdimY * hdimZ) << std::endl;
+
+    // Stand-alone broad phase: uniform grid versus multi-level grid
+    double margin = 0.1 * radius_min;
+    double time_uniform = 0;
+    double time_multilevel = 0;
+    MultiLevelGrid uniform(1);
+    MultiLevelGrid multilevel;
+    uniform.SetMargin(margin);
+    multilevel.SetMargin(margin);
+
+    startPhase(tag + "broadphase");
+    for (int rep = 0; rep < num_reps; rep++) {
+        ChTimer<double> timer;
+        timer.start();
+        uniform.Build(spheres);
+        uniform.FindPairs();
+        timer.stop();
+        time_uniform += timer();
+
+        timer.reset();
+        timer.start();
+        multilevel.Build(spheres);
+        multilevel.FindPairs();
+        timer.stop();
+        time_multilevel += timer();
+    }
+    stopPhase(tag + "broadphase");
+    time_uniform /= num_reps;
+    time_multilevel /= num_reps;
+    bool match = (uniform.GetPairs() == multilevel.GetPairs());
+    int num_pairs = (int)multilevel.GetPairs().size();
+
+    std::cout << "  uniform grid:     " << uniform.GetNumTests() << " tests   " << time_uniform << " s" << std::endl;
+    std::cout << "  multi-level grid: " << multilevel.GetNumTests() << " tests   " << time_multilevel << " s   ("
+              << multilevel.GetNumLevels() << " levels)" << std::endl;
+    std::cout << "  pairs:            " << num_pairs << (match ? "" : "   MISMATCH") << std::endl;
+
+    // Chrono::Parallel simulation, with bins sized from the median diameter
+    AutoBinning binning(&system);
+    binning.Initialize(ChVector<>(-hdimX, -hdimY, 0), ChVector<>(hdimX, hdimY, 2 * hdimZ),
+                       2 * dist.GetMedianRadius());
+    StepProfiler profiler(&system);
+    profiler.SetOutputInterval(-1);
+
+    startPhase(tag + "simulation");
+    for (int i = 0; i < m_num_steps; i++) {
+        system.DoStepDynamics(time_step);
+        profiler.Record();
+    }
+    stopPhase(tag + "simulation");
+
+    double time_step_avg = profiler.GetTotal(StepProfiler::STEP) / m_num_steps;
+    double time_broad_avg = profiler.GetTotal(StepProfiler::BROAD) / m_num_steps;
+    std::cout << "  simulation:       " << time_step_avg << " s/step   broad phase " << time_broad_avg << " s/step"
+              << std::endl;
+
+    m_execTime += profiler.GetTotal(StepProfiler::STEP) + num_reps * (time_uniform + time_multilevel);
+    addMetric(tag + "num_bodies", (int)spheres.size());
+    addMetric(tag + "num_pairs", num_pairs);
+    addMetric(tag + "num_levels", multilevel.GetNumLevels());
+    addMetric(tag + "tests_uniform", (double)uniform.GetNumTests());
+    addMetric(tag + "tests_multilevel", (double)multilevel.GetNumTests());
+    addMetric(tag + "time_uniform (s)", time_uniform);
+    addMetric(tag + "time_multilevel (s)", time_multilevel);
+    addMetric(tag + "time_generation (s)", gen.GetTimeSampling() + gen.GetTimeCreation() + gen.GetTimeInsertion());
+    addMetric(tag + "time_step (s)", time_step_avg);
+    addMetric(tag + "time_broad (s)", time_broad_avg);
+
+    return match && !spheres.empty();
+}
+
+bool PARPolydisperseTest::execute() {
+    bool passed = true;
+    for (int ratio : size_ratios)
+        passed &= Run(ratio);
+    addMetric("num_threads", m_num_threads);
+    addMetric("num_steps", m_num_steps);
+    return passed;
+}
+
+// ====================================================================================
+
+int main(int argc, char** argv) {
+    int num_steps = 50;
+    int num_threads = CHOMPfunctions::GetNumProcs();
+    if (argc > 1)
+        num_steps = std::stoi(argv[1]);
+    if (argc > 2)
+        num_threads = std::stoi(argv[2]);
+
+    std::string out_dir = "../METRICS";
+    if (!filesystem::create_directory(filesystem::path(out_dir))) {
+        std::cout << "Error creating directory " << out_dir << std::endl;
+        return 1;
+    }
+
+    PARPolydisperseTest test("metrics_PAR_polydisperse", num_steps, num_threads);
+    test.setOutDir(out_dir);
+    test.setVerbose(true);
+    bool passed = test.run();
+    test.print();
+
+    return passed ? 0 : 1;
+}
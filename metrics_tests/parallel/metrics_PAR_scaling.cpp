@@ -0,0 +1,201 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Author: Radu Serban
+// =============================================================================
+//
+// Strong and weak scaling study for Chrono::Parallel, using the settling of a
+// granular bed in a box container.
+//
+// Usage:
+//   metrics_PAR_scaling [thread_list]
+// where thread_list is a comma-separated list of thread counts (default: all
+// powers of 2 up to the number of available processors, plus that number).
+//
+// For strong scaling, the problem size is fixed. For weak scaling, the length
+// of the container (and hence the number of particles) grows proportionally to
+// the number of threads. The particles are generated with a seeded BulkGenerator
+// and the broad-phase bins are selected from the geometry only, so that every
+// thread count simulates the same problem.
+//
+// The global reference frame has Z up.
+// All units SI.
+//
+// =============================================================================
+
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chrono/ChConfig.h"
+#include "chrono/utils/ChUtilsCreators.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+#include "chrono_thirdparty/filesystem/path.h"
+
+#include "../../projects/auto_binning.h"
+#include "../../projects/bulk_generator.h"
+#include "../ScalingTest.h"
+
+using namespace chrono;
+
+// --------------------------------------------------------------------------
+
+// Container half-dimensions for a size factor of 1
+double hdimX = 1.0;
+double hdimY = 0.25;
+double hdimZ = 0.5;
+double hthick = 0.25;
+
+// Granular material
+double radius_g = 0.02;
+double rho_g = 2500;
+int num_layers = 8;
+
+// Simulation: let the particles fall for time_warmup, then measure over time_measure
+double time_step = 1e-4;
+double time_warmup = 0.05;
+double time_measure = 0.05;
+
+// ====================================================================================
+
+class PARScalingTest : public ScalingTest {
+  public:
+    PARScalingTest(const std::string& testName, Mode mode, const std::vector<int>& threads)
+        : ScalingTest(testName, "Chrono::Parallel", mode, threads) {}
+
+  protected:
+    virtual bool runScenario(int num_threads, double size_factor, PhaseTimes& times) override;
+};
+
+bool PARScalingTest::runScenario(int num_threads, double size_factor, PhaseTimes& times) {
+    double hX = hdimX * size_factor;
+
+    // Create the system
+    ChSystemParallelSMC* system = new ChSystemParallelSMC;
+    system->GetSettings()->solver.contact_force_model = ChSystemSMC::Hooke;
+    system->GetSettings()->solver.tangential_displ_mode = ChSystemSMC::TangentialDisplacementModel::OneStep;
+    system->GetSettings()->solver.use_material_properties = true;
+
+    system->Set_G_acc(ChVector<>(0, 0, -9.81));
+    system->GetSettings()->perform_thread_tuning = false;
+    system->GetSettings()->solver.use_full_inertia_tensor = false;
+    system->GetSettings()->solver.tolerance = 0.1;
+    system->GetSettings()->solver.max_iteration_bilateral = 100;
+    system->GetSettings()->collision.narrowphase_algorithm = NarrowPhaseType::NARROWPHASE_HYBRID_MPR;
+
+    // Broad-phase bins: estimate from the container and re-evaluate during warm-up only, from the
+    // shapes per bin (not the measured broad-phase time), so that all thread counts are measured
+    // with the same fixed bin configuration
+    AutoBinning binning(system);
+    binning.SetUpdateInterval(100);
+    binning.SetTimingFeedback(false);
+    binning.SetVerbose(false);
+    binning.Initialize(ChVector<>(-hX, -hdimY, 0), ChVector<>(hX, hdimY, 2 * hdimZ), 2 * radius_g);
+
+    system->SetParallelThreadNumber(num_threads);
+    CHOMPfunctions::SetNumThreads(num_threads);
+
+    // Contact material
+    auto material = chrono_types::make_shared<ChMaterialSurfaceSMC>();
+    material->SetFriction(0.9f);
+    material->SetRestitution(0.0f);
+    material->SetYoungModulus(8e5f);
+    material->SetPoissonRatio(0.3f);
+
+    // Container
+    utils::CreateBoxContainer(system, -1, material, ChVector<>(hX, hdimY, hdimZ), hthick);
+
+    // Granular material (seeded generator: same bed for all thread counts)
+    BulkGenerator gen(system, 1);
+    gen.SetMaterial(material);
+    gen.SetDensity(rho_g);
+    gen.SetRadius(radius_g);
+    gen.SetBodyIdentifier(1);
+
+    double r = 1.01 * radius_g;
+    ChVector<> hdims(hX - r, hdimY - r, 0);
+    ChVector<> center(0, 0, 2 * r);
+    for (int il = 0; il < num_layers; il++) {
+        gen.CreateObjectsBox(center, hdims, 2 * r);
+        center.z() += 2 * r;
+    }
+
+    // Warm up, then measure
+    int num_warmup = (int)std::ceil(time_warmup / time_step);
+    int num_measure = (int)std::ceil(time_measure / time_step);
+
+    for (int i = 0; i < num_warmup; i++) {
+        system->DoStepDynamics(time_step);
+        binning.Update();
+    }
+    binning.Freeze();
+
+    for (int i = 0; i < num_measure; i++) {
+        system->DoStepDynamics(time_step);
+        times.step += system->GetTimerStep();
+        times.broad += system->GetTimerCollisionBroad();
+        times.narrow += system->GetTimerCollisionNarrow();
+        times.update += system->GetTimerUpdate();
+        times.solver += system->GetTimerAdvance();
+        times.num_contacts += system->GetNcontacts();
+        times.num_steps++;
+    }
+    times.num_bodies = system->GetNbodies();
+
+    delete system;
+
+    return true;
+}
+
+// ====================================================================================
+
+int main(int argc, char** argv) {
+    // Thread counts: from the command line or powers of 2 up to the number of processors
+    std::vector<int> threads;
+    if (argc > 1) {
+        std::stringstream ss(argv[1]);
+        std::string item;
+        while (std::getline(ss, item, ','))
+            threads.push_back(std::stoi(item));
+    } else {
+        int max_threads = CHOMPfunctions::GetNumProcs();
+        for (int nt = 1; nt < max_threads; nt *= 2)
+            threads.push_back(nt);
+        threads.push_back(max_threads);
+    }
+
+    std::string out_dir = "../METRICS";
+    if (!filesystem::create_directory(filesystem::path(out_dir))) {
+        std::cout << "Error creating directory " << out_dir << std::endl;
+        return 1;
+    }
+
+    bool passed = true;
+
+    PARScalingTest testStrong("metrics_PAR_scaling_strong", ScalingTest::STRONG, threads);
+    PARScalingTest testWeak("metrics_PAR_scaling_weak", ScalingTest::WEAK, threads);
+
+    testStrong.setOutDir(out_dir);
+    testStrong.setVerbose(true);
+    passed &= testStrong.run();
+    testStrong.print();
+
+    testWeak.setOutDir(out_dir);
+    testWeak.setVerbose(true);
+    passed &= testWeak.run();
+    testWeak.print();
+
+    return passed ? 0 : 1;
+}
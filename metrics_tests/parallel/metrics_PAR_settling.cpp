@@ -42,48 +42,14 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
+#include "../../projects/auto_binning.h"
+#include "../../projects/step_profiler.h"
 #include "../BaseTest.h"
 
 using namespace chrono;
 
 // --------------------------------------------------------------------------
 
-void TimingHeader() {
-    printf("    TIME    |");
-    printf("    STEP |");
-    printf("   BROAD |");
-    printf("  NARROW |");
-    printf("  SOLVER |");
-    printf("  UPDATE |");
-    printf("# BODIES |");
-    printf("# CONTACT|");
-    printf(" # ITERS |");
-    printf("   RESID |");
-    printf("\n\n");
-}
-
-void TimingOutput(chrono::ChSystem* mSys) {
-    double TIME = mSys->GetChTime();
-    double STEP = mSys->GetTimerStep();
-    double BROD = mSys->GetTimerCollisionBroad();
-    double NARR = mSys->GetTimerCollisionNarrow();
-    double SOLVER = mSys->GetTimerAdvance();
-    double UPDT = mSys->GetTimerUpdate();
-    double RESID = 0;
-    int REQ_ITS = 0;
-    int BODS = mSys->GetNbodies();
-    int CNTC = mSys->GetNcontacts();
-    if (chrono::ChSystemParallel* parallel_sys = dynamic_cast<chrono::ChSystemParallel*>(mSys)) {
-        RESID = std::static_pointer_cast<chrono::ChIterativeSolverParallel>(mSys->GetSolver())->GetResidual();
-        REQ_ITS = std::static_pointer_cast<chrono::ChIterativeSolverParallel>(mSys->GetSolver())->GetTotalIterations();
-        BODS = parallel_sys->GetNbodies();
-        CNTC = parallel_sys->GetNcontacts();
-    }
-
-    printf("   %8.5f | %7.4f | %7.4f | %7.4f | %7.4f | %7.4f | %7d | %7d | %7d | %7.4f |\n", TIME, STEP, BROD, NARR,
-           SOLVER, UPDT, BODS, CNTC, REQ_ITS, RESID);
-}
-
 // ====================================================================================
 
 // Test class
@@ -116,6 +82,8 @@ bool PARSettlingTest::execute() {
     std::cout << "Test: " << getTestName() << std::endl;
     std::cout << "Requested number of threads: " << m_num_threads << std::endl;
 
+    startPhase("setup");
+
     // ----------------
     // Model parameters
     // ----------------
@@ -145,13 +113,6 @@ bool PARSettlingTest::execute() {
     float kt_terrain = 2.86e6f;
     float gt_terrain = 1.0e3f;
 
-    // Estimates for number of bins for broad-phase
-    int factor = 2;
-    int binsX = (int)std::ceil(hdimX / radius_g) / factor;
-    int binsY = (int)std::ceil(hdimY / radius_g) / factor;
-    int binsZ = 1;
-    std::cout << "Broad-phase bins: " << binsX << " x " << binsY << " x " << binsZ << std::endl;
-
     // --------------------------
     // Create the parallel system
     // --------------------------
@@ -195,7 +156,16 @@ bool PARSettlingTest::execute() {
     system->GetSettings()->solver.tolerance = 0.1;
     system->GetSettings()->solver.max_iteration_bilateral = 100;
     system->GetSettings()->collision.narrowphase_algorithm = NarrowPhaseType::NARROWPHASE_HYBRID_MPR;
-    system->GetSettings()->collision.bins_per_axis = vec3(binsX, binsY, binsZ);
+
+    // Broad-phase bins: initial estimate from the container, re-evaluated during settling from the
+    // shapes per bin only. Judging changes against the measured broad-phase time would make the
+    // bin layout (and hence the measurements) depend on timing noise; console logging is disabled
+    // so that it does not perturb the measurements.
+    AutoBinning binning(system);
+    binning.SetUpdateInterval(500);
+    binning.SetTimingFeedback(false);
+    binning.SetVerbose(false);
+    binning.Initialize(ChVector<>(-hdimX, -hdimY, 0), ChVector<>(hdimX, hdimY, 2 * hdimZ), 2 * radius_g);
 
     // Set number of threads
     system->SetParallelThreadNumber(m_num_threads);
@@ -313,26 +283,20 @@ bool PARSettlingTest::execute() {
     // Simulate system
     // ---------------
 
-    double sim_time = 0;
-    double broad_time = 0;
-    double narrow_time = 0;
-    double update_time = 0;
-    double solve_time = 0;
-    int num_steps = 0;
+    // Console output disabled, so that it does not perturb the measurements
+    StepProfiler profiler(system);
+    profiler.SetOutputInterval(-1);
+
+    stopPhase("setup");
+    startPhase("simulation");
 
-    ////TimingHeader();
     double time_end = 0.5;
     while (system->GetChTime() < time_end) {
+        beginStep();
         system->DoStepDynamics(time_step);
-
-        sim_time += system->GetTimerStep();
-        broad_time += system->GetTimerCollisionBroad();
-        narrow_time += system->GetTimerCollisionNarrow();
-        update_time += system->GetTimerUpdate();
-        solve_time += system->GetTimerAdvance();
-        num_steps++;
-
-        ////TimingOutput(system);
+        endStep();
+        binning.Update();
+        profiler.Record();
 
 #ifdef CHRONO_OPENGL
         if (render) {
@@ -346,25 +310,23 @@ bool PARSettlingTest::execute() {
 #endif
     }
 
+    stopPhase("simulation");
+
     system->CalculateContactForces();
     real3 cforce = system->GetBodyContactForce(container);
     int ncontacts = system->GetNcontacts();
     std::cout << "Number of contacts:         " << ncontacts << std::endl;
     std::cout << "Contact force on container: " << cforce.x << "  " << cforce.y << "  " << cforce.z << std::endl;
-    std::cout << "Total simulation time: " << sim_time << std::endl;
-    std::cout << "    Broad phase:       " << broad_time << std::endl;
-    std::cout << "    Narrow phase:      " << narrow_time << std::endl;
-    std::cout << "    Update phase:      " << update_time << std::endl;
-    std::cout << "    Solve phase:       " << solve_time << std::endl;
+    profiler.PrintSummary();
 
-    m_execTime = sim_time;
+    m_execTime = profiler.GetTotal(StepProfiler::STEP);
     addMetric("number_contacts", ncontacts);
     addMetric("vertical_force", cforce.z);
-    addMetric("avg_sim_time_per_step (ms)", 1000 * sim_time / num_steps);
-    addMetric("avg_broad_time_per_step (ms)", 1000 * broad_time / num_steps);
-    addMetric("avg_narrow_time_per_step (ms)", 1000 * narrow_time / num_steps);
-    addMetric("avg_update_time_per_step (ms)", 1000 * update_time / num_steps);
-    addMetric("avg_solve_time_per_step (ms)", 1000 * solve_time / num_steps);
+    addMetric("avg_sim_time_per_step (ms)", 1000 * profiler.GetAverage(StepProfiler::STEP));
+    addMetric("avg_broad_time_per_step (ms)", 1000 * profiler.GetAverage(StepProfiler::BROAD));
+    addMetric("avg_narrow_time_per_step (ms)", 1000 * profiler.GetAverage(StepProfiler::NARROW));
+    addMetric("avg_update_time_per_step (ms)", 1000 * profiler.GetAverage(StepProfiler::UPDATE));
+    addMetric("avg_solve_time_per_step (ms)", 1000 * profiler.GetAverage(StepProfiler::ADVANCE));
 
     return true;
 }
@@ -385,21 +347,25 @@ int main(int argc, char** argv) {
 
     testDEM2.setOutDir(out_dir);
     testDEM2.setVerbose(true);
+    testDEM2.setPerfCounters(true);
     passed &= testDEM2.run();
     testDEM2.print();
 
     testDEM4.setOutDir(out_dir);
     testDEM4.setVerbose(true);
+    testDEM4.setPerfCounters(true);
     passed &= testDEM4.run();
     testDEM4.print();
 
     testDVI2.setOutDir(out_dir);
     testDVI2.setVerbose(true);
+    testDVI2.setPerfCounters(true);
     passed &= testDVI2.run();
     testDVI2.print();
 
     testDVI4.setOutDir(out_dir);
     testDVI4.setVerbose(true);
+    testDVI4.setPerfCounters(true);
     passed &= testDVI4.run();
     testDVI4.print();
 
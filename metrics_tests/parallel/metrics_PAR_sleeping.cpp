@@ -0,0 +1,273 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Author: Radu Serban
+// =============================================================================
+//
+// Correctness and performance of sleeping quiescent particles (SleepManager in
+// projects/sleep_manager.h). The same scenario is run with and without sleeping:
+//   1. settling of a granular bed (SMC contact) in a box container;
+//   2. cratering: a heavy ball dropped onto the settled bed.
+// The test passes if the two runs agree on the bed height, the vertical force
+// on the container, and the final ball depth, within the specified tolerances.
+//
+// Usage:
+//   metrics_PAR_sleeping [num_threads]
+//
+// The global reference frame has Z up.
+// All units SI.
+//
+// =============================================================================
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "chrono/ChConfig.h"
+#include "chrono/utils/ChUtilsCreators.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+#include "chrono_thirdparty/filesystem/path.h"
+
+#include "../../projects/bulk_generator.h"
+#include "../../projects/sleep_manager.h"
+#include "../../projects/step_profiler.h"
+#include "../BaseTest.h"
+
+using namespace chrono;
+
+// --------------------------------------------------------------------------
+
+// Container half-dimensions
+double hdimX = 0.5;
+double hdimY = 0.25;
+double hdimZ = 0.5;
+double hthick = 0.05;
+
+// Granular material
+double radius_g = 0.01;
+double rho_g = 2500;
+int num_layers = 8;
+
+// Projectile
+double radius_b = 0.05;
+double rho_b = 7800;
+double drop_height = 0.2;
+
+// Simulation
+double time_step = 1e-4;
+double time_settling = 1.0;
+double time_crater = 0.5;
+
+// Tolerances (absolute, as fractions of the particle radius; relative for the container force)
+double tol_height = 0.5;
+double tol_depth = 1.0;
+double tol_force = 0.05;
+
+// ====================================================================================
+
+// Results of one run
+struct RunResults {
+    double mean_height;   ///< mean particle height after settling
+    double max_height;    ///< highest particle after settling
+    double force;         ///< vertical contact force on the container after settling
+    double depth;         ///< depth of the ball bottom below the initial bed surface
+    double time_settle;   ///< simulation time for settling
+    double time_crater;   ///< simulation time for cratering
+    double avg_sleeping;  ///< average sleeping fraction
+};
+
+class PARSleepingTest : public BaseTest {
+  public:
+    PARSleepingTest(const std::string& testName, int num_threads)
+        : BaseTest(testName, "Chrono::Parallel"), m_num_threads(num_threads), m_execTime(0) {}
+
+    virtual bool execute() override;
+    virtual double getExecutionTime() const override { return m_execTime; }
+
+  private:
+    void Run(bool sleeping, RunResults& res);
+
+    int m_num_threads;
+    double m_execTime;
+};
+
+void PARSleepingTest::Run(bool sleeping, RunResults& res) {
+    ChSystemParallelSMC system;
+    system.Set_G_acc(ChVector<>(0, 0, -9.81));
+    system.SetParallelThreadNumber(m_num_threads);
+    CHOMPfunctions::SetNumThreads(m_num_threads);
+    system.GetSettings()->solver.contact_force_model = ChSystemSMC::Hertz;
+    system.GetSettings()->solver.tangential_displ_mode = ChSystemSMC::TangentialDisplacementModel::OneStep;
+    system.GetSettings()->solver.use_material_properties = true;
+    system.GetSettings()->collision.narrowphase_algorithm = NarrowPhaseType::NARROWPHASE_HYBRID_MPR;
+    system.GetSettings()->collision.bins_per_axis = vec3(20, 10, 10);
+
+    auto material = chrono_types::make_shared<ChMaterialSurfaceSMC>();
+    material->SetFriction(0.5f);
+    material->SetRestitution(0.1f);
+    material->SetYoungModulus(1e7f);
+
+    // Container
+    auto container = std::shared_ptr<ChBody>(system.NewBody());
+    container->SetIdentifier(-1);
+    container->SetBodyFixed(true);
+    container->SetCollide(true);
+    container->SetMaterialSurface(material);
+    container->GetCollisionModel()->ClearModel();
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hdimY, hthick), ChVector<>(0, 0, -hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hthick, hdimY, hdimZ + hthick),
+                          ChVector<>(hdimX + hthick, 0, hdimZ - hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hthick, hdimY, hdimZ + hthick),
+                          ChVector<>(-hdimX - hthick, 0, hdimZ - hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hthick, hdimZ + hthick),
+                          ChVector<>(0, hdimY + hthick, hdimZ - hthick));
+    utils::AddBoxGeometry(container.get(), ChVector<>(hdimX, hthick, hdimZ + hthick),
+                          ChVector<>(0, -hdimY - hthick, hdimZ - hthick));
+    container->GetCollisionModel()->BuildModel();
+    system.AddBody(container);
+
+    // Granular material (same initial configuration in both runs)
+    BulkGenerator gen(&system);
+    gen.SetMaterial(material);
+    gen.SetRadius(radius_g);
+    gen.SetDensity(rho_g);
+    gen.SetBodyIdentifier(1);
+    double r = 1.01 * radius_g;
+    std::vector<ChVector<>> points;
+    for (int il = 0; il < num_layers; il++) {
+        auto layer = gen.SampleBox(ChVector<>(0, 0, (2 * il + 2) * r), ChVector<>(hdimX - r, hdimY - r, 0), 2 * r);
+        points.insert(points.end(), layer.begin(), layer.end());
+    }
+    auto particles = gen.CreateSpheres(points);
+
+    SleepManager sleep(&system);
+    sleep.SetBodyRange(particles->GetFirstIndex(), particles->GetNumParticles());
+    sleep.SetGranularThresholds(radius_g);
+    sleep.SetSleepSteps((int)std::ceil(0.05 / time_step));
+
+    StepProfiler profiler(&system);
+    profiler.SetOutputInterval(-1);
+
+    // Settling
+    while (system.GetChTime() < time_settling) {
+        system.DoStepDynamics(time_step);
+        profiler.Record();
+        if (sleeping)
+            sleep.Update();
+    }
+    res.time_settle = profiler.GetTotal(StepProfiler::STEP);
+
+    // Wake all particles and take one step, so that contacts with the container are reported again.
+    sleep.WakeAll();
+    system.DoStepDynamics(time_step);
+    system.CalculateContactForces();
+    res.force = system.GetBodyContactForce(container).z;
+
+    std::vector<ChVector<>> pos;
+    particles->GetPositions(pos);
+    res.mean_height = 0;
+    res.max_height = 0;
+    for (const auto& p : pos) {
+        res.mean_height += p.z();
+        res.max_height = std::max(res.max_height, p.z());
+    }
+    res.mean_height /= pos.size();
+
+    // Cratering
+    double surface = res.max_height + radius_g;
+    double mass_b = rho_b * (4.0 / 3) * CH_C_PI * radius_b * radius_b * radius_b;
+    auto ball = std::shared_ptr<ChBody>(system.NewBody());
+    ball->SetIdentifier(0);
+    ball->SetMass(mass_b);
+    ball->SetInertiaXX(0.4 * mass_b * radius_b * radius_b * ChVector<>(1, 1, 1));
+    ball->SetPos(ChVector<>(0, 0, surface + radius_b + drop_height));
+    ball->SetCollide(true);
+    ball->SetMaterialSurface(material);
+    ball->GetCollisionModel()->ClearModel();
+    utils::AddSphereGeometry(ball.get(), radius_b);
+    ball->GetCollisionModel()->BuildModel();
+    system.AddBody(ball);
+
+    double time_end = system.GetChTime() + time_crater;
+    double time_start = profiler.GetTotal(StepProfiler::STEP);
+    while (system.GetChTime() < time_end) {
+        system.DoStepDynamics(time_step);
+        profiler.Record();
+        if (sleeping)
+            sleep.Update();
+    }
+    res.time_crater = profiler.GetTotal(StepProfiler::STEP) - time_start;
+    res.depth = surface - (ball->GetPos().z() - radius_b);
+    res.avg_sleeping = sleep.GetAverageSleepingFraction();
+
+    std::cout << (sleeping ? "sleeping:     " : "no sleeping:  ") << pos.size() << " particles"
+              << "  mean height " << res.mean_height << "  max height " << res.max_height << "  force " << res.force
+              << "  depth " << res.depth << "  time " << res.time_settle << " + " << res.time_crater << std::endl;
+}
+
+bool PARSleepingTest::execute() {
+    RunResults ref;
+    RunResults slp;
+
+    startPhase("reference");
+    Run(false, ref);
+    stopPhase("reference");
+
+    startPhase("sleeping");
+    Run(true, slp);
+    stopPhase("sleeping");
+
+    double err_height = std::abs(slp.mean_height - ref.mean_height) / radius_g;
+    double err_max_height = std::abs(slp.max_height - ref.max_height) / radius_g;
+    double err_force = std::abs(slp.force - ref.force) / std::abs(ref.force);
+    double err_depth = std::abs(slp.depth - ref.depth) / radius_g;
+
+    m_execTime = ref.time_settle + ref.time_crater + slp.time_settle + slp.time_crater;
+    addMetric("num_threads", m_num_threads);
+    addMetric("avg_sleeping_fraction", slp.avg_sleeping);
+    addMetric("time_settling_ref (s)", ref.time_settle);
+    addMetric("time_settling_sleep (s)", slp.time_settle);
+    addMetric("time_crater_ref (s)", ref.time_crater);
+    addMetric("time_crater_sleep (s)", slp.time_crater);
+    addMetric("err_mean_height (radii)", err_height);
+    addMetric("err_max_height (radii)", err_max_height);
+    addMetric("err_vertical_force (rel)", err_force);
+    addMetric("err_crater_depth (radii)", err_depth);
+
+    return err_height < tol_height && err_max_height < 2 * tol_height && err_force < tol_force &&
+           err_depth < tol_depth;
+}
+
+// ====================================================================================
+
+int main(int argc, char** argv) {
+    int num_threads = CHOMPfunctions::GetNumProcs();
+    if (argc > 1)
+        num_threads = std::stoi(argv[1]);
+
+    std::string out_dir = "../METRICS";
+    if (!filesystem::create_directory(filesystem::path(out_dir))) {
+        std::cout << "Error creating directory " << out_dir << std::endl;
+        return 1;
+    }
+
+    PARSleepingTest test("metrics_PAR_sleeping", num_threads);
+    test.setOutDir(out_dir);
+    test.setVerbose(true);
+    bool passed = test.run();
+    test.print();
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,671 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Regression comparator for the JSON files written by the metrics tests.
+//
+// Usage:
+//   metrics_compare [-t tolerance_file] [-v] <baseline> <current>
+//
+// where <baseline> and <current> are either two JSON files produced by
+// BaseTest::run() or two directories containing such files (in which case
+// files are matched by name). Every numeric metric is compared against the
+// baseline value with a tolerance taken from the first matching rule in the
+// tolerance file (see data/tolerances.txt for the format). Timing metrics are
+// direction-aware: only a slowdown counts as a regression.
+//
+// Some metrics depend on the environment rather than on the code: hardware
+// counters (perf_*) are only available if the kernel grants PMU access, and
+// allocation counts only if the tests were built with METRICS_COUNT_ALLOCATIONS.
+// Such optional metrics are reported as skipped (not as regressions) when they
+// are missing from one of the runs, and all perf_* metrics are skipped when
+// either run reports perf_available = 0.
+//
+// The program prints a table of all compared metrics and returns 0 if no
+// regression was detected, 1 otherwise, and 2 on usage or I/O errors.
+//
+// =============================================================================
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// =============================================================================
+// Minimal JSON reader (sufficient for the output of BaseTest)
+// =============================================================================
+
+struct JsonValue {
+    enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+    Type type = NUL;
+    double number = 0;
+    std::string str;
+    std::vector<JsonValue> items;                            // array elements
+    std::vector<std::pair<std::string, JsonValue>> members;  // object members (in file order)
+
+    const JsonValue* Find(const std::string& key) const {
+        for (const auto& m : members) {
+            if (m.first == key)
+                return &m.second;
+        }
+        return nullptr;
+    }
+};
+
+class JsonParser {
+  public:
+    explicit JsonParser(const std::string& text) : m_text(text), m_pos(0) {}
+
+    bool Parse(JsonValue& value, std::string& error) {
+        if (!ParseValue(value)) {
+            error = m_error;
+            return false;
+        }
+        SkipSpace();
+        if (m_pos != m_text.size()) {
+            error = "trailing characters at offset " + std::to_string(m_pos);
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    void SkipSpace() {
+        while (m_pos < m_text.size() && std::isspace((unsigned char)m_text[m_pos]))
+            m_pos++;
+    }
+
+    bool Fail(const std::string& msg) {
+        m_error = msg + " at offset " + std::to_string(m_pos);
+        return false;
+    }
+
+    bool ParseValue(JsonValue& value) {
+        SkipSpace();
+        if (m_pos >= m_text.size())
+            return Fail("unexpected end of input");
+
+        char c = m_text[m_pos];
+        if (c == '{')
+            return ParseObject(value);
+        if (c == '[')
+            return ParseArray(value);
+        if (c == '"') {
+            value.type = JsonValue::STRING;
+            return ParseString(value.str);
+        }
+        if (m_text.compare(m_pos, 4, "true") == 0) {
+            value.type = JsonValue::BOOL;
+            value.number = 1;
+            m_pos += 4;
+            return true;
+        }
+        if (m_text.compare(m_pos, 5, "false") == 0) {
+            value.type = JsonValue::BOOL;
+            value.number = 0;
+            m_pos += 5;
+            return true;
+        }
+        if (m_text.compare(m_pos, 4, "null") == 0) {
+            value.type = JsonValue::NUL;
+            m_pos += 4;
+            return true;
+        }
+        // Also accept the non-standard nan/inf tokens that std::ostream may produce.
+        const char* start = m_text.c_str() + m_pos;
+        char* end = nullptr;
+        double v = std::strtod(start, &end);
+        if (end == start)
+            return Fail("invalid value");
+        value.type = JsonValue::NUMBER;
+        value.number = v;
+        m_pos += end - start;
+        return true;
+    }
+
+    bool ParseString(std::string& out) {
+        m_pos++;  // opening quote
+        out.clear();
+        while (m_pos < m_text.size()) {
+            char c = m_text[m_pos++];
+            if (c == '"')
+                return true;
+            if (c == '\\' && m_pos < m_text.size()) {
+                char e = m_text[m_pos++];
+                switch (e) {
+                    case 'n':
+                        out += '\n';
+                        break;
+                    case 't':
+                        out += '\t';
+                        break;
+                    case 'u':
+                        // Non-ASCII escapes are not expected in metric names; keep them verbatim.
+                        out += "\\u";
+                        break;
+                    default:
+                        out += e;
+                        break;
+                }
+                continue;
+            }
+            out += c;
+        }
+        return Fail("unterminated string");
+    }
+
+    bool ParseArray(JsonValue& value) {
+        value.type = JsonValue::ARRAY;
+        m_pos++;
+        SkipSpace();
+        if (m_pos < m_text.size() && m_text[m_pos] == ']') {
+            m_pos++;
+            return true;
+        }
+        while (true) {
+            JsonValue item;
+            if (!ParseValue(item))
+                return false;
+            value.items.push_back(item);
+            SkipSpace();
+            if (m_pos >= m_text.size())
+                return Fail("unterminated array");
+            char c = m_text[m_pos++];
+            if (c == ']')
+                return true;
+            if (c != ',')
+                return Fail("expected ',' or ']'");
+        }
+    }
+
+    bool ParseObject(JsonValue& value) {
+        value.type = JsonValue::OBJECT;
+        m_pos++;
+        SkipSpace();
+        if (m_pos < m_text.size() && m_text[m_pos] == '}') {
+            m_pos++;
+            return true;
+        }
+        while (true) {
+            SkipSpace();
+            if (m_pos >= m_text.size() || m_text[m_pos] != '"')
+                return Fail("expected member name");
+            std::string key;
+            if (!ParseString(key))
+                return false;
+            SkipSpace();
+            if (m_pos >= m_text.size() || m_text[m_pos] != ':')
+                return Fail("expected ':'");
+            m_pos++;
+            JsonValue member;
+            if (!ParseValue(member))
+                return false;
+            value.members.emplace_back(key, member);
+            SkipSpace();
+            if (m_pos >= m_text.size())
+                return Fail("unterminated object");
+            char c = m_text[m_pos++];
+            if (c == '}')
+                return true;
+            if (c != ',')
+                return Fail("expected ',' or '}'");
+        }
+    }
+
+    const std::string& m_text;
+    size_t m_pos;
+    std::string m_error;
+};
+
+// =============================================================================
+// Test results
+// =============================================================================
+
+struct TestResult {
+    std::string name;
+    bool passed = true;
+    std::vector<std::pair<std::string, double>> metrics;  // flattened numeric metrics (in file order)
+    std::map<std::string, std::string> fingerprint;       // machine and build information
+
+    const double* Find(const std::string& key) const {
+        for (const auto& m : metrics) {
+            if (m.first == key)
+                return &m.second;
+        }
+        return nullptr;
+    }
+};
+
+// Collect all numeric members of a (possibly nested) object, using dotted names for nested keys.
+static void Flatten(const JsonValue& obj, const std::string& prefix, std::vector<std::pair<std::string, double>>& out) {
+    for (const auto& m : obj.members) {
+        std::string key = prefix.empty() ? m.first : prefix + "." + m.first;
+        if (m.second.type == JsonValue::NUMBER)
+            out.emplace_back(key, m.second.number);
+        else if (m.second.type == JsonValue::OBJECT)
+            Flatten(m.second, key, out);
+    }
+}
+
+static bool LoadResult(const fs::path& file, TestResult& result) {
+    std::ifstream ifs(file);
+    if (!ifs.is_open()) {
+        std::cerr << "ERROR: cannot open " << file << std::endl;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << ifs.rdbuf();
+    std::string text = buffer.str();
+
+    JsonValue root;
+    std::string error;
+    if (!JsonParser(text).Parse(root, error) || root.type != JsonValue::OBJECT) {
+        std::cerr << "ERROR: cannot parse " << file << ": " << error << std::endl;
+        return false;
+    }
+
+    const JsonValue* name = root.Find("name");
+    result.name = (name && name->type == JsonValue::STRING) ? name->str : file.stem().string();
+
+    const JsonValue* passed = root.Find("passed");
+    result.passed = !passed || passed->number != 0;
+
+    const JsonValue* exec_time = root.Find("execution_time");
+    if (exec_time && exec_time->type == JsonValue::NUMBER)
+        result.metrics.emplace_back("execution_time", exec_time->number);
+
+    const JsonValue* metrics = root.Find("metrics");
+    if (metrics && metrics->type == JsonValue::OBJECT)
+        Flatten(*metrics, "", result.metrics);
+
+    const JsonValue* fingerprint = root.Find("fingerprint");
+    if (fingerprint && fingerprint->type == JsonValue::OBJECT) {
+        for (const auto& m : fingerprint->members) {
+            if (m.second.type == JsonValue::STRING)
+                result.fingerprint[m.first] = m.second.str;
+            else if (m.second.type == JsonValue::NUMBER)
+                result.fingerprint[m.first] = std::to_string((long long)m.second.number);
+        }
+    }
+
+    return true;
+}
+
+// Load either a single JSON file or all JSON files in a directory, keyed by file name.
+static bool LoadResults(const fs::path& path, std::map<std::string, TestResult>& results) {
+    std::error_code ec;
+    if (fs::is_directory(path, ec)) {
+        for (const auto& entry : fs::directory_iterator(path)) {
+            if (entry.path().extension() != ".json")
+                continue;
+            TestResult result;
+            if (!LoadResult(entry.path(), result))
+                return false;
+            results[entry.path().filename().string()] = result;
+        }
+        return true;
+    }
+
+    TestResult result;
+    if (!LoadResult(path, result))
+        return false;
+    results[""] = result;
+    return true;
+}
+
+// =============================================================================
+// Tolerances
+// =============================================================================
+
+enum class Direction {
+    LOWER,   // lower is better (e.g. timings): only an increase is a regression
+    HIGHER,  // higher is better (e.g. throughput): only a decrease is a regression
+    BOTH     // any deviation beyond tolerance is a regression (e.g. physical results)
+};
+
+struct ToleranceRule {
+    std::string pattern;  // glob pattern ('*' wildcard) on "metric" or "test/metric"
+    double rel;           // relative tolerance (fraction of the baseline magnitude)
+    double abs;           // absolute tolerance
+    Direction dir;
+    bool optional;        // metric may be legitimately absent from a run
+};
+
+// Simple glob matching with '*' as the only wildcard.
+static bool GlobMatch(const char* pattern, const char* str) {
+    if (*pattern == '\0')
+        return *str == '\0';
+    if (*pattern == '*')
+        return GlobMatch(pattern + 1, str) || (*str != '\0' && GlobMatch(pattern, str + 1));
+    return *pattern == *str && GlobMatch(pattern + 1, str + 1);
+}
+
+static bool LoadTolerances(const std::string& filename, std::vector<ToleranceRule>& rules) {
+    std::ifstream ifs(filename);
+    if (!ifs.is_open()) {
+        std::cerr << "ERROR: cannot open tolerance file " << filename << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int line_num = 0;
+    while (std::getline(ifs, line)) {
+        line_num++;
+        auto hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+
+        // The pattern may contain spaces (metric names such as "avg_time_per_step (ms)"),
+        // so parse the trailing fields from the end of the line.
+        std::istringstream iss(line);
+        std::vector<std::string> tokens;
+        std::string tok;
+        while (iss >> tok)
+            tokens.push_back(tok);
+        if (tokens.empty())
+            continue;
+
+        ToleranceRule rule;
+        rule.optional = (tokens.back() == "optional");
+        if (rule.optional)
+            tokens.pop_back();
+        if (tokens.size() < 4) {
+            std::cerr << "ERROR: " << filename << ":" << line_num
+                      << ": expected '<pattern> <rel> <abs> <direction> [optional]'" << std::endl;
+            return false;
+        }
+
+        size_t n = tokens.size();
+        rule.rel = std::atof(tokens[n - 3].c_str());
+        rule.abs = std::atof(tokens[n - 2].c_str());
+        const std::string& dir = tokens[n - 1];
+        if (dir == "lower")
+            rule.dir = Direction::LOWER;
+        else if (dir == "higher")
+            rule.dir = Direction::HIGHER;
+        else if (dir == "both")
+            rule.dir = Direction::BOTH;
+        else {
+            std::cerr << "ERROR: " << filename << ":" << line_num << ": unknown direction '" << dir << "'"
+                      << std::endl;
+            return false;
+        }
+        rule.pattern = tokens[0];
+        for (size_t i = 1; i < n - 3; i++)
+            rule.pattern += " " + tokens[i];
+
+        rules.push_back(rule);
+    }
+
+    return true;
+}
+
+// Return true if the metric is only produced in some environments (hardware counters, allocation counts).
+static bool IsOptionalMetric(const std::string& metric) {
+    if (metric.compare(0, 5, "perf_") == 0)
+        return metric != "perf_available";
+    return metric.find("alloc") != std::string::npos;
+}
+
+// Find the tolerance for the given metric. Without a matching rule, metrics with "time" in their
+// name, hardware counter values and memory usage are treated as costs (10%, lower is better), instructions per
+// cycle and parallel efficiencies as throughput (10%, higher is better); all others must match
+// within 5%. Hardware counter and allocation metrics are optional.
+static ToleranceRule FindTolerance(const std::vector<ToleranceRule>& rules,
+                                   const std::string& test,
+                                   const std::string& metric) {
+    std::string qualified = test + "/" + metric;
+    for (const auto& rule : rules) {
+        if (GlobMatch(rule.pattern.c_str(), metric.c_str()) || GlobMatch(rule.pattern.c_str(), qualified.c_str()))
+            return rule;
+    }
+
+    bool optional = IsOptionalMetric(metric);
+    if (metric.compare(0, 5, "perf_") == 0) {
+        if (metric == "perf_available")
+            return {"", 0.0, 0.0, Direction::BOTH, false};
+        if (metric.size() >= 3 && metric.compare(metric.size() - 3, 3, "ipc") == 0)
+            return {"", 0.10, 0.0, Direction::HIGHER, optional};
+        return {"", 0.10, 0.0, Direction::LOWER, optional};
+    }
+    if (metric.find("rss") != std::string::npos || metric.find("alloc") != std::string::npos)
+        return {"", 0.10, 0.0, Direction::LOWER, optional};
+    if (metric.compare(0, 10, "efficiency") == 0)
+        return {"", 0.10, 0.0, Direction::HIGHER, optional};
+    if (metric.find("time") != std::string::npos)
+        return {"", 0.10, 0.0, Direction::LOWER, optional};
+    return {"", 0.05, 0.0, Direction::BOTH, optional};
+}
+
+// =============================================================================
+// Comparison
+// =============================================================================
+
+enum class Status { OK, IMPROVED, REGRESSED, MISSING, NEW, SKIPPED };
+
+static const char* StatusString(Status s) {
+    switch (s) {
+        case Status::OK:
+            return "ok";
+        case Status::IMPROVED:
+            return "improved";
+        case Status::REGRESSED:
+            return "REGRESSED";
+        case Status::MISSING:
+            return "MISSING";
+        case Status::NEW:
+            return "new";
+        case Status::SKIPPED:
+            return "skipped";
+    }
+    return "";
+}
+
+static Status Compare(double base, double cur, const ToleranceRule& tol) {
+    double allowed = std::max(tol.rel * std::abs(base), tol.abs);
+    double diff = cur - base;
+
+    if (std::isnan(cur) && !std::isnan(base))
+        return Status::REGRESSED;
+
+    switch (tol.dir) {
+        case Direction::LOWER:
+            if (diff > allowed)
+                return Status::REGRESSED;
+            return (-diff > allowed) ? Status::IMPROVED : Status::OK;
+        case Direction::HIGHER:
+            if (-diff > allowed)
+                return Status::REGRESSED;
+            return (diff > allowed) ? Status::IMPROVED : Status::OK;
+        case Direction::BOTH:
+            return (std::abs(diff) > allowed) ? Status::REGRESSED : Status::OK;
+    }
+    return Status::OK;
+}
+
+struct Row {
+    std::string test;
+    std::string metric;
+    double base;
+    double cur;
+    double allowed;
+    Status status;
+};
+
+static void PrintTable(const std::vector<Row>& rows, bool verbose) {
+    size_t wtest = 4;
+    size_t wmetric = 6;
+    for (const auto& r : rows) {
+        wtest = std::max(wtest, r.test.size());
+        wmetric = std::max(wmetric, r.metric.size());
+    }
+
+    printf("%-*s  %-*s  %14s  %14s  %9s  %12s  %s\n", (int)wtest, "TEST", (int)wmetric, "METRIC", "BASELINE",
+           "CURRENT", "CHANGE", "TOLERANCE", "STATUS");
+    for (const auto& r : rows) {
+        if (!verbose && r.status == Status::OK)
+            continue;
+
+        char change[32] = "";
+        if (r.status != Status::MISSING && r.status != Status::NEW && r.status != Status::SKIPPED) {
+            if (r.base != 0)
+                snprintf(change, sizeof(change), "%+8.2f%%", 100 * (r.cur - r.base) / std::abs(r.base));
+            else
+                snprintf(change, sizeof(change), "%+9.3g", r.cur - r.base);
+        }
+
+        printf("%-*s  %-*s  %14.6g  %14.6g  %9s  %12.4g  %s\n", (int)wtest, r.test.c_str(), (int)wmetric,
+               r.metric.c_str(), r.base, r.cur, change, r.allowed, StatusString(r.status));
+    }
+}
+
+// Warn if the two results were produced on different hardware or with a different build configuration,
+// in which case timing differences are not meaningful.
+static void CheckFingerprints(const TestResult& base, const TestResult& cur) {
+    static const char* keys[] = {"cpu_model", "num_cores", "omp_threads", "simd", "compiler", "build_type"};
+    for (const char* key : keys) {
+        auto b = base.fingerprint.find(key);
+        auto c = cur.fingerprint.find(key);
+        if (b == base.fingerprint.end() || c == cur.fingerprint.end() || b->second == c->second)
+            continue;
+        std::cout << "WARNING: " << base.name << ": " << key << " differs (baseline: '" << b->second
+                  << "', current: '" << c->second << "')" << std::endl;
+    }
+}
+
+static void ShowUsage(const char* prog) {
+    std::cout << "Usage: " << prog << " [-t tolerance_file] [-v] <baseline> <current>" << std::endl;
+    std::cout << "  <baseline>, <current>  metrics JSON files or directories of JSON files" << std::endl;
+    std::cout << "  -t file                tolerance rules ('<pattern> <rel> <abs> lower|higher|both [optional]')"
+              << std::endl;
+    std::cout << "  -v                     list all metrics (default: only changes)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::string tol_file;
+    bool verbose = false;
+    std::vector<std::string> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-t" && i + 1 < argc) {
+            tol_file = argv[++i];
+        } else if (arg == "-v") {
+            verbose = true;
+        } else if (arg == "-h" || arg == "--help") {
+            ShowUsage(argv[0]);
+            return 0;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.size() != 2) {
+        ShowUsage(argv[0]);
+        return 2;
+    }
+
+    std::vector<ToleranceRule> rules;
+    if (!tol_file.empty() && !LoadTolerances(tol_file, rules))
+        return 2;
+
+    std::map<std::string, TestResult> baseline;
+    std::map<std::string, TestResult> current;
+    if (!LoadResults(paths[0], baseline) || !LoadResults(paths[1], current))
+        return 2;
+
+    // When comparing two single files, match them regardless of their names.
+    if (baseline.size() == 1 && current.size() == 1 && baseline.count("") && current.count(""))
+        current.begin()->second.name = baseline.begin()->second.name;
+
+    std::vector<Row> rows;
+    int num_regressions = 0;
+    int num_improvements = 0;
+    int num_skipped = 0;
+
+    for (const auto& b : baseline) {
+        const TestResult& base = b.second;
+        auto c = current.find(b.first);
+        if (c == current.end()) {
+            rows.push_back({base.name, "(test result)", 0, 0, 0, Status::MISSING});
+            num_regressions++;
+            continue;
+        }
+        const TestResult& cur = c->second;
+
+        CheckFingerprints(base, cur);
+
+        if (base.passed && !cur.passed) {
+            rows.push_back({base.name, "passed", 1, 0, 0, Status::REGRESSED});
+            num_regressions++;
+        }
+
+        // Hardware counters are not comparable if either run could not read them.
+        const double* base_perf = base.Find("perf_available");
+        const double* cur_perf = cur.Find("perf_available");
+        bool perf_comparable = !(base_perf && *base_perf == 0) && !(cur_perf && *cur_perf == 0);
+
+        for (const auto& m : base.metrics) {
+            ToleranceRule tol = FindTolerance(rules, base.name, m.first);
+            const double* value = cur.Find(m.first);
+            bool is_perf = (m.first.compare(0, 5, "perf_") == 0);
+            if (is_perf && !perf_comparable) {
+                rows.push_back({base.name, m.first, m.second, value ? *value : 0, 0, Status::SKIPPED});
+                num_skipped++;
+                continue;
+            }
+            if (!value) {
+                if (tol.optional) {
+                    rows.push_back({base.name, m.first, m.second, 0, 0, Status::SKIPPED});
+                    num_skipped++;
+                } else {
+                    rows.push_back({base.name, m.first, m.second, 0, 0, Status::MISSING});
+                    num_regressions++;
+                }
+                continue;
+            }
+            Status status = Compare(m.second, *value, tol);
+            double allowed = std::max(tol.rel * std::abs(m.second), tol.abs);
+            rows.push_back({base.name, m.first, m.second, *value, allowed, status});
+            if (status == Status::REGRESSED)
+                num_regressions++;
+            else if (status == Status::IMPROVED)
+                num_improvements++;
+        }
+
+        for (const auto& m : cur.metrics) {
+            if (!base.Find(m.first))
+                rows.push_back({cur.name, m.first, 0, m.second, 0, Status::NEW});
+        }
+    }
+
+    PrintTable(rows, verbose);
+
+    std::cout << std::endl;
+    std::cout << "Compared " << baseline.size() << " test(s): " << num_regressions << " regression(s), "
+              << num_improvements << " improvement(s), " << num_skipped << " skipped" << std::endl;
+
+    return num_regressions > 0 ? 1 : 0;
+}
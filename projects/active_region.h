@@ -0,0 +1,185 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Dynamic activity region for Chrono::Parallel.
+//
+// Chrono::Parallel can deactivate all colliding bodies whose collision shapes
+// lie entirely outside a given axis-aligned box (collision.use_aabb_active).
+// Deactivated bodies are excluded from collision detection and from the solve
+// and are not integrated, so their state is preserved; they are reactivated
+// automatically once their shapes overlap the box again.
+//
+// An ActiveRegion moves this box with a set of tracked bodies (for example a
+// vehicle chassis or a wheel): the region is the union of the tracked bodies'
+// bounding boxes, enlarged by a margin and extended along each tracked body's
+// velocity over a look-ahead time, so that particles are reactivated before the
+// tracked bodies reach them. If no tracked body is registered, a default region
+// is used (or the activity box is disabled). The number of active colliding
+// bodies is recorded after each step.
+//
+// Usage:
+//   ActiveRegion region(system);
+//   region.AddTrackedBody(chassis, ChVector<>(2.5, 1.2, 1.0));
+//   region.SetMargin(ChVector<>(0.5, 0.5, 0.5));
+//   region.Initialize();
+//   while (...) {
+//       system->DoStepDynamics(step_size);
+//       region.Update();
+//   }
+//
+// =============================================================================
+
+#ifndef ACTIVE_REGION_H
+#define ACTIVE_REGION_H
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class ActiveRegion {
+  public:
+    ActiveRegion(chrono::ChSystemParallel* system)
+        : m_system(system),
+          m_margin(0, 0, 0),
+          m_lookahead(0),
+          m_has_default(false),
+          m_num_active(0),
+          m_num_colliding(0),
+          m_cum_active(0),
+          m_cum_colliding(0) {}
+
+    /// Track the specified body. The region covers a box with the given half-dimensions (in the absolute
+    /// frame) centered at the body's reference frame.
+    void AddTrackedBody(std::shared_ptr<chrono::ChBody> body, const chrono::ChVector<>& hdims) {
+        m_tracked.push_back({body, hdims});
+    }
+
+    /// Remove all tracked bodies.
+    void ClearTrackedBodies() { m_tracked.clear(); }
+
+    /// Set the margin added on each side of the tracked bodies' boxes (default: 0).
+    void SetMargin(const chrono::ChVector<>& margin) { m_margin = margin; }
+
+    /// Extend the region along the tracked bodies' velocities over the given time (default: 0).
+    void SetLookahead(double time) { m_lookahead = time; }
+
+    /// Set the region used while no bodies are tracked (default: none, i.e. all bodies active).
+    void SetDefaultRegion(const chrono::ChVector<>& aabb_min, const chrono::ChVector<>& aabb_max) {
+        m_default_min = aabb_min;
+        m_default_max = aabb_max;
+        m_has_default = true;
+    }
+
+    /// Set the activity box from the current state of the tracked bodies. Must be called before the first step.
+    void Initialize() { Apply(); }
+
+    /// Record the number of active bodies in the last step and move the activity box.
+    /// Must be called after each step.
+    void Update() {
+        const auto& active = m_system->data_manager->host_data.active_rigid;
+        const auto& collide = m_system->data_manager->host_data.collide_rigid;
+        size_t num_bodies = std::min(active.size(), collide.size());
+        int num_active = 0;
+        int num_colliding = 0;
+        for (size_t i = 0; i < num_bodies; i++) {
+            if (collide[i]) {
+                num_colliding++;
+                if (active[i])
+                    num_active++;
+            }
+        }
+        m_num_active = num_active;
+        m_num_colliding = num_colliding;
+        m_cum_active += num_active;
+        m_cum_colliding += num_colliding;
+
+        Apply();
+    }
+
+    /// Return the number of active colliding bodies in the last step.
+    int GetNumActive() const { return m_num_active; }
+
+    /// Return the total number of colliding bodies in the last step.
+    int GetNumColliding() const { return m_num_colliding; }
+
+    /// Return the fraction of active colliding bodies, averaged over all recorded steps.
+    double GetAverageActiveFraction() const { return m_cum_colliding > 0 ? m_cum_active / m_cum_colliding : 1; }
+
+    /// Return the current activity box.
+    void GetRegion(chrono::ChVector<>& aabb_min, chrono::ChVector<>& aabb_max) const {
+        aabb_min = m_min;
+        aabb_max = m_max;
+    }
+
+    /// Print the current activity box and body counts.
+    void Print() const {
+        printf("[ActiveRegion] t = %.4f  active %d / %d  box [%.3f, %.3f, %.3f] - [%.3f, %.3f, %.3f]\n",
+               m_system->GetChTime(), m_num_active, m_num_colliding, m_min.x(), m_min.y(), m_min.z(), m_max.x(),
+               m_max.y(), m_max.z());
+    }
+
+  private:
+    struct TrackedBody {
+        std::shared_ptr<chrono::ChBody> body;
+        chrono::ChVector<> hdims;
+    };
+
+    /// Recompute the region and pass it to the collision system.
+    void Apply() {
+        auto& settings = m_system->GetSettings()->collision;
+        if (m_tracked.empty()) {
+            settings.use_aabb_active = m_has_default;
+            m_min = m_default_min;
+            m_max = m_default_max;
+        } else {
+            const double inf = std::numeric_limits<double>::max();
+            m_min = chrono::ChVector<>(+inf, +inf, +inf);
+            m_max = chrono::ChVector<>(-inf, -inf, -inf);
+            for (const auto& t : m_tracked) {
+                chrono::ChVector<> pos = t.body->GetPos();
+                chrono::ChVector<> ahead = pos + m_lookahead * t.body->GetPos_dt();
+                chrono::ChVector<> ext = t.hdims + m_margin;
+                for (int i = 0; i < 3; i++) {
+                    m_min[i] = std::min(m_min[i], std::min(pos[i], ahead[i]) - ext[i]);
+                    m_max[i] = std::max(m_max[i], std::max(pos[i], ahead[i]) + ext[i]);
+                }
+            }
+            settings.use_aabb_active = true;
+        }
+        settings.aabb_min = chrono::real3(m_min.x(), m_min.y(), m_min.z());
+        settings.aabb_max = chrono::real3(m_max.x(), m_max.y(), m_max.z());
+    }
+
+    chrono::ChSystemParallel* m_system;
+
+    std::vector<TrackedBody> m_tracked;  ///< bodies followed by the region
+    chrono::ChVector<> m_margin;         ///< margin on each side of the tracked boxes
+    double m_lookahead;                  ///< look-ahead time along the tracked bodies' velocities
+    bool m_has_default;                  ///< use a default region when no bodies are tracked?
+    chrono::ChVector<> m_default_min;    ///< default region (lower corner)
+    chrono::ChVector<> m_default_max;    ///< default region (upper corner)
+    chrono::ChVector<> m_min;            ///< current region (lower corner)
+    chrono::ChVector<> m_max;            ///< current region (upper corner)
+
+    int m_num_active;        ///< active colliding bodies in the last step
+    int m_num_colliding;     ///< colliding bodies in the last step
+    double m_cum_active;     ///< cumulative number of active colliding bodies
+    double m_cum_colliding;  ///< cumulative number of colliding bodies
+};
+
+#endif
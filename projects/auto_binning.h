@@ -0,0 +1,332 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Automatic selection of the number of broad-phase bins for Chrono::Parallel.
+//
+// The bin counts are derived from the extent of the global AABB and from the
+// distribution of collision shape sizes: the bin edge is set to a multiple of
+// the median shape size (robust to a few large shapes such as container walls)
+// and the number of bins along each axis is the AABB extent divided by that
+// edge. An initial estimate is made from a user-provided domain and body size
+// (shape AABBs are only available after the first collision detection pass).
+//
+// If a re-evaluation interval is set, the bins are recomputed every so many
+// steps from the current AABB and shape sizes. The bin edge is additionally
+// scaled if the measured average number of shapes per active bin falls outside
+// a target range. A new bin configuration is kept only if the measured
+// broad-phase time does not increase; otherwise the previous configuration is
+// restored and further changes are postponed. All decisions are logged.
+//
+// Without timing feedback (e.g. for reproducible runs, see deterministic_mode.h)
+// every change is kept, so that the bins depend only on the simulation state.
+//
+// Usage:
+//   AutoBinning binning(system);
+//   binning.Initialize(domain_min, domain_max, 2 * particle_radius);
+//   while (...) {
+//       system->DoStepDynamics(step_size);
+//       binning.Update();
+//   }
+//
+// =============================================================================
+
+#ifndef AUTO_BINNING_H
+#define AUTO_BINNING_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class AutoBinning {
+  public:
+    AutoBinning(chrono::ChSystemParallel* system)
+        : m_system(system),
+          m_interval(0),
+          m_size_factor(2),
+          m_min_per_bin(2),
+          m_max_per_bin(24),
+          m_max_bins(1 << 24),
+          m_tolerance(0.05),
+          m_verbose(true),
+          m_feedback(true),
+          m_scale(1),
+          m_body_size(0),
+          m_num_steps(0),
+          m_cum_broad(0),
+          m_cum_per_bin(0),
+          m_num_samples(0),
+          m_trial(false),
+          m_broad_ref(0),
+          m_prev_scale(1),
+          m_hold(0),
+          m_hold_length(1),
+          m_num_changes(0) {
+        m_bins[0] = m_bins[1] = m_bins[2] = 1;
+        m_prev_bins[0] = m_prev_bins[1] = m_prev_bins[2] = 1;
+    }
+
+    /// Re-evaluate the bins every 'num_steps' calls to Update (default: 0, i.e. never).
+    void SetUpdateInterval(int num_steps) { m_interval = num_steps; }
+
+    /// Set the bin edge as a multiple of the characteristic (median) shape size (default: 2).
+    void SetSizeFactor(double factor) { m_size_factor = factor; }
+
+    /// Set the target range for the average number of shapes per active bin (default: [2, 24]).
+    void SetShapesPerBin(double min_per_bin, double max_per_bin) {
+        m_min_per_bin = min_per_bin;
+        m_max_per_bin = max_per_bin;
+    }
+
+    /// Set the maximum total number of bins (default: 2^24).
+    void SetMaxBins(int max_bins) { m_max_bins = max_bins; }
+
+    /// Set the relative increase in broad-phase time above which a new bin configuration is rejected (default: 5%).
+    void SetTolerance(double tolerance) { m_tolerance = tolerance; }
+
+    /// Enable/disable judging bin changes against the measured broad-phase time (default: true).
+    void SetTimingFeedback(bool feedback) { m_feedback = feedback; }
+
+    /// Enable/disable logging of binning decisions to the console (default: true).
+    void SetVerbose(bool verbose) { m_verbose = verbose; }
+
+    /// Also log binning decisions to the specified file.
+    void SetLogFile(const std::string& filename) { m_log.open(filename, std::ios::out); }
+
+    /// Select the initial bins from the given domain and characteristic body size (e.g. particle diameter).
+    void Initialize(const chrono::ChVector<>& domain_min, const chrono::ChVector<>& domain_max, double body_size) {
+        m_body_size = body_size;
+        int bins[3];
+        Estimate(domain_min, domain_max, body_size, bins);
+        Apply(bins);
+        Log("initial", -1, -1);
+    }
+
+    /// Accumulate broad-phase statistics for the last step and, if due, re-evaluate the bins.
+    /// Must be called after each step.
+    void Update() {
+        m_num_steps++;
+        m_cum_broad += m_system->GetTimerCollisionBroad();
+        const auto& measures = m_system->data_manager->measures.collision;
+        if (measures.number_of_bins_active > 0) {
+            m_cum_per_bin += (double)measures.number_of_bin_intersections / measures.number_of_bins_active;
+            m_num_samples++;
+        }
+
+        if (m_interval <= 0 || m_num_steps % m_interval != 0)
+            return;
+
+        double broad = m_cum_broad / m_interval;
+        double per_bin = m_num_samples > 0 ? m_cum_per_bin / m_num_samples : 0;
+        m_cum_broad = 0;
+        m_cum_per_bin = 0;
+        m_num_samples = 0;
+
+        Evaluate(broad, per_bin);
+    }
+
+    /// Stop re-evaluating the bins. A change not yet judged against the measured broad-phase time is undone.
+    void Freeze() {
+        m_interval = 0;
+        if (m_trial) {
+            m_trial = false;
+            Apply(m_prev_bins);
+            m_scale = m_prev_scale;
+        }
+        Log("freeze", -1, -1);
+    }
+
+    /// Return the current number of bins along the specified axis (0, 1, or 2).
+    int GetBins(int axis) const { return m_bins[axis]; }
+
+    /// Return the characteristic shape size used for the last bin estimate.
+    double GetBodySize() const { return m_body_size; }
+
+    /// Return the number of accepted changes to the bin configuration (excluding the initial one).
+    int GetNumChanges() const { return m_num_changes; }
+
+  private:
+    /// Re-evaluate the bin configuration, given the average broad-phase time and shapes per bin.
+    void Evaluate(double broad, double per_bin) {
+        // Judge the last change against the broad-phase time measured before it.
+        if (m_trial) {
+            m_trial = false;
+            if (broad > (1 + m_tolerance) * m_broad_ref) {
+                Apply(m_prev_bins);
+                m_scale = m_prev_scale;
+                m_hold_length *= 2;
+                m_hold = m_hold_length;
+                Log("revert", broad, per_bin);
+                return;
+            }
+            m_num_changes++;
+            m_hold_length = 1;
+            Log("keep", broad, per_bin);
+        }
+
+        if (m_hold > 0) {
+            m_hold--;
+            return;
+        }
+
+        // Current global AABB and characteristic shape size.
+        const auto& measures = m_system->data_manager->measures.collision;
+        chrono::ChVector<> aabb_min(measures.min_bounding_point[0], measures.min_bounding_point[1],
+                                    measures.min_bounding_point[2]);
+        chrono::ChVector<> aabb_max(measures.max_bounding_point[0], measures.max_bounding_point[1],
+                                    measures.max_bounding_point[2]);
+        double size = ShapeSize();
+        if (size <= 0)
+            return;
+        m_body_size = size;
+
+        // Correct the bin edge if the shapes per bin are outside the target range (fewer, larger bins if too
+        // sparse; more, smaller bins if too crowded). The number of shapes per bin scales with the bin volume.
+        double scale = m_scale;
+        if (per_bin > 0 && (per_bin < m_min_per_bin || per_bin > m_max_per_bin)) {
+            double target = std::sqrt(m_min_per_bin * m_max_per_bin);
+            double ratio = std::cbrt(target / per_bin);
+            scale *= std::min(2.0, std::max(0.5, ratio));
+        }
+
+        int bins[3];
+        Estimate(aabb_min, aabb_max, scale * size, bins);
+        if (!Differs(bins))
+            return;
+
+        std::copy(m_bins, m_bins + 3, m_prev_bins);
+        m_prev_scale = m_scale;
+        m_scale = scale;
+        m_broad_ref = broad;
+        m_trial = m_feedback;
+        if (!m_feedback)
+            m_num_changes++;
+        Apply(bins);
+        Log("change", broad, per_bin);
+    }
+
+    /// Estimate the bins for the given AABB and characteristic body size.
+    void Estimate(const chrono::ChVector<>& aabb_min, const chrono::ChVector<>& aabb_max, double size, int* bins) {
+        double edge = m_size_factor * size;
+        chrono::ChVector<> extent = aabb_max - aabb_min;
+        double total = 1;
+        for (int i = 0; i < 3; i++) {
+            bins[i] = std::max(1, (int)std::round(extent[i] / edge));
+            total *= bins[i];
+        }
+
+        // Uniformly coarsen the grid if the total number of bins is too large.
+        if (total > m_max_bins) {
+            double ratio = std::cbrt(m_max_bins / total);
+            for (int i = 0; i < 3; i++)
+                bins[i] = std::max(1, (int)(bins[i] * ratio));
+        }
+    }
+
+    /// Median size of the rigid collision shapes, from their current AABBs.
+    /// For large systems, only a regular sample of the shapes is considered.
+    double ShapeSize() {
+        const auto& aabb_min = m_system->data_manager->host_data.aabb_min;
+        const auto& aabb_max = m_system->data_manager->host_data.aabb_max;
+        size_t num_shapes = std::min<size_t>(m_system->data_manager->num_rigid_shapes, aabb_min.size());
+        if (num_shapes == 0)
+            return 0;
+
+        const size_t max_samples = 4096;
+        size_t stride = std::max<size_t>(1, num_shapes / max_samples);
+
+        m_sizes.clear();
+        for (size_t i = 0; i < num_shapes; i += stride) {
+            chrono::real3 d = aabb_max[i] - aabb_min[i];
+            double s = std::max(d[0], std::max(d[1], d[2]));
+            if (s > 0 && std::isfinite(s))
+                m_sizes.push_back(s);
+        }
+        if (m_sizes.empty())
+            return 0;
+
+        auto mid = m_sizes.begin() + m_sizes.size() / 2;
+        std::nth_element(m_sizes.begin(), mid, m_sizes.end());
+        return *mid;
+    }
+
+    /// Return true if the given bins differ significantly from the current ones.
+    bool Differs(const int* bins) const {
+        for (int i = 0; i < 3; i++) {
+            int diff = std::abs(bins[i] - m_bins[i]);
+            if (diff > 1 && diff > 0.2 * m_bins[i])
+                return true;
+        }
+        return false;
+    }
+
+    void Apply(const int* bins) {
+        std::copy(bins, bins + 3, m_bins);
+        m_system->GetSettings()->collision.fixed_bins = true;
+        m_system->GetSettings()->collision.bins_per_axis = chrono::vec3(m_bins[0], m_bins[1], m_bins[2]);
+    }
+
+    void Log(const char* decision, double broad, double per_bin) {
+        char buf[200];
+        int n = sprintf(buf, "[AutoBinning] t = %.4f  %-7s bins: %d x %d x %d  (size %.4g, edge %.4g",
+                        m_system->GetChTime(), decision, m_bins[0], m_bins[1], m_bins[2], m_body_size,
+                        m_size_factor * m_scale * m_body_size);
+        if (broad >= 0)
+            sprintf(buf + n, ", broad %.3f ms, %.1f shapes/bin)", 1000 * broad, per_bin);
+        else
+            sprintf(buf + n, ")");
+
+        if (m_verbose)
+            std::cout << buf << std::endl;
+        if (m_log.is_open())
+            m_log << buf << std::endl;
+    }
+
+    chrono::ChSystemParallel* m_system;
+
+    int m_interval;        ///< re-evaluation interval (in steps)
+    double m_size_factor;  ///< bin edge as multiple of the characteristic shape size
+    double m_min_per_bin;  ///< lower limit of target shapes per active bin
+    double m_max_per_bin;  ///< upper limit of target shapes per active bin
+    double m_max_bins;     ///< maximum total number of bins
+    double m_tolerance;    ///< accepted relative increase in broad-phase time
+    bool m_verbose;        ///< log to console?
+    bool m_feedback;       ///< judge changes against the measured broad-phase time?
+    std::ofstream m_log;   ///< optional log file
+
+    int m_bins[3];                ///< current bins per axis
+    double m_scale;               ///< correction factor for the bin edge (from measured shapes per bin)
+    double m_body_size;           ///< characteristic shape size
+    std::vector<double> m_sizes;  ///< scratch space for shape sizes
+
+    int m_num_steps;       ///< number of calls to Update
+    double m_cum_broad;    ///< cumulative broad-phase time since last evaluation
+    double m_cum_per_bin;  ///< cumulative shapes per active bin since last evaluation
+    int m_num_samples;     ///< number of samples in m_cum_per_bin
+
+    bool m_trial;         ///< last change still to be judged?
+    double m_broad_ref;   ///< average broad-phase time before the last change
+    int m_prev_bins[3];   ///< bins before the last change
+    double m_prev_scale;  ///< edge correction before the last change
+    int m_hold;           ///< number of evaluations to skip
+    int m_hold_length;    ///< hold duration after the next rejected change
+    int m_num_changes;    ///< number of accepted changes
+};
+
+#endif
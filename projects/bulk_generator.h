@@ -0,0 +1,435 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Bulk generation of granular material (identical spheres) for Chrono::Parallel.
+//
+// This is an alternative to utils::Generator::createObjectsBox for large beds:
+//
+// - Sampling. Positions with a minimum separation are generated by dart
+//   throwing on a background grid (cell diagonal equal to the separation, so
+//   that each cell holds at most one point). The grid is split into tiles at
+//   least as wide as the separation; tiles are processed in parallel in up to
+//   2^3 passes, such that tiles processed concurrently are never adjacent and
+//   therefore cannot produce conflicting points. Each tile uses its own random
+//   generator seeded from its index, so the result does not depend on the
+//   number of threads. A zero half-dimension of the box results in planar (or
+//   linear) sampling, as for utils::Generator.
+//
+// - Body creation. The spheres are created as a ParticleBatch (see
+//   projects/particle_batch.h): bodies are allocated contiguously, set up in
+//   parallel, and added to the system with the per-body arrays of the data
+//   manager reserved up front.
+//
+// - Polydisperse beds. For a size distribution (see size_distribution.h), the
+//   number of spheres of each radius class is set from its number fraction and
+//   a target solid volume fraction of the box. Classes are sampled from the
+//   largest radius down, each with the separation of its own radius; the
+//   candidates of a class are shuffled and accepted, until the class count is
+//   reached, if they do not overlap the spheres of the larger classes (checked
+//   in parallel on one grid per class, with cells sized from the class radius).
+//   Each class is created as a separate particle batch.
+//
+// Timing of the sampling, creation, and insertion phases is recorded.
+//
+// =============================================================================
+
+#ifndef BULK_GENERATOR_H
+#define BULK_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "chrono/core/ChTimer.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+#include "particle_batch.h"
+#include "size_distribution.h"
+
+class BulkGenerator {
+  public:
+    BulkGenerator(chrono::ChSystemParallel* system, unsigned int seed = 0)
+        : m_system(system),
+          m_seed(seed),
+          m_radius(0.01),
+          m_density(1000),
+          m_id(0),
+          m_num_bodies(0),
+          m_num_batches(0),
+          m_time_sample(0),
+          m_time_create(0),
+          m_time_insert(0),
+          m_rounds(16) {}
+
+    /// Set the contact material of the generated bodies.
+    void SetMaterial(std::shared_ptr<chrono::ChMaterialSurface> material) { m_material = material; }
+
+    /// Set the sphere radius (default: 0.01).
+    void SetRadius(double radius) { m_radius = radius; }
+
+    /// Set the material density (default: 1000).
+    void SetDensity(double density) { m_density = density; }
+
+    /// Set the identifier of the next generated body (default: 0).
+    void SetBodyIdentifier(int id) { m_id = id; }
+
+    /// Set the number of sampling attempts per grid cell (default: 16).
+    void SetSamplingRounds(int rounds) { m_rounds = std::max(1, rounds); }
+
+    /// Sample points in the box with given center and half-dimensions, with minimum separation 'sep'.
+    std::vector<chrono::ChVector<>> SampleBox(const chrono::ChVector<>& center,
+                                              const chrono::ChVector<>& hdims,
+                                              double sep) {
+        chrono::ChTimer<double> timer;
+        timer.start();
+
+        // Background grid. Degenerate (zero-width) directions have a single cell.
+        int dim = 0;
+        for (int i = 0; i < 3; i++) {
+            if (hdims[i] > 0)
+                dim++;
+        }
+        double cell = (dim > 0) ? sep / std::sqrt((double)dim) : 1;
+
+        int n[3];      // number of cells
+        double c[3];   // cell size
+        int r[3];      // neighborhood radius (in cells)
+        int t[3];      // tile size (in cells)
+        int nt[3];     // number of tiles
+        double lo[3];  // grid origin
+        for (int i = 0; i < 3; i++) {
+            lo[i] = center[i] - hdims[i];
+            if (hdims[i] > 0) {
+                n[i] = std::max(1, (int)std::ceil(2 * hdims[i] / cell));
+                c[i] = 2 * hdims[i] / n[i];
+                r[i] = (int)std::ceil(sep / c[i]);
+                t[i] = std::max(r[i], 4);
+            } else {
+                n[i] = 1;
+                c[i] = 0;
+                r[i] = 0;
+                t[i] = 1;
+            }
+            nt[i] = (n[i] + t[i] - 1) / t[i];
+        }
+
+        // Neighbor cell offsets that may contain a conflicting point, nearest first (for early rejection).
+        std::vector<Offset> offsets;
+        for (int dk = -r[2]; dk <= r[2]; dk++) {
+            for (int dj = -r[1]; dj <= r[1]; dj++) {
+                for (int di = -r[0]; di <= r[0]; di++) {
+                    double gap[3] = {std::max(0, std::abs(di) - 1) * c[0], std::max(0, std::abs(dj) - 1) * c[1],
+                                     std::max(0, std::abs(dk) - 1) * c[2]};
+                    double gap2 = gap[0] * gap[0] + gap[1] * gap[1] + gap[2] * gap[2];
+                    if (gap2 < sep * sep)
+                        offsets.push_back({di, dj, dk, gap2 + 1e-3 * (di * di + dj * dj + dk * dk)});
+                }
+            }
+        }
+        std::sort(offsets.begin(), offsets.end(), [](const Offset& a, const Offset& b) { return a.dist < b.dist; });
+
+        size_t num_cells = (size_t)n[0] * n[1] * n[2];
+        std::vector<chrono::ChVector<>> pos(num_cells);
+        std::vector<char> occupied(num_cells, 0);
+        double sep2 = sep * sep;
+
+        // Process the tiles in passes of equal parity along each axis. Tiles in the same pass are separated by
+        // at least one tile (with width not smaller than the separation) along some axis.
+        for (int pass = 0; pass < 8; pass++) {
+            int parity[3] = {pass & 1, (pass >> 1) & 1, (pass >> 2) & 1};
+            if ((parity[0] && nt[0] < 2) || (parity[1] && nt[1] < 2) || (parity[2] && nt[2] < 2))
+                continue;
+
+            std::vector<int> tiles;
+            for (int k = parity[2]; k < nt[2]; k += 2)
+                for (int j = parity[1]; j < nt[1]; j += 2)
+                    for (int i = parity[0]; i < nt[0]; i += 2)
+                        tiles.push_back((k * nt[1] + j) * nt[0] + i);
+
+#pragma omp parallel for schedule(dynamic)
+            for (int it = 0; it < (int)tiles.size(); it++) {
+                int tile = tiles[it];
+                int ti[3] = {tile % nt[0], (tile / nt[0]) % nt[1], tile / (nt[0] * nt[1])};
+                int start[3];
+                int end[3];
+                for (int a = 0; a < 3; a++) {
+                    start[a] = ti[a] * t[a];
+                    end[a] = std::min(n[a], start[a] + t[a]);
+                }
+
+                std::mt19937 rng(Hash(m_seed, m_num_batches, tile));
+                std::uniform_real_distribution<double> unif(0.0, 1.0);
+
+                for (int round = 0; round < m_rounds; round++) {
+                    for (int k = start[2]; k < end[2]; k++) {
+                        for (int j = start[1]; j < end[1]; j++) {
+                            for (int i = start[0]; i < end[0]; i++) {
+                                size_t id = ((size_t)k * n[1] + j) * n[0] + i;
+                                if (occupied[id])
+                                    continue;
+                                chrono::ChVector<> p(lo[0] + (i + unif(rng)) * c[0],  //
+                                                     lo[1] + (j + unif(rng)) * c[1],  //
+                                                     lo[2] + (k + unif(rng)) * c[2]);
+                                if (Accept(p, i, j, k, n, offsets, pos, occupied, sep2)) {
+                                    pos[id] = p;
+                                    occupied[id] = 1;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        std::vector<chrono::ChVector<>> points;
+        points.reserve(std::count(occupied.begin(), occupied.end(), 1));
+        for (size_t id = 0; id < num_cells; id++) {
+            if (occupied[id])
+                points.push_back(pos[id]);
+        }
+
+        m_num_batches++;
+        timer.stop();
+        m_time_sample += timer();
+
+        return points;
+    }
+
+    /// Create spheres at the specified positions and add them to the system (as one particle batch).
+    std::shared_ptr<ParticleBatch> CreateSpheres(const std::vector<chrono::ChVector<>>& points) {
+        auto batch = std::make_shared<ParticleBatch>(m_system, points, m_radius, m_density, m_material, m_id);
+
+        m_time_create += batch->GetTimeCreation();
+        m_time_insert += batch->GetTimeInsertion();
+        m_id += batch->GetNumParticles();
+        m_num_bodies += batch->GetNumParticles();
+
+        return batch;
+    }
+
+    /// Sample positions in the specified box and create spheres there. Return the number of new bodies.
+    int CreateObjectsBox(const chrono::ChVector<>& center, const chrono::ChVector<>& hdims, double sep) {
+        std::vector<chrono::ChVector<>> points = SampleBox(center, hdims, sep);
+        CreateSpheres(points);
+        return (int)points.size();
+    }
+
+    /// Sample a polydisperse bed in the box with given center and half-dimensions (the spheres are contained in the
+    /// box, except along directions with zero half-dimension). The number of spheres of each class of the distribution
+    /// is its number fraction times the total number for the given solid volume fraction of the box (a zero
+    /// half-dimension counts as the largest diameter). Return the positions for each class; fewer positions than the
+    /// target are returned for a class if the box cannot accommodate them.
+    std::vector<std::vector<chrono::ChVector<>>> SampleBox(const chrono::ChVector<>& center,
+                                                           const chrono::ChVector<>& hdims,
+                                                           const SizeDistribution& dist,
+                                                           double solid_fraction) {
+        int num_classes = dist.GetNumClasses();
+        std::vector<std::vector<chrono::ChVector<>>> points(num_classes);
+        if (num_classes == 0)
+            return points;
+
+        double volume = 1;
+        for (int a = 0; a < 3; a++)
+            volume *= (hdims[a] > 0) ? 2 * hdims[a] : 2 * dist.GetMaxRadius();
+        double num_total = solid_fraction * volume / dist.GetMeanVolume();
+
+        std::vector<ClassGrid> grids;
+        for (int c = 0; c < num_classes; c++) {
+            double radius = dist.GetRadius(c);
+            int target = (int)std::round(dist.GetFraction(c) * num_total);
+            if (target == 0)
+                continue;
+
+            // Candidates with the separation of this class, inside the box
+            double r = 1.01 * radius;
+            chrono::ChVector<> hd;
+            for (int a = 0; a < 3; a++)
+                hd[a] = (hdims[a] > 0) ? std::max(hdims[a] - r, 0.0) : 0.0;
+            std::vector<chrono::ChVector<>> candidates = SampleBox(center, hd, 2 * r);
+
+            chrono::ChTimer<double> timer;
+            timer.start();
+
+            std::mt19937 rng(Hash(m_seed, m_num_batches, 0xFFFFFFFFu - c));
+            std::shuffle(candidates.begin(), candidates.end(), rng);
+
+            // Reject candidates overlapping a larger sphere
+            std::vector<char> ok(candidates.size());
+#pragma omp parallel for schedule(static)
+            for (int i = 0; i < (int)candidates.size(); i++) {
+                ok[i] = 1;
+                for (const auto& grid : grids) {
+                    if (grid.Overlaps(candidates[i], r)) {
+                        ok[i] = 0;
+                        break;
+                    }
+                }
+            }
+
+            std::vector<chrono::ChVector<>>& accepted = points[c];
+            for (size_t i = 0; i < candidates.size() && (int)accepted.size() < target; i++) {
+                if (ok[i])
+                    accepted.push_back(candidates[i]);
+            }
+
+            if (c < num_classes - 1)
+                grids.push_back(ClassGrid(accepted, r));
+
+            timer.stop();
+            m_time_sample += timer();
+        }
+
+        return points;
+    }
+
+    /// Create spheres of the specified radius at the specified positions and add them to the system (as one
+    /// particle batch).
+    std::shared_ptr<ParticleBatch> CreateSpheres(const std::vector<chrono::ChVector<>>& points, double radius) {
+        double radius_default = m_radius;
+        m_radius = radius;
+        auto batch = CreateSpheres(points);
+        m_radius = radius_default;
+        return batch;
+    }
+
+    /// Sample a polydisperse bed in the specified box and create the spheres (one particle batch per radius class).
+    /// Return the number of new bodies.
+    int CreateObjectsBox(const chrono::ChVector<>& center,
+                         const chrono::ChVector<>& hdims,
+                         const SizeDistribution& dist,
+                         double solid_fraction) {
+        std::vector<std::vector<chrono::ChVector<>>> points = SampleBox(center, hdims, dist, solid_fraction);
+        int num = 0;
+        for (int c = 0; c < dist.GetNumClasses(); c++) {
+            if (points[c].empty())
+                continue;
+            CreateSpheres(points[c], dist.GetRadius(c));
+            num += (int)points[c].size();
+        }
+        return num;
+    }
+
+    /// Return the total number of bodies created by this generator.
+    int GetTotalNumBodies() const { return m_num_bodies; }
+
+    /// Return the cumulative time spent sampling positions.
+    double GetTimeSampling() const { return m_time_sample; }
+
+    /// Return the cumulative time spent creating bodies and collision models.
+    double GetTimeCreation() const { return m_time_create; }
+
+    /// Return the cumulative time spent adding bodies to the system.
+    double GetTimeInsertion() const { return m_time_insert; }
+
+  private:
+    /// Offset to a neighbor cell, with a sort key (distance between the closest points of the two cells).
+    struct Offset {
+        int di, dj, dk;
+        double dist;
+    };
+
+    /// Hash grid of the accepted spheres of one radius class, with cells of the sphere diameter (with separation).
+    /// A sphere not larger than the class spheres can only overlap those in the 27 neighbor cells of its center.
+    struct ClassGrid {
+        ClassGrid(const std::vector<chrono::ChVector<>>& points, double radius) : cell(2 * radius), radius(radius) {
+            for (int i = 0; i < (int)points.size(); i++)
+                cells[Key(points[i], 0, 0, 0)].push_back(points[i]);
+        }
+
+        uint64_t Key(const chrono::ChVector<>& p, int di, int dj, int dk) const {
+            // Cell coordinates offset by 2^20, packed in 21 bits each
+            uint64_t i = (uint64_t)((int64_t)std::floor(p.x() / cell) + di + (1 << 20)) & 0x1FFFFF;
+            uint64_t j = (uint64_t)((int64_t)std::floor(p.y() / cell) + dj + (1 << 20)) & 0x1FFFFF;
+            uint64_t k = (uint64_t)((int64_t)std::floor(p.z() / cell) + dk + (1 << 20)) & 0x1FFFFF;
+            return i | (j << 21) | (k << 42);
+        }
+
+        bool Overlaps(const chrono::ChVector<>& p, double r) const {
+            double d2 = (r + radius) * (r + radius);
+            for (int dk = -1; dk <= 1; dk++) {
+                for (int dj = -1; dj <= 1; dj++) {
+                    for (int di = -1; di <= 1; di++) {
+                        auto it = cells.find(Key(p, di, dj, dk));
+                        if (it == cells.end())
+                            continue;
+                        for (const auto& q : it->second) {
+                            if ((q - p).Length2() < d2)
+                                return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+        double cell;    ///< cell size
+        double radius;  ///< class radius (with separation)
+        std::unordered_map<uint64_t, std::vector<chrono::ChVector<>>> cells;
+    };
+
+    /// Check the candidate point against the points in the neighboring cells.
+    static bool Accept(const chrono::ChVector<>& p,
+                       int i,
+                       int j,
+                       int k,
+                       const int* n,
+                       const std::vector<Offset>& offsets,
+                       const std::vector<chrono::ChVector<>>& pos,
+                       const std::vector<char>& occupied,
+                       double sep2) {
+        for (const auto& o : offsets) {
+            int ii = i + o.di;
+            int jj = j + o.dj;
+            int kk = k + o.dk;
+            if (ii < 0 || ii >= n[0] || jj < 0 || jj >= n[1] || kk < 0 || kk >= n[2])
+                continue;
+            size_t id = ((size_t)kk * n[1] + jj) * n[0] + ii;
+            if (occupied[id] && (pos[id] - p).Length2() < sep2)
+                return false;
+        }
+        return true;
+    }
+
+    /// Seed for the random generator of a tile.
+    static uint32_t Hash(uint32_t seed, uint32_t batch, uint32_t tile) {
+        uint32_t h = seed * 0x9E3779B9u ^ batch * 0x85EBCA6Bu ^ tile * 0xC2B2AE35u;
+        h ^= h >> 16;
+        h *= 0x7FEB352Du;
+        h ^= h >> 15;
+        return h;
+    }
+
+    chrono::ChSystemParallel* m_system;
+    std::shared_ptr<chrono::ChMaterialSurface> m_material;
+
+    unsigned int m_seed;  ///< seed for random number generation
+    double m_radius;      ///< sphere radius
+    double m_density;     ///< material density
+    int m_id;             ///< identifier of the next generated body
+    int m_num_bodies;     ///< total number of generated bodies
+    int m_num_batches;    ///< number of calls to SampleBox
+
+    double m_time_sample;  ///< cumulative time for sampling positions
+    double m_time_create;  ///< cumulative time for creating bodies
+    double m_time_insert;  ///< cumulative time for adding bodies to the system
+
+    int m_rounds;  ///< sampling attempts per grid cell
+};
+
+#endif
@@ -62,6 +62,7 @@ TerrainNode::TerrainNode(Type type,
       m_num_tires(num_tires),
       m_use_checkpoint(use_checkpoint),
       m_render(render),
+      m_binning(nullptr),
       m_render_path(false),
       m_constructed(false),
       m_settling_output(false),
@@ -176,6 +177,7 @@ TerrainNode::TerrainNode(Type type,
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 TerrainNode::~TerrainNode() {
+    delete m_binning;
     delete m_system;
 }
 
@@ -251,14 +253,12 @@ void TerrainNode::Construct() {
     if (m_constructed)
         return;
 
-    // Estimates for number of bins for broad-phase.
+    // Broad-phase bins: initial estimate from the container, re-evaluated during the simulation.
     if (m_type == GRANULAR) {
-        int factor = 2;
-        int binsX = (int)std::ceil(m_hdimX / m_radius_g) / factor;
-        int binsY = (int)std::ceil(m_hdimY / m_radius_g) / factor;
-        int binsZ = 1;
-        m_system->GetSettings()->collision.bins_per_axis = vec3(binsX, binsY, binsZ);
-        cout << m_prefix << " broad-phase bins: " << binsX << " x " << binsY << " x " << binsZ << endl;
+        m_binning = new AutoBinning(m_system);
+        m_binning->SetUpdateInterval(500);
+        m_binning->Initialize(ChVector<>(-m_hdimX, -m_hdimY, 0), ChVector<>(m_hdimX, m_hdimY, 2 * m_hdimZ),
+                              2 * m_radius_g);
     }
 
     // ------------------------------
@@ -370,27 +370,29 @@ void TerrainNode::Construct() {
 
     // Create particles
     if (m_type == GRANULAR) {
-        // Create a particle generator and a mixture entirely made out of spheres
-        utils::Generator gen(m_system);
-        std::shared_ptr<utils::MixtureIngredient> m1 = gen.AddMixtureIngredient(utils::SPHERE, 1.0);
-        m1->setDefaultMaterial(m_material_terrain);
-        m1->setDefaultDensity(m_rho_g);
-        m1->setDefaultSize(m_radius_g);
+        // Create a bulk generator for identical spheres
+        BulkGenerator gen(m_system);
+        gen.SetMaterial(m_material_terrain);
+        gen.SetDensity(m_rho_g);
+        gen.SetRadius(m_radius_g);
 
         // Set starting value for body identifiers
-        gen.setBodyIdentifier(m_Id_g);
+        gen.SetBodyIdentifier(m_Id_g);
 
-        // Create particles in layers until reaching the desired number of particles
+        // Sample particle positions in layers, then create all particles as a single batch
         double r = 1.01 * m_radius_g;
         ChVector<> hdims(m_hdimX - r, m_hdimY - r, 0);
         ChVector<> center(0, 0, 2 * r);
 
+        std::vector<ChVector<>> points;
         for (int il = 0; il < m_num_layers; il++) {
-            gen.createObjectsBox(utils::POISSON_DISK, 2 * r, center, hdims);
+            auto layer = gen.SampleBox(center, hdims, 2 * r);
+            points.insert(points.end(), layer.begin(), layer.end());
             center.z() += 2 * r;
         }
+        m_particles = gen.CreateSpheres(points);
 
-        m_num_particles = gen.getTotalNumBodies();
+        m_num_particles = m_particles->GetNumParticles();
         cout << m_prefix << " Generated particles:  " << m_num_particles << endl;
     }
 
@@ -529,11 +531,20 @@ void TerrainNode::Settle() {
         int output_steps = (int)std::ceil(1 / (output_fps * m_step_size));
         int output_frame = 0;
 
+        // Put quiescent particles to sleep while settling (all are woken up at the end)
+        SleepManager sleep(m_system);
+        sleep.SetBodyRange(m_particles_start_index, m_num_particles);
+        sleep.SetGranularThresholds(m_radius_g);
+        sleep.SetSleepSteps((int)std::ceil(0.05 / m_step_size));
+
         for (int is = 0; is < sim_steps; is++) {
             // Advance step
             m_timer.reset();
             m_timer.start();
             m_system->DoStepDynamics(m_step_size);
+            if (m_binning)
+                m_binning->Update();
+            sleep.Update();
             m_timer.stop();
             m_cum_sim_time += m_timer();
             cout << '\r' << std::fixed << std::setprecision(6) << m_system->GetChTime() << "  ["
@@ -562,7 +573,9 @@ void TerrainNode::Settle() {
 #endif
         }
 
+        sleep.WakeAll();
         cout << m_prefix << " settling time = " << m_cum_sim_time << endl;
+        cout << m_prefix << " avg. sleeping fraction = " << sleep.GetAverageSleepingFraction() << endl;
         m_cum_sim_time = 0;
     }
 
@@ -1027,6 +1040,8 @@ void TerrainNode::Advance(double step_size) {
     while (t < step_size) {
         double h = std::min<>(m_step_size, step_size - t);
         m_system->DoStepDynamics(h);
+        if (m_binning)
+            m_binning->Update();
         t += h;
     }
     m_timer.stop();
@@ -1079,11 +1094,13 @@ void TerrainNode::WriteParticleInformation(utils::CSV_writer& csv) {
     csv << m_system->GetChTime() << endl;
     csv << m_num_particles << m_radius_g << endl;
 
-    // Write particle positions and linear velocities
-    for (auto body : m_system->Get_bodylist()) {
-        if (body->GetIdentifier() < m_Id_g)
-            continue;
-        csv << body->GetIdentifier() << body->GetPos() << body->GetPos_dt() << endl;
+    // Write particle positions and linear velocities (read in bulk; particles have consecutive identifiers)
+    std::vector<ChVector<>> pos;
+    std::vector<ChVector<>> vel;
+    ParticleBatch::ReadPositions(m_system, m_particles_start_index, m_num_particles, pos);
+    ParticleBatch::ReadVelocities(m_system, m_particles_start_index, m_num_particles, vel);
+    for (unsigned int i = 0; i < m_num_particles; i++) {
+        csv << m_Id_g + (int)i << pos[i] << vel[i] << endl;
     }
 }
 
@@ -1096,13 +1113,19 @@ void TerrainNode::WriteCheckpoint() {
     csv << m_system->GetChTime() << endl;
     csv << m_num_particles << endl;
 
-    // Loop over all bodies in the system and write state for granular material bodies.
-    // Filter granular material using the body identifier.
-    for (auto body : m_system->Get_bodylist()) {
-        if (body->GetIdentifier() < m_Id_g)
-            continue;
-        csv << body->GetIdentifier() << body->GetPos() << body->GetRot() << body->GetPos_dt() << body->GetRot_dt()
-            << endl;
+    // Write state for granular material bodies (read in bulk; particles have consecutive identifiers).
+    std::vector<ChVector<>> pos;
+    std::vector<ChQuaternion<>> rot;
+    std::vector<ChVector<>> vel;
+    std::vector<ChVector<>> omg;
+    ParticleBatch::ReadPositions(m_system, m_particles_start_index, m_num_particles, pos);
+    ParticleBatch::ReadRotations(m_system, m_particles_start_index, m_num_particles, rot);
+    ParticleBatch::ReadVelocities(m_system, m_particles_start_index, m_num_particles, vel);
+    ParticleBatch::ReadAngularVelocities(m_system, m_particles_start_index, m_num_particles, omg);
+    for (unsigned int i = 0; i < m_num_particles; i++) {
+        ChQuaternion<> rot_dt;
+        rot_dt.Qdt_from_Wrel(omg[i], rot[i]);
+        csv << m_Id_g + (int)i << pos[i] << rot[i] << vel[i] << rot_dt << endl;
     }
 
     std::string checkpoint_filename = m_out_dir + "/" + m_checkpoint_filename;
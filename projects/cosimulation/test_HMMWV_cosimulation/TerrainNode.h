@@ -30,6 +30,11 @@
 
 #include "chrono_parallel/physics/ChSystemParallel.h"
 
+#include "../../auto_binning.h"
+#include "../../bulk_generator.h"
+#include "../../particle_batch.h"
+#include "../../sleep_manager.h"
+
 #include "BaseNode.h"
 
 // =============================================================================
@@ -166,6 +171,7 @@ class TerrainNode : public BaseNode {
     Type m_type;  ///< terrain type (RIGID or GRANULAR)
 
     chrono::ChSystemParallel* m_system;  ///< containing system
+    AutoBinning* m_binning;              ///< broad-phase bin selection (granular terrain only)
     bool m_constructed;                  ///< system construction completed?
 
     chrono::ChMaterialSurface::ContactMethod m_method;              ///< contact method (penalty or complementarity)
@@ -200,6 +206,7 @@ class TerrainNode : public BaseNode {
     bool m_settling_output;  ///< output files during settling?
 
     int m_particles_start_index;       ///< start index for granular material bodies in system body list
+    std::shared_ptr<ParticleBatch> m_particles;  ///< granular material bodies (if GRANULAR)
     unsigned int m_proxy_start_index;  ///< start index for proxy contact shapes in global arrays
 
     bool m_render_path;                             ///< if true, render the Bezier curve
@@ -39,6 +39,11 @@
 
 #include "chrono_parallel/physics/ChSystemParallel.h"
 
+#include "../../auto_binning.h"
+#include "../../bulk_generator.h"
+#include "../../particle_batch.h"
+#include "../../sleep_manager.h"
+
 #include "BaseNode.h"
 
 // =============================================================================
@@ -155,6 +160,7 @@ class TerrainNode : public BaseNode {
     Type m_type;  ///< terrain type (RIGID or GRANULAR)
 
     chrono::ChSystemParallel* m_system;  ///< containing system
+    AutoBinning* m_binning;              ///< broad-phase bin selection
     bool m_constructed;                  ///< system construction completed?
 
     chrono::ChMaterialSurface::ContactMethod m_method;              ///< contact method (penalty or complementarity)
@@ -193,6 +199,7 @@ class TerrainNode : public BaseNode {
     std::vector<Triangle> m_triangles;         ///< tire mesh connectivity
 
     int m_particles_start_index;       ///< start index for granular material bodies in system body list
+    std::shared_ptr<ParticleBatch> m_particles;  ///< granular material bodies (if GRANULAR)
 
     bool m_render;  ///< if true, use OpenGL rendering
 
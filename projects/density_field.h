@@ -0,0 +1,411 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Voxel estimate of the bulk density, porosity and coordination number of a
+// granular bed of spheres in a Chrono::Parallel system.
+//
+// The volume and mass of every selected particle are distributed over a
+// regular grid of voxels, in proportion to the part of the sphere inside each
+// voxel. A sphere contained in a single voxel is assigned to it entirely;
+// otherwise the overlap weights are computed by quadrature over a fixed lattice
+// of sample points in the sphere (default: 8 points per diameter, about 270
+// points). Particles are processed in parallel into per-thread grids, which are
+// summed in thread order. Parts of spheres outside the grid are ignored.
+//
+// From the voxel grid, Update() also builds a profile along Z: for each layer
+// of voxels, the solid fraction, porosity, bulk density and the average number
+// of contacts of the particles centered in that layer with other selected
+// particles (coordination number, from the current contact list).
+//
+// Particles are the bodies with identifiers in the selected range (default:
+// positive identifiers) that carry a sphere visualization asset (as added by
+// utils::AddSphereGeometry or ParticleBatch); its radius is used. The cached
+// selection is rebuilt when the number of bodies changes.
+//
+// Usage:
+//   DensityField field(system);
+//   field.SetGrid(ChVector<>(-hx, -hy, 0), ChVector<>(hx, hy, hz), 4 * radius);
+//   field.Update();
+//   double rho = field.GetBulkDensity(0, surface);
+//   field.WriteProfile(out_dir + "/density.dat");
+//
+// =============================================================================
+
+#ifndef DENSITY_FIELD_H
+#define DENSITY_FIELD_H
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "chrono/assets/ChSphereShape.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class DensityField {
+  public:
+    /// Average quantities over one layer of voxels.
+    struct Layer {
+        double z;               ///< height of the layer center
+        double solid_fraction;  ///< particle volume / layer volume
+        double porosity;        ///< 1 - solid fraction
+        double bulk_density;    ///< particle mass / layer volume
+        double coordination;    ///< average number of particle contacts of the particles centered in the layer
+        int num_particles;      ///< number of particles centered in the layer
+    };
+
+    /// Estimate the fields for the bodies with identifiers in [min_id, max_id] (default: positive identifiers).
+    DensityField(chrono::ChSystemParallel* system, int min_id = 1, int max_id = INT_MAX)
+        : m_system(system), m_min_id(min_id), m_max_id(max_id), m_num_bodies(0), m_num_skipped(0), m_valid(false) {
+        m_n[0] = m_n[1] = m_n[2] = 0;
+        SetSamples(8);
+    }
+
+    /// Set the grid: a box with the given corners, split into voxels with edges as close as possible to 'size'.
+    void SetGrid(const chrono::ChVector<>& min, const chrono::ChVector<>& max, double size) {
+        m_min = min;
+        for (int i = 0; i < 3; i++) {
+            double extent = max[i] - min[i];
+            m_n[i] = std::max(1, (int)std::round(extent / size));
+            m_h[i] = extent / m_n[i];
+        }
+        m_voxel_volume = m_h[0] * m_h[1] * m_h[2];
+        size_t num_voxels = (size_t)m_n[0] * m_n[1] * m_n[2];
+        m_volume.assign(num_voxels, 0.0);
+        m_mass.assign(num_voxels, 0.0);
+        m_profile.clear();
+    }
+
+    /// Set the number of quadrature points per sphere diameter, for spheres spanning several voxels (default: 8).
+    void SetSamples(int num_samples) {
+        m_points.clear();
+        for (int i = 0; i < num_samples; i++) {
+            for (int j = 0; j < num_samples; j++) {
+                for (int k = 0; k < num_samples; k++) {
+                    chrono::ChVector<> p((2 * i + 1.0) / num_samples - 1, (2 * j + 1.0) / num_samples - 1,
+                                         (2 * k + 1.0) / num_samples - 1);
+                    if (p.Length2() <= 1)
+                        m_points.push_back(p);
+                }
+            }
+        }
+    }
+
+    /// Force a rebuild of the cached particle selection at the next call to Update().
+    void Invalidate() { m_num_bodies = 0; }
+
+    /// Compute the fields for the current state of the system.
+    void Update() {
+        Refresh();
+        size_t num_voxels = m_volume.size();
+        if (num_voxels == 0)
+            return;
+
+        int num_threads = chrono::CHOMPfunctions::GetNumThreads();
+        int team_size = 1;
+
+        // Particle positions (from the data manager after a step, from the bodies otherwise).
+        const auto& bodies = m_system->Get_bodylist();
+        const auto& pos_rigid = m_system->data_manager->host_data.pos_rigid;
+        bool has_state = m_system->GetStepcount() > 0 && pos_rigid.size() == bodies.size();
+        int n = (int)m_indices.size();
+        m_pos.resize(n);
+        for (int k = 0; k < n; k++) {
+            int i = m_indices[k];
+            m_pos[k] = has_state ? chrono::ChVector<>(pos_rigid[i].x, pos_rigid[i].y, pos_rigid[i].z)
+                                 : bodies[i]->GetPos();
+        }
+
+        // Distribute particle volume and mass over the voxels.
+#pragma omp parallel num_threads(num_threads)
+        {
+            // The team may be smaller than requested: one grid per thread of the actual team.
+#pragma omp single
+            {
+                team_size = chrono::CHOMPfunctions::GetNumThreads();
+                m_thread_volume.resize(team_size);
+                m_thread_mass.resize(team_size);
+            }
+
+            int t = chrono::CHOMPfunctions::GetThreadNum();
+            std::vector<double>& volume = m_thread_volume[t];
+            std::vector<double>& mass = m_thread_mass[t];
+            volume.assign(num_voxels, 0.0);
+            mass.assign(num_voxels, 0.0);
+
+#pragma omp for schedule(static)
+            for (int k = 0; k < n; k++) {
+                const chrono::ChVector<>& c = m_pos[k];
+                double r = m_radius[k];
+                double vol = (4.0 / 3.0) * chrono::CH_C_PI * r * r * r;
+
+                int lo[3], hi[3];
+                for (int a = 0; a < 3; a++) {
+                    lo[a] = Cell(c[a] - r, a);
+                    hi[a] = Cell(c[a] + r, a);
+                }
+                if (lo[0] == hi[0] && lo[1] == hi[1] && lo[2] == hi[2]) {
+                    if (Inside(c)) {
+                        size_t v = Index(lo[0], lo[1], lo[2]);
+                        volume[v] += vol;
+                        mass[v] += m_pmass[k];
+                    }
+                    continue;
+                }
+
+                double w = 1.0 / m_points.size();
+                for (const auto& p : m_points) {
+                    chrono::ChVector<> q = c + r * p;
+                    if (!Inside(q))
+                        continue;
+                    size_t v = Index(Cell(q.x(), 0), Cell(q.y(), 1), Cell(q.z(), 2));
+                    volume[v] += w * vol;
+                    mass[v] += w * m_pmass[k];
+                }
+            }
+
+            // Sum the per-thread grids (in thread order for every voxel).
+#pragma omp barrier
+#pragma omp for schedule(static)
+            for (int v = 0; v < (int)num_voxels; v++) {
+                double vol_sum = 0;
+                double mass_sum = 0;
+                for (int s = 0; s < team_size; s++) {
+                    vol_sum += m_thread_volume[s][v];
+                    mass_sum += m_thread_mass[s][v];
+                }
+                m_volume[v] = vol_sum;
+                m_mass[v] = mass_sum;
+            }
+        }
+
+        BuildProfile(has_state);
+        m_valid = true;
+    }
+
+    /// Return the number of voxels along the specified axis (0, 1, or 2).
+    int GetNumVoxels(int axis) const { return m_n[axis]; }
+
+    /// Return the voxel edge length along the specified axis (0, 1, or 2).
+    double GetVoxelSize(int axis) const { return m_h[axis]; }
+
+    /// Return the number of selected particles.
+    int GetNumParticles() const { return (int)m_indices.size(); }
+
+    /// Return the number of bodies in the identifier range without a sphere asset (ignored).
+    int GetNumSkipped() const { return m_num_skipped; }
+
+    /// Return the solid fraction of the specified voxel.
+    double GetSolidFraction(int ix, int iy, int iz) const { return m_volume[Index(ix, iy, iz)] / m_voxel_volume; }
+
+    /// Return the porosity of the specified voxel.
+    double GetPorosity(int ix, int iy, int iz) const { return 1 - GetSolidFraction(ix, iy, iz); }
+
+    /// Return the bulk density of the specified voxel.
+    double GetBulkDensity(int ix, int iy, int iz) const { return m_mass[Index(ix, iy, iz)] / m_voxel_volume; }
+
+    /// Return the profile along Z (one entry per layer of voxels, from the bottom of the grid).
+    const std::vector<Layer>& GetProfile() const { return m_profile; }
+
+    /// Return the bulk density of the grid slab between the two heights (partial layers weighted by overlap).
+    double GetBulkDensity(double z_min, double z_max) const { return SlabAverage(z_min, z_max, m_mass); }
+
+    /// Return the solid fraction of the grid slab between the two heights.
+    double GetSolidFraction(double z_min, double z_max) const { return SlabAverage(z_min, z_max, m_volume); }
+
+    /// Return the porosity of the grid slab between the two heights.
+    double GetPorosity(double z_min, double z_max) const { return 1 - GetSolidFraction(z_min, z_max); }
+
+    /// Return the average number of contacts with other selected particles, over all selected particles.
+    double GetCoordination() const { return m_indices.empty() ? 0 : 2.0 * m_num_contacts / m_indices.size(); }
+
+    /// Write the profile along Z: height, solid fraction, porosity, bulk density, coordination, particles.
+    bool WriteProfile(const std::string& filename) const {
+        FILE* fp = fopen(filename.c_str(), "w");
+        if (!fp)
+            return false;
+        for (const auto& layer : m_profile) {
+            fprintf(fp, "%12.6e  %10.6f  %10.6f  %12.6e  %8.4f  %d\n", layer.z, layer.solid_fraction, layer.porosity,
+                    layer.bulk_density, layer.coordination, layer.num_particles);
+        }
+        fclose(fp);
+        return true;
+    }
+
+  private:
+    /// Rebuild the cached particle selection (indices, radii, masses) if the number of bodies changed.
+    void Refresh() {
+        const auto& bodies = m_system->Get_bodylist();
+        if (bodies.size() == m_num_bodies)
+            return;
+
+        m_indices.clear();
+        m_radius.clear();
+        m_pmass.clear();
+        m_selected.assign(bodies.size(), -1);
+        m_num_skipped = 0;
+        for (size_t i = 0; i < bodies.size(); i++) {
+            int id = bodies[i]->GetIdentifier();
+            if (id < m_min_id || id > m_max_id)
+                continue;
+            double radius = 0;
+            for (const auto& asset : bodies[i]->GetAssets()) {
+                if (auto sphere = std::dynamic_pointer_cast<chrono::ChSphereShape>(asset)) {
+                    radius = sphere->GetSphereGeometry().rad;
+                    break;
+                }
+            }
+            if (radius <= 0) {
+                m_num_skipped++;
+                continue;
+            }
+            m_selected[i] = (int)m_indices.size();
+            m_indices.push_back((int)i);
+            m_radius.push_back(radius);
+            m_pmass.push_back(bodies[i]->GetMass());
+        }
+        m_num_bodies = bodies.size();
+    }
+
+    /// Per-layer averages and coordination numbers.
+    void BuildProfile(bool has_state) {
+        int n = (int)m_indices.size();
+        double layer_volume = m_voxel_volume * m_n[0] * m_n[1];
+
+        // Contacts between selected particles.
+        m_contacts.assign(n, 0);
+        m_num_contacts = 0;
+        if (has_state) {
+            const auto& bids = m_system->data_manager->host_data.bids_rigid_rigid;
+            size_t num_contacts = std::min<size_t>(m_system->data_manager->num_rigid_contacts, bids.size());
+            for (size_t c = 0; c < num_contacts; c++) {
+                int a = bids[c].x;
+                int b = bids[c].y;
+                if (a < 0 || b < 0 || a >= (int)m_selected.size() || b >= (int)m_selected.size())
+                    continue;
+                int ka = m_selected[a];
+                int kb = m_selected[b];
+                if (ka < 0 || kb < 0)
+                    continue;
+                m_contacts[ka]++;
+                m_contacts[kb]++;
+                m_num_contacts++;
+            }
+        }
+
+        m_profile.resize(m_n[2]);
+        std::vector<int> layer_contacts(m_n[2], 0);
+        for (int iz = 0; iz < m_n[2]; iz++) {
+            Layer& layer = m_profile[iz];
+            double vol = 0;
+            double mass = 0;
+            for (int iy = 0; iy < m_n[1]; iy++) {
+                for (int ix = 0; ix < m_n[0]; ix++) {
+                    size_t v = Index(ix, iy, iz);
+                    vol += m_volume[v];
+                    mass += m_mass[v];
+                }
+            }
+            layer.z = m_min.z() + (iz + 0.5) * m_h[2];
+            layer.solid_fraction = vol / layer_volume;
+            layer.porosity = 1 - layer.solid_fraction;
+            layer.bulk_density = mass / layer_volume;
+            layer.num_particles = 0;
+        }
+        for (int k = 0; k < n; k++) {
+            if (!Inside(m_pos[k]))
+                continue;
+            int iz = Cell(m_pos[k].z(), 2);
+            m_profile[iz].num_particles++;
+            layer_contacts[iz] += m_contacts[k];
+        }
+        for (int iz = 0; iz < m_n[2]; iz++) {
+            Layer& layer = m_profile[iz];
+            layer.coordination = layer.num_particles > 0 ? (double)layer_contacts[iz] / layer.num_particles : 0;
+        }
+    }
+
+    /// Average of a voxel quantity (per unit volume) over the slab between two heights.
+    double SlabAverage(double z_min, double z_max, const std::vector<double>& values) const {
+        if (!m_valid || z_max <= z_min)
+            return 0;
+        double sum = 0;
+        double volume = 0;
+        for (int iz = 0; iz < m_n[2]; iz++) {
+            double lo = m_min.z() + iz * m_h[2];
+            double frac = (std::min(z_max, lo + m_h[2]) - std::max(z_min, lo)) / m_h[2];
+            if (frac <= 0)
+                continue;
+            double layer = 0;
+            for (int iy = 0; iy < m_n[1]; iy++)
+                for (int ix = 0; ix < m_n[0]; ix++)
+                    layer += values[Index(ix, iy, iz)];
+            sum += frac * layer;
+            volume += frac * m_voxel_volume * m_n[0] * m_n[1];
+        }
+        return volume > 0 ? sum / volume : 0;
+    }
+
+    /// Voxel index along the given axis (clamped to the grid).
+    int Cell(double x, int axis) const {
+        int i = (int)std::floor((x - m_min[axis]) / m_h[axis]);
+        return std::min(m_n[axis] - 1, std::max(0, i));
+    }
+
+    /// Return true if the point is inside the grid.
+    bool Inside(const chrono::ChVector<>& p) const {
+        for (int a = 0; a < 3; a++) {
+            double x = (p[a] - m_min[a]) / m_h[a];
+            if (x < 0 || x >= m_n[a])
+                return false;
+        }
+        return true;
+    }
+
+    size_t Index(int ix, int iy, int iz) const { return ((size_t)iz * m_n[1] + iy) * m_n[0] + ix; }
+
+    chrono::ChSystemParallel* m_system;
+    int m_min_id;  ///< smallest selected identifier
+    int m_max_id;  ///< largest selected identifier
+
+    chrono::ChVector<> m_min;  ///< lower corner of the grid
+    int m_n[3];                ///< number of voxels per axis
+    double m_h[3];             ///< voxel edge lengths
+    double m_voxel_volume;     ///< volume of one voxel
+
+    std::vector<chrono::ChVector<>> m_points;  ///< quadrature points in the unit sphere
+
+    size_t m_num_bodies;           ///< number of bodies at the last rebuild
+    int m_num_skipped;             ///< bodies in the identifier range without a sphere asset
+    std::vector<int> m_indices;    ///< body indices of the selected particles
+    std::vector<int> m_selected;   ///< body index -> particle index (-1 if not selected)
+    std::vector<double> m_radius;  ///< particle radii
+    std::vector<double> m_pmass;   ///< particle masses
+    std::vector<chrono::ChVector<>> m_pos;  ///< particle positions at the last update
+
+    std::vector<double> m_volume;                      ///< particle volume per voxel
+    std::vector<double> m_mass;                        ///< particle mass per voxel
+    std::vector<std::vector<double>> m_thread_volume;  ///< per-thread particle volume per voxel
+    std::vector<std::vector<double>> m_thread_mass;    ///< per-thread particle mass per voxel
+
+    std::vector<int> m_contacts;   ///< number of contacts per particle
+    int m_num_contacts;            ///< number of contacts between selected particles
+    std::vector<Layer> m_profile;  ///< profile along Z
+    bool m_valid;                  ///< fields computed?
+};
+
+#endif
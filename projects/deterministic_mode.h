@@ -0,0 +1,147 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Reproducible Chrono::Parallel runs, for performance comparisons of two builds.
+//
+// Chrono::Parallel generates contact pairs in sorted shape-pair order and uses
+// statically partitioned OpenMP loops and reductions, so the results of a step
+// depend only on the state and on the number of threads in a team. Runs
+// diverge when that number changes (dynamic thread teams, thread tuning) or
+// when a driver takes decisions based on measured times (e.g. AutoBinning) or
+// on time-seeded random numbers (the samplers of utils::Generator). A
+// DeterministicMode object removes the first cause:
+//
+// - the OpenMP runtime is set to a fixed team size (no dynamic adjustment) and
+//   a static schedule for loops with a runtime schedule;
+// - the thread count of the system is fixed and thread tuning is disabled.
+//
+// The driver is responsible for the others: use BulkGenerator with the seed
+// returned by GetSeed() and disable the timing feedback of AutoBinning.
+//
+// To check that two runs are identical, a 64-bit hash of the bit patterns of
+// all body positions, orientations and velocities can be recorded at any time
+// (e.g. at every output frame); the recorded hashes are combined in a trace
+// hash, printed with the final state hash at the end of the run.
+//
+// Usage:
+//   DeterministicMode deterministic(system, num_threads);
+//   BulkGenerator gen(system, deterministic.GetSeed());
+//   binning.SetTimingFeedback(false);
+//   while (...) {
+//       system->DoStepDynamics(step_size);
+//       if (output)
+//           deterministic.Record();
+//   }
+//   deterministic.PrintSummary();
+//
+// =============================================================================
+
+#ifndef DETERMINISTIC_MODE_H
+#define DETERMINISTIC_MODE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class DeterministicMode {
+  public:
+    /// Configure the system and the OpenMP runtime for reproducible runs with the given number of threads.
+    DeterministicMode(chrono::ChSystemParallel* system, int num_threads, unsigned int seed = 1)
+        : m_system(system), m_num_threads(num_threads), m_seed(seed), m_num_records(0), m_trace(kOffset) {
+#ifdef _OPENMP
+        omp_set_dynamic(0);
+        omp_set_schedule(omp_sched_static, 0);
+#endif
+        m_system->SetParallelThreadNumber(num_threads);
+        chrono::CHOMPfunctions::SetNumThreads(num_threads);
+        m_system->GetSettings()->perform_thread_tuning = false;
+    }
+
+    /// Return the number of threads used for all parallel regions.
+    int GetNumThreads() const { return m_num_threads; }
+
+    /// Return the seed to be used for random number generation (e.g. BulkGenerator).
+    unsigned int GetSeed() const { return m_seed; }
+
+    /// Return a hash of the current positions, orientations and velocities of all bodies.
+    uint64_t StateHash() const {
+        uint64_t h = kOffset;
+        for (const auto& body : m_system->Get_bodylist()) {
+            const chrono::ChVector<>& pos = body->GetPos();
+            const chrono::ChQuaternion<>& rot = body->GetRot();
+            const chrono::ChVector<>& vel = body->GetPos_dt();
+            const chrono::ChVector<>& omg = body->GetWvel_loc();
+            double values[13] = {pos.x(), pos.y(), pos.z(), rot.e0(), rot.e1(), rot.e2(), rot.e3(),
+                                 vel.x(), vel.y(), vel.z(), omg.x(), omg.y(), omg.z()};
+            h = Combine(h, values, sizeof(values));
+        }
+        return h;
+    }
+
+    /// Record the hash of the current state in the trace. Return the state hash.
+    uint64_t Record() {
+        uint64_t h = StateHash();
+        double time = m_system->GetChTime();
+        m_trace = Combine(m_trace, &time, sizeof(time));
+        m_trace = Combine(m_trace, &h, sizeof(h));
+        m_num_records++;
+        return h;
+    }
+
+    /// Return the combined hash of all recorded states.
+    uint64_t GetTraceHash() const { return m_trace; }
+
+    /// Return the number of recorded states.
+    int GetNumRecords() const { return m_num_records; }
+
+    /// Print the run configuration, the hash of the current state, and the trace hash.
+    void PrintSummary(std::ostream& os = std::cout) const {
+        os << "Deterministic run: " << m_num_threads << " threads, seed " << m_seed << std::endl;
+        os << "  state hash:  " << ToHex(StateHash()) << "  (t = " << m_system->GetChTime() << ", "
+           << m_system->Get_bodylist().size() << " bodies)" << std::endl;
+        os << "  trace hash:  " << ToHex(m_trace) << "  (" << m_num_records << " records)" << std::endl;
+    }
+
+    /// Format a hash as a 16-digit hexadecimal string.
+    static std::string ToHex(uint64_t h) {
+        char buf[20];
+        sprintf(buf, "%016llx", (unsigned long long)h);
+        return buf;
+    }
+
+  private:
+    static const uint64_t kOffset = 14695981039346656037ULL;  ///< FNV-1a offset basis
+    static const uint64_t kPrime = 1099511628211ULL;          ///< FNV-1a prime
+
+    /// Combine the given bytes into the hash (FNV-1a).
+    static uint64_t Combine(uint64_t h, const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            h ^= bytes[i];
+            h *= kPrime;
+        }
+        return h;
+    }
+
+    chrono::ChSystemParallel* m_system;
+    int m_num_threads;    ///< fixed number of threads
+    unsigned int m_seed;  ///< seed for random number generation
+    int m_num_records;    ///< number of calls to Record
+    uint64_t m_trace;     ///< combined hash of the recorded states
+};
+
+#endif
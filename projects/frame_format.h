@@ -0,0 +1,499 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Compact binary file format for visualization frames (does not depend on
+// Chrono; used by FrameWriter in frame_writer.h and by the frame_to_povray
+// converter).
+//
+// A frame file stores a sequence of records after a short file header:
+// - a shape table: the identifiers of all bodies and, for every visualization
+//   asset, its body index, shape type, dimensions, local frame, and color;
+//   a new table is written whenever the set of bodies changes;
+// - frames: the time, the body reference frames (float32, structure of arrays:
+//   all x, then all y, ...), and the body activity flags.
+// Shapes are therefore written once per table rather than once per frame, and
+// a frame costs 29 bytes per body (before compression).
+//
+// If built with FRAME_OUTPUT_ZLIB (and linked against zlib), record payloads
+// can be deflated; the float arrays of a frame are byte-shuffled first (all
+// first bytes, then all second bytes, ...), which makes slowly varying values
+// compress much better. Readers built without zlib reject compressed files.
+//
+// A frame can be converted to the text format of utils::WriteShapesPovray
+// (same line layout, values rounded to float32).
+//
+// =============================================================================
+
+#ifndef FRAME_FORMAT_H
+#define FRAME_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef FRAME_OUTPUT_ZLIB
+#include <zlib.h>
+#endif
+
+namespace frame_format {
+
+const char kMagic[8] = {'C', 'H', 'F', 'R', 'A', 'M', 'E', '1'};
+const uint32_t kVersion = 1;
+
+const uint32_t kFlagBodyInfo = 1;   ///< converted text includes one line per body
+const uint32_t kFlagCompressed = 2;  ///< record payloads may be deflated
+
+const uint8_t kRecordTable = 'T';
+const uint8_t kRecordFrame = 'F';
+
+const int kMaxDims = 7;  ///< maximum number of shape dimensions (cylinder: radius and two end points)
+
+/// Shape table: bodies and visualization assets (structure of arrays).
+struct ShapeTable {
+    std::vector<int32_t> identifier;  ///< body identifiers
+    std::vector<uint32_t> body;       ///< body index of each shape
+    std::vector<int32_t> type;        ///< shape type (collision::ShapeType value)
+    std::vector<uint8_t> num_dims;    ///< number of dimensions of each shape
+    std::vector<float> dims;          ///< shape dimensions (kMaxDims per shape)
+    std::vector<float> pos;           ///< shape position in the body frame (3 per shape)
+    std::vector<float> rot;           ///< shape orientation in the body frame (4 per shape)
+    std::vector<float> color;         ///< body color (3 per shape)
+    std::vector<std::string> name;    ///< text written instead of the dimensions (quoted mesh name), or empty
+
+    size_t GetNumBodies() const { return identifier.size(); }
+    size_t GetNumShapes() const { return body.size(); }
+
+    void Clear() {
+        identifier.clear();
+        body.clear();
+        type.clear();
+        num_dims.clear();
+        dims.clear();
+        pos.clear();
+        rot.clear();
+        color.clear();
+        name.clear();
+    }
+};
+
+/// Body reference frames at one time (structure of arrays).
+struct Frame {
+    double time;
+    std::vector<float> x, y, z;          ///< body positions
+    std::vector<float> e0, e1, e2, e3;   ///< body orientations
+    std::vector<uint8_t> active;         ///< body activity flags
+
+    size_t GetNumBodies() const { return x.size(); }
+
+    void Resize(size_t n) {
+        x.resize(n);
+        y.resize(n);
+        z.resize(n);
+        e0.resize(n);
+        e1.resize(n);
+        e2.resize(n);
+        e3.resize(n);
+        active.resize(n);
+    }
+};
+
+// -----------------------------------------------------------------------------
+// Serialization helpers
+// -----------------------------------------------------------------------------
+
+template <typename T>
+void Append(std::vector<char>& buf, const T& value) {
+    const char* p = reinterpret_cast<const char*>(&value);
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+void Append(std::vector<char>& buf, const std::vector<T>& values) {
+    const char* p = reinterpret_cast<const char*>(values.data());
+    buf.insert(buf.end(), p, p + values.size() * sizeof(T));
+}
+
+/// Sequential reader over a record payload; sets 'ok' to false on overrun.
+struct Cursor {
+    const char* ptr;
+    const char* end;
+    bool ok;
+
+    Cursor(const std::vector<char>& buf) : ptr(buf.data()), end(buf.data() + buf.size()), ok(true) {}
+
+    template <typename T>
+    void Read(T& value) {
+        if (ptr + sizeof(T) > end) {
+            ok = false;
+            return;
+        }
+        std::memcpy(&value, ptr, sizeof(T));
+        ptr += sizeof(T);
+    }
+
+    template <typename T>
+    void Read(std::vector<T>& values, size_t n) {
+        if (ptr + n * sizeof(T) > end) {
+            ok = false;
+            return;
+        }
+        values.resize(n);
+        std::memcpy(values.data(), ptr, n * sizeof(T));
+        ptr += n * sizeof(T);
+    }
+};
+
+/// Byte-shuffle (or unshuffle) 'n' elements of 'size' bytes.
+inline void Shuffle(const char* src, char* dst, size_t n, size_t size, bool inverse) {
+    for (size_t i = 0; i < n; i++)
+        for (size_t b = 0; b < size; b++) {
+            if (inverse)
+                dst[i * size + b] = src[b * n + i];
+            else
+                dst[b * n + i] = src[i * size + b];
+        }
+}
+
+// -----------------------------------------------------------------------------
+// Writer
+// -----------------------------------------------------------------------------
+
+class FileWriter {
+  public:
+    /// Open the specified file and write the file header.
+    /// A compression level 1-9 requires FRAME_OUTPUT_ZLIB; 0 stores records uncompressed.
+    FileWriter(const std::string& filename, bool body_info, int compression = 0)
+        : m_compression(0), m_bytes(0) {
+#ifdef FRAME_OUTPUT_ZLIB
+        m_compression = compression;
+#else
+        (void)compression;
+#endif
+        m_file.open(filename, std::ios::binary | std::ios::trunc);
+        uint32_t flags = (body_info ? kFlagBodyInfo : 0) | (m_compression > 0 ? kFlagCompressed : 0);
+        m_file.write(kMagic, sizeof(kMagic));
+        m_file.write(reinterpret_cast<const char*>(&kVersion), sizeof(kVersion));
+        m_file.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
+        m_bytes = sizeof(kMagic) + sizeof(kVersion) + sizeof(flags);
+    }
+
+    bool IsOpen() const { return m_file.is_open(); }
+
+    /// Return the effective compression level (0 if built without zlib).
+    int GetCompression() const { return m_compression; }
+
+    /// Return the number of bytes written so far.
+    size_t GetNumBytes() const { return m_bytes; }
+
+    void WriteTable(const ShapeTable& table) {
+        std::vector<char> buf;
+        Append(buf, (uint32_t)table.GetNumBodies());
+        Append(buf, (uint32_t)table.GetNumShapes());
+        Append(buf, table.identifier);
+        Append(buf, table.body);
+        Append(buf, table.type);
+        Append(buf, table.num_dims);
+        Append(buf, table.dims);
+        Append(buf, table.pos);
+        Append(buf, table.rot);
+        Append(buf, table.color);
+        for (const auto& name : table.name) {
+            Append(buf, (uint32_t)name.size());
+            buf.insert(buf.end(), name.begin(), name.end());
+        }
+        WriteRecord(kRecordTable, buf, 0, 0);
+    }
+
+    void WriteFrame(const Frame& frame) {
+        uint32_t n = (uint32_t)frame.GetNumBodies();
+        m_buf.clear();
+        m_buf.reserve(sizeof(double) + sizeof(uint32_t) + 29 * (size_t)n);
+        Append(m_buf, frame.time);
+        Append(m_buf, n);
+        size_t floats_begin = m_buf.size();
+        Append(m_buf, frame.x);
+        Append(m_buf, frame.y);
+        Append(m_buf, frame.z);
+        Append(m_buf, frame.e0);
+        Append(m_buf, frame.e1);
+        Append(m_buf, frame.e2);
+        Append(m_buf, frame.e3);
+        Append(m_buf, frame.active);
+        WriteRecord(kRecordFrame, m_buf, floats_begin, 7 * (size_t)n);
+    }
+
+  private:
+    /// Write one record; 'num_floats' float values starting at 'floats_begin' are shuffled before compression.
+    void WriteRecord(uint8_t type, std::vector<char>& buf, size_t floats_begin, size_t num_floats) {
+        uint32_t raw_size = (uint32_t)buf.size();
+        const char* payload = buf.data();
+        uint32_t stored_size = raw_size;
+
+#ifdef FRAME_OUTPUT_ZLIB
+        if (m_compression > 0) {
+            if (num_floats > 0) {
+                m_shuffled.assign(buf.begin(), buf.end());
+                Shuffle(buf.data() + floats_begin, m_shuffled.data() + floats_begin, num_floats, sizeof(float), false);
+                buf.swap(m_shuffled);
+            }
+            uLongf size = compressBound(raw_size);
+            m_packed.resize(size);
+            if (compress2(reinterpret_cast<Bytef*>(m_packed.data()), &size, reinterpret_cast<const Bytef*>(buf.data()),
+                          raw_size, m_compression) == Z_OK &&
+                size < raw_size) {
+                payload = m_packed.data();
+                stored_size = (uint32_t)size;
+            } else {
+                // Store uncompressed (and unshuffled).
+                if (num_floats > 0)
+                    buf.swap(m_shuffled);
+                payload = buf.data();
+            }
+        }
+#else
+        (void)floats_begin;
+        (void)num_floats;
+#endif
+
+        m_file.write(reinterpret_cast<const char*>(&type), sizeof(type));
+        m_file.write(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+        m_file.write(reinterpret_cast<const char*>(&stored_size), sizeof(stored_size));
+        m_file.write(payload, stored_size);
+        m_file.flush();
+        m_bytes += sizeof(type) + sizeof(raw_size) + sizeof(stored_size) + stored_size;
+    }
+
+    std::ofstream m_file;
+    int m_compression;
+    size_t m_bytes;
+    std::vector<char> m_buf;
+    std::vector<char> m_shuffled;
+    std::vector<char> m_packed;
+};
+
+// -----------------------------------------------------------------------------
+// Reader
+// -----------------------------------------------------------------------------
+
+class FileReader {
+  public:
+    /// Open the specified file and read the file header.
+    explicit FileReader(const std::string& filename) : m_flags(0), m_valid(false) {
+        m_file.open(filename, std::ios::binary);
+        char magic[sizeof(kMagic)];
+        uint32_t version = 0;
+        m_file.read(magic, sizeof(magic));
+        m_file.read(reinterpret_cast<char*>(&version), sizeof(version));
+        m_file.read(reinterpret_cast<char*>(&m_flags), sizeof(m_flags));
+        m_valid = m_file.good() && std::memcmp(magic, kMagic, sizeof(kMagic)) == 0 && version == kVersion;
+#ifndef FRAME_OUTPUT_ZLIB
+        if (m_flags & kFlagCompressed)
+            m_error = "compressed frame file (rebuild with zlib support)";
+#endif
+        if (!m_valid)
+            m_error = "not a frame file: " + filename;
+    }
+
+    /// Return false if the file could not be read (see GetError).
+    bool IsValid() const { return m_valid && m_error.empty(); }
+    const std::string& GetError() const { return m_error; }
+
+    bool HasBodyInfo() const { return (m_flags & kFlagBodyInfo) != 0; }
+
+    /// Return the shape table in effect for the last frame read.
+    const ShapeTable& GetTable() const { return m_table; }
+
+    /// Read the next frame (and any preceding shape table). Returns false at the end of the file or on error.
+    bool ReadFrame(Frame& frame) {
+        uint8_t type;
+        std::vector<char> buf;
+        while (ReadRecord(type, buf)) {
+            Cursor c(buf);
+            if (type == kRecordTable) {
+                if (!ParseTable(c))
+                    return Fail("corrupt shape table");
+                continue;
+            }
+            if (type != kRecordFrame)
+                return Fail("unknown record type");
+
+            uint32_t n = 0;
+            c.Read(frame.time);
+            c.Read(n);
+            if (!c.ok || n != m_table.GetNumBodies())
+                return Fail("frame does not match the shape table");
+            c.Read(frame.x, n);
+            c.Read(frame.y, n);
+            c.Read(frame.z, n);
+            c.Read(frame.e0, n);
+            c.Read(frame.e1, n);
+            c.Read(frame.e2, n);
+            c.Read(frame.e3, n);
+            c.Read(frame.active, n);
+            if (!c.ok)
+                return Fail("truncated frame");
+            return true;
+        }
+        return false;
+    }
+
+  private:
+    bool Fail(const std::string& msg) {
+        m_error = msg;
+        return false;
+    }
+
+    bool ReadRecord(uint8_t& type, std::vector<char>& buf) {
+        if (!IsValid())
+            return false;
+        uint32_t raw_size = 0;
+        uint32_t stored_size = 0;
+        m_file.read(reinterpret_cast<char*>(&type), sizeof(type));
+        m_file.read(reinterpret_cast<char*>(&raw_size), sizeof(raw_size));
+        m_file.read(reinterpret_cast<char*>(&stored_size), sizeof(stored_size));
+        if (!m_file.good())
+            return false;
+        buf.resize(stored_size);
+        m_file.read(buf.data(), stored_size);
+        if (!m_file.good())
+            return Fail("truncated record");
+        if (stored_size == raw_size)
+            return true;
+
+#ifdef FRAME_OUTPUT_ZLIB
+        std::vector<char> raw(raw_size);
+        uLongf size = raw_size;
+        if (uncompress(reinterpret_cast<Bytef*>(raw.data()), &size, reinterpret_cast<const Bytef*>(buf.data()),
+                       stored_size) != Z_OK ||
+            size != raw_size)
+            return Fail("corrupt compressed record");
+        if (type == kRecordFrame && raw_size >= sizeof(double) + sizeof(uint32_t)) {
+            uint32_t n;
+            std::memcpy(&n, raw.data() + sizeof(double), sizeof(n));
+            size_t floats_begin = sizeof(double) + sizeof(uint32_t);
+            if (floats_begin + 29 * (size_t)n != raw_size)
+                return Fail("corrupt frame record");
+            buf.assign(raw.begin(), raw.end());
+            Shuffle(raw.data() + floats_begin, buf.data() + floats_begin, 7 * (size_t)n, sizeof(float), true);
+        } else {
+            buf.swap(raw);
+        }
+        return true;
+#else
+        return Fail("compressed record (rebuild with zlib support)");
+#endif
+    }
+
+    bool ParseTable(Cursor& c) {
+        uint32_t nb = 0;
+        uint32_t ns = 0;
+        c.Read(nb);
+        c.Read(ns);
+        c.Read(m_table.identifier, nb);
+        c.Read(m_table.body, ns);
+        c.Read(m_table.type, ns);
+        c.Read(m_table.num_dims, ns);
+        c.Read(m_table.dims, kMaxDims * (size_t)ns);
+        c.Read(m_table.pos, 3 * (size_t)ns);
+        c.Read(m_table.rot, 4 * (size_t)ns);
+        c.Read(m_table.color, 3 * (size_t)ns);
+        m_table.name.resize(ns);
+        for (uint32_t i = 0; i < ns && c.ok; i++) {
+            uint32_t len = 0;
+            c.Read(len);
+            std::vector<char> chars;
+            c.Read(chars, len);
+            m_table.name[i].assign(chars.begin(), chars.end());
+        }
+        if (!c.ok)
+            return false;
+        for (uint32_t i = 0; i < ns; i++)
+            if (m_table.body[i] >= nb || m_table.num_dims[i] > kMaxDims)
+                return false;
+        return true;
+    }
+
+    std::ifstream m_file;
+    uint32_t m_flags;
+    bool m_valid;
+    std::string m_error;
+    ShapeTable m_table;
+};
+
+// -----------------------------------------------------------------------------
+// Conversion to the text format of utils::WriteShapesPovray
+// -----------------------------------------------------------------------------
+
+/// Write the specified frame as utils::WriteShapesPovray would (with the given delimiter).
+/// Links are not recorded in frame files; the link count is always 0.
+inline void WritePovray(std::ostream& os,
+                        const ShapeTable& table,
+                        const Frame& frame,
+                        bool body_info,
+                        const std::string& delim = ",") {
+    size_t nb = table.GetNumBodies();
+    size_t ns = table.GetNumShapes();
+
+    os << (body_info ? nb : 0) << delim << ns << delim << 0 << delim << "\n";
+
+    if (body_info) {
+        for (size_t i = 0; i < nb; i++) {
+            os << table.identifier[i] << delim << (int)frame.active[i] << delim;
+            os << frame.x[i] << delim << frame.y[i] << delim << frame.z[i] << delim;
+            os << frame.e0[i] << delim << frame.e1[i] << delim << frame.e2[i] << delim << frame.e3[i] << delim << "\n";
+        }
+    }
+
+    for (size_t k = 0; k < ns; k++) {
+        size_t i = table.body[k];
+        double q0 = frame.e0[i], q1 = frame.e1[i], q2 = frame.e2[i], q3 = frame.e3[i];
+        const float* sp = &table.pos[3 * k];
+        const float* sq = &table.rot[4 * k];
+
+        // Shape position: body position plus the shape offset rotated by the body orientation.
+        double vx = sp[0], vy = sp[1], vz = sp[2];
+        double tx = 2 * (q2 * vz - q3 * vy);
+        double ty = 2 * (q3 * vx - q1 * vz);
+        double tz = 2 * (q1 * vy - q2 * vx);
+        double px = frame.x[i] + vx + q0 * tx + (q2 * tz - q3 * ty);
+        double py = frame.y[i] + vy + q0 * ty + (q3 * tx - q1 * tz);
+        double pz = frame.z[i] + vz + q0 * tz + (q1 * ty - q2 * tx);
+
+        // Shape orientation: body orientation times the shape orientation.
+        double r0 = q0 * sq[0] - q1 * sq[1] - q2 * sq[2] - q3 * sq[3];
+        double r1 = q0 * sq[1] + q1 * sq[0] + q2 * sq[3] - q3 * sq[2];
+        double r2 = q0 * sq[2] - q1 * sq[3] + q2 * sq[0] + q3 * sq[1];
+        double r3 = q0 * sq[3] + q1 * sq[2] - q2 * sq[1] + q3 * sq[0];
+
+        os << table.identifier[i] << delim << (int)frame.active[i] << delim;
+        os << px << delim << py << delim << pz << delim;
+        os << r0 << delim << r1 << delim << r2 << delim << r3 << delim;
+        os << table.color[3 * k] << delim << table.color[3 * k + 1] << delim << table.color[3 * k + 2] << delim;
+        os << table.type[k];
+        if (!table.name[k].empty()) {
+            os << delim << table.name[k];
+        } else {
+            for (int d = 0; d < table.num_dims[k]; d++)
+                os << delim << table.dims[kMaxDims * k + d];
+        }
+        os << delim << "\n";
+    }
+}
+
+}  // end namespace frame_format
+
+#endif
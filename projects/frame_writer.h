@@ -0,0 +1,231 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Binary replacement for per-frame utils::WriteShapesPovray output.
+//
+// A FrameWriter appends all frames of a simulation to a single file in the
+// format of frame_format.h: the visualization shapes are written once (again
+// only when bodies are added or removed), and every frame stores just the body
+// reference frames as float32 arrays. The body states are gathered in parallel.
+// Frames are converted to the POV-Ray text files of utils::WriteShapesPovray
+// with the frame_to_povray program (one data_###.dat file per frame).
+//
+// Assets added to a body that is already in the system are only picked up
+// after a call to Invalidate(). Links are not recorded.
+//
+// Usage:
+//   FrameWriter frames(system, out_dir + "/frames.bin", false);
+//   ...
+//   if (sim_frame == next_out_frame)
+//       frames.Write();
+//
+// =============================================================================
+
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chrono/assets/ChBoxShape.h"
+#include "chrono/assets/ChCapsuleShape.h"
+#include "chrono/assets/ChColorAsset.h"
+#include "chrono/assets/ChConeShape.h"
+#include "chrono/assets/ChCylinderShape.h"
+#include "chrono/assets/ChEllipsoidShape.h"
+#include "chrono/assets/ChRoundedBoxShape.h"
+#include "chrono/assets/ChRoundedCylinderShape.h"
+#include "chrono/assets/ChSphereShape.h"
+#include "chrono/assets/ChTriangleMeshShape.h"
+#include "chrono/collision/ChCCollisionModel.h"
+#include "chrono/core/ChTimer.h"
+#include "chrono/physics/ChSystem.h"
+
+#include "frame_format.h"
+
+class FrameWriter {
+  public:
+    /// Create the output file. 'body_info' has the meaning of the corresponding argument of
+    /// utils::WriteShapesPovray. A compression level 1-9 requires zlib support (FRAME_OUTPUT_ZLIB).
+    FrameWriter(chrono::ChSystem* system, const std::string& filename, bool body_info = true, int compression = 0)
+        : m_system(system), m_file(filename, body_info, compression), m_valid(false), m_num_frames(0),
+          m_num_skipped(0), m_time(0) {}
+
+    /// Return false if the output file could not be created.
+    bool IsOpen() const { return m_file.IsOpen(); }
+
+    /// Append a frame with the current state of the system.
+    void Write() {
+        chrono::ChTimer<double> timer;
+        timer.start();
+
+        const auto& bodies = m_system->Get_bodylist();
+        size_t n = bodies.size();
+        bool changed = !m_valid || n != m_bodies.size();
+        for (size_t i = 0; i < n && !changed; i++)
+            changed = bodies[i].get() != m_bodies[i];
+        if (changed)
+            WriteTable();
+
+        m_frame.time = m_system->GetChTime();
+        m_frame.Resize(n);
+#pragma omp parallel for
+        for (int i = 0; i < (int)n; i++) {
+            const auto& frame = bodies[i]->GetFrame_REF_to_abs();
+            const chrono::ChVector<>& pos = frame.GetPos();
+            const chrono::ChQuaternion<>& rot = frame.GetRot();
+            m_frame.x[i] = (float)pos.x();
+            m_frame.y[i] = (float)pos.y();
+            m_frame.z[i] = (float)pos.z();
+            m_frame.e0[i] = (float)rot.e0();
+            m_frame.e1[i] = (float)rot.e1();
+            m_frame.e2[i] = (float)rot.e2();
+            m_frame.e3[i] = (float)rot.e3();
+            m_frame.active[i] = bodies[i]->IsActive() ? 1 : 0;
+        }
+        m_file.WriteFrame(m_frame);
+        m_num_frames++;
+
+        timer.stop();
+        m_time += timer();
+    }
+
+    /// Force a new shape table at the next frame (e.g. after adding assets to existing bodies).
+    void Invalidate() { m_valid = false; }
+
+    /// Return the number of frames written.
+    int GetNumFrames() const { return m_num_frames; }
+
+    /// Return the number of bytes written so far.
+    size_t GetNumBytes() const { return m_file.GetNumBytes(); }
+
+    /// Return the effective compression level (0 if built without zlib).
+    int GetCompression() const { return m_file.GetCompression(); }
+
+    /// Return the number of visualization assets not supported by the format (in the last shape table).
+    int GetNumSkippedShapes() const { return m_num_skipped; }
+
+    /// Return the cumulative wall-clock time spent in Write().
+    double GetTime() const { return m_time; }
+
+  private:
+    void WriteTable() {
+        using namespace chrono;
+        const auto& bodies = m_system->Get_bodylist();
+
+        m_table.Clear();
+        m_bodies.clear();
+        m_num_skipped = 0;
+
+        for (size_t i = 0; i < bodies.size(); i++) {
+            const auto& body = bodies[i];
+            m_bodies.push_back(body.get());
+            m_table.identifier.push_back(body->GetIdentifier());
+
+            ChColor color(0.8f, 0.8f, 0.8f);
+            for (const auto& asset : body->GetAssets()) {
+                if (auto color_asset = std::dynamic_pointer_cast<ChColorAsset>(asset)) {
+                    color = color_asset->GetColor();
+                    break;
+                }
+            }
+
+            for (const auto& asset : body->GetAssets()) {
+                auto visual = std::dynamic_pointer_cast<ChVisualization>(asset);
+                if (!visual)
+                    continue;
+                if (!AddShape(visual)) {
+                    m_num_skipped++;
+                    continue;
+                }
+                ChQuaternion<> rot = visual->Rot.Get_A_quaternion();
+                m_table.body.push_back((uint32_t)i);
+                m_table.pos.insert(m_table.pos.end(), {(float)visual->Pos.x(), (float)visual->Pos.y(),
+                                                       (float)visual->Pos.z()});
+                m_table.rot.insert(m_table.rot.end(),
+                                   {(float)rot.e0(), (float)rot.e1(), (float)rot.e2(), (float)rot.e3()});
+                m_table.color.insert(m_table.color.end(), {color.R, color.G, color.B});
+            }
+        }
+
+        m_file.WriteTable(m_table);
+        m_valid = true;
+    }
+
+    /// Append the type and dimensions of a supported shape (same values as utils::WriteShapesPovray).
+    bool AddShape(std::shared_ptr<chrono::ChVisualization> visual) {
+        using namespace chrono;
+        std::vector<double> dims;
+        std::string name;
+        collision::ShapeType type;
+
+        if (auto sphere = std::dynamic_pointer_cast<ChSphereShape>(visual)) {
+            type = collision::SPHERE;
+            dims = {sphere->GetSphereGeometry().rad};
+        } else if (auto ellipsoid = std::dynamic_pointer_cast<ChEllipsoidShape>(visual)) {
+            type = collision::ELLIPSOID;
+            const ChVector<>& size = ellipsoid->GetEllipsoidGeometry().rad;
+            dims = {size.x(), size.y(), size.z()};
+        } else if (auto box = std::dynamic_pointer_cast<ChBoxShape>(visual)) {
+            type = collision::BOX;
+            const ChVector<>& size = box->GetBoxGeometry().Size;
+            dims = {size.x(), size.y(), size.z()};
+        } else if (auto capsule = std::dynamic_pointer_cast<ChCapsuleShape>(visual)) {
+            type = collision::CAPSULE;
+            const geometry::ChCapsule& geom = capsule->GetCapsuleGeometry();
+            dims = {geom.rad, geom.hlen};
+        } else if (auto cylinder = std::dynamic_pointer_cast<ChCylinderShape>(visual)) {
+            type = collision::CYLINDER;
+            const geometry::ChCylinder& geom = cylinder->GetCylinderGeometry();
+            dims = {geom.rad, geom.p1.x(), geom.p1.y(), geom.p1.z(), geom.p2.x(), geom.p2.y(), geom.p2.z()};
+        } else if (auto cone = std::dynamic_pointer_cast<ChConeShape>(visual)) {
+            type = collision::CONE;
+            const geometry::ChCone& geom = cone->GetConeGeometry();
+            dims = {geom.rad.x(), geom.rad.y()};
+        } else if (auto rbox = std::dynamic_pointer_cast<ChRoundedBoxShape>(visual)) {
+            type = collision::ROUNDEDBOX;
+            const geometry::ChRoundedBox& geom = rbox->GetRoundedBoxGeometry();
+            dims = {geom.Size.x(), geom.Size.y(), geom.Size.z(), geom.radsphere};
+        } else if (auto rcyl = std::dynamic_pointer_cast<ChRoundedCylinderShape>(visual)) {
+            type = collision::ROUNDEDCYL;
+            const geometry::ChRoundedCylinder& geom = rcyl->GetRoundedCylinderGeometry();
+            dims = {geom.rad, geom.hlen, geom.radsphere};
+        } else if (auto mesh = std::dynamic_pointer_cast<ChTriangleMeshShape>(visual)) {
+            type = collision::TRIANGLEMESH;
+            name = "\"" + mesh->GetName() + "\"";
+        } else {
+            return false;
+        }
+
+        m_table.type.push_back((int32_t)type);
+        m_table.num_dims.push_back((uint8_t)dims.size());
+        for (int d = 0; d < frame_format::kMaxDims; d++)
+            m_table.dims.push_back(d < (int)dims.size() ? (float)dims[d] : 0.0f);
+        m_table.name.push_back(name);
+        return true;
+    }
+
+    chrono::ChSystem* m_system;
+    frame_format::FileWriter m_file;
+    frame_format::ShapeTable m_table;
+    frame_format::Frame m_frame;
+    std::vector<chrono::ChBody*> m_bodies;  ///< bodies described by the current shape table
+    bool m_valid;                           ///< false if a new shape table must be written
+    int m_num_frames;
+    int m_num_skipped;
+    double m_time;
+};
+
+#endif
@@ -18,6 +18,25 @@
 // bed of granular material, using either penalty or complementarity method for
 // frictional contact.
 //
+// In the DROPPING problem, the surface of the bed is sampled on a height map
+// (see height_map.h) at each output frame: the height maps are appended to the
+// binary raster file heightmap.bin, and the crater depth, diameter, rim height
+// and rim diameter around the ball (relative to the mean surface height before
+// impact) are written to crater.dat. Full-particle PovRay dumps are therefore
+// disabled by default (output.povray=true to enable them).
+//
+// The PIPELINE problem runs settling and dropping as the stages of a
+// StagePipeline (see stage_pipeline.h): the settled bed is cached in the cache
+// subdirectory of the output directory, keyed by a hash of the parameters the
+// settling depends on, so that changing only the drop parameters (drop height,
+// ball density, ...) reuses it without settling again.
+//
+// Usage:
+//   demo_crater [-s scenario.json] [key=value ...]
+// All problem definitions below can be overridden from a scenario file or the
+// command line (e.g. problem=DROPPING simulation.drop_height=0.2); see
+// GetProblemSpecs() for the available keys.
+//
 // The global reference frame has Z up.
 // All units SI.
 // =============================================================================
@@ -45,6 +64,10 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
+#include "../height_map.h"
+#include "../scenario.h"
+#include "../stage_pipeline.h"
+#include "../step_profiler.h"
 #include "../utils.h"
 
 using namespace chrono;
@@ -61,7 +84,7 @@ using std::endl;
 // Comment the following line to use NSC contact
 #define USE_SMC
 
-enum ProblemType { SETTLING, DROPPING };
+enum ProblemType { SETTLING, DROPPING, PIPELINE };
 
 ProblemType problem = SETTLING;
 
@@ -95,6 +118,9 @@ float contact_recovery_speed = 0.1;
 
 double tolerance = 1.0;
 
+// Number of broad-phase bins in each direction
+ChVector<int> bins_per_axis(20, 20, 20);
+
 // Contact force model
 #ifdef USE_SMC
 ChSystemSMC::ContactForceModel contact_force_model = ChSystemSMC::ContactForceModel::Hooke;
@@ -102,18 +128,22 @@ ChSystemSMC::TangentialDisplacementModel tangential_displ_mode = ChSystemSMC::Ta
 #endif
 
 // Output
-bool povray_output = true;
+bool povray_output = false;
+bool heightmap_output = true;
+double heightmap_cell = 1e-3;  // height map cell size
 
 #ifdef USE_SMC
-const std::string out_dir = "../CRATER_SMC";
+std::string out_dir = "../CRATER_SMC";
 #else
-const std::string out_dir = "../CRATER_NSC";
+std::string out_dir = "../CRATER_NSC";
 #endif
 
-const std::string pov_dir = out_dir + "/POVRAY";
-const std::string height_file = out_dir + "/height.dat";
-const std::string stats_file = out_dir + "/stats.dat";
-const std::string checkpoint_file = out_dir + "/settled.dat";
+std::string pov_dir = out_dir + "/POVRAY";
+std::string height_file = out_dir + "/height.dat";
+std::string stats_file = out_dir + "/stats.dat";
+std::string checkpoint_file = out_dir + "/settled.dat";
+std::string heightmap_file = out_dir + "/heightmap.bin";
+std::string crater_file = out_dir + "/crater.dat";
 
 int out_fps_settling = 120;
 int out_fps_dropping = 1200;
@@ -305,27 +335,38 @@ bool CheckSettled(ChSystem* sys, double threshold) {
 }
 
 // -----------------------------------------------------------------------------
-int main(int argc, char* argv[]) {
-// Create system
+// Move the falling ball (the first body of a settled system) just above the
+// granular material with a velocity given by free fall from the specified
+// height and starting at rest, and release it.
+// -----------------------------------------------------------------------------
+std::shared_ptr<ChBody> DropBall(ChSystemParallel* system) {
+    double z = FindHighest(system);
+    double vz = std::sqrt(2 * gravity * h);
+    cout << "Move falling ball with center at " << z + R_b + r_g << " and velocity " << vz << endl;
+    auto ball = system->Get_bodylist().at(0);
+    ball->SetMass(mass_b);
+    ball->SetInertiaXX(inertia_b);
+    ball->SetPos(ChVector<>(0, 0, z + r_g + R_b));
+    ball->SetRot(ChQuaternion<>(1, 0, 0, 0));
+    ball->SetPos_dt(ChVector<>(0, 0, -vz));
+    ball->SetBodyFixed(false);
+    return ball;
+}
+
+// -----------------------------------------------------------------------------
+// Create a Chrono::Parallel system with the solver and collision settings above,
+// using the specified number of threads.
+// -----------------------------------------------------------------------------
+ChSystemParallel* CreateSystem(int num_threads) {
 #ifdef USE_SMC
-    cout << "Create SMC system" << endl;
     ChSystemParallelSMC* msystem = new ChSystemParallelSMC();
 #else
-    cout << "Create NSC system" << endl;
     ChSystemParallelNSC* msystem = new ChSystemParallelNSC();
 #endif
 
-    // Debug log messages.
-    ////msystem->SetLoggingLevel(LOG_INFO, true);
-    ////msystem->SetLoggingLevel(LOG_TRACE, true);
-
     // Set number of threads.
-    int max_threads = omp_get_num_procs();
-    if (threads > max_threads)
-        threads = max_threads;
-    msystem->SetParallelThreadNumber(threads);
-    omp_set_num_threads(threads);
-    cout << "Using " << threads << " threads" << endl;
+    msystem->SetParallelThreadNumber(num_threads);
+    CHOMPfunctions::SetNumThreads(num_threads);
 
     msystem->GetSettings()->perform_thread_tuning = thread_tuning;
 
@@ -353,7 +394,221 @@ int main(int argc, char* argv[]) {
     msystem->GetSettings()->collision.collision_envelope = 0.05 * r_g;
 #endif
 
-    msystem->GetSettings()->collision.bins_per_axis = vec3(20, 20, 20);
+    msystem->GetSettings()->collision.bins_per_axis = vec3(bins_per_axis.x(), bins_per_axis.y(), bins_per_axis.z());
+
+    return msystem;
+}
+
+// -----------------------------------------------------------------------------
+// Run settling and dropping as the stages of a pipeline: the settled state is
+// cached, keyed by the parameters it depends on. Writes the ball height and
+// (if enabled) the height maps and crater metrics at the dropping output frames.
+// -----------------------------------------------------------------------------
+int RunPipeline() {
+    double zero_v = 0.1 * r_g;
+    int out_steps = (int)std::ceil((1.0 / time_step) / out_fps_dropping);
+
+    ChStreamOutAsciiFile hfile(height_file.c_str());
+    std::unique_ptr<ChStreamOutAsciiFile> cfile;
+    std::shared_ptr<ChBody> ball;
+    std::unique_ptr<HeightMap> heights;
+    double reference = 0;
+    HeightMap::Crater crater = {0, 0, 0, 0, false};
+    int sim_frame = 0;
+
+    StagePipeline pipeline([]() { return CreateSystem(threads); }, out_dir + "/cache");
+
+    // Settling: the ball is created fixed below the granular material.
+    pipeline.AddStage("settling")
+        .AddInput("gravity", gravity)
+        .AddInput("tolerance", tolerance)
+#ifdef USE_SMC
+        .AddInput("contact_force_model", (double)contact_force_model)
+        .AddInput("tangential_displ_mode", (double)tangential_displ_mode)
+#else
+        .AddInput("max_iteration_normal", max_iteration_normal)
+        .AddInput("max_iteration_sliding", max_iteration_sliding)
+        .AddInput("max_iteration_spinning", max_iteration_spinning)
+        .AddInput("contact_recovery_speed", contact_recovery_speed)
+#endif
+        .AddInput("particle_radius", r_g)
+        .AddInput("ball_radius", R_b)
+        .AddInput("hdimX", hDimX)
+        .AddInput("hdimY", hDimY)
+        .AddInput("hdimZ", hDimZ)
+        .AddInput("hthick", hThickness)
+        .AddInput("num_layers", numLayers)
+        .AddInput("layer_height", layerHeight)
+        .AddInput("granular_density", rho_g)
+        .AddInput("granular_young_modulus", Y_g)
+        .AddInput("granular_friction", mu_g)
+        .AddInput("granular_restitution", cr_g)
+        .AddInput("container_young_modulus", Y_c)
+        .AddInput("container_friction", mu_c)
+        .AddInput("container_restitution", cr_c)
+        .SetDuration(time_settling_min, time_settling_max, time_step)
+        .SetEntry([](ChSystemParallel* system) {
+            CreateFallingBall(system, -3 * R_b, 0);
+            system->Get_bodylist().at(0)->SetBodyFixed(true);
+            CreateObjects(system);
+        })
+        .SetExit([&](ChSystemParallel* system, double time) { return CheckSettled(system, zero_v); });
+
+    // Dropping: measurements only, not cached.
+    pipeline.AddStage("dropping")
+        .AddInput("drop_height", h)
+        .AddInput("ball_density", rho_b)
+        .SetDuration(0, time_dropping, time_step)
+        .SetCached(false)
+        .SetEntry([&](ChSystemParallel* system) {
+            ball = DropBall(system);
+            if (heightmap_output) {
+                heights.reset(new HeightMap(system));
+                heights->SetGrid(-hDimX, -hDimY, hDimX, hDimY, heightmap_cell);
+                reference = heights->Update().GetMeanHeight();
+                heights->OpenRaster(heightmap_file);
+                cfile.reset(new ChStreamOutAsciiFile(crater_file.c_str()));
+            }
+        })
+        .SetStep([&](ChSystemParallel* system, double time) {
+            if (++sim_frame % out_steps != 0)
+                return;
+            hfile << time << "  " << ball->GetPos().z() << "\n";
+            if (heightmap_output) {
+                heights->Update().WriteRaster(time);
+                crater = heights->MeasureCrater(ball->GetPos().x(), ball->GetPos().y(), reference);
+                *cfile << time << "  " << crater.depth << "  " << crater.diameter << "  " << crater.rim_height << "  "
+                      << crater.rim_diameter << "\n";
+            }
+        });
+
+    if (!pipeline.Run())
+        return 1;
+
+    cout << "==================================" << endl;
+    pipeline.PrintSummary();
+    cout << "Ball height:       " << ball->GetPos().z() << endl;
+    if (heightmap_output) {
+        cout << "Crater depth:      " << crater.depth << endl;
+        cout << "Crater diameter:   " << crater.diameter << (crater.valid ? "" : "  (surface not recovered)") << endl;
+        cout << "Rim height:        " << crater.rim_height << "  diameter: " << crater.rim_diameter << endl;
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Override the global problem definitions from a scenario file and/or
+// command-line arguments (see scenario.h). Keys not specified keep the values
+// above. Quantities derived from the overridden values are recomputed.
+// -----------------------------------------------------------------------------
+bool GetProblemSpecs(int argc, char* argv[], Scenario& scenario) {
+    if (!scenario.Parse(argc, argv))
+        return false;
+
+    scenario.ReadEnum("problem", problem, {{"SETTLING", SETTLING}, {"DROPPING", DROPPING}, {"PIPELINE", PIPELINE}});
+
+    scenario.Read("threads.num", threads);
+    scenario.Read("threads.tuning", thread_tuning);
+
+    scenario.Read("simulation.gravity", gravity);
+    scenario.Read("simulation.time_settling_min", time_settling_min);
+    scenario.Read("simulation.time_settling_max", time_settling_max);
+    scenario.Read("simulation.time_dropping", time_dropping);
+    scenario.Read("simulation.drop_height", h);
+
+    scenario.Read("solver.time_step", time_step);
+    scenario.Read("solver.tolerance", tolerance);
+#ifdef USE_SMC
+    scenario.ReadContactForceModel("solver.contact_force_model", contact_force_model);
+    scenario.ReadTangentialDisplacementModel("solver.tangential_displ_mode", tangential_displ_mode);
+#else
+    scenario.Read("solver.max_iteration_normal", max_iteration_normal);
+    scenario.Read("solver.max_iteration_sliding", max_iteration_sliding);
+    scenario.Read("solver.max_iteration_spinning", max_iteration_spinning);
+    scenario.Read("solver.contact_recovery_speed", contact_recovery_speed);
+#endif
+
+    scenario.Read("collision.bins_per_axis", bins_per_axis);
+
+    scenario.Read("geometry.particle_radius", r_g);
+    scenario.Read("geometry.ball_radius", R_b);
+    scenario.Read("geometry.hdimX", hDimX);
+    scenario.Read("geometry.hdimY", hDimY);
+    scenario.Read("geometry.hdimZ", hDimZ);
+    scenario.Read("geometry.hthick", hThickness);
+    scenario.Read("geometry.num_layers", numLayers);
+    scenario.Read("geometry.layer_height", layerHeight);
+
+    scenario.Read("material.granular.density", rho_g);
+    scenario.Read("material.granular.young_modulus", Y_g);
+    scenario.Read("material.granular.friction", mu_g);
+    scenario.Read("material.granular.restitution", cr_g);
+    scenario.Read("material.ball.density", rho_b);
+    scenario.Read("material.container.young_modulus", Y_c);
+    scenario.Read("material.container.friction", mu_c);
+    scenario.Read("material.container.restitution", cr_c);
+
+    scenario.Read("output.dir", out_dir);
+    scenario.Read("output.povray", povray_output);
+    scenario.Read("output.heightmap", heightmap_output);
+    scenario.Read("output.heightmap_cell", heightmap_cell);
+    scenario.Read("output.fps_settling", out_fps_settling);
+    scenario.Read("output.fps_dropping", out_fps_dropping);
+    scenario.Read("output.timing_frame", timing_frame);
+
+    vol_g = (4.0 / 3) * CH_C_PI * r_g * r_g * r_g;
+    mass_g = rho_g * vol_g;
+    inertia_g = 0.4 * mass_g * r_g * r_g * ChVector<>(1, 1, 1);
+    vol_b = (4.0 / 3) * CH_C_PI * R_b * R_b * R_b;
+    mass_b = rho_b * vol_b;
+    inertia_b = 0.4 * mass_b * R_b * R_b * ChVector<>(1, 1, 1);
+
+    pov_dir = out_dir + "/POVRAY";
+    height_file = out_dir + "/height.dat";
+    stats_file = out_dir + "/stats.dat";
+    checkpoint_file = out_dir + "/settled.dat";
+    heightmap_file = out_dir + "/heightmap.bin";
+    crater_file = out_dir + "/crater.dat";
+
+    return scenario.CheckUnused();
+}
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    // Process the scenario specification
+    Scenario scenario;
+    if (!GetProblemSpecs(argc, argv, scenario))
+        return 1;
+
+    // Clamp the number of threads to the maximum available.
+    int max_threads = omp_get_num_procs();
+    if (threads > max_threads)
+        threads = max_threads;
+    cout << "Using " << threads << " threads" << endl;
+
+    // The pipeline manages its own systems.
+    if (problem == PIPELINE) {
+        if (!filesystem::create_directory(filesystem::path(out_dir))) {
+            cout << "Error creating directory " << out_dir << endl;
+            return 1;
+        }
+        scenario.Write(out_dir + "/scenario.json");
+        return RunPipeline();
+    }
+
+// Create system
+#ifdef USE_SMC
+    cout << "Create SMC system" << endl;
+#else
+    cout << "Create NSC system" << endl;
+#endif
+
+    ChSystemParallel* msystem = CreateSystem(threads);
+
+    // Debug log messages.
+    ////msystem->SetLoggingLevel(LOG_INFO, true);
+    ////msystem->SetLoggingLevel(LOG_TRACE, true);
 
     // Depending on problem type:
     // - Select end simulation time
@@ -383,18 +638,7 @@ int main(int argc, char* argv[]) {
         utils::ReadCheckpoint(msystem, checkpoint_file);
         cout << "  done.  Read " << msystem->Get_bodylist().size() << " bodies." << endl;
 
-        // Move the falling ball just above the granular material with a velocity
-        // given by free fall from the specified height and starting at rest.
-        double z = FindHighest(msystem);
-        double vz = std::sqrt(2 * gravity * h);
-        cout << "Move falling ball with center at " << z + R_b + r_g << " and velocity " << vz << endl;
-        ball = msystem->Get_bodylist().at(0);
-        ball->SetMass(mass_b);
-        ball->SetInertiaXX(inertia_b);
-        ball->SetPos(ChVector<>(0, 0, z + r_g + R_b));
-        ball->SetRot(ChQuaternion<>(1, 0, 0, 0));
-        ball->SetPos_dt(ChVector<>(0, 0, -vz));
-        ball->SetBodyFixed(false);
+        ball = DropBall(msystem);
     }
 
     // Number of steps
@@ -414,6 +658,7 @@ int main(int argc, char* argv[]) {
         cout << "Error creating directory " << pov_dir << endl;
         return 1;
     }
+    scenario.Write(out_dir + "/scenario.json");
 
     // Perform the simulation
     double time = 0;
@@ -425,6 +670,24 @@ int main(int argc, char* argv[]) {
     ChStreamOutAsciiFile sfile(stats_file.c_str());
     ChStreamOutAsciiFile hfile(height_file.c_str());
 
+    StepProfiler profiler(msystem);
+
+    // Surface height map and crater metrics (DROPPING only), relative to the mean surface height before impact.
+    HeightMap heights(msystem);
+    heights.SetGrid(-hDimX, -hDimY, hDimX, hDimY, heightmap_cell);
+    double reference = 0;
+    HeightMap::Crater crater = {0, 0, 0, 0, false};
+    std::unique_ptr<ChStreamOutAsciiFile> cfile;
+    if (problem == DROPPING && heightmap_output) {
+        reference = heights.Update().GetMeanHeight();
+        cfile.reset(new ChStreamOutAsciiFile(crater_file.c_str()));
+        if (!heights.OpenRaster(heightmap_file)) {
+            cout << "Error creating " << heightmap_file << endl;
+            return 1;
+        }
+        cout << "Reference surface height: " << reference << endl;
+    }
+
 #ifdef CHRONO_OPENGL
     opengl::ChOpenGLWindow& gl_window = opengl::ChOpenGLWindow::getInstance();
     gl_window.Initialize(1280, 720, "Crater Test", msystem);
@@ -464,6 +727,15 @@ int main(int argc, char* argv[]) {
                 cout << "     Ball height:    " << ball->GetPos().z() << endl;
             }
 
+            // Sample the surface and measure the crater.
+            if (problem == DROPPING && heightmap_output) {
+                heights.Update().WriteRaster(time);
+                crater = heights.MeasureCrater(ball->GetPos().x(), ball->GetPos().y(), reference);
+                *cfile << time << "  " << crater.depth << "  " << crater.diameter << "  " << crater.rim_height << "  "
+                      << crater.rim_diameter << "\n";
+                cout << "     Crater depth:   " << crater.depth << "  diameter: " << crater.diameter << endl;
+            }
+
             out_frame++;
             next_out_frame += out_steps;
             num_contacts = 0;
@@ -486,7 +758,7 @@ int main(int argc, char* argv[]) {
 #endif
 
         ////progressbar(out_steps + sim_frame - next_out_frame + 1, out_steps);
-        TimingOutput(msystem);
+        profiler.Record();
 
         time += time_step;
         sim_frame++;
@@ -506,9 +778,15 @@ int main(int argc, char* argv[]) {
     }
 
     // Final stats
+    profiler.PrintSummary();
     cout << "==================================" << endl;
     cout << "Number of bodies:  " << msystem->Get_bodylist().size() << endl;
     cout << "Lowest position:   " << FindLowest(msystem) << endl;
+    if (problem == DROPPING && heightmap_output) {
+        cout << "Crater depth:      " << crater.depth << endl;
+        cout << "Crater diameter:   " << crater.diameter << (crater.valid ? "" : "  (surface not recovered)") << endl;
+        cout << "Rim height:        " << crater.rim_height << "  diameter: " << crater.rim_diameter << endl;
+    }
     cout << "Simulation time:   " << exec_time << endl;
     cout << "Number of threads: " << threads << endl;
 
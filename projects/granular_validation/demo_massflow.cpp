@@ -18,11 +18,21 @@
 // container and the mass of the collected material is measured over time, using
 // either penalty or complementarity method for frictional contact.
 //
+// The flow is measured at the gate (plane z = 0) with a FluxCounter (see
+// projects/flux_counter.h): particles are counted as they cross the plane,
+// giving the collected mass at step resolution (written to flux.dat at the end
+// of the DROPPING phase). The simulation stops once the container is empty.
+//
+// With 'deterministic' set, two runs with the same number of threads produce
+// bit-identical results (see projects/deterministic_mode.h), e.g. for comparing
+// the performance of two builds; state hashes are printed at the end of the run.
+//
 // The global reference frame has Z up.
 // All units SI.
 // =============================================================================
 
 #include <cstdio>
+#include <memory>
 #include <vector>
 #include <cmath>
 
@@ -37,6 +47,11 @@
 
 #include "chrono_thirdparty/filesystem/path.h"
 
+#include "../bulk_generator.h"
+#include "../deterministic_mode.h"
+#include "../flux_counter.h"
+#include "../particle_query.h"
+
 // Control use of OpenGL run-time rendering
 // Note: CHRONO_OPENGL is defined in ChConfig.h
 ////#undef CHRONO_OPENGL
@@ -73,6 +88,10 @@ int threads = 100;
 // Perform dynamic tuning of number of threads?
 bool thread_tuning = true;
 
+// Reproducible run (fixed threads, no thread tuning, seeded particle generation)?
+bool deterministic = false;
+unsigned int seed = 1;
+
 // Simulation parameters
 double gravity = 9.81;
 
@@ -104,6 +123,7 @@ const std::string out_dir = "../MASSFLOW_NSC";
 
 const std::string pov_dir = out_dir + "/POVRAY";
 const std::string flow_file = out_dir + "/flow.dat";
+const std::string flux_file = out_dir + "/flux.dat";
 const std::string stats_file = out_dir + "/stats.dat";
 const std::string checkpoint_file = out_dir + "/settled.dat";
 
@@ -266,6 +286,28 @@ void CreateParticles(ChSystemParallel* system) {
     mat_g->SetFriction(mu_g);
 #endif
 
+    ChVector<> hdims(0.3 * height, 0.3 * width, 0);
+    ChVector<> center(-0.4 * height, 0, 0.8 * height);
+    ChVector<> vel(0, 0, 0);
+    double r = 1.01 * r_g;
+
+    // Seeded sampling for reproducible runs (utils::Generator seeds its Poisson-disk sampler from the clock)
+    if (deterministic) {
+        BulkGenerator gen(system, seed);
+        gen.SetMaterial(mat_g);
+        gen.SetRadius(r_g);
+        gen.SetDensity(rho_g);
+        gen.SetBodyIdentifier(1);
+
+        while (gen.GetTotalNumBodies() < (int)desired_num_particles) {
+            gen.CreateObjectsBox(center, hdims, 2 * r);
+            center.z() += 2 * r;
+        }
+
+        std::cout << "Number of particles: " << gen.GetTotalNumBodies() << std::endl;
+        return;
+    }
+
     // Create a mixture entirely made out of spheres
     utils::Generator gen(system);
 
@@ -276,11 +318,6 @@ void CreateParticles(ChSystemParallel* system) {
 
     gen.setBodyIdentifier(1);
 
-    ChVector<> hdims(0.3 * height, 0.3 * width, 0);
-    ChVector<> center(-0.4 * height, 0, 0.8 * height);
-    ChVector<> vel(0, 0, 0);
-    double r = 1.01 * r_g;
-
     while (gen.getTotalNumBodies() < desired_num_particles) {
         gen.createObjectsBox(utils::POISSON_DISK, 2 * r, center, hdims, vel);
         center.z() += 2 * r;
@@ -289,58 +326,6 @@ void CreateParticles(ChSystemParallel* system) {
     std::cout << "Number of particles: " << gen.getTotalNumBodies() << std::endl;
 }
 
-// -----------------------------------------------------------------------------
-// Find and return the body with specified identifier.
-// -----------------------------------------------------------------------------
-ChBody* FindBodyById(ChSystemParallel* sys, int id) {
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() == id)
-            return body.get();
-    }
-
-    return NULL;
-}
-
-// -----------------------------------------------------------------------------
-// Find the number of particles whose height is below and above, respectively,
-// the specified value.
-// -----------------------------------------------------------------------------
-int GetNumParticlesBelowHeight(ChSystemParallel* sys, double value) {
-    int count = 0;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 0 && body->GetPos().z() < value)
-            count++;
-    }
-    return count;
-}
-
-int GetNumParticlesAboveHeight(ChSystemParallel* sys, double value) {
-    int count = 0;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 0 && body->GetPos().z() > value)
-            count++;
-    }
-    return count;
-}
-
-// -----------------------------------------------------------------------------
-// Return true if all bodies in the granular mix have a linear velocity whose
-// magnitude is below the specified value.
-// -----------------------------------------------------------------------------
-bool CheckSettled(ChSystemParallel* sys, double threshold) {
-    double t2 = threshold * threshold;
-
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 0) {
-            double vel2 = body->GetPos_dt().Length2();
-            if (vel2 > t2)
-                return false;
-        }
-    }
-
-    return true;
-}
-
 // -----------------------------------------------------------------------------
 int main(int argc, char* argv[]) {
 // Create system
@@ -356,11 +341,16 @@ int main(int argc, char* argv[]) {
     int max_threads = omp_get_num_procs();
     if (threads > max_threads)
         threads = max_threads;
-    msystem->SetParallelThreadNumber(threads);
-    omp_set_num_threads(threads);
     cout << "Using " << threads << " threads" << endl;
 
-    msystem->GetSettings()->perform_thread_tuning = thread_tuning;
+    std::unique_ptr<DeterministicMode> det_mode;
+    if (deterministic) {
+        det_mode = std::unique_ptr<DeterministicMode>(new DeterministicMode(msystem, threads, seed));
+    } else {
+        msystem->SetParallelThreadNumber(threads);
+        omp_set_num_threads(threads);
+        msystem->GetSettings()->perform_thread_tuning = thread_tuning;
+    }
 
     // Set gravitational acceleration
     msystem->Set_G_acc(ChVector<>(0, 0, -gravity));
@@ -391,6 +381,10 @@ int main(int argc, char* argv[]) {
     int out_fps;
     ChBody* insert;
 
+    // Statistics of the granular material (settling check) and particle flux through the gate
+    ParticleQuery particles(msystem);
+    FluxCounter flux(msystem, 0);
+
     switch (problem) {
         case SETTLING:
             time_end = time_settling_max;
@@ -403,7 +397,7 @@ int main(int argc, char* argv[]) {
             time_end = time_dropping_max;
             out_fps = out_fps_dropping;
             utils::ReadCheckpoint(msystem, checkpoint_file);
-            insert = FindBodyById(msystem, 0);
+            insert = particles.FindBodyById(0).get();
             break;
     }
 
@@ -442,6 +436,8 @@ int main(int argc, char* argv[]) {
 #endif
 
     while (time < time_end) {
+        flux.Update();
+
         // Output data
         if (sim_frame == next_out_frame) {
             char filename[100];
@@ -455,10 +451,15 @@ int main(int argc, char* argv[]) {
             cout << "             Execution time: " << exec_time << endl;
 
             double opening = insert->GetPos().x() + 0.5 * height + delta;
-            int count = GetNumParticlesBelowHeight(msystem, 0);
+            int count = flux.GetNumPassed();
+            double mass = flux.GetMassPassed();
 
             cout << "             Gap:            " << -opening << endl;
             cout << "             Flow:           " << count << endl;
+            cout << "             Mass:           " << mass << endl;
+
+            if (det_mode)
+                cout << "             State hash:     " << DeterministicMode::ToHex(det_mode->Record()) << endl;
 
             sfile << time << "  " << exec_time << "  " << num_contacts / out_steps << "\n";
             sfile.GetFstream().sync();
@@ -470,8 +471,8 @@ int main(int argc, char* argv[]) {
                     cout << "             Checkpoint:     " << msystem->Get_bodylist().size() << " bodies" << endl;
                     break;
                 case DROPPING:
-                    // Save current gap opening and number of dropped particles.
-                    ffile << time << "  " << -opening << "  " << count << "\n";
+                    // Save current gap opening, number and mass of dropped particles.
+                    ffile << time << "  " << -opening << "  " << count << "  " << mass << "\n";
                     ffile.GetFstream().sync();
                     break;
             }
@@ -482,14 +483,13 @@ int main(int argc, char* argv[]) {
         }
 
         // Check for early termination of settling phase.
-        if (problem == SETTLING && time > time_settling_min && CheckSettled(msystem, zero_v)) {
+        if (problem == SETTLING && time > time_settling_min && particles.Update().max_speed <= zero_v) {
             cout << "Granular material settled...  time = " << time << endl;
             break;
         }
 
         // Check for early termination of dropping phase.
-        if (problem == DROPPING && time > time_opening &&
-            GetNumParticlesAboveHeight(msystem, -pos_collector / 2) == 0) {
+        if (problem == DROPPING && time > time_opening && flux.GetNumRemaining() == 0) {
             cout << "Granular material exhausted... time = " << time << endl;
             break;
         }
@@ -529,11 +529,20 @@ int main(int argc, char* argv[]) {
         cout << "  done.  Wrote " << msystem->Get_bodylist().size() << " bodies." << endl;
     }
 
+    // Write the crossings of the gate (cumulative mass flow at step resolution)
+    if (problem == DROPPING) {
+        flux.WriteEvents(flux_file);
+        cout << "Wrote " << flux.GetNumCrossed() << " crossings (mass " << flux.GetMassCrossed() << ") to "
+             << flux_file << endl;
+    }
+
     // Final stats
     cout << "==================================" << endl;
     cout << "Number of bodies:  " << msystem->GetNumBodies() << endl;
     cout << "Simulation time:   " << exec_time << endl;
     cout << "Number of threads: " << threads << endl;
+    if (det_mode)
+        det_mode->PrintSummary();
 
     return 0;
 }
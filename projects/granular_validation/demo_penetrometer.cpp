@@ -18,11 +18,28 @@
 // bed of granular material, using either penalty or complementarity method for
 // frictional contact.
 //
+// The SWEEP problem drops one penetrator for every combination of the values in
+// sweep_shape, sweep_density, and sweep_velocity (impact velocity), all into the
+// same settled bed kept in memory (read once from the settled checkpoint file,
+// or obtained by settling the material first). Cases can run concurrently on
+// subsets of the threads (sweep_concurrent). The penetration depth vs. time of
+// each case is written to its own file, and a summary of each case to sweep.dat
+// in the output directory.
+//
+// The PIPELINE problem runs settling and dropping as the stages of a
+// StagePipeline (see stage_pipeline.h): the settled bed is cached in the cache
+// subdirectory of the output directory, keyed by a hash of the parameters the
+// settling depends on, so that changing only the penetrator (shape, density,
+// drop height) reuses it without settling again.
+//
 // The global reference frame has Z up.
 // All units SI.
 // =============================================================================
 
 #include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <cmath>
 
@@ -45,6 +62,10 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
+#include "../parameter_sweep.h"
+#include "../particle_query.h"
+#include "../stage_pipeline.h"
+#include "../system_snapshot.h"
 #include "../utils.h"
 
 using namespace chrono;
@@ -61,7 +82,7 @@ using std::endl;
 // Comment the following line to use NSC contact
 #define USE_SMC
 
-enum ProblemType { SETTLING, DROPPING };
+enum ProblemType { SETTLING, DROPPING, SWEEP, PIPELINE };
 ProblemType problem = DROPPING;
 
 enum PenetratorGeom { P_SPHERE, P_CONE1, P_CONE2 };
@@ -116,6 +137,7 @@ const std::string pov_dir = out_dir + "/POVRAY";
 const std::string height_file = out_dir + "/height.dat";
 const std::string stats_file = out_dir + "/stats.dat";
 const std::string checkpoint_file = out_dir + "/settled.dat";
+const std::string sweep_file = out_dir + "/sweep.dat";
 
 int out_fps_settling = 120;
 int out_fps_dropping = 1200;
@@ -167,6 +189,12 @@ double layerHeight = 1e-2;
 // Drop height (above surface of settled granular material)
 double h = 10e-2;
 
+// Parameter sweep (SWEEP only)
+std::vector<double> sweep_shape = {P_SPHERE, P_CONE1, P_CONE2};    // penetrator geometry (PenetratorGeom)
+std::vector<double> sweep_density = {700};                          // penetrator density
+std::vector<double> sweep_velocity = {std::sqrt(2 * gravity * h)};  // impact velocity
+int sweep_concurrent = 1;  // number of cases run concurrently (threads are split evenly)
+
 // -----------------------------------------------------------------------------
 // Create the dynamic objects:
 // - granular material consisting of identical spheres with specified radius and
@@ -228,28 +256,28 @@ int CreateObjects(ChSystemParallel* msystem) {
 // -----------------------------------------------------------------------------
 // Calculate intertia properties of the falling object
 // -----------------------------------------------------------------------------
-void CalculatePenetratorInertia(double & mass, ChVector<> & inertia) {
+void CalculatePenetratorInertia(PenetratorGeom geom, double density, double & mass, ChVector<> & inertia) {
     ChVector<> gyr_b;  // components gyration
     double vol_b;      // components volume
-    switch (penetGeom) {
+    switch (geom) {
         case P_SPHERE:
             vol_b = utils::CalcSphereVolume(R_b);
             gyr_b = utils::CalcSphereGyration(R_b).diagonal();
-            mass = rho_b * vol_b;
+            mass = density * vol_b;
             inertia = mass * gyr_b;
             break;
         case P_CONE1:
             // apex angle = 30 de
             vol_b = utils::CalcConeVolume(R_bc1, H_bc1);
             gyr_b = utils::CalcConeGyration(R_bc1, H_bc1).diagonal();
-            mass = rho_b * vol_b;
+            mass = density * vol_b;
             inertia = mass * gyr_b;
             break;
         case P_CONE2:
             // apex angle = 60 deg
             vol_b = utils::CalcConeVolume(R_bc2, H_bc2);
             gyr_b = utils::CalcConeGyration(R_bc2, H_bc2).diagonal();
-            mass = rho_b * vol_b;
+            mass = density * vol_b;
             inertia = mass * gyr_b;
             break;
 	}
@@ -258,9 +286,9 @@ void CalculatePenetratorInertia(double & mass, ChVector<> & inertia) {
 // -----------------------------------------------------------------------------
 // Create collision geometry of the falling object
 // -----------------------------------------------------------------------------
-void CreatePenetratorGeometry(std::shared_ptr<ChBody> obj) {
+void CreatePenetratorGeometry(std::shared_ptr<ChBody> obj, PenetratorGeom geom) {
     obj->GetCollisionModel()->ClearModel();
-    switch (penetGeom) {
+    switch (geom) {
         case P_SPHERE:
             utils::AddSphereGeometry(obj.get(), R_b);
             break;
@@ -279,9 +307,9 @@ void CreatePenetratorGeometry(std::shared_ptr<ChBody> obj) {
 // -----------------------------------------------------------------------------
 // Calculate falling object height
 // -----------------------------------------------------------------------------
-double RecalcPenetratorLocation(double z) {
+double RecalcPenetratorLocation(double z, PenetratorGeom geom) {
     double locZ = 0;
-    switch (penetGeom) {
+    switch (geom) {
         case P_SPHERE:
             locZ = z + R_b + r_g;
             break;
@@ -298,37 +326,14 @@ double RecalcPenetratorLocation(double z) {
 }
 
 // -----------------------------------------------------------------------------
-// Find the height of the highest and lowest, respectively, sphere in the
-// granular mix, respectively.  We only look at bodies whith stricty positive
-// identifiers (to exclude the containing bin).
-// -----------------------------------------------------------------------------
-double FindHighest(ChSystem* sys) {
-    double highest = 0;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 0 && body->GetPos().z() > highest)
-            highest = body->GetPos().z();
-    }
-    return highest;
-}
-
-double FindLowest(ChSystem* sys) {
-    double lowest = 1000;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 0 && body->GetPos().z() < lowest)
-            lowest = body->GetPos().z();
-    }
-    return lowest;
-}
-
+// Create the falling object with the specified geometry and density, such that
+// its bottom point is just above the granular material and its downward initial
+// velocity has the specified magnitude.
 // -----------------------------------------------------------------------------
-// Create the falling object such that its bottom point is at the specified height
-// and its downward initial velocity has the specified magnitude.
-// -----------------------------------------------------------------------------
-std::shared_ptr<ChBody> CreatePenetrator(ChSystemParallel* msystem) {
-    // Estimate object initial location and velocity
-    double z = FindHighest(msystem);
-    double vz = std::sqrt(2 * gravity * h);
-    double initLoc = RecalcPenetratorLocation(z);
+std::shared_ptr<ChBody> CreatePenetrator(ChSystemParallel* msystem, PenetratorGeom geom, double density, double vz) {
+    // Estimate object initial location
+    double z = ParticleQuery(msystem).Update().max_height;
+    double initLoc = RecalcPenetratorLocation(z, geom);
     cout << "creating object at " << initLoc << " and velocity " << vz << endl;
 
 // Create a material for the penetrator
@@ -353,7 +358,7 @@ std::shared_ptr<ChBody> CreatePenetrator(ChSystemParallel* msystem) {
 
     double mass;
     ChVector<> inertia;
-    CalculatePenetratorInertia(mass, inertia);
+    CalculatePenetratorInertia(geom, density, mass, inertia);
     obj->SetIdentifier(Id_b);
     obj->SetMass(mass);
     obj->SetInertiaXX(inertia);
@@ -363,30 +368,12 @@ std::shared_ptr<ChBody> CreatePenetrator(ChSystemParallel* msystem) {
     obj->SetCollide(true);
     obj->SetBodyFixed(false);
 
-    CreatePenetratorGeometry(obj);
+    CreatePenetratorGeometry(obj, geom);
 
     msystem->AddBody(obj);
     return obj;
 }
 
-// -----------------------------------------------------------------------------
-// Return true if all bodies in the granular mix have a linear velocity whose
-// magnitude is below the specified value.
-// -----------------------------------------------------------------------------
-bool CheckSettled(ChSystem* sys, double threshold) {
-    double t2 = threshold * threshold;
-
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 0) {
-            double vel2 = body->GetPos_dt().Length2();
-            if (vel2 > t2)
-                return false;
-        }
-    }
-
-    return true;
-}
-
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 void SetArgumentsForMbdFromInput(int argc, char* argv[]) {
@@ -417,40 +404,19 @@ void SetArgumentsForMbdFromInput(int argc, char* argv[]) {
 }
 
 // -----------------------------------------------------------------------------
-int main(int argc, char* argv[]) {
-    // Create output directories.
-    if (!filesystem::create_directory(filesystem::path(out_dir))) {
-        cout << "Error creating directory " << out_dir << endl;
-        return 1;
-    }
-    if (!filesystem::create_directory(filesystem::path(pov_dir))) {
-        cout << "Error creating directory " << pov_dir << endl;
-        return 1;
-    }
-    
-    // Get problem parameters from arguments
-    SetArgumentsForMbdFromInput(argc, argv);
-
-// Create system
+// Create a Chrono::Parallel system with the solver and collision settings above,
+// using the specified number of threads.
+// -----------------------------------------------------------------------------
+ChSystemParallel* CreateSystem(int num_threads) {
 #ifdef USE_SMC
-    cout << "Create SMC system" << endl;
     ChSystemParallelSMC* msystem = new ChSystemParallelSMC();
 #else
-    cout << "Create NSC system" << endl;
     ChSystemParallelNSC* msystem = new ChSystemParallelNSC();
 #endif
 
-    // Debug log messages.
-    ////msystem->SetLoggingLevel(LOG_INFO, true);
-    ////msystem->SetLoggingLevel(LOG_TRACE, true);
-
     // Set number of threads.
-    int max_threads = omp_get_num_procs();
-    if (threads > max_threads)
-        threads = max_threads;
-    msystem->SetParallelThreadNumber(threads);
-    omp_set_num_threads(threads);
-    cout << "Using " << threads << " threads" << endl;
+    msystem->SetParallelThreadNumber(num_threads);
+    CHOMPfunctions::SetNumThreads(num_threads);
 
     msystem->GetSettings()->perform_thread_tuning = thread_tuning;
 
@@ -480,6 +446,243 @@ int main(int argc, char* argv[]) {
 
     msystem->GetSettings()->collision.bins_per_axis = vec3(20, 20, 20);
 
+    return msystem;
+}
+
+// -----------------------------------------------------------------------------
+// Settle the granular material in the specified system (parameter sweep, when
+// no settled checkpoint file exists): stop when the particle speeds fall below
+// the zero velocity level after time_settling_min, or at time_settling_max.
+// -----------------------------------------------------------------------------
+double SettleMaterial(ChSystemParallel* system) {
+    double zero_v = 0.1 * r_g;
+    ParticleQuery particles(system);
+
+    double time = 0;
+    while (time < time_settling_max) {
+        if (time > time_settling_min && particles.Update().max_speed <= zero_v)
+            break;
+        system->DoStepDynamics(time_step);
+        time += time_step;
+    }
+
+    return time;
+}
+
+// -----------------------------------------------------------------------------
+// Run one case of the parameter sweep: restore the settled bed, drop a
+// penetrator with the specified geometry, density, and impact velocity, and
+// record its penetration depth (depth of its bottom point below the surface of
+// the granular material) for time_dropping. The depth history is written to
+// its own file; returns the maximum and final depths and the time of the
+// maximum depth.
+// -----------------------------------------------------------------------------
+ParameterSweep::Results RunDropCase(const SystemSnapshot& settled, const std::vector<double>& params, int num_threads) {
+    PenetratorGeom geom = static_cast<PenetratorGeom>((int)params[0]);
+    double density = params[1];
+    double velocity = params[2];
+
+    // Chrono object construction uses global (non thread-safe) counters; serialize it with the other cases.
+    std::unique_ptr<ChSystemParallel> msystem;
+    {
+        std::lock_guard<std::recursive_mutex> lock(SystemSnapshot::GetConstructionMutex());
+        msystem.reset(CreateSystem(num_threads));
+        settled.Restore(msystem.get());
+    }
+
+    // Height of the penetrator center when its bottom point touches the surface.
+    double z_surface = RecalcPenetratorLocation(ParticleQuery(msystem.get()).Update().max_height, geom);
+    std::shared_ptr<ChBody> obj;
+    {
+        std::lock_guard<std::recursive_mutex> lock(SystemSnapshot::GetConstructionMutex());
+        obj = CreatePenetrator(msystem.get(), geom, density, velocity);
+    }
+
+    char filename[100];
+    sprintf(filename, "%s/depth_%d_%g_%g.dat", out_dir.c_str(), (int)geom, density, velocity);
+    std::ofstream dfile(filename);
+
+    int out_steps = (int)std::ceil((1.0 / time_step) / out_fps_dropping);
+    double max_depth = 0;
+    double max_time = 0;
+    double depth = 0;
+    double time = 0;
+    int sim_frame = 0;
+    while (time < time_dropping) {
+        depth = z_surface - obj->GetPos().z();
+        if (depth > max_depth) {
+            max_depth = depth;
+            max_time = time;
+        }
+        if (sim_frame % out_steps == 0)
+            dfile << time << "  " << depth << "  " << obj->GetPos_dt().z() << "\n";
+
+        msystem->DoStepDynamics(time_step);
+        time += time_step;
+        sim_frame++;
+    }
+
+    return {{"max_depth", max_depth}, {"final_depth", depth}, {"max_depth_time", max_time}};
+}
+
+// -----------------------------------------------------------------------------
+// Parameter sweep: obtain the settled bed once, keep it in memory, and run one
+// drop case for each combination of the swept values.
+// -----------------------------------------------------------------------------
+int RunSweep() {
+    std::unique_ptr<ChSystemParallel> msystem(CreateSystem(threads));
+
+    if (filesystem::path(checkpoint_file).exists()) {
+        cout << "Read checkpoint data from " << checkpoint_file;
+        utils::ReadCheckpoint(msystem.get(), checkpoint_file);
+        cout << "  done.  Read " << msystem->Get_bodylist().size() << " bodies." << endl;
+    } else {
+        int num_particles = CreateObjects(msystem.get());
+        cout << "Granular material:  " << num_particles << " particles" << endl;
+        double time = SettleMaterial(msystem.get());
+        cout << "Granular material settled...  time = " << time << endl;
+        utils::WriteCheckpoint(msystem.get(), checkpoint_file);
+    }
+
+    SystemSnapshot settled;
+    settled.Capture(msystem.get());
+    msystem.reset();
+
+    ParameterSweep sweep;
+    sweep.AddParameter("shape", sweep_shape);
+    sweep.AddParameter("density", sweep_density);
+    sweep.AddParameter("velocity", sweep_velocity);
+    sweep.SetNumThreads(threads);
+    sweep.SetNumConcurrent(sweep_concurrent);
+
+    cout << "Parameter sweep:  " << sweep.GetNumCases() << " cases, " << sweep_concurrent << " concurrent" << endl;
+    sweep.Run([&](const std::vector<double>& params, int num_threads) {
+        return RunDropCase(settled, params, num_threads);
+    });
+
+    if (!sweep.Write(sweep_file)) {
+        cout << "Error writing " << sweep_file << endl;
+        return 1;
+    }
+    cout << "Sweep time: " << sweep.GetTime() << "  results in " << sweep_file << endl;
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Run settling and dropping as the stages of a pipeline: the settled state is
+// cached, keyed by the parameters it depends on. Writes the penetrator height
+// at the dropping output frames.
+// -----------------------------------------------------------------------------
+int RunPipeline() {
+    double zero_v = 0.1 * r_g;
+    int out_steps = (int)std::ceil((1.0 / time_step) / out_fps_dropping);
+
+    std::ofstream hfile(height_file.c_str());
+    std::shared_ptr<ChBody> obj;
+    int sim_frame = 0;
+
+    StagePipeline pipeline([]() { return CreateSystem(threads); }, out_dir + "/cache");
+
+    pipeline.AddStage("settling")
+        .AddInput("gravity", gravity)
+        .AddInput("tolerance", tolerance)
+#ifdef USE_SMC
+        .AddInput("contact_force_model", (double)contact_force_model)
+        .AddInput("tangential_displ_mode", (double)tangential_displ_mode)
+#else
+        .AddInput("max_iteration_normal", max_iteration_normal)
+        .AddInput("max_iteration_sliding", max_iteration_sliding)
+        .AddInput("max_iteration_spinning", max_iteration_spinning)
+        .AddInput("contact_recovery_speed", contact_recovery_speed)
+#endif
+        .AddInput("particle_radius", r_g)
+        .AddInput("hdimX", hDimX)
+        .AddInput("hdimY", hDimY)
+        .AddInput("hdimZ", hDimZ)
+        .AddInput("hthick", hThickness)
+        .AddInput("num_layers", numLayers)
+        .AddInput("layer_height", layerHeight)
+        .AddInput("granular_density", rho_g)
+        .AddInput("granular_young_modulus", Y_g)
+        .AddInput("granular_friction", mu_g)
+        .AddInput("granular_restitution", cr_g)
+        .AddInput("container_young_modulus", Y_c)
+        .AddInput("container_friction", mu_c)
+        .AddInput("container_restitution", cr_c)
+        .SetDuration(time_settling_min, time_settling_max, time_step)
+        .SetEntry([](ChSystemParallel* system) { CreateObjects(system); })
+        .SetExit([zero_v](ChSystemParallel* system, double time) {
+            return ParticleQuery(system).Update().max_speed <= zero_v;
+        });
+
+    // Dropping: measurements only, not cached.
+    pipeline.AddStage("dropping")
+        .AddInput("penetrator_shape", (double)penetGeom)
+        .AddInput("penetrator_density", rho_b)
+        .AddInput("drop_height", h)
+        .SetDuration(0, time_dropping, time_step)
+        .SetCached(false)
+        .SetEntry([&](ChSystemParallel* system) {
+            obj = CreatePenetrator(system, penetGeom, rho_b, std::sqrt(2 * gravity * h));
+        })
+        .SetStep([&](ChSystemParallel* system, double time) {
+            if (++sim_frame % out_steps != 0)
+                return;
+            hfile << time << "  " << obj->GetPos().z() << "\n";
+        });
+
+    if (!pipeline.Run())
+        return 1;
+
+    cout << "==================================" << endl;
+    pipeline.PrintSummary();
+    cout << "Number of bodies:  " << pipeline.GetSystem()->Get_bodylist().size() << endl;
+    cout << "Penetrator height: " << obj->GetPos().z() << endl;
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    // Create output directories.
+    if (!filesystem::create_directory(filesystem::path(out_dir))) {
+        cout << "Error creating directory " << out_dir << endl;
+        return 1;
+    }
+    if (!filesystem::create_directory(filesystem::path(pov_dir))) {
+        cout << "Error creating directory " << pov_dir << endl;
+        return 1;
+    }
+    
+    // Get problem parameters from arguments
+    SetArgumentsForMbdFromInput(argc, argv);
+
+    // Clamp the number of threads to the maximum available.
+    int max_threads = omp_get_num_procs();
+    if (threads > max_threads)
+        threads = max_threads;
+    cout << "Using " << threads << " threads" << endl;
+
+    // The parameter sweep manages its own systems.
+    if (problem == SWEEP)
+        return RunSweep();
+    if (problem == PIPELINE)
+        return RunPipeline();
+
+// Create system
+#ifdef USE_SMC
+    cout << "Create SMC system" << endl;
+#else
+    cout << "Create NSC system" << endl;
+#endif
+
+    ChSystemParallel* msystem = CreateSystem(threads);
+
+    // Debug log messages.
+    ////msystem->SetLoggingLevel(LOG_INFO, true);
+    ////msystem->SetLoggingLevel(LOG_TRACE, true);
+
     // Depending on problem type:
     // - Select end simulation time
     // - Select output FPS
@@ -505,7 +708,7 @@ int main(int argc, char* argv[]) {
         cout << "Read checkpoint data from " << checkpoint_file;
         utils::ReadCheckpoint(msystem, checkpoint_file);
         cout << "  done.  Read " << msystem->Get_bodylist().size() << " bodies." << endl;
-        obj = CreatePenetrator(msystem);
+        obj = CreatePenetrator(msystem, penetGeom, rho_b, std::sqrt(2 * gravity * h));
     }
 
     // Number of steps
@@ -543,13 +746,18 @@ int main(int argc, char* argv[]) {
     gl_window.SetRenderMode(opengl::WIREFRAME);
 #endif
 
+    // Statistics of the granular material
+    ParticleQuery particles(msystem);
+
     while (time < time_end) {
+        const ParticleQuery::Result& stats = particles.Update();
+
         if (sim_frame == next_out_frame) {
             cout << endl;
             cout << "---- Frame:          " << out_frame << endl;
             cout << "     Sim frame:      " << sim_frame << endl;
             cout << "     Time:           " << time << endl;
-            cout << "     Lowest point:   " << FindLowest(msystem) << endl;
+            cout << "     Lowest point:   " << stats.min_height << endl;
             cout << "     Avg. contacts:  " << num_contacts / out_steps << endl;
             cout << "     Execution time: " << exec_time << endl;
 
@@ -581,7 +789,7 @@ int main(int argc, char* argv[]) {
             num_contacts = 0;
         }
 
-        if (problem == SETTLING && time > time_settling_min && CheckSettled(msystem, zero_v)) {
+        if (problem == SETTLING && time > time_settling_min && stats.max_speed <= zero_v) {
             cout << "Granular material settled...  time = " << time << endl;
             break;
         }
@@ -598,7 +806,6 @@ int main(int argc, char* argv[]) {
 #endif
 
         ////progressbar(out_steps + sim_frame - next_out_frame + 1, out_steps);
-        //TimingOutput(msystem);
 
         time += time_step;
         sim_frame++;
@@ -620,7 +827,7 @@ int main(int argc, char* argv[]) {
     // Final stats
     cout << "==================================" << endl;
     cout << "Number of bodies:  " << msystem->Get_bodylist().size() << endl;
-    cout << "Lowest position:   " << FindLowest(msystem) << endl;
+    cout << "Lowest position:   " << particles.Update().min_height << endl;
     cout << "Simulation time:   " << exec_time << endl;
     cout << "Number of threads: " << threads << endl;
 
@@ -48,6 +48,7 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
+#include "../step_profiler.h"
 #include "../utils.h"
 
 using namespace chrono;
@@ -430,6 +431,10 @@ int main(int argc, char* argv[]) {
     shearStream.SetNumFormat("%16.4e");
     forceStream.SetNumFormat("%16.4e");
 
+    // Per-step statistics are written to the stats file
+    StepProfiler profiler(my_system);
+    profiler.SetOutputFile(&statsStream);
+
 // Create the OpenGL visualization window
 
 #ifdef CHRONO_OPENGL
@@ -488,7 +493,7 @@ int main(int argc, char* argv[]) {
         my_system->DoStepDynamics(time_step);
 #endif
 
-        TimingOutput(my_system, &statsStream);
+        profiler.Record();
 
         //  Output to files
 
@@ -532,5 +537,7 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    profiler.PrintSummary();
+
     return 0;
 }
@@ -20,11 +20,45 @@
 // the load body. During the shearing mode, the shear plate is translated in the
 // x-direction at a specified velocity.
 //
+// Usage:
+//   directShear [-s scenario.json] [key=value ...]
+// All problem definitions below can be overridden from a scenario file or the
+// command line (e.g. problem=SHEARING simulation.normal_pressure=64000); see
+// GetProblemSpecs() for the available keys.
+//
+// The SWEEP problem runs the pressing and shearing phases for every combination
+// of the values in sweep.friction, sweep.cohesion, and sweep.normal_pressure,
+// all starting from the same settled state kept in memory (read once from the
+// settled checkpoint file, or obtained by settling the material first). Cases
+// can run concurrently on subsets of the threads (sweep.concurrent); a summary
+// of each case is written to sweep.dat in the output directory.
+//
+// The MULTISTAGE problem shears the material (material.granular.*) at each of
+// the normal pressures in sweep.normal_pressure, every stage pressed from the
+// same settled state, and fits the Mohr-Coulomb envelopes of the peak and
+// residual shear stresses (see shear_envelope.h). The stage results are written
+// to multistage.dat and the envelopes to directShear_multistage.json (metrics
+// format) in the output directory.
+//
+// At the end of SETTLING and PRESSING, and at every output frame of these
+// phases, the bulk density of the bed is measured on a voxel grid (see
+// density_field.h); the final profiles of solid fraction, bulk density and
+// coordination number are written to density.dat. With
+// material.granular.press_to_bulk_density, PRESSING ends as soon as the bed
+// reaches material.granular.bulk_density.
+//
+// With servo.pressing, PRESSING drives the load plate to the normal pressure
+// with a stress servo and ends as soon as the stress and the plate height have
+// converged; the dead-weight plate is then used for SHEARING as before.
+//
 // The global reference frame has Z up.
 // All units SI (CGS, i.e., centimeter - gram - second)
 // =============================================================================
 
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <utility>
 #include <vector>
 #include <valarray>
 #include <string>
@@ -41,6 +75,8 @@
 #include "chrono_parallel/solver/ChSystemDescriptorParallel.h"
 
 #include "chrono_thirdparty/filesystem/path.h"
+#include "chrono_thirdparty/rapidjson/prettywriter.h"
+#include "chrono_thirdparty/rapidjson/stringbuffer.h"
 
 // Control use of OpenGL run-time rendering
 // Note: CHRONO_OPENGL is defined in ChConfig.h
@@ -50,6 +86,15 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
+#include "../density_field.h"
+#include "../frame_writer.h"
+#include "../parameter_sweep.h"
+#include "../particle_query.h"
+#include "../plate_servo.h"
+#include "../scenario.h"
+#include "../shear_envelope.h"
+#include "../step_profiler.h"
+#include "../system_snapshot.h"
 #include "../utils.h"
 
 using namespace chrono;
@@ -66,7 +111,7 @@ using std::endl;
 // Comment the following line to use NSC contact
 //#define USE_SMC
 
-enum ProblemType { SETTLING, PRESSING, SHEARING, TESTING };
+enum ProblemType { SETTLING, PRESSING, SHEARING, TESTING, SWEEP, MULTISTAGE };
 
 ProblemType problem = TESTING;
 
@@ -94,6 +139,11 @@ bool use_actuator = true;
 // Save PovRay post-processing data?
 bool write_povray_data = true;
 
+// Write all visualization frames to a single binary file (convert with frame_to_povray)
+// instead of one PovRay text file per frame?
+bool binary_frames = true;
+int frame_compression = 1;  // zlib level (0: none; ignored without zlib support)
+
 // Simulation times
 double time_settling_min = 0.1;
 double time_settling_max = 1.0;
@@ -108,6 +158,18 @@ double time_testing = 2;
 // Stopping criteria for settling (as fraction of particle radius)
 double settling_tol = 0.2;
 
+// Stress-controlled pressing: lower the (kinematic) load plate with a PI servo on
+// the normal stress under it and end PRESSING when stress and plate height
+// converge (see plate_servo.h), instead of releasing a dead-weight plate.
+bool servo_pressing = false;
+double servo_speed = 1;          // [cm/s] maximum plate speed
+double servo_kp = 1;             // proportional gain (on the relative stress error)
+double servo_ki = 0.5;           // [1/s] integral gain
+double servo_filter = 1e-3;      // [s] time constant of the stress filter
+double servo_stress_tol = 0.02;  // relative stress tolerance
+double servo_height_tol = 0.01;  // [cm] plate height tolerance
+double servo_window = 0.05;      // [s] time window for convergence
+
 // Solver settings
 #ifdef USE_SMC
 double time_step = 1e-5;
@@ -125,6 +187,9 @@ bool clamp_bilaterals = false;
 double bilateral_clamp_speed = 10e30;
 double tolerance = 1;
 
+// Number of broad-phase bins in each direction
+ChVector<int> bins_per_axis(10, 10, 10);
+
 // Contact force model
 #ifdef USE_SMC
 ChSystemSMC::ContactForceModel contact_force_model = ChSystemSMC::ContactForceModel::Hertz;
@@ -133,16 +198,21 @@ ChSystemSMC::TangentialDisplacementModel tangential_displ_mode = ChSystemSMC::Ta
 
 // Output
 #ifdef USE_SMC
-const std::string out_dir = "../DIRECTSHEAR_SMC";
+std::string out_dir = "../DIRECTSHEAR_SMC";
 #else
-const std::string out_dir = "../DIRECTSHEAR_NSC";
+std::string out_dir = "../DIRECTSHEAR_NSC";
 #endif
 
-const std::string pov_dir = out_dir + "/POVRAY";
-const std::string shear_file = out_dir + "/shear.dat";
-const std::string stats_file = out_dir + "/stats.dat";
-const std::string settled_ckpnt_file = out_dir + "/settled.dat";
-const std::string pressed_ckpnt_file = out_dir + "/pressed.dat";
+std::string pov_dir = out_dir + "/POVRAY";
+std::string frames_file = out_dir + "/frames.bin";
+std::string shear_file = out_dir + "/shear.dat";
+std::string stats_file = out_dir + "/stats.dat";
+std::string sweep_file = out_dir + "/sweep.dat";
+std::string multistage_file = out_dir + "/multistage.dat";
+std::string multistage_metrics_file = out_dir + "/directShear_multistage.json";
+std::string density_file = out_dir + "/density.dat";
+std::string settled_ckpnt_file = out_dir + "/settled.dat";
+std::string pressed_ckpnt_file = out_dir + "/pressed.dat";
 
 // Frequency for visualization output
 int out_fps_settling = 120;
@@ -192,6 +262,7 @@ double r_g = 0.3;      // [cm] radius of granular spheres
 double rho_g = 2.550;  // [g/cm^3] density of granules
 
 double desiredBulkDensity = 1.5;  // [g/cm^3] desired bulk density
+bool press_to_density = false;    // end PRESSING when the bed reaches the desired bulk density?
 
 float Y_g = (float)(Pa2cgs * 4e7);  // (1,000 times softer than experiment on glass beads)
 float cr_g = 0.87f;
@@ -203,6 +274,16 @@ int Id_ball = -4;
 double mass_ball = 200;            // [g] mass of testing ball
 double radius_ball = 0.9 * hdimX;  // [cm] radius of testing ball
 
+// Parameter sweep (SWEEP only); an empty friction list uses mu_g
+// The normal pressures and the concurrency also apply to the stages of MULTISTAGE.
+std::vector<double> sweep_friction;
+std::vector<double> sweep_cohesion = {0};
+std::vector<double> sweep_pressure = {Pa2cgs * 3.1e3, Pa2cgs * 6.4e3, Pa2cgs * 12.5e3, Pa2cgs * 24.2e3};
+int sweep_concurrent = 1;  // number of cases run concurrently (threads are split evenly)
+
+// Time constant of the filter on the shear stress for the peak and residual values (SWEEP and MULTISTAGE)
+double shear_filter = 0.01;
+
 // =============================================================================
 // Create the containing bin (the ground), the shear box, and the load plate.
 //
@@ -469,86 +550,24 @@ void CreateBall(ChSystemParallel* system) {
 }
 
 // =============================================================================
-// Find the height of the highest and lowest sphere in the granular mix. We only
-// look at bodies whith positive identifiers (to exclude all other bodies).
-// =============================================================================
-
-void FindHeightRange(ChSystemParallel* sys, double& lowest, double& highest) {
-    highest = -1000;
-    lowest = 1000;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() <= 0)
-            continue;
-        double h = body->GetPos().z();
-        if (h < lowest)
-            lowest = h;
-        else if (h > highest)
-            highest = h;
-    }
-}
-
-// =============================================================================
-//
-//// TODO:  cannot do this with SMC!!!!!
-//
-// =============================================================================
-
-void setBulkDensity(ChSystem* sys, double bulkDensity) {
-    double vol_g = (4.0 / 3) * CH_C_PI * r_g * r_g * r_g;
-
-    double normalPlateHeight = sys->Get_bodylist().at(1)->GetPos().z() - hdimZ;
-    double bottomHeight = 0;
-    double boxVolume = hdimX * 2 * hdimX * 2 * (normalPlateHeight - bottomHeight);
-    double granularVolume = (sys->Get_bodylist().size() - 3) * vol_g;
-    double reqDensity = bulkDensity * boxVolume / granularVolume;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 1) {
-            body->SetMass(reqDensity * vol_g);
-        }
-    }
-
-    cout << "N Bodies: " << sys->Get_bodylist().size() << endl;
-    cout << "Box Volume: " << boxVolume << endl;
-    cout << "Granular Volume: " << granularVolume << endl;
-    cout << "Desired bulk density = " << bulkDensity << ", Required Body Density = " << reqDensity << endl;
-}
-
+// Create a Chrono::Parallel system with the solver and collision settings above,
+// using the specified number of threads.
 // =============================================================================
 
-int main(int argc, char* argv[]) {
-    // Create output directories.
-    if (!filesystem::create_directory(filesystem::path(out_dir))) {
-        cout << "Error creating directory " << out_dir << endl;
-        return 1;
-    }
-    if (!filesystem::create_directory(filesystem::path(pov_dir))) {
-        cout << "Error creating directory " << pov_dir << endl;
-        return 1;
-    }
-
-// -------------
-// Create system
-// -------------
-
+ChSystemParallel* CreateSystem(int num_threads) {
 #ifdef USE_SMC
-    cout << "Create SMC system" << endl;
     ChSystemParallelSMC* msystem = new ChSystemParallelSMC();
 #else
-    cout << "Create NSC system" << endl;
     ChSystemParallelNSC* msystem = new ChSystemParallelNSC();
 #endif
 
     msystem->Set_G_acc(ChVector<>(0, 0, -gravity));
 
     // Set number of threads.
-    int max_threads = omp_get_num_procs();
-    if (threads > max_threads)
-        threads = max_threads;
-    msystem->SetParallelThreadNumber(threads);
-    omp_set_num_threads(threads);
-    cout << "Using " << threads << " threads" << endl;
+    msystem->SetParallelThreadNumber(num_threads);
+    CHOMPfunctions::SetNumThreads(num_threads);
 
-    msystem->GetSettings()->max_threads = threads;
+    msystem->GetSettings()->max_threads = num_threads;
     msystem->GetSettings()->perform_thread_tuning = thread_tuning;
 
     // Edit system settings
@@ -575,7 +594,467 @@ int main(int argc, char* argv[]) {
     msystem->GetSettings()->collision.collision_envelope = 0.05 * r_g;
 #endif
 
-    msystem->GetSettings()->collision.bins_per_axis = vec3(10, 10, 10);
+    msystem->GetSettings()->collision.bins_per_axis = vec3(bins_per_axis.x(), bins_per_axis.y(), bins_per_axis.z());
+
+    return msystem;
+}
+
+// =============================================================================
+// Advance the simulation until the highest particle settles (the deviation of
+// its height over the last 'time_min' seconds falls below the specified
+// fraction of a particle radius) or until 'time_max'. Used by the parameter
+// sweep, without any output. Returns the simulated time.
+// =============================================================================
+
+double SettleMaterial(ChSystemParallel* system, double time_min, double time_max) {
+    int buffer_size = (int)std::ceil(time_min / time_step);
+    std::valarray<double> hdata(0.0, buffer_size);
+
+    ParticleQuery particles(system);
+
+    double time = 0;
+    int sim_frame = 0;
+    while (time < time_max) {
+        hdata[sim_frame % buffer_size] = particles.Update().max_height;
+
+        if (time > time_min) {
+            double mean_height = hdata.sum() / buffer_size;
+            std::valarray<double> x = hdata - mean_height;
+            if (std::sqrt((x * x).sum() / buffer_size) < settling_tol * r_g)
+                break;
+        }
+
+        system->DoStepDynamics(time_step);
+        time += time_step;
+        sim_frame++;
+    }
+
+    return time;
+}
+
+// =============================================================================
+// Run one case of the parameter sweep: restore the settled state with the
+// specified granular friction and cohesion (adhesion for SMC), press the
+// material under the specified normal pressure, then shear it. Returns the peak
+// shear stress, the residual shear stress (average over the last quarter of the
+// shearing phase), both of the filtered stress signal, and the height of the
+// load plate after pressing and at the end of shearing.
+// =============================================================================
+
+ParameterSweep::Results RunShearCase(const SystemSnapshot& settled,
+                                     const std::vector<double>& params,
+                                     int num_threads) {
+    double friction = params[0];
+    double cohesion = params[1];
+    double pressure = params[2];
+
+    // Chrono object construction uses global (non thread-safe) counters; serialize it with the other cases.
+    std::unique_ptr<ChSystemParallel> msystem;
+    {
+        std::lock_guard<std::recursive_mutex> lock(SystemSnapshot::GetConstructionMutex());
+        msystem.reset(CreateSystem(num_threads));
+
+        // Restore the settled state, editing the granular material (positive identifiers).
+        settled.Restore(msystem.get(), [&](std::shared_ptr<ChMaterialSurface> mat, int identifier) {
+            if (identifier <= 0)
+                return;
+#ifdef USE_SMC
+            auto mat_g = std::static_pointer_cast<ChMaterialSurfaceSMC>(mat);
+            mat_g->SetFriction((float)friction);
+            mat_g->SetAdhesion((float)cohesion);
+#else
+            auto mat_g = std::static_pointer_cast<ChMaterialSurfaceNSC>(mat);
+            mat_g->SetFriction((float)friction);
+            mat_g->SetCohesion((float)cohesion);
+#endif
+        });
+    }
+
+    auto ground = msystem->Get_bodylist().at(0);
+    auto shearBox = msystem->Get_bodylist().at(1);
+    auto loadPlate = msystem->Get_bodylist().at(2);
+
+    // Pressing: release the load plate just above the granular material.
+    ParticleQuery particles(msystem.get());
+    double highest = particles.Update().max_height;
+    ChVector<> pos = loadPlate->GetPos();
+    loadPlate->SetPos(ChVector<>(pos.x(), pos.y(), highest + 2 * r_g));
+    {
+        std::lock_guard<std::recursive_mutex> lock(SystemSnapshot::GetConstructionMutex());
+        ConnectLoadPlate(msystem.get(), ground, loadPlate);
+    }
+    loadPlate->SetBodyFixed(false);
+
+    double area = 4 * hdimX * hdimY;
+    loadPlate->SetMass(pressure * area / gravity);
+
+    SettleMaterial(msystem.get(), time_pressing_min, time_pressing_max);
+    double plate_z_pressed = loadPlate->GetPos().z();
+
+    // Shearing (the actuator motion is a function of the system time).
+    msystem->SetChTime(0);
+    std::shared_ptr<ChLinkLinActuator> actuator;
+    if (use_actuator) {
+        std::lock_guard<std::recursive_mutex> lock(SystemSnapshot::GetConstructionMutex());
+        ConnectShearBox(msystem.get(), ground, shearBox);
+        actuator = std::static_pointer_cast<ChLinkLinActuator>(msystem->SearchLink("actuator"));
+    }
+    shearBox->SetBodyFixed(!use_actuator);
+
+    int write_steps = (int)std::ceil((1.0 / time_step) / write_fps);
+    ShearStressMonitor monitor(shear_filter, 0.75 * time_shearing);
+    double time = 0;
+    int sim_frame = 0;
+    while (time < time_shearing) {
+        ChVector<> pos_old = shearBox->GetPos();
+        msystem->DoStepDynamics(time_step);
+
+        if (!use_actuator) {
+            double xpos_new = pos_old.x() + desiredVelocity * time_step;
+            shearBox->SetPos(ChVector<>(xpos_new, pos_old.y(), pos_old.z()));
+            shearBox->SetPos_dt(ChVector<>(desiredVelocity, 0, 0));
+        }
+
+        // Shear force from the actuator reaction or, for kinematic shearing, from the contacts on the shear box.
+        if (sim_frame % write_steps == 0) {
+            double force;
+            if (use_actuator) {
+                force = std::abs(actuator->Get_react_force().x());
+            } else {
+                msystem->CalculateContactForces();
+                force = std::abs(msystem->GetBodyContactForce(shearBox).x);
+            }
+            monitor.Add(time, force / area);
+        }
+
+        time += time_step;
+        sim_frame++;
+    }
+
+    return {{"peak_shear_stress", monitor.GetPeak()},
+            {"residual_shear_stress", monitor.GetResidual()},
+            {"plate_z_pressed", plate_z_pressed},
+            {"plate_z_final", loadPlate->GetPos().z()}};
+}
+
+// =============================================================================
+// Obtain the settled state (from the settled checkpoint file if it exists, by
+// settling the material otherwise) and keep it in memory.
+// =============================================================================
+
+void CaptureSettledState(SystemSnapshot& settled) {
+    std::unique_ptr<ChSystemParallel> msystem(CreateSystem(threads));
+
+    if (filesystem::path(settled_ckpnt_file).exists()) {
+        cout << "Read checkpoint data from " << settled_ckpnt_file;
+        utils::ReadCheckpoint(msystem.get(), settled_ckpnt_file);
+        cout << "  done.  Read " << msystem->Get_bodylist().size() << " bodies." << endl;
+    } else {
+        CreateMechanismBodies(msystem.get());
+        int num_particles = CreateGranularMaterial(msystem.get());
+        cout << "Granular material:  " << num_particles << " particles" << endl;
+        double time = SettleMaterial(msystem.get(), time_settling_min, time_settling_max);
+        cout << "Granular material settled...  time = " << time << endl;
+        utils::WriteCheckpoint(msystem.get(), settled_ckpnt_file);
+    }
+
+    settled.Capture(msystem.get());
+}
+
+// =============================================================================
+// Parameter sweep: obtain the settled state once, keep it in memory, and run
+// one pressing and shearing case for each combination of the swept values.
+// =============================================================================
+
+int RunSweep() {
+    SystemSnapshot settled;
+    CaptureSettledState(settled);
+
+    if (sweep_friction.empty())
+        sweep_friction.push_back(mu_g);
+
+    ParameterSweep sweep;
+    sweep.AddParameter("friction", sweep_friction);
+    sweep.AddParameter("cohesion", sweep_cohesion);
+    sweep.AddParameter("normal_pressure", sweep_pressure);
+    sweep.SetNumThreads(threads);
+    sweep.SetNumConcurrent(sweep_concurrent);
+
+    cout << "Parameter sweep:  " << sweep.GetNumCases() << " cases, " << sweep_concurrent << " concurrent" << endl;
+    sweep.Run([&](const std::vector<double>& params, int num_threads) {
+        return RunShearCase(settled, params, num_threads);
+    });
+
+    if (!sweep.Write(sweep_file)) {
+        cout << "Error writing " << sweep_file << endl;
+        return 1;
+    }
+    cout << "Sweep time: " << sweep.GetTime() << "  results in " << sweep_file << endl;
+
+    return 0;
+}
+
+// =============================================================================
+// Multi-stage direct shear test: one pressing and shearing stage per normal
+// pressure, all from the same settled state (stages run concurrently as in the
+// parameter sweep). The Mohr-Coulomb envelopes of the peak and residual shear
+// stresses are reported as metrics (friction angle in degrees, cohesion in Pa).
+// =============================================================================
+
+// Metrics of the multi-stage test, in file order.
+typedef std::vector<std::pair<std::string, double>> MetricList;
+
+void AddEnvelope(MetricList& metrics, const std::string& name, MohrCoulombFit& envelope) {
+    bool valid = envelope.Fit();
+    cout << "Mohr-Coulomb envelope (" << name << "):  friction angle " << envelope.GetFrictionAngle()
+         << " deg  cohesion " << envelope.GetCohesion() / Pa2cgs << " Pa  R2 " << envelope.GetR2() << endl;
+    metrics.push_back({name + "_valid", valid ? 1 : 0});
+    metrics.push_back({name + "_friction_angle (deg)", envelope.GetFrictionAngle()});
+    metrics.push_back({name + "_cohesion (Pa)", envelope.GetCohesion() / Pa2cgs});
+    metrics.push_back({name + "_r2", envelope.GetR2()});
+}
+
+// Write the results in the JSON layout of the metrics tests (so that they can be compared with metrics_compare).
+bool WriteMetrics(const std::string& filename,
+                  const std::string& name,
+                  bool passed,
+                  double execution_time,
+                  const MetricList& metrics) {
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("name");
+    writer.String(name.c_str());
+    writer.Key("project_name");
+    writer.String("Chrono::Parallel");
+    writer.Key("passed");
+    writer.Int(passed ? 1 : 0);
+    writer.Key("execution_time");
+    writer.Double(execution_time);
+    writer.Key("metrics");
+    writer.StartObject();
+    for (const auto& m : metrics) {
+        writer.Key(m.first.c_str());
+        writer.Double(m.second);
+    }
+    writer.EndObject();
+    writer.EndObject();
+
+    std::ofstream ofs(filename);
+    if (!ofs.is_open())
+        return false;
+    ofs << buffer.GetString() << endl;
+    return ofs.good();
+}
+
+int RunMultiStage() {
+    SystemSnapshot settled;
+    CaptureSettledState(settled);
+
+    ParameterSweep stages;
+    stages.AddParameter("friction", {mu_g});
+    stages.AddParameter("cohesion", {0});
+    stages.AddParameter("normal_pressure", sweep_pressure);
+    stages.SetNumThreads(threads);
+    stages.SetNumConcurrent(sweep_concurrent);
+
+    cout << "Multi-stage shear test:  " << stages.GetNumCases() << " stages, " << sweep_concurrent << " concurrent"
+         << endl;
+    stages.Run([&](const std::vector<double>& params, int num_threads) {
+        return RunShearCase(settled, params, num_threads);
+    });
+
+    if (!stages.Write(multistage_file))
+        cout << "Error writing " << multistage_file << endl;
+
+    // Failure envelopes from the stages that completed (stresses in the order returned by RunShearCase).
+    MetricList metrics;
+    MohrCoulombFit peak;
+    MohrCoulombFit residual;
+    int num_failed = 0;
+    for (int i = 0; i < stages.GetNumCases(); i++) {
+        if (stages.HasFailed(i)) {
+            num_failed++;
+            continue;
+        }
+        double pressure = stages.GetCase(i)[2];
+        const ParameterSweep::Results& results = stages.GetResults(i);
+        peak.Add(pressure, results[0].second);
+        residual.Add(pressure, results[1].second);
+        std::string stage = "stage" + std::to_string(i + 1);
+        metrics.push_back({stage + "_normal_pressure (Pa)", pressure / Pa2cgs});
+        metrics.push_back({stage + "_peak_shear_stress (Pa)", results[0].second / Pa2cgs});
+        metrics.push_back({stage + "_residual_shear_stress (Pa)", results[1].second / Pa2cgs});
+    }
+
+    AddEnvelope(metrics, "peak", peak);
+    AddEnvelope(metrics, "residual", residual);
+    metrics.push_back({"num_stages", stages.GetNumCases()});
+    metrics.push_back({"num_threads", threads});
+
+    bool passed = num_failed == 0 && peak.GetNumPoints() >= 2;
+    if (!WriteMetrics(multistage_metrics_file, "directShear_multistage", passed, stages.GetTime(), metrics))
+        cout << "Error writing " << multistage_metrics_file << endl;
+    cout << "Multi-stage time: " << stages.GetTime() << "  " << (passed ? "PASSED" : "FAILED") << "  envelopes in "
+         << multistage_metrics_file << endl;
+
+    return passed ? 0 : 1;
+}
+
+// =============================================================================
+// Override the global problem definitions from a scenario file and/or
+// command-line arguments (see scenario.h). Keys not specified keep the values
+// above; units are those of this program (cgs).
+// =============================================================================
+
+bool GetProblemSpecs(int argc, char* argv[], Scenario& scenario) {
+    if (!scenario.Parse(argc, argv))
+        return false;
+
+    scenario.ReadEnum("problem", problem,
+                      {{"SETTLING", SETTLING},
+                       {"PRESSING", PRESSING},
+                       {"SHEARING", SHEARING},
+                       {"TESTING", TESTING},
+                       {"SWEEP", SWEEP},
+                       {"MULTISTAGE", MULTISTAGE}});
+
+    scenario.Read("threads.num", threads);
+    scenario.Read("threads.tuning", thread_tuning);
+
+    scenario.Read("simulation.time_settling_min", time_settling_min);
+    scenario.Read("simulation.time_settling_max", time_settling_max);
+    scenario.Read("simulation.time_pressing_min", time_pressing_min);
+    scenario.Read("simulation.time_pressing_max", time_pressing_max);
+    scenario.Read("simulation.time_shearing", time_shearing);
+    scenario.Read("simulation.time_testing", time_testing);
+    scenario.Read("simulation.settling_tol", settling_tol);
+    scenario.Read("simulation.use_actuator", use_actuator);
+    scenario.Read("simulation.normal_pressure", normalPressure);
+    scenario.Read("simulation.shear_velocity", desiredVelocity);
+    scenario.Read("simulation.gravity", gravity);
+
+    scenario.Read("servo.pressing", servo_pressing);
+    scenario.Read("servo.max_speed", servo_speed);
+    scenario.Read("servo.kp", servo_kp);
+    scenario.Read("servo.ki", servo_ki);
+    scenario.Read("servo.filter", servo_filter);
+    scenario.Read("servo.stress_tol", servo_stress_tol);
+    scenario.Read("servo.height_tol", servo_height_tol);
+    scenario.Read("servo.window", servo_window);
+
+    scenario.Read("solver.time_step", time_step);
+    scenario.Read("solver.tolerance", tolerance);
+    scenario.Read("solver.max_iteration_bilateral", max_iteration_bilateral);
+    scenario.Read("solver.clamp_bilaterals", clamp_bilaterals);
+    scenario.Read("solver.bilateral_clamp_speed", bilateral_clamp_speed);
+#ifdef USE_SMC
+    scenario.ReadContactForceModel("solver.contact_force_model", contact_force_model);
+    scenario.ReadTangentialDisplacementModel("solver.tangential_displ_mode", tangential_displ_mode);
+#else
+    scenario.Read("solver.max_iteration_normal", max_iteration_normal);
+    scenario.Read("solver.max_iteration_sliding", max_iteration_sliding);
+    scenario.Read("solver.max_iteration_spinning", max_iteration_spinning);
+    scenario.Read("solver.contact_recovery_speed", contact_recovery_speed);
+#endif
+
+    scenario.Read("collision.bins_per_axis", bins_per_axis);
+
+    scenario.Read("geometry.hdimX", hdimX);
+    scenario.Read("geometry.hdimY", hdimY);
+    scenario.Read("geometry.hdimZ", hdimZ);
+    scenario.Read("geometry.hthick", hthick);
+    scenario.Read("geometry.h_scaling", h_scaling);
+    scenario.Read("geometry.particle_radius", r_g);
+    radius_ball = 0.9 * hdimX;
+    scenario.Read("geometry.ball_radius", radius_ball);
+
+    scenario.Read("material.walls.young_modulus", Y_walls);
+    scenario.Read("material.walls.restitution", cr_walls);
+    scenario.Read("material.walls.poisson_ratio", nu_walls);
+    scenario.Read("material.walls.friction", mu_walls);
+    scenario.Read("material.granular.density", rho_g);
+    scenario.Read("material.granular.bulk_density", desiredBulkDensity);
+    scenario.Read("material.granular.press_to_bulk_density", press_to_density);
+    scenario.Read("material.granular.young_modulus", Y_g);
+    scenario.Read("material.granular.restitution", cr_g);
+    scenario.Read("material.granular.poisson_ratio", nu_g);
+    scenario.Read("material.granular.friction", mu_g);
+    scenario.Read("material.ball_mass", mass_ball);
+
+    scenario.Read("sweep.friction", sweep_friction);
+    scenario.Read("sweep.cohesion", sweep_cohesion);
+    scenario.Read("sweep.normal_pressure", sweep_pressure);
+    scenario.Read("sweep.concurrent", sweep_concurrent);
+    scenario.Read("sweep.shear_filter", shear_filter);
+
+    scenario.Read("output.dir", out_dir);
+    scenario.Read("output.povray", write_povray_data);
+    scenario.Read("output.binary_frames", binary_frames);
+    scenario.Read("output.frame_compression", frame_compression);
+    scenario.Read("output.fps_settling", out_fps_settling);
+    scenario.Read("output.fps_pressing", out_fps_pressing);
+    scenario.Read("output.fps_shearing", out_fps_shearing);
+    scenario.Read("output.fps_testing", out_fps_testing);
+    scenario.Read("output.write_fps", write_fps);
+    scenario.Read("output.timing_frame", timing_frame);
+
+    pov_dir = out_dir + "/POVRAY";
+    frames_file = out_dir + "/frames.bin";
+    shear_file = out_dir + "/shear.dat";
+    stats_file = out_dir + "/stats.dat";
+    sweep_file = out_dir + "/sweep.dat";
+    multistage_file = out_dir + "/multistage.dat";
+    multistage_metrics_file = out_dir + "/directShear_multistage.json";
+    density_file = out_dir + "/density.dat";
+    settled_ckpnt_file = out_dir + "/settled.dat";
+    pressed_ckpnt_file = out_dir + "/pressed.dat";
+
+    return scenario.CheckUnused();
+}
+
+// =============================================================================
+
+int main(int argc, char* argv[]) {
+    // Process the scenario specification.
+    Scenario scenario;
+    if (!GetProblemSpecs(argc, argv, scenario))
+        return 1;
+
+    // Create output directories.
+    if (!filesystem::create_directory(filesystem::path(out_dir))) {
+        cout << "Error creating directory " << out_dir << endl;
+        return 1;
+    }
+    if (!filesystem::create_directory(filesystem::path(pov_dir))) {
+        cout << "Error creating directory " << pov_dir << endl;
+        return 1;
+    }
+    scenario.Write(out_dir + "/scenario.json");
+
+    // Clamp the number of threads to the maximum available.
+    int max_threads = omp_get_num_procs();
+    if (threads > max_threads)
+        threads = max_threads;
+    cout << "Using " << threads << " threads" << endl;
+
+    // The parameter sweep and the multi-stage test manage their own systems.
+    if (problem == SWEEP)
+        return RunSweep();
+    if (problem == MULTISTAGE)
+        return RunMultiStage();
+
+// -------------
+// Create system
+// -------------
+
+#ifdef USE_SMC
+    cout << "Create SMC system" << endl;
+#else
+    cout << "Create NSC system" << endl;
+#endif
+
+    ChSystemParallel* msystem = CreateSystem(threads);
 
     // --------------
     // Problem set up
@@ -595,6 +1074,7 @@ int main(int argc, char* argv[]) {
     std::shared_ptr<ChLinkLockPrismatic> prismatic_box_ground;
     std::shared_ptr<ChLinkLockPrismatic> prismatic_plate_ground;
     std::shared_ptr<ChLinkLinActuator> actuator;
+    std::unique_ptr<PlateServo> servo;
 
     switch (problem) {
         case SETTLING: {
@@ -633,12 +1113,28 @@ int main(int argc, char* argv[]) {
             loadPlate = msystem->Get_bodylist().at(2);
 
             // Move the load plate just above the granular material.
-            double highest, lowest;
-            FindHeightRange(msystem, lowest, highest);
+            ParticleQuery particles(msystem);
+            double highest = particles.Update().max_height;
             ChVector<> pos = loadPlate->GetPos();
             double z_new = highest + 2 * r_g;
             loadPlate->SetPos(ChVector<>(pos.x(), pos.y(), z_new));
 
+            // Set plate mass from desired applied normal pressure
+            double area = 4 * hdimX * hdimY;
+            double mass = normalPressure * area / gravity;
+            loadPlate->SetMass(mass);
+
+            // With a stress servo, the plate motion is prescribed (no joint).
+            if (servo_pressing) {
+                loadPlate->SetBodyFixed(true);
+                servo.reset(new PlateServo(msystem, loadPlate, area, normalPressure));
+                servo->SetMaxSpeed(servo_speed);
+                servo->SetGains(servo_kp, servo_ki);
+                servo->SetFilter(servo_filter);
+                servo->SetTolerances(servo_stress_tol, servo_height_tol, servo_window);
+                break;
+            }
+
             // Connect the load plate to the shear box.
             ConnectLoadPlate(msystem, ground, loadPlate);
             prismatic_plate_ground = std::static_pointer_cast<ChLinkLockPrismatic>(msystem->SearchLink("prismatic_plate_ground"));
@@ -646,11 +1142,6 @@ int main(int argc, char* argv[]) {
             // Release the load plate.
             loadPlate->SetBodyFixed(false);
 
-            // Set plate mass from desired applied normal pressure
-            double area = 4 * hdimX * hdimY;
-            double mass = normalPressure * area / gravity;
-            loadPlate->SetMass(mass);
-
             break;
         }
 
@@ -685,8 +1176,6 @@ int main(int argc, char* argv[]) {
             // Release the load plate.
             loadPlate->SetBodyFixed(false);
 
-            // setBulkDensity(msystem, desiredBulkDensity);
-
             // Set plate mass from desired applied normal pressure
             double area = 4 * hdimX * hdimY;
             double mass = normalPressure * area / gravity;
@@ -780,6 +1269,24 @@ int main(int argc, char* argv[]) {
     gl_window.SetRenderMode(opengl::WIREFRAME);
 #endif
 
+    StepProfiler profiler(msystem);
+
+    std::unique_ptr<FrameWriter> frames;
+    if (write_povray_data && binary_frames)
+        frames.reset(new FrameWriter(msystem, frames_file, false, frame_compression));
+
+    // Statistics of the granular material
+    ParticleQuery particles(msystem);
+
+    // Bulk density of the granular bed in the bin and shear box (only used for SETTLING or PRESSING).
+    // The bed extends up to the load plate when pressing, up to the highest particle otherwise.
+    DensityField density(msystem);
+    density.SetGrid(ChVector<>(-hdimX, -hdimY, 0), ChVector<>(hdimX, hdimY, 2 * (1 + h_scaling) * hdimZ), 4 * r_g);
+    auto bed_top = [&]() {
+        return problem == PRESSING ? loadPlate->GetPos().z() : particles.GetResult().max_height + r_g;
+    };
+    double bulk_density = 0;
+
     // Loop until reaching the end time...
     while (time < time_end) {
         // Current position and velocity of the shear box
@@ -787,8 +1294,9 @@ int main(int argc, char* argv[]) {
         ChVector<> vel_old = shearBox->GetPos_dt();
 
         // Calculate minimum and maximum particle heights
-        double highest, lowest;
-        FindHeightRange(msystem, lowest, highest);
+        const ParticleQuery::Result& stats = particles.Update();
+        double highest = stats.max_height;
+        double lowest = stats.min_height;
 
         // If at an output frame, write PovRay file and print info
         if (sim_frame == next_out_frame) {
@@ -799,10 +1307,15 @@ int main(int argc, char* argv[]) {
             cout << "                       vel:    " << vel_old.x() << endl;
             cout << "             Particle lowest:  " << lowest << endl;
             cout << "                      highest: " << highest << endl;
+            if (servo)
+                cout << "             Normal stress:    " << servo->GetStress() << "  (target " << servo->GetTarget()
+                     << ")" << endl;
             cout << "             Execution time:   " << exec_time << endl;
 
             // Save PovRay post-processing data.
-            if (write_povray_data) {
+            if (frames) {
+                frames->Write();
+            } else if (write_povray_data) {
                 char filename[100];
                 sprintf(filename, "%s/data_%03d.dat", pov_dir.c_str(), out_frame + 1);
                 utils::WriteShapesPovray(msystem, filename, false);
@@ -816,6 +1329,11 @@ int main(int argc, char* argv[]) {
                 else
                     utils::WriteCheckpoint(msystem, pressed_ckpnt_file);
                 cout << msystem->Get_bodylist().size() << " bodies" << endl;
+
+                density.Update();
+                bulk_density = density.GetBulkDensity(0, bed_top());
+                cout << "             Bulk density:     " << bulk_density << "  (porosity "
+                     << density.GetPorosity(0, bed_top()) << ")" << endl;
             }
 
             // Increment counters
@@ -823,8 +1341,21 @@ int main(int argc, char* argv[]) {
             next_out_frame += out_steps;
         }
 
-        // Check for early termination of a settling phase.
-        if (problem == SETTLING || problem == PRESSING) {
+        // Check for early termination of a pressing phase driven to the desired bulk density.
+        if (problem == PRESSING && press_to_density && bulk_density >= desiredBulkDensity) {
+            cout << "Desired bulk density reached...  time = " << time << endl;
+            break;
+        }
+
+        // Check for early termination of a stress-controlled pressing phase.
+        if (servo && servo->IsConverged()) {
+            cout << "Normal stress converged...  time = " << time << "  plate height = " << servo->GetHeight()
+                 << endl;
+            break;
+        }
+
+        // Check for early termination of a settling phase (pressing with a servo ends on convergence only).
+        if (problem == SETTLING || (problem == PRESSING && !servo)) {
             // Store maximum particle height in circular buffer
             hdata[sim_frame % buffer_size] = highest;
 
@@ -855,7 +1386,9 @@ int main(int argc, char* argv[]) {
 #endif
 
         ////progressbar(out_steps + sim_frame - next_out_frame + 1, out_steps);
-        TimingOutput(msystem);
+        profiler.Record();
+        if (servo)
+            servo->Update(time_step);
 
         // Record stats about the simulation
         if (sim_frame % write_steps == 0) {
@@ -949,9 +1482,19 @@ int main(int argc, char* argv[]) {
         else
             utils::WriteCheckpoint(msystem, pressed_ckpnt_file);
         cout << msystem->Get_bodylist().size() << " bodies" << endl;
+
+        // Validate the bed: bulk density against the desired value, profiles along Z.
+        particles.Update();
+        density.Update();
+        density.WriteProfile(density_file);
+        cout << "Bulk density:      " << density.GetBulkDensity(0, bed_top()) << "  (desired " << desiredBulkDensity
+             << ")" << endl;
+        cout << "Porosity:          " << density.GetPorosity(0, bed_top()) << endl;
+        cout << "Coordination:      " << density.GetCoordination() << endl;
     }
 
     // Final stats
+    profiler.PrintSummary();
     cout << "==================================" << endl;
     cout << "Number of bodies:  " << msystem->Get_bodylist().size() << endl;
     cout << "Simulation time:   " << exec_time << endl;
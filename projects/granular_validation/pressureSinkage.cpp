@@ -14,6 +14,21 @@
 //
 // ChronoParallel demo program for pressure-sinkage studies.
 //
+// The SWEEP problem runs the pressing phase for every combination of the values
+// in sweep_friction and sweep_cohesion, all starting from the same settled
+// state kept in memory (read once from the settled checkpoint file, or obtained
+// by settling the material first). Cases can run concurrently on subsets of the
+// threads (sweep_concurrent); a summary of each case is written to sweep.dat in
+// the output directory.
+//
+// With servo_pressing, the PRESSING phase drives the load plate to the normal
+// stress servo_pressure and ends as soon as the stress and the plate height
+// have converged.
+//
+// The bulk density of the settled bed is measured on a voxel grid (see
+// density_field.h) at the end of SETTLING and before PRESSING, and compared with
+// desiredBulkDensity; the profiles along Z are written to density.dat.
+//
 // The global reference frame has Z up.
 // All units SI (CGS, i.e., centimeter - gram - second)
 //
@@ -22,6 +37,7 @@
 #include "core/ChStream.h"
 
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <valarray>
 #include <string>
@@ -47,6 +63,14 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
+#include "../density_field.h"
+#include "../frame_writer.h"
+#include "../parameter_sweep.h"
+#include "../particle_query.h"
+#include "../plate_servo.h"
+#include "../sleep_manager.h"
+#include "../step_profiler.h"
+#include "../system_snapshot.h"
 #include "../utils.h"
 
 using namespace chrono;
@@ -63,7 +87,7 @@ using std::endl;
 // Comment the following line to use NSC contact
 //#define USE_SMC
 
-enum ProblemType { SETTLING, PRESSING, TESTING };
+enum ProblemType { SETTLING, PRESSING, TESTING, SWEEP };
 
 ProblemType problem = TESTING;
 
@@ -91,6 +115,11 @@ bool use_actuator = true;
 // Save PovRay post-processing data?
 bool write_povray_data = true;
 
+// Write all visualization frames to a single binary file (convert with frame_to_povray)
+// instead of one PovRay text file per frame?
+bool binary_frames = true;
+int frame_compression = 1;  // zlib level (0: none; ignored without zlib support)
+
 // Simulation times
 double time_settling_min = 0.1;
 double time_settling_max = 1.0;
@@ -103,6 +132,9 @@ double time_testing = 2;
 // Stopping criteria for settling (fraction of particle radius)
 double settling_tol = 0.2;
 
+// Put quiescent particles to sleep during settling?
+bool use_sleeping = true;
+
 // Solver settings
 #ifdef USE_SMC
 double time_step = 1e-5;
@@ -134,8 +166,11 @@ const std::string out_dir = "../PRESSURESINKAGE_NSC";
 #endif
 
 const std::string pov_dir = out_dir + "/POVRAY";
+const std::string frames_file = out_dir + "/frames.bin";
 const std::string sinkage_file = out_dir + "/sinkage.dat";
 const std::string stats_file = out_dir + "/stats.dat";
+const std::string sweep_file = out_dir + "/sweep.dat";
+const std::string density_file = out_dir + "/density.dat";
 const std::string settled_ckpnt_file = out_dir + "/settled.dat";
 const std::string pressed_ckpnt_file = out_dir + "/pressed.dat";
 
@@ -174,6 +209,19 @@ float mu_walls = 0.3f;
 // Desired sinkage velocity [cm/s]
 double desiredVelocity = 1;
 
+// Stress-controlled pressing: lower the (kinematic) load plate with a PI servo on
+// the normal stress under it and end PRESSING when stress and plate height
+// converge (see plate_servo.h), instead of a fixed velocity for a fixed time.
+bool servo_pressing = false;
+double servo_pressure = Pa2cgs * 20e3;  // target normal stress (20 kPa)
+double servo_speed = 1;                 // [cm/s] maximum plate speed
+double servo_kp = 1;                    // proportional gain (on the relative stress error)
+double servo_ki = 0.5;                  // [1/s] integral gain
+double servo_filter = 1e-3;             // [s] time constant of the stress filter
+double servo_stress_tol = 0.02;         // relative stress tolerance
+double servo_height_tol = 0.01;         // [cm] plate height tolerance
+double servo_window = 0.05;             // [s] time window for convergence
+
 // Parameters for the granular material
 int Id_g = 1;          // start body ID for particles
 double r_g = 0.4;      // [cm] radius of granular sphers
@@ -190,6 +238,11 @@ int Id_ball = -4;
 double mass_ball = 200;            // [g] mass of testing ball
 double radius_ball = 0.9 * hdimY;  // [cm] radius of testing ball
 
+// Parameter sweep (SWEEP only)
+std::vector<double> sweep_friction = {0.3, 0.5, 0.7};
+std::vector<double> sweep_cohesion = {0};
+int sweep_concurrent = 1;  // number of cases run concurrently (threads are split evenly)
+
 // =============================================================================
 // Create the containing bin (the ground) and the load plate.
 //
@@ -387,89 +440,45 @@ void CreateBall(ChSystemParallel* system) {
 }
 
 // =============================================================================
-// Find the height of the highest and lowest sphere in the granular mix. We only
-// look at bodies whith positive identifiers (to exclude all other bodies).
+// Report the bulk density, porosity and coordination number of the granular bed
+// in the bin (up to the top of the highest particle) and write the profiles
+// along Z.
 // =============================================================================
 
-void FindHeightRange(ChSystemParallel* sys, double& lowest, double& highest) {
-    highest = -1000;
-    lowest = 1000;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() <= 0)
-            continue;
-
-        if (fabs(body->GetPos().x()) <= hdimX_p && fabs(body->GetPos().y()) <= hdimY_p) {
-            double h = body->GetPos().z();
-            if (h < lowest)
-                lowest = h;
-            else if (h > highest)
-                highest = h;
-        }
-    }
-}
-
-// =============================================================================
-//
-//// TODO:  cannot do this with SMC!!!!!
-//
-// =============================================================================
+void ReportBulkDensity(ChSystemParallel* system) {
+    ParticleQuery particles(system);
+    double top = particles.Update().max_height + r_g;
 
-void setBulkDensity(ChSystem* sys, double bulkDensity) {
-    double vol_g = (4.0 / 3) * CH_C_PI * r_g * r_g * r_g;
-
-    double normalPlateHeight = sys->Get_bodylist().at(1)->GetPos().z() - hdimZ;
-    double bottomHeight = 0;
-    double boxVolume = hdimX * 2 * hdimX * 2 * (normalPlateHeight - bottomHeight);
-    double granularVolume = (sys->Get_bodylist().size() - 3) * vol_g;
-    double reqDensity = bulkDensity * boxVolume / granularVolume;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 1) {
-            body->SetMass(reqDensity * vol_g);
-        }
-    }
+    DensityField density(system);
+    density.SetGrid(ChVector<>(-hdimX, -hdimY, 0), ChVector<>(hdimX, hdimY, top), 4 * r_g);
+    density.Update();
+    density.WriteProfile(density_file);
 
-    cout << "N Bodies: " << sys->Get_bodylist().size() << endl;
-    cout << "Box Volume: " << boxVolume << endl;
-    cout << "Granular Volume: " << granularVolume << endl;
-    cout << "Desired bulk density = " << bulkDensity << ", Required Body Density = " << reqDensity << endl;
+    cout << "Bulk density:      " << density.GetBulkDensity(0, top) << "  (desired " << desiredBulkDensity << ")"
+         << endl;
+    cout << "Porosity:          " << density.GetPorosity(0, top) << endl;
+    cout << "Coordination:      " << density.GetCoordination() << endl;
 }
 
+// =============================================================================
+// Create a Chrono::Parallel system with the solver and collision settings above,
+// using the specified number of threads.
 // =============================================================================
 
-int main(int argc, char* argv[]) {
-    // Create output directories.
-    if (!filesystem::create_directory(filesystem::path(out_dir))) {
-        cout << "Error creating directory " << out_dir << endl;
-        return 1;
-    }
-    if (!filesystem::create_directory(filesystem::path(pov_dir))) {
-        cout << "Error creating directory " << pov_dir << endl;
-        return 1;
-    }
-
-// -------------
-// Create system
-// -------------
-
+ChSystemParallel* CreateSystem(int num_threads) {
 #ifdef USE_SMC
-    cout << "Create SMC system" << endl;
     ChSystemParallelSMC* msystem = new ChSystemParallelSMC();
 #else
-    cout << "Create NSC system" << endl;
     ChSystemParallelNSC* msystem = new ChSystemParallelNSC();
 #endif
 
     msystem->Set_G_acc(ChVector<>(0, 0, -gravity));
 
     // Set number of threads.
-    int max_threads = omp_get_num_procs();
-    if (threads > max_threads)
-        threads = max_threads;
-    msystem->SetParallelThreadNumber(threads);
-    omp_set_num_threads(threads);
-    cout << "Using " << threads << " threads" << endl;
+    msystem->SetParallelThreadNumber(num_threads);
+    CHOMPfunctions::SetNumThreads(num_threads);
 
-    msystem->GetSettings()->max_threads = threads;
+    msystem->GetSettings()->max_threads = num_threads;
     msystem->GetSettings()->perform_thread_tuning = thread_tuning;
 
     // Edit system settings
@@ -498,6 +507,224 @@ int main(int argc, char* argv[]) {
 
     msystem->GetSettings()->collision.bins_per_axis = vec3(10, 10, 10);
 
+    return msystem;
+}
+
+// =============================================================================
+// Settle the granular material in the specified system (parameter sweep, when
+// no settled checkpoint file exists): stop when the deviation of the highest
+// particle height over the last time_settling_min seconds falls below the
+// specified fraction of a particle radius, or at time_settling_max.
+// =============================================================================
+
+double SettleMaterial(ChSystemParallel* system) {
+    int buffer_size = (int)std::ceil(time_settling_min / time_step);
+    std::valarray<double> hdata(0.0, buffer_size);
+
+    SleepManager sleep(system);
+    sleep.SetGranularThresholds(r_g);
+    sleep.SetSleepSteps((int)std::ceil(0.05 / time_step));
+
+    ParticleQuery particles(system);
+    particles.SetLateralBox(hdimX_p, hdimY_p);
+
+    double time = 0;
+    int sim_frame = 0;
+    while (time < time_settling_max) {
+        hdata[sim_frame % buffer_size] = particles.Update().max_height;
+
+        if (time > time_settling_min) {
+            double mean_height = hdata.sum() / buffer_size;
+            std::valarray<double> x = hdata - mean_height;
+            if (std::sqrt((x * x).sum() / buffer_size) < settling_tol * r_g)
+                break;
+        }
+
+        system->DoStepDynamics(time_step);
+        if (use_sleeping)
+            sleep.Update();
+        time += time_step;
+        sim_frame++;
+    }
+
+    sleep.WakeAll();
+    return time;
+}
+
+// =============================================================================
+// Run one case of the parameter sweep: restore the settled state with the
+// specified granular friction and cohesion (adhesion for SMC), then press the
+// load plate into the material for time_pressing_max. Returns the maximum and
+// final pressure under the plate and the final sinkage (depth of the plate
+// bottom below the initial material surface).
+// =============================================================================
+
+ParameterSweep::Results RunPressingCase(const SystemSnapshot& settled,
+                                        const std::vector<double>& params,
+                                        int num_threads) {
+    double friction = params[0];
+    double cohesion = params[1];
+
+    // Chrono object construction uses global (non thread-safe) counters; serialize it with the other cases.
+    std::unique_ptr<ChSystemParallel> msystem;
+    {
+        std::lock_guard<std::recursive_mutex> lock(SystemSnapshot::GetConstructionMutex());
+        msystem.reset(CreateSystem(num_threads));
+
+        // Restore the settled state, editing the granular material (positive identifiers).
+        settled.Restore(msystem.get(), [&](std::shared_ptr<ChMaterialSurface> mat, int identifier) {
+            if (identifier <= 0)
+                return;
+#ifdef USE_SMC
+            auto mat_g = std::static_pointer_cast<ChMaterialSurfaceSMC>(mat);
+            mat_g->SetFriction((float)friction);
+            mat_g->SetAdhesion((float)cohesion);
+#else
+            auto mat_g = std::static_pointer_cast<ChMaterialSurfaceNSC>(mat);
+            mat_g->SetFriction((float)friction);
+            mat_g->SetCohesion((float)cohesion);
+#endif
+        });
+    }
+
+    auto ground = msystem->Get_bodylist().at(0);
+    auto loadPlate = msystem->Get_bodylist().at(1);
+
+    // Move the load plate just above the granular material and add its collision geometry.
+    ParticleQuery particles(msystem.get());
+    particles.SetLateralBox(hdimX_p, hdimY_p);
+    double highest = particles.Update().max_height;
+    double surface = highest + r_g;
+    ChVector<> pos = loadPlate->GetPos();
+    loadPlate->SetPos(ChVector<>(pos.x(), pos.y(), highest + 1.01 * r_g));
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(SystemSnapshot::GetConstructionMutex());
+        loadPlate->GetCollisionModel()->ClearModel();
+        utils::AddBoxGeometry(loadPlate.get(), ChVector<>(hdimX_p, hdimY_p, hdimZ_p), ChVector<>(0, 0, hdimZ_p));
+        loadPlate->GetCollisionModel()->BuildModel();
+    }
+
+    // Pressing (the actuator motion is a function of the system time).
+    msystem->SetChTime(0);
+    std::shared_ptr<ChLinkLinActuator> actuator;
+    if (use_actuator) {
+        std::lock_guard<std::recursive_mutex> lock(SystemSnapshot::GetConstructionMutex());
+        ConnectLoadPlate(msystem.get(), ground, loadPlate);
+        actuator = std::static_pointer_cast<ChLinkLinActuator>(msystem->SearchLink("actuator"));
+    }
+    loadPlate->SetBodyFixed(!use_actuator);
+
+    double area = 4 * hdimX_p * hdimY_p;
+    double max_pressure = 0;
+    double pressure = 0;
+    double time = 0;
+    while (time < time_pressing_max) {
+        ChVector<> pos_old = loadPlate->GetPos();
+        msystem->DoStepDynamics(time_step);
+
+        // Normal force from the actuator reaction or, for kinematic pressing, from the contacts on the plate.
+        double force;
+        if (use_actuator) {
+            force = std::abs(actuator->Get_react_force().x());
+        } else {
+            double zpos_new = pos_old.z() + desiredVelocity * time_step;
+            loadPlate->SetPos(ChVector<>(pos_old.x(), pos_old.y(), zpos_new));
+            loadPlate->SetPos_dt(ChVector<>(0, 0, desiredVelocity));
+            msystem->CalculateContactForces();
+            force = std::abs(msystem->GetBodyContactForce(loadPlate).z);
+        }
+        pressure = force / area;
+        max_pressure = std::max(max_pressure, pressure);
+
+        time += time_step;
+    }
+
+    return {{"max_pressure", max_pressure},
+            {"final_pressure", pressure},
+            {"sinkage", surface - loadPlate->GetPos().z()}};
+}
+
+// =============================================================================
+// Parameter sweep: obtain the settled state once, keep it in memory, and run
+// one pressing case for each combination of the swept values.
+// =============================================================================
+
+int RunSweep() {
+    std::unique_ptr<ChSystemParallel> msystem(CreateSystem(threads));
+
+    if (filesystem::path(settled_ckpnt_file).exists()) {
+        cout << "Read checkpoint data from " << settled_ckpnt_file;
+        utils::ReadCheckpoint(msystem.get(), settled_ckpnt_file);
+        cout << "  done.  Read " << msystem->Get_bodylist().size() << " bodies." << endl;
+    } else {
+        CreateMechanismBodies(msystem.get());
+        int num_particles = CreateGranularMaterial(msystem.get());
+        cout << "Granular material:  " << num_particles << " particles" << endl;
+        double time = SettleMaterial(msystem.get());
+        cout << "Granular material settled...  time = " << time << endl;
+        utils::WriteCheckpoint(msystem.get(), settled_ckpnt_file);
+    }
+
+    SystemSnapshot settled;
+    settled.Capture(msystem.get());
+    msystem.reset();
+
+    ParameterSweep sweep;
+    sweep.AddParameter("friction", sweep_friction);
+    sweep.AddParameter("cohesion", sweep_cohesion);
+    sweep.SetNumThreads(threads);
+    sweep.SetNumConcurrent(sweep_concurrent);
+
+    cout << "Parameter sweep:  " << sweep.GetNumCases() << " cases, " << sweep_concurrent << " concurrent" << endl;
+    sweep.Run([&](const std::vector<double>& params, int num_threads) {
+        return RunPressingCase(settled, params, num_threads);
+    });
+
+    if (!sweep.Write(sweep_file)) {
+        cout << "Error writing " << sweep_file << endl;
+        return 1;
+    }
+    cout << "Sweep time: " << sweep.GetTime() << "  results in " << sweep_file << endl;
+
+    return 0;
+}
+
+// =============================================================================
+
+int main(int argc, char* argv[]) {
+    // Create output directories.
+    if (!filesystem::create_directory(filesystem::path(out_dir))) {
+        cout << "Error creating directory " << out_dir << endl;
+        return 1;
+    }
+    if (!filesystem::create_directory(filesystem::path(pov_dir))) {
+        cout << "Error creating directory " << pov_dir << endl;
+        return 1;
+    }
+
+    // Clamp the number of threads to the maximum available.
+    int max_threads = omp_get_num_procs();
+    if (threads > max_threads)
+        threads = max_threads;
+    cout << "Using " << threads << " threads" << endl;
+
+    // The parameter sweep manages its own systems.
+    if (problem == SWEEP)
+        return RunSweep();
+
+// -------------
+// Create system
+// -------------
+
+#ifdef USE_SMC
+    cout << "Create SMC system" << endl;
+#else
+    cout << "Create NSC system" << endl;
+#endif
+
+    ChSystemParallel* msystem = CreateSystem(threads);
+
     // --------------
     // Problem set up
     // --------------
@@ -514,6 +741,7 @@ int main(int argc, char* argv[]) {
     std::shared_ptr<ChBody> loadPlate;
     std::shared_ptr<ChLinkLockPrismatic> prismatic;
     std::shared_ptr<ChLinkLinActuator> actuator;
+    std::unique_ptr<PlateServo> servo;
 
     switch (problem) {
         case SETTLING: {
@@ -549,9 +777,13 @@ int main(int argc, char* argv[]) {
             ground = msystem->Get_bodylist().at(0);
             loadPlate = msystem->Get_bodylist().at(1);
 
+            // Validate the settled bed.
+            ReportBulkDensity(msystem);
+
             // Move the load plate just above the granular material.
-            double highest, lowest;
-            FindHeightRange(msystem, lowest, highest);
+            ParticleQuery particles(msystem);
+            particles.SetLateralBox(hdimX_p, hdimY_p);
+            double highest = particles.Update().max_height;
             ChVector<> pos = loadPlate->GetPos();
             double z_new = highest + 1.01 * r_g;
             loadPlate->SetPos(ChVector<>(pos.x(), pos.y(), z_new));
@@ -562,6 +794,17 @@ int main(int argc, char* argv[]) {
                                   ChVector<>(0, 0, hdimZ_p));
             loadPlate->GetCollisionModel()->BuildModel();
 
+            // With a stress servo, the plate motion is prescribed (no actuator).
+            if (servo_pressing) {
+                loadPlate->SetBodyFixed(true);
+                servo.reset(new PlateServo(msystem, loadPlate, 4 * hdimX_p * hdimY_p, servo_pressure));
+                servo->SetMaxSpeed(servo_speed);
+                servo->SetGains(servo_kp, servo_ki);
+                servo->SetFilter(servo_filter);
+                servo->SetTolerances(servo_stress_tol, servo_height_tol, servo_window);
+                break;
+            }
+
             // If using an actuator, connect the load plate and get a handle to the actuator.
             if (use_actuator) {
                 ConnectLoadPlate(msystem, ground, loadPlate);
@@ -651,6 +894,21 @@ int main(int argc, char* argv[]) {
     gl_window.SetRenderMode(opengl::WIREFRAME);
 #endif
 
+    StepProfiler profiler(msystem);
+
+    std::unique_ptr<FrameWriter> frames;
+    if (write_povray_data && binary_frames)
+        frames.reset(new FrameWriter(msystem, frames_file, false, frame_compression));
+
+    // Sleeping of quiescent particles (SETTLING only)
+    SleepManager sleep(msystem);
+    sleep.SetGranularThresholds(r_g);
+    sleep.SetSleepSteps((int)std::ceil(0.05 / time_step));
+
+    // Statistics of the granular material
+    ParticleQuery particles(msystem);
+    particles.SetLateralBox(hdimX_p, hdimY_p);
+
     // Loop until reaching the end time...
     while (time < time_end) {
         // Current position and velocity of the shear box
@@ -658,8 +916,9 @@ int main(int argc, char* argv[]) {
         ChVector<> vel_old = loadPlate->GetPos_dt();
 
         // Calculate minimum and maximum particle heights
-        double highest, lowest;
-        FindHeightRange(msystem, lowest, highest);
+        const ParticleQuery::Result& stats = particles.Update();
+        double highest = stats.max_height;
+        double lowest = stats.min_height;
 
         // If at an output frame, write PovRay file and print info
         if (sim_frame == next_out_frame) {
@@ -669,10 +928,15 @@ int main(int argc, char* argv[]) {
             cout << "             Load plate pos: " << pos_old.z() << endl;
             cout << "             Lowest point:   " << lowest << endl;
             cout << "             Highest point:  " << highest << endl;
+            if (servo)
+                cout << "             Normal stress:  " << servo->GetStress() << "  (target " << servo->GetTarget()
+                     << ")" << endl;
             cout << "             Execution time: " << exec_time << endl;
 
             // Save PovRay post-processing data.
-            if (write_povray_data) {
+            if (frames) {
+                frames->Write();
+            } else if (write_povray_data) {
                 char filename[100];
                 sprintf(filename, "%s/data_%03d.dat", pov_dir.c_str(), out_frame + 1);
                 utils::WriteShapesPovray(msystem, filename, false);
@@ -693,6 +957,13 @@ int main(int argc, char* argv[]) {
             next_out_frame += out_steps;
         }
 
+        // Check for early termination of a stress-controlled pressing phase.
+        if (servo && servo->IsConverged()) {
+            cout << "Normal stress converged...  time = " << time << "  plate height = " << servo->GetHeight()
+                 << endl;
+            break;
+        }
+
         // Check for early termination of a settling phase.
         if (problem == SETTLING) {
             // Store maximum particle height in circular buffer
@@ -724,7 +995,9 @@ int main(int argc, char* argv[]) {
         msystem->DoStepDynamics(time_step);
 #endif
 
-        TimingOutput(msystem);
+        profiler.Record();
+        if (problem == SETTLING && use_sleeping)
+            sleep.Update();
 
         // Record stats about the simulation
         if (sim_frame % write_steps == 0) {
@@ -745,7 +1018,10 @@ int main(int argc, char* argv[]) {
         if (problem == PRESSING || problem == TESTING) {
             // Get the current reaction force or impose load plate position
             double cnstr_force = 0;
-            if (use_actuator) {
+            if (servo) {
+                servo->Update(time_step);
+                cnstr_force = servo->GetRawStress() * 4 * hdimX_p * hdimY_p;
+            } else if (use_actuator) {
                 cnstr_force = actuator->Get_react_force().x();
             } else {
                 double zpos_new = pos_old.z() + desiredVelocity * time_step;
@@ -787,6 +1063,7 @@ int main(int argc, char* argv[]) {
     // ----------------
 
     // Create a checkpoint from the last state
+    sleep.WakeAll();
     if (problem == SETTLING || problem == PRESSING) {
         cout << "             Write checkpoint data " << flush;
         if (problem == SETTLING)
@@ -795,8 +1072,11 @@ int main(int argc, char* argv[]) {
             utils::WriteCheckpoint(msystem, pressed_ckpnt_file);
         cout << msystem->Get_bodylist().size() << " bodies" << endl;
     }
+    if (problem == SETTLING)
+        ReportBulkDensity(msystem);
 
     // Final stats
+    profiler.PrintSummary();
     cout << "==================================" << endl;
     cout << "Number of bodies:  " << msystem->Get_bodylist().size() << endl;
     cout << "Simulation time:   " << exec_time << endl;
@@ -20,12 +20,23 @@
 // rolling mode, the wheel is translated and rotated in the x-direction at a
 // specified slip.
 //
+// With use_slip_ramp, the rolling mode runs one segment per value in
+// slip_values, at constant wheel angular velocity: a segment ends when the
+// block means of the drawbar pull and of the wheel torque are steady (see
+// steady_state.h), and the mean drawbar pull, torque and sinkage of each slip
+// are written to slip.dat. With use_recycling, the bin moves forward with the
+// wheel and the particles of the strip it leaves behind are poured back in
+// front of the wheel, so that the test length is not limited by the bin.
+//
 // The global reference frame has Z up.
 // All units SI (CGS, i.e., centimeter - gram - second)
 //
 // =============================================================================
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <vector>
 #include <valarray>
 #include <string>
@@ -44,6 +55,9 @@
 
 #include "chrono_thirdparty/filesystem/path.h"
 
+#include "../particle_query.h"
+#include "../steady_state.h"
+
 // Control use of OpenGL run-time rendering
 // Note: CHRONO_OPENGL is defined in ChConfig.h
 //#undef CHRONO_OPENGL
@@ -108,6 +122,23 @@ double time_pressing_max = 1.0;
 
 double time_rolling = 10;
 
+// Slip ramp (ROLLING only): one segment per slip value, each lasting at least
+// slip_time_min and at most slip_time_max, ending as soon as the means of the
+// drawbar pull and of the wheel torque over two successive blocks agree within
+// steady_tol.
+bool use_slip_ramp = false;
+std::vector<double> slip_values = {0.0, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6};
+double slip_time_min = 1.0;  // [s] minimum segment duration
+double slip_time_max = 5.0;  // [s] maximum segment duration
+double steady_block = 0.25;  // [s] averaging block
+double steady_tol = 0.05;    // relative tolerance on successive block means
+
+// Material recycling (ROLLING only): when the wheel gets within recycle_margin
+// of the front wall, the bin moves forward by recycle_length and the particles
+// of the rear strip are poured back into the new front strip.
+bool use_recycling = false;
+double recycle_length = 20;  // [cm] length of the recycled strip
+
 double time_testing = 2;
 
 // Stopping criteria for settling (as fraction of particle radius)
@@ -139,6 +170,7 @@ const std::string out_dir = "../SINGLEWHEEL_NSC";
 
 const std::string pov_dir = out_dir + "/POVRAY";
 const std::string roll_file = out_dir + "/roll.dat";
+const std::string slip_file = out_dir + "/slip.dat";
 const std::string stats_file = out_dir + "/stats.dat";
 const std::string settled_ckpnt_file = out_dir + "/settled.dat";
 const std::string pressed_ckpnt_file = out_dir + "/pressed.dat";
@@ -163,6 +195,7 @@ int Id_ground = -1;   // body ID for the ground (containing bin)
 int Id_wheel = -2;    // body ID for the wheel
 int Id_axle = -3;     // body ID for the axle
 int Id_chassis = -4;  // body ID for the chassis
+int Id_bin = -5;      // body ID for the moving bin (ROLLING with recycling)
 
 double hdimX = 100.0 / 2;  // [cm] bin half-length in x direction
 double hdimY = 60.0 / 2;   // [cm] bin half-depth in y direction
@@ -175,6 +208,7 @@ double wheelSlip = 0.3;                // [-]  ratio of angular and translation
 double angVel = 17 * CH_C_PI / 180.0;  // [rad/s] angular velocity of the wheel
 double wheelWeight = 80;               // * N2cgs;   // Normal load of the wheel
 double velocity = angVel * wheelRadius * (1.0 - wheelSlip);
+double recycle_margin = 3 * wheelRadius;  // [cm] distance from the wheel to the front wall triggering recycling
 
 float Y_walls = (float)(Pa2cgs * 2e6);
 float mu_walls = 0.3f;
@@ -194,6 +228,20 @@ int Id_ball = -4;
 double mass_ball = 200;                  // [g] mass of testing ball
 double radius_ball = 0.1 * wheelRadius;  // [cm] radius of testing ball
 
+// =============================================================================
+// Add the contact geometry of the containing bin to the specified body.
+// =============================================================================
+
+void AddBinGeometry(ChBody* body) {
+    body->GetCollisionModel()->ClearModel();
+    utils::AddBoxGeometry(body, ChVector<>(hdimX, hdimY, hthick), ChVector<>(0, 0, -hthick));
+    utils::AddBoxGeometry(body, ChVector<>(hthick, hdimY, hdimZ), ChVector<>(-hdimX - hthick, 0, hdimZ));
+    utils::AddBoxGeometry(body, ChVector<>(hthick, hdimY, hdimZ), ChVector<>(hdimX + hthick, 0, hdimZ));
+    utils::AddBoxGeometry(body, ChVector<>(hdimX, hthick, hdimZ), ChVector<>(0, -hdimY - hthick, hdimZ));
+    utils::AddBoxGeometry(body, ChVector<>(hdimX, hthick, hdimZ), ChVector<>(0, hdimY + hthick, hdimZ));
+    body->GetCollisionModel()->BuildModel();
+}
+
 // =============================================================================
 // Create the containing bin (the ground), wheel, chassis, and axle.
 //
@@ -231,15 +279,8 @@ void CreateMechanismBodies(ChSystemParallel* system) {
     ground->SetBodyFixed(true);
     ground->SetCollide(true);
 
-    // Attach geometry of the containing bin.  Disable contact ground-shearBox
-    // and ground-loadPlate.
-    ground->GetCollisionModel()->ClearModel();
-    utils::AddBoxGeometry(ground.get(), ChVector<>(hdimX, hdimY, hthick), ChVector<>(0, 0, -hthick));
-    utils::AddBoxGeometry(ground.get(), ChVector<>(hthick, hdimY, hdimZ), ChVector<>(-hdimX - hthick, 0, hdimZ));
-    utils::AddBoxGeometry(ground.get(), ChVector<>(hthick, hdimY, hdimZ), ChVector<>(hdimX + hthick, 0, hdimZ));
-    utils::AddBoxGeometry(ground.get(), ChVector<>(hdimX, hthick, hdimZ), ChVector<>(0, -hdimY - hthick, hdimZ));
-    utils::AddBoxGeometry(ground.get(), ChVector<>(hdimX, hthick, hdimZ), ChVector<>(0, hdimY + hthick, hdimZ));
-    ground->GetCollisionModel()->BuildModel();
+    // Attach geometry of the containing bin.
+    AddBinGeometry(ground.get());
 
     system->AddBody(ground);
 
@@ -331,19 +372,50 @@ void CreateMechanismBodies(ChSystemParallel* system) {
     system->AddBody(axle);
 }
 
+// =============================================================================
+// Linear motion whose velocity can be changed during the simulation (the
+// position stays continuous). Used for the chassis actuator, so that the slip
+// ramp can change the translational velocity of the wheel.
+// =============================================================================
+
+class PiecewiseRamp : public ChFunction {
+  public:
+    PiecewiseRamp(double velocity) : m_t0(0), m_y0(0), m_v(velocity) {}
+
+    virtual PiecewiseRamp* Clone() const override { return new PiecewiseRamp(*this); }
+
+    virtual double Get_y(double x) const override { return m_y0 + m_v * (x - m_t0); }
+    virtual double Get_y_dx(double x) const override { return m_v; }
+    virtual double Get_y_dxdx(double x) const override { return 0; }
+
+    /// Change the velocity from the specified time on.
+    void SetVelocity(double time, double velocity) {
+        m_y0 = Get_y(time);
+        m_t0 = time;
+        m_v = velocity;
+    }
+
+  private:
+    double m_t0;  ///< time of the last velocity change
+    double m_y0;  ///< position at the last velocity change
+    double m_v;   ///< current velocity
+};
+
 // =============================================================================
 // Connect the chassis to the containing bin (ground) through a translational
-// joint and create a linear actuator.
+// joint and create a linear actuator. Returns the actuator motion function.
 // =============================================================================
 
-void ConnectChassisToGround(ChSystemParallel* system, std::shared_ptr<ChBody> ground, std::shared_ptr<ChBody> chassis) {
+std::shared_ptr<PiecewiseRamp> ConnectChassisToGround(ChSystemParallel* system,
+                                                      std::shared_ptr<ChBody> ground,
+                                                      std::shared_ptr<ChBody> chassis) {
     auto prismatic = chrono_types::make_shared<ChLinkLockPrismatic>();
     prismatic->Initialize(ground, chassis, ChCoordsys<>(chassis->GetPos(), Q_from_AngY(CH_C_PI_2)));
     prismatic->SetName("prismatic_chassis_ground");
     system->AddLink(prismatic);
 
     velocity = angVel * wheelRadius * (1.0 - wheelSlip);
-    auto actuator_fun = chrono_types::make_shared<ChFunction_Ramp>(0.0, velocity);
+    auto actuator_fun = chrono_types::make_shared<PiecewiseRamp>(velocity);
 
     auto actuator = chrono_types::make_shared<ChLinkLinActuator>();
     actuator->Initialize(ground, chassis, false, ChCoordsys<>(chassis->GetPos(), QUNIT),
@@ -352,6 +424,8 @@ void ConnectChassisToGround(ChSystemParallel* system, std::shared_ptr<ChBody> gr
     actuator->Set_lin_offset(1);
     actuator->Set_dist_funct(actuator_fun);
     system->AddLink(actuator);
+
+    return actuator_fun;
 }
 
 // =============================================================================
@@ -477,48 +551,78 @@ void CreateBall(ChSystemParallel* system) {
 }
 
 // =============================================================================
-// Find the height of the highest and lowest sphere in the granular mix. We only
-// look at bodies with positive identifiers (to exclude all other bodies).
+// Create a fixed body with the geometry and material of the containing bin
+// (ground), to be moved forward with the wheel when recycling the material.
+// Contact with the ground itself is disabled; the ground keeps the joints.
 // =============================================================================
 
-void FindHeightRange(ChSystemParallel* sys, double& lowest, double& highest) {
-    highest = -1000;
-    lowest = 1000;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() <= 0)
-            continue;
-        double h = body->GetPos().z();
-        if (h < lowest)
-            lowest = h;
-        else if (h > highest)
-            highest = h;
-    }
+std::shared_ptr<ChBody> CreateMovingBin(ChSystemParallel* system, std::shared_ptr<ChBody> ground) {
+#ifdef USE_SMC
+    auto bin = chrono_types::make_shared<ChBody>(chrono_types::make_shared<ChCollisionModelParallel>(), ChMaterialSurface::SMC);
+#else
+    auto bin = chrono_types::make_shared<ChBody>(chrono_types::make_shared<ChCollisionModelParallel>());
+#endif
+    bin->SetMaterialSurface(ground->GetMaterialSurfaceBase());
+
+    bin->SetIdentifier(Id_bin);
+    bin->SetMass(1.0);
+    bin->SetPos(ground->GetPos());
+    bin->SetCollide(true);
+    bin->SetBodyFixed(true);
+
+    AddBinGeometry(bin.get());
+
+    system->AddBody(bin);
+    ground->SetCollide(false);
+
+    return bin;
 }
 
 // =============================================================================
-//
-//// TODO:  cannot do this with SMC!!!!!
-//
+// Move the bin forward by 'length' and pour the particles of the rear strip it
+// leaves back into the new front strip, on layers of a regular lattice (as in
+// CreateGranularMaterial), to settle on the bed under gravity. The strip also
+// includes the particles within one radius of the new rear wall, which would
+// otherwise overlap it. The surface height of the remaining bed (highest
+// particle top) is returned in 'surface'.
+// Returns the number of recycled particles.
 // =============================================================================
 
-void setBulkDensity(ChSystem* sys, double bulkDensity) {
-    double vol_g = (4.0 / 3) * CH_C_PI * r_g * r_g * r_g;
-
-    double normalPlateHeight = sys->Get_bodylist().at(1)->GetPos().z() - hdimZ;
-    double bottomHeight = 0;
-    double boxVolume = hdimX * 2 * hdimX * 2 * (normalPlateHeight - bottomHeight);
-    double granularVolume = (sys->Get_bodylist().size() - 3) * vol_g;
-    double reqDensity = bulkDensity * boxVolume / granularVolume;
-    for (auto body : sys->Get_bodylist()) {
-        if (body->GetIdentifier() > 1) {
-            body->SetMass(reqDensity * vol_g);
-        }
+int RecycleMaterial(ChSystemParallel* system, std::shared_ptr<ChBody> bin, double length, double& surface) {
+    ChVector<> pos = bin->GetPos();
+    double x_rear = pos.x() - hdimX;
+    double x_front = pos.x() + hdimX;
+    double x_cut = x_rear + length + 1.01 * r_g;
+
+    std::vector<std::shared_ptr<ChBody>> strip;
+    double highest = -std::numeric_limits<double>::infinity();
+    for (auto body : system->Get_bodylist()) {
+        if (body->GetIdentifier() < Id_g)
+            continue;
+        if (body->GetPos().x() < x_cut)
+            strip.push_back(body);
+        else
+            highest = std::max(highest, body->GetPos().z());
     }
+    if (std::isfinite(highest))
+        surface = highest + r_g;
 
-    cout << "N Bodies: " << sys->Get_bodylist().size() << endl;
-    cout << "Box Volume: " << boxVolume << endl;
-    cout << "Granular Volume: " << granularVolume << endl;
-    cout << "Desired bulk density = " << bulkDensity << ", Required Body Density = " << reqDensity << endl;
+    bin->SetPos(ChVector<>(pos.x() + length, pos.y(), pos.z()));
+
+    double r = 1.01 * r_g;
+    int nx = std::max(1, (int)std::floor((length - 2 * r) / (2 * r)) + 1);
+    int ny = std::max(1, (int)std::floor((2 * hdimY - 2 * r) / (2 * r)) + 1);
+    for (size_t k = 0; k < strip.size(); k++) {
+        int layer = (int)k / (nx * ny);
+        int i = (int)k % (nx * ny) % nx;
+        int j = (int)k % (nx * ny) / nx;
+        strip[k]->SetPos(ChVector<>(x_front + r + 2 * r * i, -hdimY + r + 2 * r * j, 2 * r * (layer + 1)));
+        strip[k]->SetRot(QUNIT);
+        strip[k]->SetPos_dt(VNULL);
+        strip[k]->SetWvel_loc(VNULL);
+    }
+
+    return (int)strip.size();
 }
 
 // =============================================================================
@@ -602,6 +706,8 @@ int main(int argc, char* argv[]) {
     std::shared_ptr<ChLinkLockPrismatic> prismatic_axle_chassis;
     std::shared_ptr<ChLinkLinActuator> actuator;
     std::shared_ptr<ChLinkMotorRotationAngle> engine_wheel_axle;
+    std::shared_ptr<PiecewiseRamp> motion;
+    std::shared_ptr<ChBody> bin;
 
     switch (problem) {
         case SETTLING: {
@@ -642,8 +748,8 @@ int main(int argc, char* argv[]) {
             axle = msystem->Get_bodylist().at(3);
 
             // Move the load plate just above the granular material.
-            double highest, lowest;
-            FindHeightRange(msystem, lowest, highest);
+            ParticleQuery particles(msystem);
+            double highest = particles.Update().max_height;
             ChVector<> pos = wheel->GetPos();
             double z_new = highest + 1.01 * r_g + wheelRadius;
             wheel->SetPos(ChVector<>(pos.x(), pos.y(), z_new));
@@ -687,10 +793,18 @@ int main(int argc, char* argv[]) {
             axle = msystem->Get_bodylist().at(3);
 
             // Connect the chassis and get a handle to the actuator.
-            ConnectChassisToGround(msystem, ground, chassis);
+            if (use_slip_ramp) {
+                wheelSlip = slip_values[0];
+                time_end = std::max(time_rolling, slip_values.size() * slip_time_max);
+            }
+            motion = ConnectChassisToGround(msystem, ground, chassis);
             prismatic_chassis_ground = std::static_pointer_cast<ChLinkLockPrismatic>(msystem->SearchLink("prismatic_chassis_ground"));
             actuator = std::static_pointer_cast<ChLinkLinActuator>(msystem->SearchLink("actuator"));
 
+            // Let the bin follow the wheel.
+            if (use_recycling)
+                bin = CreateMovingBin(msystem, ground);
+
             // Release the load plate.
             chassis->SetBodyFixed(false);
 
@@ -711,8 +825,6 @@ int main(int argc, char* argv[]) {
             // Release the axle.
             wheel->SetBodyFixed(false);
 
-            // setBulkDensity(msystem, desiredBulkDensity);
-
             break;
         }
 
@@ -797,6 +909,20 @@ int main(int argc, char* argv[]) {
     rollStream.SetNumFormat("%16.4e");
     statsStream.SetNumFormat("%16.4e");
 
+    // Slip ramp: current segment and detectors of steady drawbar pull and torque
+    // (sinkage is only averaged). The surface height is taken at the start and after each recycling.
+    size_t segment = 0;
+    double segment_start = 0;
+    SteadyStateDetector dp_detector(steady_block, steady_tol);
+    SteadyStateDetector torque_detector(steady_block, steady_tol);
+    SteadyStateDetector sinkage_detector(steady_block, steady_tol);
+    double surface = ParticleQuery(msystem).Update().max_height + r_g;
+    std::unique_ptr<ChStreamOutAsciiFile> slipStream;
+    if (problem == ROLLING && use_slip_ramp) {
+        slipStream.reset(new ChStreamOutAsciiFile(slip_file.c_str()));
+        slipStream->SetNumFormat("%16.4e");
+    }
+
 #ifdef CHRONO_OPENGL
     opengl::ChOpenGLWindow& gl_window = opengl::ChOpenGLWindow::getInstance();
     gl_window.Initialize(1280, 720, "Single Wheel Test", msystem);
@@ -804,6 +930,9 @@ int main(int argc, char* argv[]) {
     gl_window.SetRenderMode(opengl::WIREFRAME);
 #endif
 
+    // Statistics of the granular material
+    ParticleQuery particles(msystem);
+
     // Loop until reaching the end time...
     while (time < time_end) {
         // Current position and velocity of the wheel
@@ -811,8 +940,9 @@ int main(int argc, char* argv[]) {
         ChVector<> vel_old = wheel->GetPos_dt();
 
         // Calculate minimum and maximum particle heights
-        double highest, lowest;
-        FindHeightRange(msystem, lowest, highest);
+        const ParticleQuery::Result& stats = particles.Update();
+        double highest = stats.max_height;
+        double lowest = stats.min_height;
 
         // If at an output frame, write PovRay file and print info
         if (sim_frame == next_out_frame) {
@@ -928,6 +1058,49 @@ int main(int argc, char* argv[]) {
             }
         }
 
+        if (problem == ROLLING && use_slip_ramp && sim_frame % write_steps == 0) {
+            // Advance to the next slip once the drawbar pull and the torque are steady.
+            double t = msystem->GetChTime();
+            dp_detector.Add(t, actuator->Get_react_force().x());
+            torque_detector.Add(t, engine_wheel_axle->GetMotorTorque());
+            sinkage_detector.Add(t, surface - (wheel->GetPos().z() - wheelRadius));
+
+            double duration = t - segment_start;
+            bool steady = dp_detector.IsSteady() && torque_detector.IsSteady();
+            if ((steady && duration >= slip_time_min) || duration >= slip_time_max) {
+                double slip = slip_values[segment];
+                *slipStream << slip << ", " << angVel * wheelRadius * (1 - slip) << ", " << duration << ", "
+                            << (steady ? 1 : 0) << ", " << dp_detector.GetMean() << ", " << dp_detector.GetStdDev()
+                            << ", " << torque_detector.GetMean() << ", " << torque_detector.GetStdDev() << ", "
+                            << sinkage_detector.GetMean() << ", \n";
+                slipStream->GetFstream().flush();
+                cout << "Slip " << slip << (steady ? "  steady" : "  NOT steady") << " after " << duration
+                     << " s:  DP = " << dp_detector.GetMean() << "  torque = " << torque_detector.GetMean()
+                     << "  sinkage = " << sinkage_detector.GetMean() << endl;
+
+                if (++segment == slip_values.size())
+                    break;
+                motion->SetVelocity(t, angVel * wheelRadius * (1 - slip_values[segment]));
+                dp_detector.Reset(t);
+                torque_detector.Reset(t);
+                sinkage_detector.Reset(t);
+                segment_start = t;
+            }
+        }
+
+        if (problem == ROLLING) {
+            // Recycle the material behind the wheel or end the slip ramp before the wheel reaches the front wall.
+            double x_front = (bin ? bin->GetPos().x() : 0) + hdimX;
+            if (bin && wheel->GetPos().x() > x_front - recycle_margin) {
+                int num_recycled = RecycleMaterial(msystem, bin, recycle_length, surface);
+                cout << "Recycled " << num_recycled << " particles;  bin front at " << x_front + recycle_length
+                     << endl;
+            } else if (!bin && use_slip_ramp && wheel->GetPos().x() > x_front - 1.01 * wheelRadius) {
+                cout << "Wheel reached the end of the bin...  time = " << time << endl;
+                break;
+            }
+        }
+
         // Increment counters
         time += time_step;
         sim_frame++;
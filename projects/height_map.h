@@ -0,0 +1,346 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Surface height map of a granular bed of spheres in a Chrono::Parallel
+// system, and crater metrics computed from it at run time.
+//
+// The height of a cell of a regular 2D grid (in the XY plane) is the highest
+// point of the particle surfaces above the cell center (each sphere covers the
+// cells whose centers lie within its footprint; the cell containing its center
+// gets its top). Particles are processed in parallel over the positions in the
+// data manager into per-thread grids, which are merged with a maximum. Cells
+// not covered by any particle are empty (NaN).
+//
+// Crater metrics are derived from the azimuthally averaged radial profile of
+// the heights around a given center (e.g. the projectile position), relative
+// to a reference surface height (e.g. the mean height before impact):
+// - depth: reference height minus the lowest profile height;
+// - diameter: twice the radius at which the profile, going outward from its
+//   lowest point, rises back to the reference height;
+// - rim height and rim diameter: highest profile height (above the reference)
+//   outside the lowest point, and twice its radius.
+//
+// Height maps can be appended to a compact binary raster file:
+//   header:  "CHHMAP1" + '\0', uint32 version, uint32 nx, uint32 ny,
+//            float64 x_min, float64 y_min, float64 cell size
+//   frames:  float64 time, nx * ny float32 heights (x fastest, NaN if empty)
+//
+// Particles are the bodies with identifiers in the selected range (default:
+// positive identifiers) that carry a sphere visualization asset; its radius is
+// used. The cached selection is rebuilt when the number of bodies changes.
+//
+// Usage:
+//   HeightMap heights(system);
+//   heights.SetGrid(-hx, -hy, hx, hy, 2 * radius);
+//   double reference = heights.Update().GetMeanHeight();
+//   heights.OpenRaster(out_dir + "/heightmap.bin");
+//   while (...) {
+//       ...
+//       heights.Update().WriteRaster(time);
+//       HeightMap::Crater crater = heights.MeasureCrater(ball->GetPos().x(), ball->GetPos().y(), reference);
+//   }
+//
+// =============================================================================
+
+#ifndef HEIGHT_MAP_H
+#define HEIGHT_MAP_H
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "chrono/assets/ChSphereShape.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class HeightMap {
+  public:
+    /// Crater metrics (lengths in the units of the system).
+    struct Crater {
+        double depth;         ///< reference height minus the lowest profile height
+        double diameter;      ///< diameter at the reference height (0 if the profile does not rise back to it)
+        double rim_height;    ///< highest profile height outside the lowest point, above the reference
+        double rim_diameter;  ///< diameter of the rim crest
+        bool valid;           ///< profile rises back to the reference height?
+    };
+
+    /// Map the bodies with identifiers in [min_id, max_id] (default: positive identifiers).
+    HeightMap(chrono::ChSystemParallel* system, int min_id = 1, int max_id = INT_MAX)
+        : m_system(system),
+          m_min_id(min_id),
+          m_max_id(max_id),
+          m_nx(0),
+          m_ny(0),
+          m_x0(0),
+          m_y0(0),
+          m_cell(1),
+          m_num_bodies(0) {}
+
+    /// Set the grid: the rectangle [x_min, x_max] x [y_min, y_max], split into square cells with edges as close
+    /// as possible to 'size' (along one axis, the grid may end slightly short of the rectangle).
+    void SetGrid(double x_min, double y_min, double x_max, double y_max, double size) {
+        m_x0 = x_min;
+        m_y0 = y_min;
+        m_nx = std::max(1, (int)std::round((x_max - x_min) / size));
+        m_ny = std::max(1, (int)std::round((y_max - y_min) / size));
+        m_cell = std::min((x_max - x_min) / m_nx, (y_max - y_min) / m_ny);
+        m_height.assign((size_t)m_nx * m_ny, std::numeric_limits<float>::quiet_NaN());
+    }
+
+    /// Force a rebuild of the cached particle selection at the next call to Update().
+    void Invalidate() { m_num_bodies = 0; }
+
+    /// Compute the height map for the current state of the system.
+    HeightMap& Update() {
+        Refresh();
+        size_t num_cells = m_height.size();
+        if (num_cells == 0)
+            return *this;
+
+        int num_threads = chrono::CHOMPfunctions::GetNumThreads();
+        int team_size = 1;
+
+        const auto& bodies = m_system->Get_bodylist();
+        const auto& pos_rigid = m_system->data_manager->host_data.pos_rigid;
+        bool has_state = m_system->GetStepcount() > 0 && pos_rigid.size() == bodies.size();
+        int n = (int)m_indices.size();
+        const float empty = -std::numeric_limits<float>::infinity();
+
+#pragma omp parallel num_threads(num_threads)
+        {
+            // The team may be smaller than requested: one grid per thread of the actual team.
+#pragma omp single
+            {
+                team_size = chrono::CHOMPfunctions::GetNumThreads();
+                m_thread_height.resize(team_size);
+            }
+
+            std::vector<float>& height = m_thread_height[chrono::CHOMPfunctions::GetThreadNum()];
+            height.assign(num_cells, empty);
+
+#pragma omp for schedule(static)
+            for (int k = 0; k < n; k++) {
+                int i = m_indices[k];
+                double x, y, z;
+                if (has_state) {
+                    x = pos_rigid[i].x;
+                    y = pos_rigid[i].y;
+                    z = pos_rigid[i].z;
+                } else {
+                    const chrono::ChVector<>& pos = bodies[i]->GetPos();
+                    x = pos.x();
+                    y = pos.y();
+                    z = pos.z();
+                }
+                double r = m_radius[k];
+
+                // Cell containing the sphere center: top of the sphere.
+                int cx = (int)std::floor((x - m_x0) / m_cell);
+                int cy = (int)std::floor((y - m_y0) / m_cell);
+                if (cx >= 0 && cx < m_nx && cy >= 0 && cy < m_ny) {
+                    float& h = height[(size_t)cy * m_nx + cx];
+                    h = std::max(h, (float)(z + r));
+                }
+
+                // Cells with centers within the sphere footprint: spherical cap above the cell center.
+                int ix0 = std::max(0, (int)std::ceil((x - r - m_x0) / m_cell - 0.5));
+                int ix1 = std::min(m_nx - 1, (int)std::floor((x + r - m_x0) / m_cell - 0.5));
+                int iy0 = std::max(0, (int)std::ceil((y - r - m_y0) / m_cell - 0.5));
+                int iy1 = std::min(m_ny - 1, (int)std::floor((y + r - m_y0) / m_cell - 0.5));
+                for (int iy = iy0; iy <= iy1; iy++) {
+                    double dy = m_y0 + (iy + 0.5) * m_cell - y;
+                    for (int ix = ix0; ix <= ix1; ix++) {
+                        double dx = m_x0 + (ix + 0.5) * m_cell - x;
+                        double d2 = r * r - dx * dx - dy * dy;
+                        if (d2 < 0)
+                            continue;
+                        float& h = height[(size_t)iy * m_nx + ix];
+                        h = std::max(h, (float)(z + std::sqrt(d2)));
+                    }
+                }
+            }
+
+            // Merge the per-thread grids.
+#pragma omp barrier
+#pragma omp for schedule(static)
+            for (int c = 0; c < (int)num_cells; c++) {
+                float h = empty;
+                for (int t = 0; t < team_size; t++)
+                    h = std::max(h, m_thread_height[t][c]);
+                m_height[c] = (h == empty) ? std::numeric_limits<float>::quiet_NaN() : h;
+            }
+        }
+
+        return *this;
+    }
+
+    /// Return the number of cells along X.
+    int GetNumCellsX() const { return m_nx; }
+
+    /// Return the number of cells along Y.
+    int GetNumCellsY() const { return m_ny; }
+
+    /// Return the cell edge length.
+    double GetCellSize() const { return m_cell; }
+
+    /// Return the height of the specified cell (NaN if empty).
+    double GetHeight(int ix, int iy) const { return m_height[(size_t)iy * m_nx + ix]; }
+
+    /// Return the mean height over all non-empty cells (0 if none).
+    double GetMeanHeight() const {
+        double sum = 0;
+        int num = 0;
+        for (float h : m_height) {
+            if (!std::isnan(h)) {
+                sum += h;
+                num++;
+            }
+        }
+        return num > 0 ? sum / num : 0;
+    }
+
+    /// Compute the crater metrics around the given center, relative to the given reference surface height.
+    /// The radial profile extends to the nearest grid edge and uses annuli one cell wide.
+    Crater MeasureCrater(double x, double y, double reference) const {
+        Crater crater = {0, 0, 0, 0, false};
+
+        double max_radius = std::min(std::min(x - m_x0, m_x0 + m_nx * m_cell - x),
+                                     std::min(y - m_y0, m_y0 + m_ny * m_cell - y));
+        int num_bins = (int)std::floor(max_radius / m_cell);
+        if (num_bins < 1)
+            return crater;
+
+        // Azimuthally averaged radial profile.
+        std::vector<double> sum(num_bins, 0.0);
+        std::vector<int> count(num_bins, 0);
+        for (int iy = 0; iy < m_ny; iy++) {
+            double dy = m_y0 + (iy + 0.5) * m_cell - y;
+            for (int ix = 0; ix < m_nx; ix++) {
+                float h = m_height[(size_t)iy * m_nx + ix];
+                if (std::isnan(h))
+                    continue;
+                double dx = m_x0 + (ix + 0.5) * m_cell - x;
+                int b = (int)(std::sqrt(dx * dx + dy * dy) / m_cell);
+                if (b >= num_bins)
+                    continue;
+                sum[b] += h;
+                count[b]++;
+            }
+        }
+        std::vector<int> bins;
+        std::vector<double> profile;
+        for (int b = 0; b < num_bins; b++) {
+            if (count[b] > 0) {
+                bins.push_back(b);
+                profile.push_back(sum[b] / count[b]);
+            }
+        }
+        if (profile.empty())
+            return crater;
+
+        // Lowest point, crossing of the reference height, and rim crest (outward from the lowest point).
+        size_t low = std::min_element(profile.begin(), profile.end()) - profile.begin();
+        crater.depth = reference - profile[low];
+
+        size_t rim = std::max_element(profile.begin() + low, profile.end()) - profile.begin();
+        crater.rim_height = profile[rim] - reference;
+        crater.rim_diameter = 2 * (bins[rim] + 0.5) * m_cell;
+
+        for (size_t j = low + 1; j < profile.size(); j++) {
+            if (profile[j] >= reference) {
+                double r0 = (bins[j - 1] + 0.5) * m_cell;
+                double r1 = (bins[j] + 0.5) * m_cell;
+                double f = (reference - profile[j - 1]) / (profile[j] - profile[j - 1]);
+                crater.diameter = 2 * (r0 + f * (r1 - r0));
+                crater.valid = true;
+                break;
+            }
+        }
+
+        return crater;
+    }
+
+    /// Create the specified raster file and write its header. Return false if the file cannot be created.
+    bool OpenRaster(const std::string& filename) {
+        m_raster.open(filename, std::ios::binary);
+        if (!m_raster.is_open())
+            return false;
+        const char magic[8] = {'C', 'H', 'H', 'M', 'A', 'P', '1', '\0'};
+        uint32_t header[3] = {1, (uint32_t)m_nx, (uint32_t)m_ny};
+        double grid[3] = {m_x0, m_y0, m_cell};
+        m_raster.write(magic, sizeof(magic));
+        m_raster.write(reinterpret_cast<const char*>(header), sizeof(header));
+        m_raster.write(reinterpret_cast<const char*>(grid), sizeof(grid));
+        return m_raster.good();
+    }
+
+    /// Append the current height map to the raster file, with the specified time.
+    bool WriteRaster(double time) {
+        if (!m_raster.is_open())
+            return false;
+        m_raster.write(reinterpret_cast<const char*>(&time), sizeof(time));
+        m_raster.write(reinterpret_cast<const char*>(m_height.data()), m_height.size() * sizeof(float));
+        m_raster.flush();
+        return m_raster.good();
+    }
+
+  private:
+    /// Rebuild the cached particle selection (indices, radii) if the number of bodies changed.
+    void Refresh() {
+        const auto& bodies = m_system->Get_bodylist();
+        if (bodies.size() == m_num_bodies)
+            return;
+
+        m_indices.clear();
+        m_radius.clear();
+        for (size_t i = 0; i < bodies.size(); i++) {
+            int id = bodies[i]->GetIdentifier();
+            if (id < m_min_id || id > m_max_id)
+                continue;
+            for (const auto& asset : bodies[i]->GetAssets()) {
+                if (auto sphere = std::dynamic_pointer_cast<chrono::ChSphereShape>(asset)) {
+                    m_indices.push_back((int)i);
+                    m_radius.push_back(sphere->GetSphereGeometry().rad);
+                    break;
+                }
+            }
+        }
+        m_num_bodies = bodies.size();
+    }
+
+    chrono::ChSystemParallel* m_system;
+    int m_min_id;  ///< smallest selected identifier
+    int m_max_id;  ///< largest selected identifier
+
+    int m_nx;       ///< number of cells along X
+    int m_ny;       ///< number of cells along Y
+    double m_x0;    ///< lower X limit of the grid
+    double m_y0;    ///< lower Y limit of the grid
+    double m_cell;  ///< cell edge length
+
+    size_t m_num_bodies;           ///< number of bodies at the last rebuild
+    std::vector<int> m_indices;    ///< body indices of the selected particles
+    std::vector<double> m_radius;  ///< particle radii
+
+    std::vector<float> m_height;                      ///< cell heights (NaN if empty)
+    std::vector<std::vector<float>> m_thread_height;  ///< per-thread cell heights
+    std::ofstream m_raster;                           ///< raster output file
+};
+
+#endif
@@ -0,0 +1,347 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Hierarchical (multi-level) grid broad phase for polydisperse sets of spheres.
+//
+// A uniform grid must use cells at least as large as the largest sphere, so
+// that each sphere only overlaps its neighbor cells; with a wide size
+// distribution, the cells then hold many small spheres and most candidate
+// pairs are far apart. Here, the grid has several levels with cell sizes
+// doubling from one level to the next, up to the largest sphere diameter (the
+// finest cells are not smaller than the smallest diameter). Each sphere is
+// stored at the finest level whose cell size is not smaller than its diameter
+// (plus the contact margin). A sphere is tested against the spheres in its own
+// cell and in the 13 neighbor cells of the forward half-shell at its own level
+// (each pair once) and, at each finer level, in the cells within reach of its
+// surface (large spheres are few, so searching from them is the cheaper
+// direction). The work is done per occupied cell, so that the neighbor cells at
+// the same level are looked up once for all spheres in the cell.
+//
+// Levels are sparse: the spheres of a level are sorted by cell key, and the
+// occupied cells are found through an open-addressing hash table of the keys.
+//
+// Limiting the number of levels to 1 gives the uniform grid with cells sized
+// from the largest sphere, used as the baseline in metrics_PAR_polydisperse.
+//
+// Pairs are found in parallel (OpenMP) with per-thread lists, merged and
+// sorted: the result does not depend on the number of threads.
+//
+// No Chrono dependency.
+//
+// Usage:
+//   std::vector<MultiLevelGrid::Sphere> spheres = ...;
+//   MultiLevelGrid grid;
+//   grid.SetMargin(0.1 * r_min);
+//   grid.Build(spheres);
+//   const auto& pairs = grid.FindPairs();
+//
+// =============================================================================
+
+#ifndef MULTILEVEL_GRID_H
+#define MULTILEVEL_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+class MultiLevelGrid {
+  public:
+    /// Sphere stored in the grid.
+    struct Sphere {
+        double pos[3];  ///< center
+        double radius;  ///< radius
+    };
+
+    /// Create a grid with at most the given number of levels (1: uniform grid).
+    MultiLevelGrid(int max_levels = 16)
+        : m_max_levels(std::max(1, max_levels)), m_margin(0), m_spheres(nullptr), m_num_tests(0) {}
+
+    /// Set the contact margin: spheres closer than this distance are reported as pairs (default: 0).
+    void SetMargin(double margin) { m_margin = margin; }
+
+    /// Set the maximum number of levels (1: uniform grid).
+    void SetMaxLevels(int max_levels) { m_max_levels = std::max(1, max_levels); }
+
+    /// Build the grid for the given spheres (the array must remain valid until FindPairs is called).
+    void Build(const std::vector<Sphere>& spheres) {
+        m_spheres = &spheres;
+        m_levels.clear();
+        m_pairs.clear();
+        m_num_tests = 0;
+        if (spheres.empty())
+            return;
+
+        // Bounding box and extent (diameter plus margin) range.
+        double ext_min = std::numeric_limits<double>::max();
+        double ext_max = 0;
+        for (int a = 0; a < 3; a++)
+            m_origin[a] = std::numeric_limits<double>::max();
+        for (const auto& s : spheres) {
+            double ext = 2 * s.radius + m_margin;
+            ext_min = std::min(ext_min, ext);
+            ext_max = std::max(ext_max, ext);
+            for (int a = 0; a < 3; a++)
+                m_origin[a] = std::min(m_origin[a], s.pos[a] - s.radius);
+        }
+        ext_min = std::max(ext_min, 1e-12);
+
+        // Cell sizes: halving from the largest extent, down to the smallest extent.
+        int num_levels = 1;
+        while (num_levels < m_max_levels && ext_max / std::pow(2.0, num_levels) >= ext_min)
+            num_levels++;
+        m_levels.resize(num_levels);
+        for (int l = 0; l < num_levels; l++)
+            m_levels[l].cell = ext_max / std::pow(2.0, num_levels - 1 - l);
+
+        // Assign each sphere to the finest level that fits it, then sort each level by cell key.
+        for (int i = 0; i < (int)spheres.size(); i++) {
+            double ext = 2 * spheres[i].radius + m_margin;
+            int l = 0;
+            while (l < num_levels - 1 && m_levels[l].cell < ext)
+                l++;
+            m_levels[l].entries.push_back({Key(spheres[i].pos, m_levels[l].cell), i});
+        }
+        for (auto& level : m_levels)
+            level.Finalize();
+    }
+
+    /// Find all pairs of spheres with surfaces closer than the margin (pairs (i, j) with i < j, sorted).
+    const std::vector<std::pair<int, int>>& FindPairs() {
+        m_pairs.clear();
+        m_num_tests = 0;
+        if (m_levels.empty())
+            return m_pairs;
+
+        // Work items: all occupied cells of all levels.
+        std::vector<std::pair<int, int>> items;
+        for (int l = 0; l < (int)m_levels.size(); l++) {
+            for (int c = 0; c < (int)m_levels[l].keys.size(); c++)
+                items.push_back(std::make_pair(l, c));
+        }
+
+        int num_threads = 1;
+#ifdef _OPENMP
+        num_threads = omp_get_max_threads();
+#endif
+        std::vector<std::vector<std::pair<int, int>>> thread_pairs(num_threads);
+        std::vector<uint64_t> thread_tests(num_threads, 0);
+
+#pragma omp parallel num_threads(num_threads)
+        {
+            int tid = 0;
+#ifdef _OPENMP
+            tid = omp_get_thread_num();
+#endif
+            std::vector<std::pair<int, int>>& pairs = thread_pairs[tid];
+            uint64_t tests = 0;
+
+#pragma omp for schedule(static)
+            for (int it = 0; it < (int)items.size(); it++) {
+                const Level& level = m_levels[items[it].first];
+                int cell = items[it].second;
+                int c[3];
+                Unpack(level.keys[cell], c);
+
+                // Same level: the cell itself and the 13 neighbor cells of the forward half-shell (each pair once).
+                for (int dk = 0; dk <= 1; dk++) {
+                    for (int dj = (dk > 0 ? -1 : 0); dj <= 1; dj++) {
+                        for (int di = (dk > 0 || dj > 0 ? -1 : 0); di <= 1; di++) {
+                            int n = (di == 0 && dj == 0 && dk == 0) ? cell  //
+                                                                    : level.Find(c[0] + di, c[1] + dj, c[2] + dk);
+                            if (n < 0)
+                                continue;
+                            for (int e = level.start[cell]; e < level.start[cell + 1]; e++) {
+                                int f0 = (n == cell) ? e + 1 : level.start[n];
+                                for (int f = f0; f < level.start[n + 1]; f++)
+                                    Test(level.entries[e].second, level.entries[f].second, pairs, tests);
+                            }
+                        }
+                    }
+                }
+
+                // Finer levels: the cells within reach of each sphere of this cell. There are fewer large spheres
+                // than small ones, so looking up the fine cells around the large spheres is the cheaper direction.
+                for (int e = level.start[cell]; e < level.start[cell + 1]; e++) {
+                    int j = level.entries[e].second;
+                    const Sphere& sj = (*m_spheres)[j];
+                    for (int l = 0; l < items[it].first; l++) {
+                        const Level& fine = m_levels[l];
+                        if (fine.keys.empty())
+                            continue;
+                        // A sphere of this level fits in a fine cell: its center is within reach + half a cell.
+                        double reach = sj.radius + m_margin + 0.5 * fine.cell;
+                        int lo[3];
+                        int hi[3];
+                        for (int a = 0; a < 3; a++) {
+                            lo[a] = (int)std::floor((sj.pos[a] - reach - m_origin[a]) / fine.cell);
+                            hi[a] = (int)std::floor((sj.pos[a] + reach - m_origin[a]) / fine.cell);
+                        }
+                        for (int ck = lo[2]; ck <= hi[2]; ck++) {
+                            for (int cj = lo[1]; cj <= hi[1]; cj++) {
+                                for (int ci = lo[0]; ci <= hi[0]; ci++) {
+                                    int n = fine.Find(ci, cj, ck);
+                                    if (n < 0)
+                                        continue;
+                                    for (int f = fine.start[n]; f < fine.start[n + 1]; f++)
+                                        Test(fine.entries[f].second, j, pairs, tests);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            thread_tests[tid] = tests;
+        }
+
+        size_t total = 0;
+        for (const auto& p : thread_pairs)
+            total += p.size();
+        m_pairs.reserve(total);
+        for (int t = 0; t < num_threads; t++) {
+            m_pairs.insert(m_pairs.end(), thread_pairs[t].begin(), thread_pairs[t].end());
+            m_num_tests += thread_tests[t];
+        }
+        std::sort(m_pairs.begin(), m_pairs.end());
+
+        return m_pairs;
+    }
+
+    /// Return the pairs found by the last call to FindPairs.
+    const std::vector<std::pair<int, int>>& GetPairs() const { return m_pairs; }
+
+    /// Return the number of levels of the last build.
+    int GetNumLevels() const { return (int)m_levels.size(); }
+
+    /// Return the cell size of the specified level.
+    double GetCellSize(int level) const { return m_levels[level].cell; }
+
+    /// Return the number of spheres stored at the specified level.
+    int GetNumSpheres(int level) const { return (int)m_levels[level].entries.size(); }
+
+    /// Return the number of sphere-sphere distance tests of the last call to FindPairs.
+    uint64_t GetNumTests() const { return m_num_tests; }
+
+  private:
+    /// One level of the grid: (cell key, sphere index) entries sorted by key, with a hash table of the occupied cells.
+    struct Level {
+        /// Sort the entries and build the table of occupied cells.
+        void Finalize() {
+            std::sort(entries.begin(), entries.end());
+            keys.clear();
+            start.clear();
+            for (int e = 0; e < (int)entries.size(); e++) {
+                if (e == 0 || entries[e].first != entries[e - 1].first) {
+                    keys.push_back(entries[e].first);
+                    start.push_back(e);
+                }
+            }
+            start.push_back((int)entries.size());
+
+            size_t size = 16;
+            while (size < 2 * keys.size())
+                size *= 2;
+            mask = size - 1;
+            table.assign(size, -1);
+            for (int c = 0; c < (int)keys.size(); c++) {
+                size_t h = Hash(keys[c]) & mask;
+                while (table[h] >= 0)
+                    h = (h + 1) & mask;
+                table[h] = c;
+            }
+        }
+
+        /// Return the index of the occupied cell with the given coordinates (-1 if empty).
+        int Find(int i, int j, int k) const {
+            if (i < 0 || j < 0 || k < 0 || i > kMaxCoord || j > kMaxCoord || k > kMaxCoord)
+                return -1;
+            uint64_t key = Pack(i, j, k);
+            size_t h = Hash(key) & mask;
+            while (table[h] >= 0) {
+                if (keys[table[h]] == key)
+                    return table[h];
+                h = (h + 1) & mask;
+            }
+            return -1;
+        }
+
+        static size_t Hash(uint64_t key) {
+            // MurmurHash3 finalizer
+            key ^= key >> 33;
+            key *= 0xFF51AFD7ED558CCDULL;
+            key ^= key >> 33;
+            key *= 0xC4CEB9FE1A85EC53ULL;
+            key ^= key >> 33;
+            return (size_t)key;
+        }
+
+        double cell;                                    ///< cell size
+        std::vector<std::pair<uint64_t, int>> entries;  ///< (cell key, sphere index), sorted
+        std::vector<uint64_t> keys;                     ///< keys of the occupied cells
+        std::vector<int> start;                         ///< first entry of each occupied cell (plus end)
+        std::vector<int> table;                         ///< hash table of the occupied cells
+        size_t mask;                                    ///< table size - 1
+    };
+
+    static const int kMaxCoord = (1 << 21) - 1;
+
+    /// Pack cell coordinates (21 bits each) in a key.
+    static uint64_t Pack(int i, int j, int k) { return (uint64_t)i | ((uint64_t)j << 21) | ((uint64_t)k << 42); }
+
+    /// Unpack the cell coordinates from a key.
+    static void Unpack(uint64_t key, int* c) {
+        c[0] = (int)(key & kMaxCoord);
+        c[1] = (int)((key >> 21) & kMaxCoord);
+        c[2] = (int)((key >> 42) & kMaxCoord);
+    }
+
+    /// Key of the cell containing the given point.
+    uint64_t Key(const double* pos, double cell) const {
+        int c[3];
+        for (int a = 0; a < 3; a++)
+            c[a] = std::min(kMaxCoord, (int)std::floor((pos[a] - m_origin[a]) / cell));
+        return Pack(c[0], c[1], c[2]);
+    }
+
+    /// Record the pair of spheres i and j if their surfaces are closer than the margin.
+    void Test(int i, int j, std::vector<std::pair<int, int>>& pairs, uint64_t& tests) const {
+        const Sphere& a = (*m_spheres)[i];
+        const Sphere& b = (*m_spheres)[j];
+        double dx = a.pos[0] - b.pos[0];
+        double dy = a.pos[1] - b.pos[1];
+        double dz = a.pos[2] - b.pos[2];
+        double d = a.radius + b.radius + m_margin;
+        tests++;
+        if (dx * dx + dy * dy + dz * dz < d * d)
+            pairs.push_back(std::make_pair(std::min(i, j), std::max(i, j)));
+    }
+
+    int m_max_levels;  ///< maximum number of levels
+    double m_margin;   ///< contact margin
+    double m_origin[3];
+
+    const std::vector<Sphere>* m_spheres;
+    std::vector<Level> m_levels;
+
+    std::vector<std::pair<int, int>> m_pairs;
+    uint64_t m_num_tests;  ///< number of distance tests in the last FindPairs
+};
+
+#endif
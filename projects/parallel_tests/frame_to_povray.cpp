@@ -0,0 +1,69 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Convert a binary frame file (written with FrameWriter, see
+// projects/frame_writer.h) to the POV-Ray text files of
+// utils::WriteShapesPovray, one file per frame.
+//
+// Usage:
+//   frame_to_povray <frames.bin> <output_dir> [first_index]
+//
+// Frames are written to <output_dir>/data_###.dat, numbered from first_index
+// (default 1), which matches the file names used by the simulation programs.
+//
+// =============================================================================
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "../frame_format.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: " << argv[0] << " <frames.bin> <output_dir> [first_index]" << std::endl;
+        return 1;
+    }
+    std::string out_dir = argv[2];
+    int index = (argc > 3) ? std::stoi(argv[3]) : 1;
+
+    frame_format::FileReader reader(argv[1]);
+    if (!reader.IsValid()) {
+        std::cout << "Error: " << reader.GetError() << std::endl;
+        return 1;
+    }
+
+    frame_format::Frame frame;
+    int num_frames = 0;
+    while (reader.ReadFrame(frame)) {
+        char filename[300];
+        sprintf(filename, "%s/data_%03d.dat", out_dir.c_str(), index++);
+        std::ofstream os(filename);
+        if (!os.is_open()) {
+            std::cout << "Error creating " << filename << std::endl;
+            return 1;
+        }
+        frame_format::WritePovray(os, reader.GetTable(), frame, reader.HasBodyInfo());
+        num_frames++;
+    }
+
+    if (!reader.GetError().empty()) {
+        std::cout << "Error: " << reader.GetError() << " (after " << num_frames << " frames)" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Converted " << num_frames << " frames" << std::endl;
+    return 0;
+}
@@ -14,6 +14,17 @@
 //
 // ChronoParallel test program for settling process of granular material.
 //
+// Usage:
+//   test_PAR_settling [num_threads] [use_sleeping] [deterministic] [size_ratio]
+//
+// With a size ratio larger than 1, the bed is polydisperse (see
+// projects/size_distribution.h): radii from radius_g to size_ratio * radius_g,
+// with equal solid volume per radius class, generated with BulkGenerator.
+//
+// In deterministic mode (see projects/deterministic_mode.h), two runs with the
+// same number of threads produce bit-identical results, e.g. for comparing the
+// performance of two builds; state hashes are printed at the end of the run.
+//
 // The global reference frame has Z up.
 // All units SI (CGS, i.e., centimeter - gram - second)
 //
@@ -21,6 +32,7 @@
 
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <fstream>
 #include <string>
@@ -40,40 +52,14 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
-using namespace chrono;
-
-// --------------------------------------------------------------------------
+#include "../auto_binning.h"
+#include "../bulk_generator.h"
+#include "../deterministic_mode.h"
+#include "../size_distribution.h"
+#include "../sleep_manager.h"
+#include "../step_profiler.h"
 
-void TimingHeader() {
-    printf("    TIME    |");
-    printf("    STEP |");
-    printf("   BROAD |");
-    printf("  NARROW |");
-    printf("  SOLVER |");
-    printf("  UPDATE |");
-    printf("# BODIES |");
-    printf("# CONTACT|");
-    printf(" # ITERS |");
-    printf("\n\n");
-}
-
-void TimingOutput(chrono::ChSystem* mSys) {
-    double TIME = mSys->GetChTime();
-    double STEP = mSys->GetTimerStep();
-    double BROD = mSys->GetTimerCollisionBroad();
-    double NARR = mSys->GetTimerCollisionNarrow();
-    double SOLVER = mSys->GetTimerAdvance();
-    double UPDT = mSys->GetTimerUpdate();
-    int REQ_ITS = 0;
-    int BODS = mSys->GetNbodies();
-    int CNTC = mSys->GetNcontacts();
-    if (chrono::ChSystemParallel* parallel_sys = dynamic_cast<chrono::ChSystemParallel*>(mSys)) {
-        REQ_ITS = std::static_pointer_cast<chrono::ChIterativeSolverParallel>(mSys->GetSolver())->GetTotalIterations();
-    }
-
-    printf("   %8.5f | %7.4f | %7.4f | %7.4f | %7.4f | %7.4f | %7d | %7d | %7d |\n", TIME, STEP, BROD, NARR,
-           SOLVER, UPDT, BODS, CNTC, REQ_ITS);
-}
+using namespace chrono;
 
 // --------------------------------------------------------------------------
 
@@ -83,11 +69,23 @@ int main(int argc, char** argv) {
     bool use_mat_properties = true;
     bool render = false;
     bool track_granule = false;
+    bool use_sleeping = false;
+    bool deterministic = false;
+    double size_ratio = 1;
 
-    // Get number of threads from arguments (if specified)
+    // Get number of threads, sleeping flag, deterministic flag, and size ratio from arguments (if specified)
     if (argc > 1) {
         num_threads = std::stoi(argv[1]);
     }
+    if (argc > 2) {
+        use_sleeping = std::stoi(argv[2]) != 0;
+    }
+    if (argc > 3) {
+        deterministic = std::stoi(argv[3]) != 0;
+    }
+    if (argc > 4) {
+        size_ratio = std::stod(argv[4]);
+    }
 
     std::cout << "Requested number of threads: " << num_threads << std::endl;
 
@@ -110,6 +108,13 @@ int main(int argc, char** argv) {
     ChVector<> inertia_g = 0.4 * mass_g * radius_g * radius_g * ChVector<>(1, 1, 1);
     int num_layers = 10;
 
+    // Size distribution (polydisperse if size_ratio > 1)
+    int num_classes = 6;
+    double solid_fraction = 0.3;
+    SizeDistribution dist = SizeDistribution::Monodisperse(radius_g);
+    if (size_ratio > 1)
+        dist = SizeDistribution::PowerLaw(radius_g, size_ratio * radius_g, 4, num_classes);
+
     // Terrain contact properties
     float friction_terrain = 0.9f;
     float restitution_terrain = 0.0f;
@@ -122,13 +127,6 @@ int main(int argc, char** argv) {
     float coh_pressure_terrain = 0e3f;
     float coh_force_terrain = (float)(CH_C_PI * radius_g * radius_g) * coh_pressure_terrain;
 
-    // Estimates for number of bins for broad-phase
-    int factor = 2;
-    int binsX = (int)std::ceil(hdimX / radius_g) / factor;
-    int binsY = (int)std::ceil(hdimY / radius_g) / factor;
-    int binsZ = 1;
-    std::cout << "Broad-phase bins: " << binsX << " x " << binsY << " x " << binsZ << std::endl;
-
     // --------------------------
     // Create the parallel system
     // --------------------------
@@ -168,11 +166,22 @@ int main(int argc, char** argv) {
     system->GetSettings()->solver.tolerance = 0.1;
     system->GetSettings()->solver.max_iteration_bilateral = 100;
     system->GetSettings()->collision.narrowphase_algorithm = NarrowPhaseType::NARROWPHASE_HYBRID_MPR;
-    system->GetSettings()->collision.bins_per_axis = vec3(binsX, binsY, binsZ);
 
-    // Set number of threads
-    system->SetParallelThreadNumber(num_threads);
-    CHOMPfunctions::SetNumThreads(num_threads);
+    // Broad-phase bins: initial estimate from the container and the median particle size, re-evaluated during settling
+    AutoBinning binning(system);
+    binning.SetUpdateInterval(500);
+    binning.SetTimingFeedback(!deterministic);
+    binning.Initialize(ChVector<>(-hdimX, -hdimY, 0), ChVector<>(hdimX, hdimY, 2 * hdimZ),
+                       2 * dist.GetMedianRadius());
+
+    // Set number of threads (fixed OpenMP team in deterministic mode)
+    std::unique_ptr<DeterministicMode> det_mode;
+    if (deterministic) {
+        det_mode = std::unique_ptr<DeterministicMode>(new DeterministicMode(system, num_threads));
+    } else {
+        system->SetParallelThreadNumber(num_threads);
+        CHOMPfunctions::SetNumThreads(num_threads);
+    }
 
     // Sanity check: print number of threads in a parallel region
 #pragma omp parallel
@@ -246,27 +255,58 @@ int main(int argc, char** argv) {
     // Create particles
     // ----------------
 
-    // Create a particle generator and a mixture entirely made out of spheres
-    utils::Generator gen(system);
-    std::shared_ptr<utils::MixtureIngredient> m1 = gen.AddMixtureIngredient(utils::SPHERE, 1.0);
-    m1->setDefaultMaterial(material_terrain);
-    m1->setDefaultDensity(rho_g);
-    m1->setDefaultSize(radius_g);
-
-    // Set starting value for body identifiers
-    gen.setBodyIdentifier(Id_g);
-
     // Create particles in layers until reaching the desired number of particles
     double r = 1.01 * radius_g;
     ChVector<> hdims(hdimX - r, hdimY - r, 0);
     ChVector<> center(0, 0, 2 * r);
+    unsigned int num_particles;
+
+    if (size_ratio > 1) {
+        // Polydisperse bed, with the height of the monodisperse layers
+        BulkGenerator gen(system, det_mode ? det_mode->GetSeed() : 0);
+        gen.SetMaterial(material_terrain);
+        gen.SetDensity(rho_g);
+        gen.SetBodyIdentifier(Id_g);
+
+        double hz = num_layers * dist.GetMedianRadius();
+        gen.CreateObjectsBox(ChVector<>(0, 0, hz), ChVector<>(hdimX, hdimY, hz), dist, solid_fraction);
+
+        num_particles = gen.GetTotalNumBodies();
+    } else if (deterministic) {
+        // Seeded sampling (utils::Generator seeds its Poisson-disk sampler from the clock)
+        BulkGenerator gen(system, det_mode->GetSeed());
+        gen.SetMaterial(material_terrain);
+        gen.SetRadius(radius_g);
+        gen.SetDensity(rho_g);
+        gen.SetBodyIdentifier(Id_g);
+
+        std::vector<ChVector<>> points;
+        for (int il = 0; il < num_layers; il++) {
+            auto layer = gen.SampleBox(center, hdims, 2 * r);
+            points.insert(points.end(), layer.begin(), layer.end());
+            center.z() += 2 * r;
+        }
+        gen.CreateSpheres(points);
+
+        num_particles = gen.GetTotalNumBodies();
+    } else {
+        // Create a particle generator and a mixture entirely made out of spheres
+        utils::Generator gen(system);
+        std::shared_ptr<utils::MixtureIngredient> m1 = gen.AddMixtureIngredient(utils::SPHERE, 1.0);
+        m1->setDefaultMaterial(material_terrain);
+        m1->setDefaultDensity(rho_g);
+        m1->setDefaultSize(radius_g);
+
+        // Set starting value for body identifiers
+        gen.setBodyIdentifier(Id_g);
+
+        for (int il = 0; il < num_layers; il++) {
+            gen.createObjectsBox(utils::POISSON_DISK, 2 * r, center, hdims);
+            center.z() += 2 * r;
+        }
 
-    for (int il = 0; il < num_layers; il++) {
-        gen.createObjectsBox(utils::POISSON_DISK, 2 * r, center, hdims);
-        center.z() += 2 * r;
+        num_particles = gen.getTotalNumBodies();
     }
-
-    unsigned int num_particles = gen.getTotalNumBodies();
     std::cout << "Generated particles:  " << num_particles << std::endl;
 
     // If tracking a granule (roughly in the "middle of the pack"),
@@ -307,25 +347,24 @@ int main(int argc, char** argv) {
 
     double time_end = 0.4;
     double time_step = 1e-4;
+    int hash_steps = 100;  // state hash interval in deterministic mode
+    int sim_frame = 0;
 
-    double cum_sim_time = 0;
-    double cum_broad_time = 0;
-    double cum_narrow_time = 0;
-    double cum_solver_time = 0;
-    double cum_update_time = 0;
+    StepProfiler profiler(system);
 
-    TimingHeader();
+    // Optionally, put quiescent particles to sleep
+    SleepManager sleep(system);
+    sleep.SetGranularThresholds(radius_g);
+    sleep.SetSleepSteps((int)std::ceil(0.05 / time_step));
 
     while (system->GetChTime() < time_end) {
         system->DoStepDynamics(time_step);
-
-        TimingOutput(system);
-
-        cum_sim_time += system->GetTimerStep();
-        cum_broad_time += system->GetTimerCollisionBroad();
-        cum_narrow_time += system->GetTimerCollisionNarrow();
-        cum_solver_time += system->GetTimerAdvance();
-        cum_update_time += system->GetTimerUpdate();
+        binning.Update();
+        profiler.Record();
+        if (use_sleeping)
+            sleep.Update();
+        if (det_mode && ++sim_frame % hash_steps == 0)
+            det_mode->Record();
 
         if (track_granule) {
             assert(outf.is_open());
@@ -351,13 +390,11 @@ int main(int argc, char** argv) {
 #endif
     }
 
-    std::cout << std::endl;
-    std::cout << "Simulation time: " << cum_sim_time << std::endl;
-    std::cout << "    Broadphase:  " << cum_broad_time << std::endl;
-    std::cout << "    Narrowphase: " << cum_narrow_time << std::endl;
-    std::cout << "    Solver:      " << cum_solver_time << std::endl;
-    std::cout << "    Update:      " << cum_update_time << std::endl;
-    std::cout << std::endl;
+    profiler.PrintSummary();
+    if (use_sleeping)
+        std::cout << "Avg. sleeping fraction: " << sleep.GetAverageSleepingFraction() << std::endl;
+    if (det_mode)
+        det_mode->PrintSummary();
 
     return 0;
 }
\ No newline at end of file
@@ -14,11 +14,18 @@
 //
 // ChronoParallel demo program for simulatin of wheel in soilbin.
 //
+// Usage:
+//   test_PAR_soilbin [-s scenario.json] [key=value ...]
+// All simulation parameters below can be overridden from a scenario file or the
+// command line (e.g. problem=SETTLING granular.num_particles=5000); see
+// GetProblemSpecs() for the available keys.
+//
 // The global reference frame has Z up.
 // All units SI.
 // =============================================================================
 
 #include <cstdio>
+#include <memory>
 #include <vector>
 #include <cmath>
 
@@ -34,6 +41,10 @@
 
 #include "chrono_thirdparty/filesystem/path.h"
 
+#include "../auto_binning.h"
+#include "../frame_writer.h"
+#include "../scenario.h"
+
 using namespace chrono;
 using namespace chrono::collision;
 
@@ -80,20 +91,27 @@ int max_iteration_sliding = 20;
 int max_iteration_spinning = 0;
 float contact_recovery_speed = 0.1;
 #endif
+double tolerance = 1e-3;
 
 // Output
 #ifdef USE_SMC
-const std::string out_dir = "../SOILBIN_SMC";
+std::string out_dir = "../SOILBIN_SMC";
 #else
-const std::string out_dir = "../SOILBIN_NSC";
+std::string out_dir = "../SOILBIN_NSC";
 #endif
-const std::string pov_dir = out_dir + "/POVRAY";
-const std::string checkpoint_file = out_dir + "/settled.dat";
-const std::string stats_file = out_dir + "/stats.dat";
+std::string pov_dir = out_dir + "/POVRAY";
+std::string checkpoint_file = out_dir + "/settled.dat";
+std::string stats_file = out_dir + "/stats.dat";
+std::string frames_file = out_dir + "/frames.bin";
 
 int out_fps_settling = 30;
 int out_fps_dropping = 60;
 
+// Write all visualization frames to a single binary file (convert with frame_to_povray)
+// instead of one POV-Ray text file per frame?
+bool binary_frames = true;
+int frame_compression = 1;  // zlib level (0: none; ignored without zlib support)
+
 // -----------------------------------------------------------------------------
 // Parameters for the granular material (identical spheres)
 // -----------------------------------------------------------------------------
@@ -101,6 +119,10 @@ double r_g = 0.1;
 double rho_g = 2000;
 unsigned int desired_num_particles = 1000;
 
+float Y_g = 1e8f;
+float mu_g = 0.4f;
+float cr_g = 0.1f;
+
 // -----------------------------------------------------------------------------
 // Parameters for the falling object
 // -----------------------------------------------------------------------------
@@ -111,6 +133,12 @@ ChQuaternion<> initRot(1.0, 0.0, 0.0, 0.0);
 ChVector<> initLinVel(0.0, 0.0, 0.0);
 ChVector<> initAngVel(0.0, 0.0, 0.0);
 
+double rho_o = 2000.0;
+
+float Y_o = 1e8f;
+float mu_o = 0.4f;
+float cr_o = 0.1f;
+
 // -----------------------------------------------------------------------------
 // Half-dimensions of the container bin
 // -----------------------------------------------------------------------------
@@ -118,6 +146,10 @@ double hDimX = 5;
 double hDimY = 2;
 double hDimZ = 2;
 
+float Y_c = 2e6f;
+float mu_c = 0.4f;
+float cr_c = 0.1f;
+
 // =============================================================================
 // Create container bin.
 // =============================================================================
@@ -127,14 +159,14 @@ void CreateContainer(ChSystemParallel* system) {
 
 #ifdef USE_SMC
     auto mat_c = chrono_types::make_shared<ChMaterialSurfaceSMC>();
-    mat_c->SetYoungModulus(2e6f);
-    mat_c->SetFriction(0.4f);
-    mat_c->SetRestitution(0.1f);
+    mat_c->SetYoungModulus(Y_c);
+    mat_c->SetFriction(mu_c);
+    mat_c->SetRestitution(cr_c);
 
     utils::CreateBoxContainer(system, id_c, mat_c, ChVector<>(hDimX, hDimY, hDimZ), hThickness);
 #else
     auto mat_c = chrono_types::make_shared<ChMaterialSurfaceNSC>();
-    mat_c->SetFriction(0.4f);
+    mat_c->SetFriction(mu_c);
 
     utils::CreateBoxContainer(system, id_c, mat_c, ChVector<>(hDimX, hDimY, hDimZ), hThickness);
 
@@ -148,12 +180,12 @@ void CreateParticles(ChSystemParallel* system) {
 // Create a material for the ball mixture.
 #ifdef USE_SMC
     auto mat_g = chrono_types::make_shared<ChMaterialSurfaceSMC>();
-    mat_g->SetYoungModulus(1e8f);
-    mat_g->SetFriction(0.4f);
-    mat_g->SetRestitution(0.1f);
+    mat_g->SetYoungModulus(Y_g);
+    mat_g->SetFriction(mu_g);
+    mat_g->SetRestitution(cr_g);
 #else
     auto mat_g = chrono_types::make_shared<ChMaterialSurfaceNSC>();
-    mat_g->SetFriction(0.4f);
+    mat_g->SetFriction(mu_g);
 #endif
 
     // Create a mixture entirely made out of spheres.
@@ -183,20 +215,18 @@ void CreateParticles(ChSystemParallel* system) {
 // Create falling object.
 // =============================================================================
 void CreateObject(ChSystemParallel* system, double z) {
-    double rho_o = 2000.0;
-
 // -----------------------------------------
 // Create a material for the falling object.
 // -----------------------------------------
 
 #ifdef USE_SMC
     auto mat_o = chrono_types::make_shared<ChMaterialSurfaceSMC>();
-    mat_o->SetYoungModulus(1e8f);
-    mat_o->SetFriction(0.4f);
-    mat_o->SetRestitution(0.1f);
+    mat_o->SetYoungModulus(Y_o);
+    mat_o->SetFriction(mu_o);
+    mat_o->SetRestitution(cr_o);
 #else
     auto mat_o = chrono_types::make_shared<ChMaterialSurfaceNSC>();
-    mat_o->SetFriction(0.4f);
+    mat_o->SetFriction(mu_o);
 #endif
 
 // --------------------------
@@ -317,9 +347,81 @@ double FindLowest(ChSystem* sys) {
     return lowest;
 }
 
+// =============================================================================
+// Override the simulation parameters from a scenario file and/or command-line
+// arguments (see scenario.h). Keys not specified keep the values above.
+// =============================================================================
+bool GetProblemSpecs(int argc, char* argv[], Scenario& scenario) {
+    if (!scenario.Parse(argc, argv))
+        return false;
+
+    scenario.ReadEnum("problem", problem, {{"SETTLING", SETTLING}, {"DROPPING", DROPPING}});
+
+    scenario.Read("threads.num", threads);
+
+    scenario.Read("simulation.time_settling", time_settling);
+    scenario.Read("simulation.time_dropping", time_dropping);
+
+    scenario.Read("solver.time_step", time_step);
+    scenario.Read("solver.tolerance", tolerance);
+#ifndef USE_SMC
+    scenario.Read("solver.max_iteration_normal", max_iteration_normal);
+    scenario.Read("solver.max_iteration_sliding", max_iteration_sliding);
+    scenario.Read("solver.max_iteration_spinning", max_iteration_spinning);
+    scenario.Read("solver.contact_recovery_speed", contact_recovery_speed);
+#endif
+
+    scenario.Read("geometry.hdimX", hDimX);
+    scenario.Read("geometry.hdimY", hDimY);
+    scenario.Read("geometry.hdimZ", hDimZ);
+    scenario.Read("geometry.particle_radius", r_g);
+    scenario.Read("geometry.num_particles", desired_num_particles);
+    scenario.ReadEnum("geometry.object_shape", shape_o,
+                      {{"SPHERE", collision::SPHERE},
+                       {"BOX", collision::BOX},
+                       {"CAPSULE", collision::CAPSULE},
+                       {"CYLINDER", collision::CYLINDER},
+                       {"ROUNDEDCYL", collision::ROUNDEDCYL}});
+    scenario.Read("geometry.object_velocity", initLinVel);
+    scenario.Read("geometry.object_angular_velocity", initAngVel);
+
+    scenario.Read("material.granular.density", rho_g);
+    scenario.Read("material.granular.young_modulus", Y_g);
+    scenario.Read("material.granular.friction", mu_g);
+    scenario.Read("material.granular.restitution", cr_g);
+    scenario.Read("material.object.density", rho_o);
+    scenario.Read("material.object.young_modulus", Y_o);
+    scenario.Read("material.object.friction", mu_o);
+    scenario.Read("material.object.restitution", cr_o);
+    scenario.Read("material.container.young_modulus", Y_c);
+    scenario.Read("material.container.friction", mu_c);
+    scenario.Read("material.container.restitution", cr_c);
+
+    scenario.Read("output.dir", out_dir);
+    scenario.Read("output.fps_settling", out_fps_settling);
+    scenario.Read("output.fps_dropping", out_fps_dropping);
+    scenario.Read("output.binary_frames", binary_frames);
+    scenario.Read("output.frame_compression", frame_compression);
+
+    pov_dir = out_dir + "/POVRAY";
+    checkpoint_file = out_dir + "/settled.dat";
+    stats_file = out_dir + "/stats.dat";
+    frames_file = out_dir + "/frames.bin";
+
+    return scenario.CheckUnused();
+}
+
 // =============================================================================
 // =============================================================================
 int main(int argc, char* argv[]) {
+    // ------------------------------------
+    // Process the scenario specification.
+    // ------------------------------------
+
+    Scenario scenario;
+    if (!GetProblemSpecs(argc, argv, scenario))
+        return 1;
+
     // --------------------------
     // Create output directories.
     // --------------------------
@@ -332,6 +434,7 @@ int main(int argc, char* argv[]) {
         cout << "Error creating directory " << pov_dir << endl;
         return 1;
     }
+    scenario.Write(out_dir + "/scenario.json");
 
 // --------------
 // Create system.
@@ -362,7 +465,7 @@ int main(int argc, char* argv[]) {
     // Edit system settings.
     // ---------------------
 
-    msystem->GetSettings()->solver.tolerance = 1e-3;
+    msystem->GetSettings()->solver.tolerance = tolerance;
 
 #ifdef USE_SMC
     msystem->GetSettings()->collision.narrowphase_algorithm = NarrowPhaseType::NARROWPHASE_R;
@@ -378,7 +481,10 @@ int main(int argc, char* argv[]) {
     msystem->GetSettings()->collision.collision_envelope = 0.05 * r_g;
 #endif
 
-    msystem->GetSettings()->collision.bins_per_axis = vec3(10, 10, 10);
+    // Broad-phase bins: initial estimate from the container, re-evaluated during the simulation
+    AutoBinning binning(msystem);
+    binning.SetUpdateInterval(500);
+    binning.Initialize(ChVector<>(-hDimX, -hDimY, 0), ChVector<>(hDimX, hDimY, 2 * hDimZ), 2 * r_g);
 
     // ----------------------------------------
     // Depending on problem type:
@@ -427,11 +533,19 @@ int main(int argc, char* argv[]) {
     int num_contacts = 0;
     ChStreamOutAsciiFile sfile(stats_file.c_str());
 
+    std::unique_ptr<FrameWriter> frames;
+    if (binary_frames)
+        frames.reset(new FrameWriter(msystem, frames_file, true, frame_compression));
+
     while (time < time_end) {
         if (sim_frame == next_out_frame) {
-            char filename[100];
-            sprintf(filename, "%s/data_%03d.dat", pov_dir.c_str(), out_frame + 1);
-            utils::WriteShapesPovray(msystem, filename);
+            if (binary_frames) {
+                frames->Write();
+            } else {
+                char filename[100];
+                sprintf(filename, "%s/data_%03d.dat", pov_dir.c_str(), out_frame + 1);
+                utils::WriteShapesPovray(msystem, filename);
+            }
 
             cout << "------------ Output frame:   " << out_frame << endl;
             cout << "             Sim frame:      " << sim_frame << endl;
@@ -456,6 +570,7 @@ int main(int argc, char* argv[]) {
 
         // Advance dynamics.
         msystem->DoStepDynamics(time_step);
+        binning.Update();
 
         time += time_step;
         sim_frame++;
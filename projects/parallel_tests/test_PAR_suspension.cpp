@@ -19,6 +19,11 @@
 // If available, OpenGL is used for run-time rendering. Otherwise, the
 // simulation is carried out for a pre-defined duration and output files are
 // generated for post-processing with POV-Ray.
+//
+// Usage:
+//   test_PAR_suspension [-s scenario.json] [key=value ...]
+// The simulation parameters set in main() can be overridden from a scenario
+// file or the command line (e.g. solver.time_step=5e-4 car.wheel_speed=10).
 // =============================================================================
 
 #include <cstdio>
@@ -34,6 +39,8 @@
 #include "chrono_parallel/physics/ChSystemParallel.h"
 #include "chrono_parallel/solver/ChSystemDescriptorParallel.h"
 
+#include "chrono_thirdparty/filesystem/path.h"
+
 // Control use of OpenGL run-time rendering
 // Note: CHRONO_OPENGL is defined in ChConfig.h
 //#undef CHRONO_OPENGL
@@ -42,17 +49,25 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
+#include "../scenario.h"
+
 using namespace chrono;
 using namespace chrono::collision;
 
-const char* out_folder = "../DEMO_SUSPENSION/POVRAY";
+std::string out_dir = "../DEMO_SUSPENSION";
+std::string pov_dir = out_dir + "/POVRAY";
+
+// Car and ground parameters
+double wheel_speed = 20;  // prescribed angular speed of the rear wheels [rad/s]
+float mu_car = 1.0f;      // coefficient of friction for the car bodies
+float mu_ground = 1.0f;   // coefficient of friction for the ground
 
 // =============================================================================
 // Generate postprocessing output with current system state.
 // =============================================================================
 void OutputData(ChSystemParallel* sys, int out_frame, double time) {
     char filename[100];
-    sprintf(filename, "%s/data_%03d.dat", out_folder, out_frame);
+    sprintf(filename, "%s/data_%03d.dat", pov_dir.c_str(), out_frame);
     utils::WriteShapesPovray(sys, filename);
     std::cout << "time = " << time << std::flush << std::endl;
 }
@@ -133,11 +148,11 @@ class MySimpleCar {
         double frontDamping = .1;
         double rearDamping = .1;
         bool useSpheres = true;
-        double angularSpeed = 20;
+        double angularSpeed = wheel_speed;
 
         // Create the wheel material
         auto mat = chrono_types::make_shared<ChMaterialSurfaceNSC>();
-        mat->SetFriction(1.0);
+        mat->SetFriction(mu_car);
 
         // --- The car body ---
 
@@ -625,7 +640,7 @@ void AddGround(ChSystemParallelNSC* sys) {
 
     // Create a common material
     auto mat = chrono_types::make_shared<ChMaterialSurfaceNSC>();
-    mat->SetFriction(1.0f);
+    mat->SetFriction(mu_ground);
 
     // Create the containing bin (2 x 2 x 1)
     ChVector<> pos(0, -.6, -2);
@@ -697,6 +712,48 @@ int main(int argc, char* argv[]) {
     double tolerance = 1e-2;
     bool thread_tuning = false;
 
+    // Collision settings
+    double collision_envelope = 0.01;
+    ChVector<int> bins_per_axis(10, 10, 10);
+
+    // Override from scenario file and command line
+    // --------------------------------------------
+
+    Scenario scenario;
+    if (!scenario.Parse(argc, argv))
+        return 1;
+
+    scenario.Read("threads.num", threads);
+    scenario.Read("threads.tuning", thread_tuning);
+    scenario.Read("simulation.gravity", gravity);
+    scenario.Read("simulation.time_end", time_end);
+    scenario.Read("solver.time_step", time_step);
+    scenario.Read("solver.tolerance", tolerance);
+    scenario.Read("solver.max_iteration_normal", max_iteration_normal);
+    scenario.Read("solver.max_iteration_sliding", max_iteration_sliding);
+    scenario.Read("solver.max_iteration_spinning", max_iteration_spinning);
+    scenario.Read("solver.max_iteration_bilateral", max_iteration_bilateral);
+    scenario.Read("solver.contact_recovery_speed", contact_recovery_speed);
+    scenario.Read("solver.clamp_bilaterals", clamp_bilaterals);
+    scenario.Read("solver.bilateral_clamp_speed", bilateral_clamp_speed);
+    scenario.Read("collision.collision_envelope", collision_envelope);
+    scenario.Read("collision.bins_per_axis", bins_per_axis);
+    scenario.Read("material.car.friction", mu_car);
+    scenario.Read("material.ground.friction", mu_ground);
+    scenario.Read("car.wheel_speed", wheel_speed);
+    scenario.Read("output.dir", out_dir);
+    scenario.Read("output.fps", out_fps);
+    if (!scenario.CheckUnused())
+        return 1;
+
+    pov_dir = out_dir + "/POVRAY";
+    if (!filesystem::create_directory(filesystem::path(out_dir)) ||
+        !filesystem::create_directory(filesystem::path(pov_dir))) {
+        std::cout << "Error creating directory " << pov_dir << std::endl;
+        return 1;
+    }
+    scenario.Write(out_dir + "/scenario.json");
+
     // Create system
     // -------------
 
@@ -730,8 +787,8 @@ int main(int argc, char* argv[]) {
     msystem.SetMaxPenetrationRecoverySpeed(contact_recovery_speed);
     msystem.ChangeSolverType(SolverType::APGDREF);
 
-    msystem.GetSettings()->collision.collision_envelope = 0.01;
-    msystem.GetSettings()->collision.bins_per_axis = vec3(10, 10, 10);
+    msystem.GetSettings()->collision.collision_envelope = collision_envelope;
+    msystem.GetSettings()->collision.bins_per_axis = vec3(bins_per_axis.x(), bins_per_axis.y(), bins_per_axis.z());
 
     // Create the fixed and moving bodies
     // ----------------------------------
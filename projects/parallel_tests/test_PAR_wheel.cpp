@@ -423,7 +423,6 @@ int main(int argc, char* argv[]) {
             next_out_frame += out_steps;
         }
 
-        //TimingOutput(msystem);
         system->DoStepDynamics(time_step);
 
         time += time_step;
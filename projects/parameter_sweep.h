@@ -0,0 +1,210 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// In-process parameter sweep executor.
+//
+// A ParameterSweep runs one case for each combination of the values of its
+// parameters (full factorial design) and collects the named scalar results
+// returned by each case in a table. Cases can be run concurrently: the worker
+// threads split the available OpenMP threads evenly, and each case receives
+// the number of threads it should use for its own system (call both
+// SetParallelThreadNumber and CHOMPfunctions::SetNumThreads from the case, so
+// that the setting applies to the worker thread running it).
+//
+// A case typically restores a common initial state (e.g. a settled granular
+// bed kept in a SystemSnapshot) into a new system, edits the materials, runs
+// the test phase, and returns its measurements.
+//
+// Usage:
+//   ParameterSweep sweep;
+//   sweep.AddParameter("friction", {0.2, 0.3, 0.4});
+//   sweep.AddParameter("pressure", {3.1e3, 6.4e3});
+//   sweep.SetNumThreads(16);
+//   sweep.SetNumConcurrent(4);
+//   sweep.Run([&](const std::vector<double>& params, int num_threads) {
+//       ...
+//       return ParameterSweep::Results{{"peak_stress", peak}, {"residual_stress", residual}};
+//   });
+//   sweep.Write(out_dir + "/sweep.dat");
+//
+// =============================================================================
+
+#ifndef PARAMETER_SWEEP_H
+#define PARAMETER_SWEEP_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "chrono/core/ChTimer.h"
+
+class ParameterSweep {
+  public:
+    /// Named scalar results of one case.
+    typedef std::vector<std::pair<std::string, double>> Results;
+
+    /// Function running one case, given the parameter values (in the order in which the parameters were added)
+    /// and the number of threads available to the case.
+    typedef std::function<Results(const std::vector<double>& params, int num_threads)> CaseFunction;
+
+    ParameterSweep() : m_num_threads(1), m_num_concurrent(1), m_time(0) {}
+
+    /// Add a swept parameter with the specified values.
+    void AddParameter(const std::string& name, const std::vector<double>& values) {
+        m_names.push_back(name);
+        m_values.push_back(values);
+    }
+
+    /// Set the total number of threads used by the sweep (default: 1).
+    void SetNumThreads(int num_threads) { m_num_threads = std::max(num_threads, 1); }
+
+    /// Set the number of cases run concurrently (default: 1). The threads are split evenly among the cases.
+    void SetNumConcurrent(int num_concurrent) { m_num_concurrent = std::max(num_concurrent, 1); }
+
+    /// Return the number of cases (product of the numbers of values of all parameters).
+    int GetNumCases() const {
+        if (m_values.empty())
+            return 0;
+        int num = 1;
+        for (const auto& v : m_values)
+            num *= (int)v.size();
+        return num;
+    }
+
+    /// Return the parameter values for the specified case (the last parameter varies fastest).
+    std::vector<double> GetCase(int index) const {
+        std::vector<double> params(m_values.size());
+        for (int k = (int)m_values.size() - 1; k >= 0; k--) {
+            int n = (int)m_values[k].size();
+            params[k] = m_values[k][index % n];
+            index /= n;
+        }
+        return params;
+    }
+
+    /// Run all cases. Exceptions thrown by a case are reported and mark the case as failed.
+    void Run(CaseFunction fun) {
+        int num_cases = GetNumCases();
+        m_results.assign(num_cases, Results());
+        m_case_time.assign(num_cases, 0.0);
+        m_failed.assign(num_cases, 0);
+
+        chrono::ChTimer<double> timer;
+        timer.start();
+
+        int num_workers = std::min(m_num_concurrent, std::max(num_cases, 1));
+        std::atomic<int> next(0);
+        std::mutex io_mutex;
+
+        auto worker = [&](int num_threads) {
+            for (int i = next++; i < num_cases; i = next++) {
+                std::vector<double> params = GetCase(i);
+                chrono::ChTimer<double> case_timer;
+                case_timer.start();
+                try {
+                    m_results[i] = fun(params, num_threads);
+                } catch (const std::exception& e) {
+                    m_failed[i] = 1;
+                    std::lock_guard<std::mutex> lock(io_mutex);
+                    std::cout << "[ParameterSweep] case " << i + 1 << " failed: " << e.what() << std::endl;
+                }
+                case_timer.stop();
+                m_case_time[i] = case_timer();
+
+                std::lock_guard<std::mutex> lock(io_mutex);
+                std::cout << "[ParameterSweep] case " << i + 1 << " / " << num_cases << " (";
+                for (size_t k = 0; k < params.size(); k++)
+                    std::cout << (k > 0 ? ", " : "") << m_names[k] << " = " << params[k];
+                std::cout << ")  time " << m_case_time[i] << " s" << std::endl;
+            }
+        };
+
+        if (num_workers == 1) {
+            worker(m_num_threads);
+        } else {
+            std::vector<std::thread> workers;
+            for (int w = 0; w < num_workers; w++) {
+                int num_threads = std::max(m_num_threads / num_workers + (w < m_num_threads % num_workers ? 1 : 0), 1);
+                workers.push_back(std::thread(worker, num_threads));
+            }
+            for (auto& w : workers)
+                w.join();
+        }
+
+        timer.stop();
+        m_time = timer();
+    }
+
+    /// Return the results of the specified case.
+    const Results& GetResults(int index) const { return m_results[index]; }
+
+    /// Return true if the specified case failed.
+    bool HasFailed(int index) const { return m_failed[index] != 0; }
+
+    /// Return the wall-clock time of the last sweep.
+    double GetTime() const { return m_time; }
+
+    /// Write the results table: one line per case with the parameter values, the results, and the case time.
+    /// Failed cases are written with their parameter values only, preceded by a comment character.
+    bool Write(const std::string& filename) const {
+        std::ofstream os(filename);
+        if (!os.is_open())
+            return false;
+
+        // Header (result names from the first successful case)
+        os << "#";
+        for (const auto& name : m_names)
+            os << " " << name;
+        for (size_t i = 0; i < m_results.size(); i++) {
+            if (!m_failed[i]) {
+                for (const auto& r : m_results[i])
+                    os << " " << r.first;
+                break;
+            }
+        }
+        os << " time" << std::endl;
+
+        for (size_t i = 0; i < m_results.size(); i++) {
+            std::vector<double> params = GetCase((int)i);
+            if (m_failed[i])
+                os << "#";
+            for (auto p : params)
+                os << p << " ";
+            for (const auto& r : m_results[i])
+                os << r.second << " ";
+            os << m_case_time[i] << std::endl;
+        }
+        return true;
+    }
+
+  private:
+    std::vector<std::string> m_names;           ///< parameter names
+    std::vector<std::vector<double>> m_values;  ///< parameter values
+    int m_num_threads;                          ///< total number of threads
+    int m_num_concurrent;                       ///< number of cases run concurrently
+    std::vector<Results> m_results;             ///< results of each case
+    std::vector<double> m_case_time;            ///< wall-clock time of each case
+    std::vector<char> m_failed;                 ///< failed cases (not vector<bool>, written concurrently)
+    double m_time;                              ///< wall-clock time of the last sweep
+};
+
+#endif
@@ -0,0 +1,264 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Batch of identical spheres for Chrono::Parallel.
+//
+// A ParticleBatch registers N spheres of the same radius and density, sharing
+// one contact material and one visualization asset, with a single call:
+// - the ChBody objects are constructed in one contiguous memory block; the
+//   shared pointers handed to the system alias a single owner of that block,
+//   so no per-body control block is allocated;
+// - body properties and collision models are set up in parallel;
+// - the system-wide per-body arrays of the data manager are reserved for the
+//   whole batch before the bodies are added.
+// The bodies of a batch occupy consecutive indices in the data manager, which
+// allows reading back their states in bulk (positions, rotations, linear and
+// angular velocities) directly from the data manager arrays.
+//
+// =============================================================================
+
+#ifndef PARTICLE_BATCH_H
+#define PARTICLE_BATCH_H
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "chrono/assets/ChSphereShape.h"
+#include "chrono/core/ChTimer.h"
+
+#include "chrono_parallel/collision/ChCollisionModelParallel.h"
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class ParticleBatch {
+  public:
+    /// Create spheres at the specified positions and add them to the system.
+    /// Body identifiers are assigned consecutively, starting at 'first_identifier'.
+    ParticleBatch(chrono::ChSystemParallel* system,
+                  const std::vector<chrono::ChVector<>>& positions,
+                  double radius,
+                  double density,
+                  std::shared_ptr<chrono::ChMaterialSurface> material,
+                  int first_identifier = 0)
+        : m_system(system), m_num(0), m_first(0), m_time_create(0), m_time_insert(0) {
+        m_num = (int)positions.size();
+        m_first = system->data_manager->num_rigid_bodies;
+        if (m_num == 0)
+            return;
+
+        double mass = density * (4.0 / 3) * chrono::CH_C_PI * radius * radius * radius;
+        chrono::ChVector<> inertia = 0.4 * mass * radius * radius * chrono::ChVector<>(1, 1, 1);
+        auto sphere = chrono_types::make_shared<chrono::ChSphereShape>();
+        sphere->GetSphereGeometry().rad = radius;
+        auto method = system->GetContactMethod();
+
+        chrono::ChTimer<double> timer;
+        timer.start();
+
+        // Construct all bodies in one memory block (serially, since the ChObj identifier counter is not
+        // thread-safe), then set them up in parallel.
+        m_storage = std::make_shared<Storage>(m_num);
+        for (int i = 0; i < m_num; i++) {
+            new (m_storage->body(i))
+                chrono::ChBody(chrono_types::make_shared<chrono::collision::ChCollisionModelParallel>(), method);
+            m_storage->num_constructed++;
+        }
+
+#pragma omp parallel for
+        for (int i = 0; i < m_num; i++) {
+            chrono::ChBody* body = m_storage->body(i);
+            body->SetIdentifier(first_identifier + i);
+            body->SetPos(positions[i]);
+            body->SetMass(mass);
+            body->SetInertiaXX(inertia);
+            body->SetMaterialSurface(material);
+            body->SetBodyFixed(false);
+            body->SetCollide(true);
+
+            body->GetCollisionModel()->ClearModel();
+            body->GetCollisionModel()->AddSphere(radius);
+            body->GetCollisionModel()->BuildModel();
+            body->AddAsset(sphere);
+        }
+
+        timer.stop();
+        m_time_create = timer();
+
+        timer.reset();
+        timer.start();
+
+        auto& host_data = system->data_manager->host_data;
+        size_t total = m_first + m_num;
+        host_data.pos_rigid.reserve(total);
+        host_data.rot_rigid.reserve(total);
+        host_data.active_rigid.reserve(total);
+        host_data.collide_rigid.reserve(total);
+
+        for (int i = 0; i < m_num; i++)
+            system->AddBody(std::shared_ptr<chrono::ChBody>(m_storage, m_storage->body(i)));
+
+        timer.stop();
+        m_time_insert = timer();
+    }
+
+    /// Return the number of spheres in this batch.
+    int GetNumParticles() const { return m_num; }
+
+    /// Return the index of the first sphere in the data manager arrays (and in the system body list).
+    unsigned int GetFirstIndex() const { return m_first; }
+
+    /// Return the specified body of this batch.
+    std::shared_ptr<chrono::ChBody> GetBody(int i) const {
+        return std::shared_ptr<chrono::ChBody>(m_storage, m_storage->body(i));
+    }
+
+    /// Return the time spent constructing bodies and collision models.
+    double GetTimeCreation() const { return m_time_create; }
+
+    /// Return the time spent adding bodies to the system.
+    double GetTimeInsertion() const { return m_time_insert; }
+
+    /// Read the positions of all spheres in this batch.
+    void GetPositions(std::vector<chrono::ChVector<>>& pos) const { ReadPositions(m_system, m_first, m_num, pos); }
+
+    /// Read the orientations of all spheres in this batch.
+    void GetRotations(std::vector<chrono::ChQuaternion<>>& rot) const { ReadRotations(m_system, m_first, m_num, rot); }
+
+    /// Read the linear velocities (absolute frame) of all spheres in this batch.
+    void GetVelocities(std::vector<chrono::ChVector<>>& vel) const { ReadVelocities(m_system, m_first, m_num, vel); }
+
+    /// Read the angular velocities (local frame) of all spheres in this batch.
+    void GetAngularVelocities(std::vector<chrono::ChVector<>>& omg) const {
+        ReadAngularVelocities(m_system, m_first, m_num, omg);
+    }
+
+    // -------------------------------------------------------------------------
+    // Bulk readback for a range of consecutive bodies [start, start + num).
+    // After a step, the states are read from the data manager arrays; before the
+    // first step (when these arrays are not yet populated) from the bodies.
+    // -------------------------------------------------------------------------
+
+    static void ReadPositions(chrono::ChSystemParallel* system,
+                              unsigned int start,
+                              int num,
+                              std::vector<chrono::ChVector<>>& pos) {
+        pos.resize(num);
+        if (!HasState(system)) {
+            for (int i = 0; i < num; i++)
+                pos[i] = system->Get_bodylist()[start + i]->GetPos();
+            return;
+        }
+        const auto& pos_rigid = system->data_manager->host_data.pos_rigid;
+#pragma omp parallel for
+        for (int i = 0; i < num; i++) {
+            const chrono::real3& p = pos_rigid[start + i];
+            pos[i] = chrono::ChVector<>(p.x, p.y, p.z);
+        }
+    }
+
+    static void ReadRotations(chrono::ChSystemParallel* system,
+                              unsigned int start,
+                              int num,
+                              std::vector<chrono::ChQuaternion<>>& rot) {
+        rot.resize(num);
+        if (!HasState(system)) {
+            for (int i = 0; i < num; i++)
+                rot[i] = system->Get_bodylist()[start + i]->GetRot();
+            return;
+        }
+        const auto& rot_rigid = system->data_manager->host_data.rot_rigid;
+#pragma omp parallel for
+        for (int i = 0; i < num; i++) {
+            const chrono::quaternion& q = rot_rigid[start + i];
+            rot[i] = chrono::ChQuaternion<>(q.w, q.x, q.y, q.z);
+        }
+    }
+
+    static void ReadVelocities(chrono::ChSystemParallel* system,
+                               unsigned int start,
+                               int num,
+                               std::vector<chrono::ChVector<>>& vel) {
+        vel.resize(num);
+        if (!HasState(system)) {
+            for (int i = 0; i < num; i++)
+                vel[i] = system->Get_bodylist()[start + i]->GetPos_dt();
+            return;
+        }
+        const auto& v = system->data_manager->host_data.v;
+#pragma omp parallel for
+        for (int i = 0; i < num; i++) {
+            size_t k = 6 * (size_t)(start + i);
+            vel[i] = chrono::ChVector<>(v[k + 0], v[k + 1], v[k + 2]);
+        }
+    }
+
+    static void ReadAngularVelocities(chrono::ChSystemParallel* system,
+                                      unsigned int start,
+                                      int num,
+                                      std::vector<chrono::ChVector<>>& omg) {
+        omg.resize(num);
+        if (!HasState(system)) {
+            for (int i = 0; i < num; i++)
+                omg[i] = system->Get_bodylist()[start + i]->GetWvel_loc();
+            return;
+        }
+        const auto& v = system->data_manager->host_data.v;
+#pragma omp parallel for
+        for (int i = 0; i < num; i++) {
+            size_t k = 6 * (size_t)(start + i);
+            omg[i] = chrono::ChVector<>(v[k + 3], v[k + 4], v[k + 5]);
+        }
+    }
+
+  private:
+    /// Contiguous, aligned storage for the bodies of a batch.
+    struct Storage {
+        static const size_t alignment = 64;
+
+        Storage(int n) : num_constructed(0) {
+            stride = (sizeof(chrono::ChBody) + alignment - 1) / alignment * alignment;
+            raw = new unsigned char[n * stride + alignment];
+            base = raw + (alignment - (uintptr_t)raw % alignment) % alignment;
+        }
+
+        ~Storage() {
+            for (int i = 0; i < num_constructed; i++)
+                body(i)->~ChBody();
+            delete[] raw;
+        }
+
+        chrono::ChBody* body(int i) const { return reinterpret_cast<chrono::ChBody*>(base + i * stride); }
+
+        unsigned char* raw;
+        unsigned char* base;
+        size_t stride;
+        int num_constructed;
+    };
+
+    /// Return true if the data manager holds the current body states (i.e., after the first step).
+    static bool HasState(chrono::ChSystemParallel* system) {
+        return system->GetStepcount() > 0 &&
+               system->data_manager->host_data.pos_rigid.size() == system->data_manager->num_rigid_bodies;
+    }
+
+    chrono::ChSystemParallel* m_system;
+    std::shared_ptr<Storage> m_storage;  ///< owner of the body memory block
+    int m_num;                           ///< number of spheres
+    unsigned int m_first;                ///< index of the first sphere in the data manager
+    double m_time_create;                ///< time for constructing bodies
+    double m_time_insert;                ///< time for adding bodies to the system
+};
+
+#endif
@@ -0,0 +1,256 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Population statistics of the granular material in a Chrono::Parallel system.
+//
+// The validation programs monitor the particles at every step (height range for
+// settling checks, number of particles past a plane, largest speed). A
+// ParticleQuery computes all of these in a single parallel pass directly over
+// the state arrays of the data manager (positions and velocities), instead of
+// walking the body list through shared pointers once per quantity:
+//
+// - the particles are selected once by body identifier (default: positive
+//   identifiers) and, optionally, by a lateral box |x| <= hx, |y| <= hy; the
+//   selection and the masses and inertias of the selected bodies are cached;
+// - Update() returns the number of selected particles, their lowest and highest
+//   center heights, the number below / above two horizontal planes, the largest
+//   linear speed, and the total kinetic energy (translational and rotational,
+//   with diagonal inertia);
+// - FindBodyById() and GetIndex() use an identifier-to-index map.
+//
+// Partial results of the threads are combined in thread order, so results are
+// reproducible for a given number of threads. Before the first step, or after
+// bodies were added, the states are read from the bodies themselves. The cache
+// is rebuilt automatically when the number of bodies changes; call Invalidate()
+// after changing identifiers, masses, or inertias of existing bodies.
+//
+// Usage:
+//   ParticleQuery query(system);
+//   query.SetPlanes(0, -pos_collector / 2);
+//   while (...) {
+//       system->DoStepDynamics(step_size);
+//       const ParticleQuery::Result& res = query.Update();
+//       if (res.max_speed < threshold) ...
+//   }
+//
+// =============================================================================
+
+#ifndef PARTICLE_QUERY_H
+#define PARTICLE_QUERY_H
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class ParticleQuery {
+  public:
+    /// Statistics of the selected particles.
+    struct Result {
+        int num;                ///< number of selected particles
+        double min_height;      ///< lowest center height (+infinity if none)
+        double max_height;      ///< highest center height (-infinity if none)
+        int num_below;          ///< number of particles with center below the lower plane
+        int num_above;          ///< number of particles with center above the upper plane
+        double max_speed;       ///< largest linear speed
+        double kinetic_energy;  ///< total kinetic energy
+    };
+
+    /// Query the bodies with identifiers in [min_id, max_id] (default: all bodies with positive identifier).
+    ParticleQuery(chrono::ChSystemParallel* system, int min_id = 1, int max_id = INT_MAX)
+        : m_system(system),
+          m_min_id(min_id),
+          m_max_id(max_id),
+          m_box(false),
+          m_hx(0),
+          m_hy(0),
+          m_below(0),
+          m_above(0),
+          m_num_bodies(0),
+          m_last(nullptr),
+          m_result(Empty()) {}
+
+    /// Only consider particles with |x| <= hx and |y| <= hy.
+    void SetLateralBox(double hx, double hy) {
+        m_box = true;
+        m_hx = hx;
+        m_hy = hy;
+    }
+
+    /// Set the heights of the planes for the 'num_below' and 'num_above' counts (default: 0 and 0).
+    void SetPlanes(double below, double above) {
+        m_below = below;
+        m_above = above;
+    }
+
+    /// Force a rebuild of the cached selection at the next call.
+    void Invalidate() { m_last = nullptr; }
+
+    /// Compute the statistics of the selected particles for the current state.
+    const Result& Update() {
+        Refresh();
+
+        int num_threads = chrono::CHOMPfunctions::GetNumThreads();
+        m_partial.assign(num_threads, Empty());
+
+        const auto& host_data = m_system->data_manager->host_data;
+        bool has_state = HasState();
+        int n = (int)m_indices.size();
+
+#pragma omp parallel num_threads(num_threads)
+        {
+            Result& res = m_partial[chrono::CHOMPfunctions::GetThreadNum()];
+            double max_speed2 = 0;
+            double ke = 0;
+#pragma omp for schedule(static)
+            for (int k = 0; k < n; k++) {
+                int i = m_indices[k];
+                double x, y, z;
+                double v[6];
+                if (has_state) {
+                    const chrono::real3& p = host_data.pos_rigid[i];
+                    x = p.x;
+                    y = p.y;
+                    z = p.z;
+                    for (int j = 0; j < 6; j++)
+                        v[j] = host_data.v[6 * (size_t)i + j];
+                } else {
+                    const auto& body = m_system->Get_bodylist()[i];
+                    const chrono::ChVector<>& pos = body->GetPos();
+                    const chrono::ChVector<>& lin = body->GetPos_dt();
+                    const chrono::ChVector<>& ang = body->GetWvel_loc();
+                    x = pos.x();
+                    y = pos.y();
+                    z = pos.z();
+                    v[0] = lin.x(), v[1] = lin.y(), v[2] = lin.z();
+                    v[3] = ang.x(), v[4] = ang.y(), v[5] = ang.z();
+                }
+                if (m_box && (std::abs(x) > m_hx || std::abs(y) > m_hy))
+                    continue;
+
+                double speed2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+                const double* J = &m_inertia[3 * k];
+                res.num++;
+                res.min_height = std::min(res.min_height, z);
+                res.max_height = std::max(res.max_height, z);
+                res.num_below += (z < m_below);
+                res.num_above += (z > m_above);
+                max_speed2 = std::max(max_speed2, speed2);
+                ke += m_mass[k] * speed2 + J[0] * v[3] * v[3] + J[1] * v[4] * v[4] + J[2] * v[5] * v[5];
+            }
+            res.max_speed = max_speed2;
+            res.kinetic_energy = 0.5 * ke;
+        }
+
+        // Combine the partial results in thread order.
+        m_result = m_partial[0];
+        for (int t = 1; t < num_threads; t++) {
+            const Result& res = m_partial[t];
+            m_result.num += res.num;
+            m_result.min_height = std::min(m_result.min_height, res.min_height);
+            m_result.max_height = std::max(m_result.max_height, res.max_height);
+            m_result.num_below += res.num_below;
+            m_result.num_above += res.num_above;
+            m_result.max_speed = std::max(m_result.max_speed, res.max_speed);
+            m_result.kinetic_energy += res.kinetic_energy;
+        }
+        m_result.max_speed = std::sqrt(m_result.max_speed);
+
+        return m_result;
+    }
+
+    /// Return the statistics computed by the last call to Update().
+    const Result& GetResult() const { return m_result; }
+
+    /// Return the index in the system body list of the first body with the given identifier (-1 if none).
+    /// Any body can be looked up, not only the selected particles.
+    int GetIndex(int id) {
+        Refresh();
+        auto it = m_index.find(id);
+        return it == m_index.end() ? -1 : it->second;
+    }
+
+    /// Return the first body with the given identifier (empty if none).
+    std::shared_ptr<chrono::ChBody> FindBodyById(int id) {
+        int i = GetIndex(id);
+        return i < 0 ? nullptr : m_system->Get_bodylist()[i];
+    }
+
+  private:
+    /// Statistics of an empty selection.
+    static Result Empty() {
+        double inf = std::numeric_limits<double>::infinity();
+        return Result{0, inf, -inf, 0, 0, 0, 0};
+    }
+
+    /// Rebuild the cached selection and identifier map if the body list changed.
+    void Refresh() {
+        const auto& bodies = m_system->Get_bodylist();
+        size_t num_bodies = bodies.size();
+        chrono::ChBody* last = num_bodies > 0 ? bodies.back().get() : nullptr;
+        if (last == m_last && num_bodies == m_num_bodies && m_last)
+            return;
+
+        m_indices.clear();
+        m_mass.clear();
+        m_inertia.clear();
+        m_index.clear();
+        for (size_t i = 0; i < num_bodies; i++) {
+            const auto& body = bodies[i];
+            int id = body->GetIdentifier();
+            m_index.insert(std::make_pair(id, (int)i));
+            if (id < m_min_id || id > m_max_id)
+                continue;
+            const chrono::ChVector<>& J = body->GetInertiaXX();
+            m_indices.push_back((int)i);
+            m_mass.push_back(body->GetMass());
+            m_inertia.insert(m_inertia.end(), {J.x(), J.y(), J.z()});
+        }
+
+        m_num_bodies = num_bodies;
+        m_last = last;
+    }
+
+    /// Return true if the data manager holds the current states of all bodies (i.e., after a step).
+    bool HasState() const {
+        const auto& host_data = m_system->data_manager->host_data;
+        return m_system->GetStepcount() > 0 && host_data.pos_rigid.size() == m_num_bodies &&
+               host_data.v.size() >= 6 * m_num_bodies;
+    }
+
+    chrono::ChSystemParallel* m_system;
+    int m_min_id;    ///< smallest selected identifier
+    int m_max_id;    ///< largest selected identifier
+    bool m_box;      ///< restrict to a lateral box?
+    double m_hx;     ///< half-length of the lateral box along X
+    double m_hy;     ///< half-length of the lateral box along Y
+    double m_below;  ///< height of the plane for 'num_below'
+    double m_above;  ///< height of the plane for 'num_above'
+
+    size_t m_num_bodies;                   ///< number of bodies at the last rebuild
+    chrono::ChBody* m_last;                ///< last body at the last rebuild
+    std::vector<int> m_indices;            ///< body indices of the selected particles
+    std::vector<double> m_mass;            ///< masses of the selected particles
+    std::vector<double> m_inertia;         ///< diagonal inertias of the selected particles (3 per particle)
+    std::unordered_map<int, int> m_index;  ///< identifier -> body index (first body with that identifier)
+
+    Result m_result;                ///< last computed statistics
+    std::vector<Result> m_partial;  ///< per-thread partial results
+};
+
+#endif
@@ -0,0 +1,176 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Stress-controlled load plate for the pressing phases of the granular
+// validation programs (Chrono::Parallel).
+//
+// Instead of lowering the load plate at a fixed velocity (or loading it with a
+// dead weight) for a hand-tuned duration, a PlateServo prescribes the vertical
+// motion of a fixed (kinematic) plate with a PI controller on the normal stress
+// under it:
+//
+//   e = (target - stress) / target
+//   u = Kp * e + Ki * integral(e dt)
+//   v = -max_speed * clamp(u, -1, 1)
+//
+// The stress is the vertical contact force on the plate divided by its area,
+// optionally smoothed with a first-order filter (SMC contact forces are noisy).
+// The integral is frozen while the command is saturated (anti-windup).
+//
+// The servo reports convergence when, for a full time window, the filtered
+// stress stayed within a relative tolerance of the target and the plate height
+// within an absolute tolerance of its value at the beginning of the window.
+//
+// Usage:
+//   loadPlate->SetBodyFixed(true);
+//   PlateServo servo(system, loadPlate, area, normal_pressure);
+//   while (!servo.IsConverged()) {
+//       system->DoStepDynamics(step_size);
+//       servo.Update(step_size);
+//   }
+//
+// =============================================================================
+
+#ifndef PLATE_SERVO_H
+#define PLATE_SERVO_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class PlateServo {
+  public:
+    /// Control the normal stress under the given plate (contact area 'area') to the target value.
+    PlateServo(chrono::ChSystemParallel* system, std::shared_ptr<chrono::ChBody> plate, double area, double target)
+        : m_system(system),
+          m_plate(plate),
+          m_area(area),
+          m_target(target),
+          m_max_speed(1),
+          m_kp(1),
+          m_ki(0.5),
+          m_tau(0),
+          m_stress_tol(0.02),
+          m_height_tol(std::numeric_limits<double>::infinity()),
+          m_window(0.05),
+          m_stress(0),
+          m_raw_stress(0),
+          m_integral(0),
+          m_velocity(0),
+          m_first(true),
+          m_stable_time(0),
+          m_ref_height(plate->GetPos().z()) {}
+
+    /// Set the target normal stress.
+    void SetTarget(double stress) { m_target = stress; }
+
+    /// Set the maximum plate speed (default: 1).
+    void SetMaxSpeed(double speed) { m_max_speed = speed; }
+
+    /// Set the proportional (dimensionless) and integral (1/time) gains on the relative stress error (default: 1, 0.5).
+    void SetGains(double kp, double ki) {
+        m_kp = kp;
+        m_ki = ki;
+    }
+
+    /// Set the time constant of the filter on the measured stress (default: 0, no filtering).
+    void SetFilter(double tau) { m_tau = tau; }
+
+    /// Set the convergence criteria: relative stress tolerance, absolute height tolerance, and the time window over
+    /// which both must hold (default: 0.02, no height check, 0.05).
+    void SetTolerances(double stress_tol, double height_tol, double window) {
+        m_stress_tol = stress_tol;
+        m_height_tol = height_tol;
+        m_window = window;
+    }
+
+    /// Measure the stress under the plate and prescribe the plate motion over the next step.
+    /// Must be called after each step.
+    void Update(double step) {
+        m_system->CalculateContactForces();
+        m_raw_stress = m_system->GetBodyContactForce(m_plate).z / m_area;
+        if (m_first || m_tau <= 0)
+            m_stress = m_raw_stress;
+        else
+            m_stress += (step / (m_tau + step)) * (m_raw_stress - m_stress);
+        m_first = false;
+
+        // PI control of the plate velocity, with the integral frozen while saturated in the direction of the error.
+        double e = (m_target - m_stress) / m_target;
+        double integral = m_integral + e * step;
+        double u = m_kp * e + m_ki * integral;
+        if (std::abs(u) <= 1 || u * e < 0)
+            m_integral = integral;
+        else
+            u = m_kp * e + m_ki * m_integral;
+        m_velocity = -m_max_speed * std::max(-1.0, std::min(1.0, u));
+
+        const chrono::ChVector<>& pos = m_plate->GetPos();
+        double z = pos.z() + m_velocity * step;
+        m_plate->SetPos(chrono::ChVector<>(pos.x(), pos.y(), z));
+        m_plate->SetPos_dt(chrono::ChVector<>(0, 0, m_velocity));
+
+        // Convergence: stress and height stable over the time window.
+        if (std::abs(e) <= m_stress_tol && std::abs(z - m_ref_height) <= m_height_tol) {
+            m_stable_time += step;
+        } else {
+            m_stable_time = 0;
+            m_ref_height = z;
+        }
+    }
+
+    /// Return true if the stress and the plate height have converged.
+    bool IsConverged() const { return m_stable_time >= m_window; }
+
+    /// Return the target normal stress.
+    double GetTarget() const { return m_target; }
+
+    /// Return the (filtered) normal stress under the plate.
+    double GetStress() const { return m_stress; }
+
+    /// Return the unfiltered normal stress under the plate at the last update.
+    double GetRawStress() const { return m_raw_stress; }
+
+    /// Return the prescribed vertical plate velocity.
+    double GetVelocity() const { return m_velocity; }
+
+    /// Return the current height of the plate.
+    double GetHeight() const { return m_plate->GetPos().z(); }
+
+  private:
+    chrono::ChSystemParallel* m_system;
+    std::shared_ptr<chrono::ChBody> m_plate;
+    double m_area;        ///< plate contact area
+    double m_target;      ///< target normal stress
+    double m_max_speed;   ///< maximum plate speed
+    double m_kp;          ///< proportional gain
+    double m_ki;          ///< integral gain
+    double m_tau;         ///< time constant of the stress filter
+    double m_stress_tol;  ///< relative stress tolerance for convergence
+    double m_height_tol;  ///< absolute height tolerance for convergence
+    double m_window;      ///< time window for convergence
+
+    double m_stress;       ///< filtered stress
+    double m_raw_stress;   ///< measured stress at the last update
+    double m_integral;     ///< integral of the relative stress error
+    double m_velocity;     ///< prescribed plate velocity
+    bool m_first;          ///< no measurement yet?
+    double m_stable_time;  ///< time over which the convergence criteria held
+    double m_ref_height;   ///< plate height at the beginning of the stable period
+};
+
+#endif
@@ -0,0 +1,432 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Scenario description for the Chrono::Parallel test drivers.
+//
+// A Scenario collects run-time values for the parameters of a driver program
+// (solver, collision, material, geometry, output, and thread settings) from an
+// optional JSON file and from command-line overrides, so that a single binary
+// can be driven by a sweep script instead of being recompiled.
+//
+// Parameters are addressed by dotted keys ("section.key") matching the nesting
+// of the JSON file:
+//   {
+//     "problem": "SETTLING",
+//     "threads":   { "num": 8, "tuning": false },
+//     "solver":    { "time_step": 1e-4, "max_iteration_sliding": 200 },
+//     "collision": { "bins_per_axis": [20, 20, 10] },
+//     "material":  { "friction": 0.4 },
+//     "output":    { "dir": "../RUN_001", "povray": false }
+//   }
+// and can be overridden on the command line, with the same keys:
+//   driver -s base.json solver.time_step=5e-5 collision.bins_per_axis=10,10,10
+//
+// A driver keeps its file-scope globals as default values and reads each of
+// them with Read(); a global is left unchanged if its key is not specified.
+// Keys that were specified but never read (e.g. misspelled) are reported by
+// CheckUnused(), and the effective values of all read parameters can be saved
+// with Write(), so that each run in a sweep records its own configuration.
+//
+// Usage:
+//   Scenario scenario;
+//   if (!scenario.Parse(argc, argv))
+//       return 1;
+//   scenario.Read("solver.time_step", time_step);
+//   scenario.ReadEnum("problem", problem, {{"SETTLING", SETTLING}, {"DROPPING", DROPPING}});
+//   if (!scenario.CheckUnused())
+//       return 1;
+//   ...
+//   scenario.Write(out_dir + "/scenario.json");
+//
+// =============================================================================
+
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "chrono/core/ChException.h"
+#include "chrono/core/ChVector.h"
+#include "chrono/physics/ChSystemSMC.h"
+
+#include "chrono_thirdparty/rapidjson/document.h"
+#include "chrono_thirdparty/rapidjson/filereadstream.h"
+
+class Scenario {
+  public:
+    Scenario() {}
+
+    /// Process the command line: '-s <file>' (or '--scenario <file>') loads a scenario file and each 'key=value'
+    /// argument overrides a parameter. Overrides take precedence over the file, regardless of their order.
+    /// Return false (after printing a usage message) if the arguments cannot be processed.
+    bool Parse(int argc, char* argv[]) {
+        std::vector<std::pair<std::string, std::string>> overrides;
+        for (int i = 1; i < argc; i++) {
+            std::string arg(argv[i]);
+            if (arg == "-s" || arg == "--scenario") {
+                if (i + 1 >= argc) {
+                    PrintUsage(argv[0]);
+                    return false;
+                }
+                if (!Load(argv[++i]))
+                    return false;
+                continue;
+            }
+            if (arg == "-h" || arg == "--help") {
+                PrintUsage(argv[0]);
+                return false;
+            }
+            size_t eq = arg.find('=');
+            if (eq == std::string::npos || eq == 0) {
+                std::cout << "Invalid argument: " << arg << std::endl;
+                PrintUsage(argv[0]);
+                return false;
+            }
+            overrides.push_back({arg.substr(0, eq), arg.substr(eq + 1)});
+        }
+        for (const auto& o : overrides)
+            Set(o.first, o.second);
+        return true;
+    }
+
+    /// Load parameters from the specified JSON file (C-style comments allowed).
+    /// Values already specified are overwritten. Return false if the file cannot be read or parsed.
+    bool Load(const std::string& filename) {
+        FILE* fp = fopen(filename.c_str(), "r");
+        if (!fp) {
+            std::cout << "Cannot open scenario file " << filename << std::endl;
+            return false;
+        }
+        char buffer[65536];
+        rapidjson::FileReadStream is(fp, buffer, sizeof(buffer));
+        rapidjson::Document d;
+        d.ParseStream<rapidjson::ParseFlag::kParseCommentsFlag>(is);
+        fclose(fp);
+
+        if (d.HasParseError() || !d.IsObject()) {
+            std::cout << "Invalid scenario file " << filename << " (error at offset " << d.GetErrorOffset() << ")"
+                      << std::endl;
+            return false;
+        }
+        Flatten(d, "");
+        m_files.push_back(filename);
+        return true;
+    }
+
+    /// Specify (or override) the value of a parameter.
+    void Set(const std::string& key, const std::string& value) { m_values[key] = value; }
+
+    /// Return true if a value was specified for the given parameter.
+    bool Has(const std::string& key) const { return m_values.find(key) != m_values.end(); }
+
+    /// Read the specified parameter into 'var'. If no value was specified, 'var' is left unchanged.
+    /// In both cases, the parameter value is recorded as part of the effective scenario.
+    void Read(const std::string& key, double& var) {
+        std::string value;
+        if (Find(key, value))
+            var = ToDouble(key, value);
+        m_used[key] = FormatNumber(var);
+    }
+
+    void Read(const std::string& key, float& var) {
+        std::string value;
+        if (Find(key, value))
+            var = (float)ToDouble(key, value);
+        m_used[key] = FormatNumber(var);
+    }
+
+    void Read(const std::string& key, int& var) {
+        std::string value;
+        if (Find(key, value))
+            var = ToInt(key, value);
+        m_used[key] = std::to_string(var);
+    }
+
+    void Read(const std::string& key, unsigned int& var) {
+        int v = (int)var;
+        Read(key, v);
+        if (v < 0)
+            throw chrono::ChException("Scenario: negative value for parameter " + key);
+        var = (unsigned int)v;
+    }
+
+    void Read(const std::string& key, bool& var) {
+        std::string value;
+        if (Find(key, value)) {
+            if (value == "true" || value == "1" || value == "on")
+                var = true;
+            else if (value == "false" || value == "0" || value == "off")
+                var = false;
+            else
+                throw chrono::ChException("Scenario: invalid boolean '" + value + "' for parameter " + key);
+        }
+        m_used[key] = var ? "true" : "false";
+    }
+
+    void Read(const std::string& key, std::string& var) {
+        std::string value;
+        if (Find(key, value))
+            var = value;
+        m_used[key] = Quote(var);
+    }
+
+    template <typename Real>
+    void Read(const std::string& key, chrono::ChVector<Real>& var) {
+        std::string value;
+        if (Find(key, value)) {
+            auto v = ToArray(key, value);
+            if (v.size() != 3)
+                throw chrono::ChException("Scenario: expected 3 components for parameter " + key);
+            var = chrono::ChVector<Real>((Real)v[0], (Real)v[1], (Real)v[2]);
+        }
+        m_used[key] = "[" + FormatNumber((double)var.x()) + ", " + FormatNumber((double)var.y()) + ", " +
+                      FormatNumber((double)var.z()) + "]";
+    }
+
+    void Read(const std::string& key, std::vector<double>& var) {
+        std::string value;
+        if (Find(key, value))
+            var = ToArray(key, value);
+        std::string list;
+        for (size_t i = 0; i < var.size(); i++)
+            list += (i > 0 ? ", " : "") + FormatNumber(var[i]);
+        m_used[key] = "[" + list + "]";
+    }
+
+    /// Read an enumerated parameter, specified by name.
+    template <typename E>
+    void ReadEnum(const std::string& key, E& var, const std::vector<std::pair<std::string, E>>& names) {
+        std::string value;
+        if (Find(key, value)) {
+            bool found = false;
+            for (const auto& n : names) {
+                if (n.first == value) {
+                    var = n.second;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                std::string msg = "Scenario: invalid value '" + value + "' for parameter " + key + " (expected:";
+                for (const auto& n : names)
+                    msg += " " + n.first;
+                throw chrono::ChException(msg + ")");
+            }
+        }
+        for (const auto& n : names) {
+            if (n.second == var) {
+                m_used[key] = Quote(n.first);
+                break;
+            }
+        }
+    }
+
+    /// Read the SMC normal contact force model, specified by name (Hooke, Hertz, PlainCoulomb, Flores).
+    void ReadContactForceModel(const std::string& key, chrono::ChSystemSMC::ContactForceModel& var) {
+        ReadEnum(key, var,
+                 {{"Hooke", chrono::ChSystemSMC::Hooke},
+                  {"Hertz", chrono::ChSystemSMC::Hertz},
+                  {"PlainCoulomb", chrono::ChSystemSMC::PlainCoulomb},
+                  {"Flores", chrono::ChSystemSMC::Flores}});
+    }
+
+    /// Read the SMC tangential displacement model, specified by name (None, OneStep, MultiStep).
+    void ReadTangentialDisplacementModel(const std::string& key,
+                                         chrono::ChSystemSMC::TangentialDisplacementModel& var) {
+        ReadEnum(key, var,
+                 {{"None", chrono::ChSystemSMC::TangentialDisplacementModel::None},
+                  {"OneStep", chrono::ChSystemSMC::TangentialDisplacementModel::OneStep},
+                  {"MultiStep", chrono::ChSystemSMC::TangentialDisplacementModel::MultiStep}});
+    }
+
+    /// Report the specified parameters that were never read. Return false if there are any.
+    bool CheckUnused() const {
+        bool ok = true;
+        for (const auto& v : m_values) {
+            if (m_used.find(v.first) == m_used.end()) {
+                std::cout << "Unknown scenario parameter: " << v.first << std::endl;
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    /// Write the effective values of all parameters read so far, as a JSON scenario file.
+    bool Write(const std::string& filename) const {
+        std::ofstream os(filename);
+        if (!os.is_open())
+            return false;
+        Node root;
+        for (const auto& u : m_used) {
+            Node* node = &root;
+            std::stringstream ss(u.first);
+            std::string item;
+            while (std::getline(ss, item, '.'))
+                node = &node->children[item];
+            node->literal = u.second;
+        }
+        WriteNode(os, root, 0);
+        os << std::endl;
+        return true;
+    }
+
+    /// Print the effective values of all parameters read so far.
+    void Print() const {
+        for (const auto& f : m_files)
+            std::cout << "Scenario file: " << f << std::endl;
+        for (const auto& u : m_used)
+            std::cout << "  " << u.first << " = " << u.second << std::endl;
+    }
+
+  private:
+    /// Tree of parameters (for writing nested JSON).
+    struct Node {
+        std::string literal;
+        std::map<std::string, Node> children;
+    };
+
+    static void PrintUsage(const char* program) {
+        std::cout << "Usage: " << program << " [-s scenario.json] [section.key=value ...]" << std::endl;
+    }
+
+    bool Find(const std::string& key, std::string& value) const {
+        auto it = m_values.find(key);
+        if (it == m_values.end())
+            return false;
+        value = it->second;
+        return true;
+    }
+
+    /// Collect the leaves of a JSON object, with dotted keys. Arrays are stored as comma-separated lists.
+    void Flatten(const rapidjson::Value& obj, const std::string& prefix) {
+        for (auto it = obj.MemberBegin(); it != obj.MemberEnd(); ++it) {
+            std::string key = prefix + it->name.GetString();
+            const rapidjson::Value& v = it->value;
+            if (v.IsObject()) {
+                Flatten(v, key + ".");
+            } else if (v.IsArray()) {
+                std::string list;
+                for (rapidjson::SizeType i = 0; i < v.Size(); i++)
+                    list += (i > 0 ? "," : "") + ToString(v[i]);
+                m_values[key] = list;
+            } else {
+                m_values[key] = ToString(v);
+            }
+        }
+    }
+
+    static std::string ToString(const rapidjson::Value& v) {
+        if (v.IsString())
+            return v.GetString();
+        if (v.IsBool())
+            return v.GetBool() ? "true" : "false";
+        if (v.IsInt64())
+            return std::to_string(v.GetInt64());
+        if (v.IsNumber())
+            return FormatNumber(v.GetDouble());
+        return "";
+    }
+
+    static double ToDouble(const std::string& key, const std::string& value) {
+        char* end;
+        double v = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0')
+            throw chrono::ChException("Scenario: invalid number '" + value + "' for parameter " + key);
+        return v;
+    }
+
+    static int ToInt(const std::string& key, const std::string& value) {
+        char* end;
+        long v = std::strtol(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0')
+            throw chrono::ChException("Scenario: invalid integer '" + value + "' for parameter " + key);
+        return (int)v;
+    }
+
+    /// Parse a list of numbers separated by commas or blanks (optionally enclosed in brackets).
+    static std::vector<double> ToArray(const std::string& key, const std::string& value) {
+        std::string list = value;
+        for (auto& c : list) {
+            if (c == ',' || c == '[' || c == ']')
+                c = ' ';
+        }
+        std::vector<double> v;
+        std::stringstream ss(list);
+        std::string item;
+        while (ss >> item)
+            v.push_back(ToDouble(key, item));
+        return v;
+    }
+
+    /// Shortest decimal representation that reproduces the given value.
+    static std::string FormatNumber(double v) {
+        char buf[32];
+        for (int precision = 6; precision <= 17; precision++) {
+            snprintf(buf, sizeof(buf), "%.*g", precision, v);
+            if (std::strtod(buf, nullptr) == v)
+                break;
+        }
+        return buf;
+    }
+
+    static std::string FormatNumber(float v) {
+        char buf[32];
+        for (int precision = 6; precision <= 9; precision++) {
+            snprintf(buf, sizeof(buf), "%.*g", precision, v);
+            if (std::strtof(buf, nullptr) == v)
+                break;
+        }
+        return buf;
+    }
+
+    static std::string Quote(const std::string& s) {
+        std::string q = "\"";
+        for (auto c : s) {
+            if (c == '"' || c == '\\')
+                q += '\\';
+            q += c;
+        }
+        return q + "\"";
+    }
+
+    static void WriteNode(std::ostream& os, const Node& node, int level) {
+        if (node.children.empty()) {
+            os << node.literal;
+            return;
+        }
+        std::string indent(4 * (level + 1), ' ');
+        os << "{" << std::endl;
+        for (auto it = node.children.begin(); it != node.children.end(); ++it) {
+            os << indent << Quote(it->first) << ": ";
+            WriteNode(os, it->second, level + 1);
+            os << (std::next(it) != node.children.end() ? "," : "") << std::endl;
+        }
+        os << std::string(4 * level, ' ') << "}";
+    }
+
+    std::map<std::string, std::string> m_values;  ///< specified parameter values (from files and overrides)
+    std::map<std::string, std::string> m_used;    ///< effective values of all read parameters (JSON literals)
+    std::vector<std::string> m_files;             ///< loaded scenario files
+};
+
+#endif
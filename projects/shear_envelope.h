@@ -0,0 +1,170 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Online post-processing of direct shear tests.
+//
+// ShearStressMonitor reduces the shear stress signal of one shearing stage as
+// samples arrive, without storing it: the samples are smoothed with a
+// first-order filter (time constant tau; SMC contact forces are noisy), the peak
+// is the largest filtered value, and the residual stress is the mean of the
+// filtered samples after a given time (the critical-state part of the test).
+//
+// MohrCoulombFit fits the failure envelope tau = c + sigma * tan(phi) to pairs
+// of normal stress and shear stress (e.g. peak or residual stress of each
+// stage) by linear least squares, from running sums.
+//
+// Usage:
+//   ShearStressMonitor monitor(0.01, 0.75 * time_shearing);
+//   while (...) {
+//       ...
+//       monitor.Add(time, force / area);
+//   }
+//   MohrCoulombFit peak_envelope;
+//   peak_envelope.Add(normal_pressure, monitor.GetPeak());
+//   ...
+//   if (peak_envelope.Fit())
+//       cout << peak_envelope.GetFrictionAngle() << " " << peak_envelope.GetCohesion() << endl;
+//
+// =============================================================================
+
+#ifndef SHEAR_ENVELOPE_H
+#define SHEAR_ENVELOPE_H
+
+#include <algorithm>
+#include <cmath>
+
+class ShearStressMonitor {
+  public:
+    /// Filter the stress with time constant 'tau' (0: no filtering) and average the residual stress over the
+    /// samples at times >= 'residual_start'.
+    ShearStressMonitor(double tau = 0, double residual_start = 0)
+        : m_tau(tau),
+          m_residual_start(residual_start),
+          m_num(0),
+          m_time(0),
+          m_stress(0),
+          m_peak(0),
+          m_peak_time(0),
+          m_residual_sum(0),
+          m_residual_num(0) {}
+
+    /// Set the time constant of the filter (0: no filtering).
+    void SetFilter(double tau) { m_tau = tau; }
+
+    /// Set the time from which samples contribute to the residual stress.
+    void SetResidualStart(double time) { m_residual_start = time; }
+
+    /// Add a stress sample at the given time.
+    void Add(double time, double stress) {
+        if (m_num == 0 || m_tau <= 0) {
+            m_stress = stress;
+        } else {
+            double dt = time - m_time;
+            m_stress += (dt / (m_tau + dt)) * (stress - m_stress);
+        }
+        if (m_num == 0 || m_stress > m_peak) {
+            m_peak = m_stress;
+            m_peak_time = time;
+        }
+        if (time >= m_residual_start) {
+            m_residual_sum += m_stress;
+            m_residual_num++;
+        }
+        m_time = time;
+        m_num++;
+    }
+
+    /// Return the number of samples.
+    int GetNumSamples() const { return m_num; }
+
+    /// Return the current filtered stress.
+    double GetStress() const { return m_stress; }
+
+    /// Return the largest filtered stress.
+    double GetPeak() const { return m_peak; }
+
+    /// Return the time of the largest filtered stress.
+    double GetPeakTime() const { return m_peak_time; }
+
+    /// Return the mean filtered stress over the residual window (the current filtered stress if no sample yet).
+    double GetResidual() const { return m_residual_num > 0 ? m_residual_sum / m_residual_num : m_stress; }
+
+  private:
+    double m_tau;             ///< filter time constant
+    double m_residual_start;  ///< start of the residual window
+    int m_num;                ///< number of samples
+    double m_time;            ///< time of the last sample
+    double m_stress;          ///< filtered stress
+    double m_peak;            ///< largest filtered stress
+    double m_peak_time;       ///< time of the largest filtered stress
+    double m_residual_sum;    ///< sum of the filtered stress over the residual window
+    int m_residual_num;       ///< number of samples in the residual window
+};
+
+class MohrCoulombFit {
+  public:
+    MohrCoulombFit() : m_n(0), m_sx(0), m_sy(0), m_sxx(0), m_sxy(0), m_syy(0), m_c(0), m_slope(0), m_r2(0) {}
+
+    /// Add a failure point (normal stress, shear stress).
+    void Add(double normal, double shear) {
+        m_n++;
+        m_sx += normal;
+        m_sy += shear;
+        m_sxx += normal * normal;
+        m_sxy += normal * shear;
+        m_syy += shear * shear;
+    }
+
+    /// Fit the envelope to the points added so far.
+    /// Return false if there are fewer than two distinct normal stresses.
+    bool Fit() {
+        double dxx = m_sxx - m_sx * m_sx / std::max(m_n, 1);
+        double dxy = m_sxy - m_sx * m_sy / std::max(m_n, 1);
+        double dyy = m_syy - m_sy * m_sy / std::max(m_n, 1);
+        if (m_n < 2 || dxx <= 1e-12 * m_sxx)
+            return false;
+        m_slope = dxy / dxx;
+        m_c = (m_sy - m_slope * m_sx) / m_n;
+        m_r2 = dyy > 0 ? (dxy * dxy) / (dxx * dyy) : 1;
+        return true;
+    }
+
+    /// Return the number of points.
+    int GetNumPoints() const { return m_n; }
+
+    /// Return the cohesion (intercept of the envelope).
+    double GetCohesion() const { return m_c; }
+
+    /// Return the slope of the envelope (tangent of the friction angle).
+    double GetSlope() const { return m_slope; }
+
+    /// Return the friction angle in degrees.
+    double GetFrictionAngle() const { return std::atan(m_slope) * 180 / 3.14159265358979323846; }
+
+    /// Return the coefficient of determination of the fit.
+    double GetR2() const { return m_r2; }
+
+  private:
+    int m_n;         ///< number of points
+    double m_sx;     ///< sum of normal stresses
+    double m_sy;     ///< sum of shear stresses
+    double m_sxx;    ///< sum of squared normal stresses
+    double m_sxy;    ///< sum of products
+    double m_syy;    ///< sum of squared shear stresses
+    double m_c;      ///< fitted cohesion
+    double m_slope;  ///< fitted slope
+    double m_r2;     ///< coefficient of determination
+};
+
+#endif
@@ -0,0 +1,165 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Discrete particle size distribution for polydisperse granular beds.
+//
+// A distribution is a set of radius classes, each with a relative number weight;
+// the number fraction of a class (the fraction of the particles having that
+// radius) is its weight over the sum of all weights. Classes are kept sorted by
+// decreasing radius. Continuous distributions are discretized in a fixed number
+// of classes with radii equally spaced in log(radius) from rmin to rmax, each
+// weighted with the number of particles in its interval:
+// - Uniform: number density uniform in radius between rmin and rmax;
+// - PowerLaw: number density proportional to radius^(-exponent) between rmin
+//   and rmax (exponent 4: equal solid volume per class, i.e. a graded soil in
+//   which small particles are the vast majority by number);
+// - LogNormal: log(radius) normal with the given median and standard
+//   deviation, truncated to [rmin, rmax].
+// The size ratio of a distribution is rmax / rmin.
+//
+// Usage:
+//   SizeDistribution dist = SizeDistribution::LogNormal(r_g, 0.4, 0.5 * r_g, 2 * r_g);
+//   for (int c = 0; c < dist.GetNumClasses(); c++)
+//       cout << dist.GetRadius(c) << "  " << dist.GetFraction(c) << endl;
+//
+// =============================================================================
+
+#ifndef SIZE_DISTRIBUTION_H
+#define SIZE_DISTRIBUTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+class SizeDistribution {
+  public:
+    SizeDistribution() : m_total(0) {}
+
+    /// Distribution with a single radius.
+    static SizeDistribution Monodisperse(double radius) {
+        SizeDistribution dist;
+        dist.AddClass(radius, 1);
+        return dist;
+    }
+
+    /// Number density uniform in radius over [rmin, rmax], discretized in the given number of classes.
+    static SizeDistribution Uniform(double rmin, double rmax, int num_classes = 8) {
+        return PowerLaw(rmin, rmax, 0, num_classes);
+    }
+
+    /// Number density proportional to radius^(-exponent) over [rmin, rmax], discretized in the given number of classes.
+    static SizeDistribution PowerLaw(double rmin, double rmax, double exponent, int num_classes = 8) {
+        return Discretize(rmin, rmax, num_classes, [exponent](double r) { return std::pow(r, -exponent); });
+    }
+
+    /// Log-normal distribution (median radius, standard deviation of log(radius)) truncated to [rmin, rmax],
+    /// discretized in the given number of classes.
+    static SizeDistribution LogNormal(double median, double sigma, double rmin, double rmax, int num_classes = 8) {
+        double mu = std::log(median);
+        return Discretize(rmin, rmax, num_classes, [mu, sigma](double r) {
+            // Number density per unit radius
+            double x = (std::log(r) - mu) / sigma;
+            return std::exp(-0.5 * x * x) / r;
+        });
+    }
+
+    /// Add a radius class with the given relative number weight. Classes with equal radius are merged.
+    void AddClass(double radius, double weight) {
+        if (radius <= 0 || weight <= 0)
+            return;
+        auto it = std::find_if(m_classes.begin(), m_classes.end(),
+                               [radius](const Class& c) { return c.radius == radius; });
+        if (it != m_classes.end())
+            it->weight += weight;
+        else
+            m_classes.push_back({radius, weight});
+        std::sort(m_classes.begin(), m_classes.end(),
+                  [](const Class& a, const Class& b) { return a.radius > b.radius; });
+        m_total += weight;
+    }
+
+    /// Return the number of radius classes.
+    int GetNumClasses() const { return (int)m_classes.size(); }
+
+    /// Return the radius of the specified class (classes sorted by decreasing radius).
+    double GetRadius(int c) const { return m_classes[c].radius; }
+
+    /// Return the number fraction of the specified class.
+    double GetFraction(int c) const { return m_classes[c].weight / m_total; }
+
+    /// Return the smallest radius.
+    double GetMinRadius() const { return m_classes.empty() ? 0 : m_classes.back().radius; }
+
+    /// Return the largest radius.
+    double GetMaxRadius() const { return m_classes.empty() ? 0 : m_classes.front().radius; }
+
+    /// Return the ratio of the largest to the smallest radius.
+    double GetSizeRatio() const { return m_classes.empty() ? 1 : GetMaxRadius() / GetMinRadius(); }
+
+    /// Return the number-weighted median radius.
+    double GetMedianRadius() const {
+        double cum = 0;
+        for (int c = (int)m_classes.size() - 1; c >= 0; c--) {
+            cum += GetFraction(c);
+            if (cum >= 0.5)
+                return m_classes[c].radius;
+        }
+        return GetMaxRadius();
+    }
+
+    /// Return the mean particle volume.
+    double GetMeanVolume() const {
+        double vol = 0;
+        for (auto& c : m_classes)
+            vol += (c.weight / m_total) * (4.0 / 3) * 3.14159265358979323846 * c.radius * c.radius * c.radius;
+        return vol;
+    }
+
+  private:
+    struct Class {
+        double radius;  ///< class radius
+        double weight;  ///< relative number weight
+    };
+
+    /// Discretize a number density over [rmin, rmax] in classes with radii equally spaced in log(radius).
+    template <typename Density>
+    static SizeDistribution Discretize(double rmin, double rmax, int num_classes, Density density) {
+        SizeDistribution dist;
+        if (rmax <= rmin || num_classes < 2) {
+            dist.AddClass(rmin, 1);
+            return dist;
+        }
+
+        // Class c represents the radii within half a log-step of its own radius (clipped to [rmin, rmax]);
+        // its weight is the integral of the number density over that interval (midpoint rule).
+        const int num_sub = 16;
+        double step = std::log(rmax / rmin) / (num_classes - 1);
+        for (int c = 0; c < num_classes; c++) {
+            double lo = rmin * std::exp(std::max(c - 0.5, 0.0) * step);
+            double hi = rmin * std::exp(std::min(c + 0.5, num_classes - 1.0) * step);
+            double w = 0;
+            for (int s = 0; s < num_sub; s++) {
+                double r = lo + (s + 0.5) * (hi - lo) / num_sub;
+                w += density(r) * (hi - lo) / num_sub;
+            }
+            dist.AddClass(rmin * std::exp(c * step), w);
+        }
+        return dist;
+    }
+
+    std::vector<Class> m_classes;  ///< radius classes, by decreasing radius
+    double m_total;                ///< sum of the class weights
+};
+
+#endif
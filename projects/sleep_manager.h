@@ -0,0 +1,334 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Island-based sleeping of quiescent bodies for Chrono::Parallel.
+//
+// Chrono::Parallel treats a sleeping body as inactive: it is not integrated and
+// acts as a fixed obstacle for the active bodies it touches. A SleepManager puts
+// bodies to sleep and wakes them up based on contact islands:
+//
+// - After each step, a body is quiescent if its linear and angular speeds (and,
+//   optionally, the change in its total contact force since the previous step)
+//   are below the specified thresholds. The number of consecutive quiescent
+//   steps is counted for every awake body.
+// - Islands are the connected components of the contact graph between
+//   non-fixed colliding bodies (contacts with fixed bodies, e.g. container walls,
+//   do not connect islands). Bodies that fell asleep together remain in the same
+//   island, since the collision system reports no contacts between two inactive
+//   bodies.
+// - An island in which every awake body has been quiescent for at least K steps
+//   is put to sleep (velocities are zeroed). An island containing sleeping bodies
+//   and at least one awake body that is not quiescent (e.g. a particle or a tool
+//   moving into a settled region) is woken up as a whole.
+//
+// Sleeping can be restricted to a range of bodies (e.g. the granular material);
+// other bodies take part in the islands but are never put to sleep.
+//
+// Usage:
+//   SleepManager sleep(system);
+//   sleep.SetGranularThresholds(particle_radius);
+//   sleep.SetSleepSteps(200);
+//   while (...) {
+//       system->DoStepDynamics(step_size);
+//       sleep.Update();
+//   }
+//   sleep.WakeAll();
+//
+// =============================================================================
+
+#ifndef SLEEP_MANAGER_H
+#define SLEEP_MANAGER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class SleepManager {
+  public:
+    SleepManager(chrono::ChSystemParallel* system)
+        : m_system(system),
+          m_lin_threshold(1e-3),
+          m_ang_threshold(1e-1),
+          m_force_threshold(-1),
+          m_sleep_steps(100),
+          m_start(0),
+          m_num(-1),
+          m_next_tag(0),
+          m_num_sleeping(0),
+          m_cum_sleeping(0),
+          m_cum_managed(0),
+          m_sleep_events(0),
+          m_wake_events(0) {}
+
+    /// Set the linear and angular speeds below which a body is considered quiescent (default: 1e-3, 1e-1).
+    void SetVelocityThresholds(double lin, double ang) {
+        m_lin_threshold = lin;
+        m_ang_threshold = ang;
+    }
+
+    /// Set the speed thresholds for granular material with the given particle radius: the linear speed
+    /// threshold is the specified fraction of sqrt(g * radius) (the speed gained by falling over a distance of
+    /// half a radius) and the angular speed threshold is the linear one divided by the radius.
+    void SetGranularThresholds(double radius, double fraction = 0.01) {
+        double g = m_system->Get_G_acc().Length();
+        m_lin_threshold = fraction * std::sqrt(g * radius);
+        m_ang_threshold = m_lin_threshold / radius;
+    }
+
+    /// Set the change in total contact force (between consecutive steps) below which a body is considered
+    /// quiescent (default: -1, i.e. contact forces are not checked).
+    void SetForceThreshold(double df) { m_force_threshold = df; }
+
+    /// Set the number of consecutive quiescent steps after which an island is put to sleep (default: 100).
+    void SetSleepSteps(int steps) { m_sleep_steps = std::max(1, steps); }
+
+    /// Only put to sleep the bodies with indices in [start, start + num) (default: all bodies).
+    void SetBodyRange(int start, int num) {
+        m_start = start;
+        m_num = num;
+    }
+
+    /// Update the quiescence counters and put to sleep or wake up islands. Must be called after each step.
+    void Update() {
+        auto data_manager = m_system->data_manager;
+        const auto& bodies = m_system->Get_bodylist();
+        const auto& v = data_manager->host_data.v;
+        const auto& collide = data_manager->host_data.collide_rigid;
+        int n = (int)bodies.size();
+        if ((int)collide.size() < n || (int)v.size() < 6 * n)
+            return;
+        Resize(n);
+
+        bool check_force = m_force_threshold > 0;
+        if (check_force && m_system->GetContactMethod() == chrono::ChMaterialSurface::NSC)
+            m_system->CalculateContactForces();
+
+        double lin2 = m_lin_threshold * m_lin_threshold;
+        double ang2 = m_ang_threshold * m_ang_threshold;
+
+        // Quiescence counters of the awake bodies.
+#pragma omp parallel for
+        for (int i = 0; i < n; i++) {
+            m_dynamic[i] = collide[i] && !bodies[i]->GetBodyFixed();
+            if (!m_dynamic[i] || m_asleep[i])
+                continue;
+            const double* vi = &v[6 * i];
+            bool quiet = vi[0] * vi[0] + vi[1] * vi[1] + vi[2] * vi[2] < lin2 &&
+                         vi[3] * vi[3] + vi[4] * vi[4] + vi[5] * vi[5] < ang2;
+            if (check_force) {
+                chrono::real3 f = m_system->GetBodyContactForce(i);
+                chrono::real3 df = f - m_force[i];
+                m_force[i] = f;
+                quiet = quiet && (df.x * df.x + df.y * df.y + df.z * df.z < m_force_threshold * m_force_threshold);
+            }
+            m_count[i] = quiet ? m_count[i] + 1 : 0;
+        }
+
+        // Islands: contacts between non-fixed bodies, plus bodies that fell asleep together.
+        for (int i = 0; i < n; i++)
+            m_parent[i] = i;
+        const auto& bids = data_manager->host_data.bids_rigid_rigid;
+        for (unsigned int ic = 0; ic < data_manager->num_rigid_contacts; ic++) {
+            int a = bids[ic].x;
+            int b = bids[ic].y;
+            if (m_dynamic[a] && m_dynamic[b])
+                Unite(a, b);
+        }
+        m_tag_root.assign(m_next_tag, -1);
+        for (int i = 0; i < n; i++) {
+            if (!m_asleep[i])
+                continue;
+            int& r = m_tag_root[m_tag[i]];
+            if (r < 0)
+                r = i;
+            else
+                Unite(i, r);
+        }
+
+        // Island states: any sleeping body? any moving awake body? all awake bodies quiescent long enough?
+        std::fill(m_has_sleeping.begin(), m_has_sleeping.end(), 0);
+        std::fill(m_has_moving.begin(), m_has_moving.end(), 0);
+        std::fill(m_can_sleep.begin(), m_can_sleep.end(), 0);
+        for (int i = 0; i < n; i++) {
+            if (!m_dynamic[i])
+                continue;
+            int r = Find(i);
+            if (m_asleep[i]) {
+                m_has_sleeping[r] = 1;
+                continue;
+            }
+            if (m_count[i] == 0)
+                m_has_moving[r] = 1;
+            if (m_count[i] < m_sleep_steps)
+                m_has_moving[r] |= 2;
+            else if (Managed(i))
+                m_can_sleep[r] = 1;
+        }
+
+        // Wake up disturbed islands; put to sleep quiescent islands (one new tag per island).
+        m_root_tag.assign(n, -1);
+        for (int i = 0; i < n; i++) {
+            if (!m_dynamic[i])
+                continue;
+            int r = Find(i);
+            if (m_has_sleeping[r] && (m_has_moving[r] & 1)) {
+                if (m_asleep[i]) {
+                    Wake(i);
+                    m_wake_events++;
+                }
+            } else if (m_can_sleep[r] && !m_has_moving[r]) {
+                if (m_root_tag[r] < 0)
+                    m_root_tag[r] = m_next_tag++;
+                if (m_asleep[i]) {
+                    m_tag[i] = m_root_tag[r];
+                } else if (Managed(i)) {
+                    Sleep(i, m_root_tag[r]);
+                    m_sleep_events++;
+                }
+            }
+        }
+
+        // Renumber the island tags still in use, so that tags do not grow without bound.
+        if (m_next_tag > n) {
+            m_tag_root.assign(m_next_tag, -1);
+            m_next_tag = 0;
+            for (int i = 0; i < n; i++) {
+                if (!m_asleep[i])
+                    continue;
+                int& t = m_tag_root[m_tag[i]];
+                if (t < 0)
+                    t = m_next_tag++;
+                m_tag[i] = t;
+            }
+        }
+
+        int num_managed = 0;
+        for (int i = 0; i < n; i++) {
+            if (m_dynamic[i] && Managed(i))
+                num_managed++;
+        }
+        m_cum_sleeping += m_num_sleeping;
+        m_cum_managed += num_managed;
+    }
+
+    /// Wake up all sleeping bodies (e.g. at the end of a settling phase).
+    void WakeAll() {
+        for (int i = 0; i < (int)m_asleep.size(); i++) {
+            if (m_asleep[i])
+                Wake(i);
+        }
+    }
+
+    /// Return the current number of sleeping bodies.
+    int GetNumSleeping() const { return m_num_sleeping; }
+
+    /// Return the fraction of sleeping bodies (among those that can sleep), averaged over all recorded steps.
+    double GetAverageSleepingFraction() const { return m_cum_managed > 0 ? m_cum_sleeping / m_cum_managed : 0; }
+
+    /// Return the total number of times a body was put to sleep.
+    long GetNumSleepEvents() const { return m_sleep_events; }
+
+    /// Return the total number of times a body was woken up.
+    long GetNumWakeEvents() const { return m_wake_events; }
+
+    /// Print the current number of sleeping bodies and the number of sleep/wake events.
+    void Print() const {
+        printf("[SleepManager] t = %.4f  sleeping %d  (sleep events %ld, wake events %ld)\n", m_system->GetChTime(),
+               m_num_sleeping, m_sleep_events, m_wake_events);
+    }
+
+  private:
+    bool Managed(int i) const { return i >= m_start && (m_num < 0 || i < m_start + m_num); }
+
+    void Resize(int n) {
+        if ((int)m_count.size() >= n)
+            return;
+        m_count.resize(n, 0);
+        m_force.resize(n, chrono::real3(0));
+        m_asleep.resize(n, 0);
+        m_tag.resize(n, -1);
+        m_dynamic.resize(n, 0);
+        m_parent.resize(n);
+        m_has_sleeping.resize(n);
+        m_has_moving.resize(n);
+        m_can_sleep.resize(n);
+    }
+
+    void Sleep(int i, int tag) {
+        auto body = m_system->Get_bodylist()[i];
+        body->SetPos_dt(chrono::ChVector<>(0, 0, 0));
+        body->SetWvel_loc(chrono::ChVector<>(0, 0, 0));
+        body->SetSleeping(true);
+        m_asleep[i] = 1;
+        m_tag[i] = tag;
+        m_num_sleeping++;
+    }
+
+    void Wake(int i) {
+        m_system->Get_bodylist()[i]->SetSleeping(false);
+        m_asleep[i] = 0;
+        m_tag[i] = -1;
+        m_count[i] = 0;
+        m_num_sleeping--;
+    }
+
+    int Find(int i) {
+        while (m_parent[i] != i) {
+            m_parent[i] = m_parent[m_parent[i]];
+            i = m_parent[i];
+        }
+        return i;
+    }
+
+    void Unite(int a, int b) {
+        a = Find(a);
+        b = Find(b);
+        if (a != b)
+            m_parent[std::max(a, b)] = std::min(a, b);
+    }
+
+    chrono::ChSystemParallel* m_system;
+
+    double m_lin_threshold;    ///< linear speed threshold
+    double m_ang_threshold;    ///< angular speed threshold
+    double m_force_threshold;  ///< contact force change threshold (disabled if not positive)
+    int m_sleep_steps;         ///< quiescent steps before sleeping
+    int m_start;               ///< first body that can sleep
+    int m_num;                 ///< number of bodies that can sleep (all if negative)
+
+    std::vector<int> m_count;            ///< consecutive quiescent steps
+    std::vector<chrono::real3> m_force;  ///< contact force at previous step
+    std::vector<char> m_asleep;          ///< body sleeping?
+    std::vector<int> m_tag;              ///< island tag of a sleeping body
+    std::vector<char> m_dynamic;         ///< non-fixed colliding body?
+    int m_next_tag;                      ///< next island tag
+
+    std::vector<int> m_parent;         ///< union-find forest
+    std::vector<int> m_tag_root;       ///< first body found with a given tag
+    std::vector<int> m_root_tag;       ///< new tag of an island put to sleep
+    std::vector<char> m_has_sleeping;  ///< island contains sleeping bodies?
+    std::vector<char> m_has_moving;    ///< island contains moving (1) or not yet quiescent (2) awake bodies?
+    std::vector<char> m_can_sleep;     ///< island contains awake bodies that can sleep?
+
+    int m_num_sleeping;     ///< current number of sleeping bodies
+    double m_cum_sleeping;  ///< cumulative number of sleeping bodies
+    double m_cum_managed;   ///< cumulative number of bodies that can sleep
+    long m_sleep_events;    ///< number of times a body was put to sleep
+    long m_wake_events;     ///< number of times a body was woken up
+};
+
+#endif
@@ -0,0 +1,326 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Pipeline of simulation stages (settle, press, test, ...) with checkpoints
+// cached on disk, for the Chrono::Parallel granular validation programs.
+//
+// Each stage starts from the output state of the previous one (the first stage
+// from an empty system) and:
+// - runs its entry function (create bodies, move the plate, create joints, ...)
+//   with the system time reset to 0;
+// - advances the system with a fixed step size, calling its step function
+//   (output, control) after each step;
+// - exits when its exit criterion holds after time_min, or at time_max.
+// Its output state is then written with utils::WriteCheckpoint to the cache
+// directory, in a file named after the stage and a 64-bit content hash (FNV-1a)
+// of its inputs: the name, step size, durations, and the values declared with
+// AddInput, chained with the hash of the previous stage. A stage whose
+// checkpoint exists is skipped, and so are all stages before the last cached
+// one: changing an input of a stage reruns that stage and the ones after it
+// only. Inputs that are not declared (e.g. code changes) are not detected; add
+// a version input, or clear the cache directory.
+//
+// Checkpoints do not include joints: entry functions must (re)create them. The
+// system of a stage run after a cached one is created by the system factory and
+// loaded with utils::ReadCheckpoint.
+//
+// Usage:
+//   StagePipeline pipeline([&]() { return CreateSystem(threads); }, out_dir + "/cache");
+//   pipeline.AddStage("settling")
+//       .AddInput("radius", r_g)
+//       .SetDuration(time_settling_min, time_settling_max, time_step)
+//       .SetEntry([&](ChSystemParallel* sys) { CreateObjects(sys); })
+//       .SetExit([&](ChSystemParallel* sys, double time) { return CheckSettled(sys, zero_v); });
+//   pipeline.AddStage("dropping")
+//       ...
+//       .SetCached(false);
+//   pipeline.Run();
+//
+// =============================================================================
+
+#ifndef STAGE_PIPELINE_H
+#define STAGE_PIPELINE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "chrono/core/ChTimer.h"
+#include "chrono/utils/ChUtilsInputOutput.h"
+
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+#include "chrono_thirdparty/filesystem/path.h"
+
+class StagePipeline {
+  public:
+    /// Function creating a new (empty) system with the desired settings.
+    typedef std::function<chrono::ChSystemParallel*()> SystemFactory;
+
+    /// Function called once at the beginning of a stage.
+    typedef std::function<void(chrono::ChSystemParallel* system)> EntryFunction;
+
+    /// Function called after each step of a stage, with the stage time.
+    typedef std::function<void(chrono::ChSystemParallel* system, double time)> StepFunction;
+
+    /// Exit criterion of a stage, checked after each step once the minimum duration has elapsed.
+    typedef std::function<bool(chrono::ChSystemParallel* system, double time)> ExitFunction;
+
+    /// How a stage was processed by the last call to Run().
+    enum Status {
+        NOT_RUN,  ///< not reached (or pipeline failed before it)
+        SKIPPED,  ///< output state found in the cache
+        RUN       ///< simulated
+    };
+
+    class Stage {
+      public:
+        /// Declare a numeric input of the stage (part of its content hash).
+        Stage& AddInput(const std::string& name, double value) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "%.17g", value);
+            return AddInput(name, std::string(buf));
+        }
+
+        /// Declare a text input of the stage (part of its content hash).
+        Stage& AddInput(const std::string& name, const std::string& value) {
+            m_inputs += name + "=" + value + ";";
+            return *this;
+        }
+
+        /// Set the minimum and maximum duration of the stage and its step size.
+        Stage& SetDuration(double time_min, double time_max, double step) {
+            m_time_min = time_min;
+            m_time_max = time_max;
+            m_step = step;
+            return *this;
+        }
+
+        /// Set the entry function, called on the input state before the first step.
+        Stage& SetEntry(EntryFunction fun) {
+            m_entry = fun;
+            return *this;
+        }
+
+        /// Set the function called after each step.
+        Stage& SetStep(StepFunction fun) {
+            m_step_fun = fun;
+            return *this;
+        }
+
+        /// Set the exit criterion (default: none, the stage runs for its maximum duration).
+        Stage& SetExit(ExitFunction fun) {
+            m_exit = fun;
+            return *this;
+        }
+
+        /// Enable or disable caching of the stage output (default: enabled).
+        /// A stage that is not cached always runs, and so do all stages after it.
+        Stage& SetCached(bool cached) {
+            m_cached = cached;
+            return *this;
+        }
+
+        /// Return the stage name.
+        const std::string& GetName() const { return m_name; }
+
+        /// Return the content hash of the stage (valid after Run()).
+        uint64_t GetHash() const { return m_hash; }
+
+        /// Return how the stage was processed by the last call to Run().
+        Status GetStatus() const { return m_status; }
+
+        /// Return the simulated duration of the stage (0 if skipped).
+        double GetTime() const { return m_time; }
+
+        /// Return the wall-clock time of the stage, including checkpoint output.
+        double GetWallTime() const { return m_wall_time; }
+
+      private:
+        Stage(const std::string& name)
+            : m_name(name),
+              m_time_min(0),
+              m_time_max(0),
+              m_step(1e-3),
+              m_cached(true),
+              m_hash(0),
+              m_status(NOT_RUN),
+              m_time(0),
+              m_wall_time(0) {}
+
+        std::string m_name;
+        std::string m_inputs;  ///< declared inputs, serialized
+        double m_time_min;     ///< minimum duration
+        double m_time_max;     ///< maximum duration
+        double m_step;         ///< step size
+        EntryFunction m_entry;
+        StepFunction m_step_fun;
+        ExitFunction m_exit;
+        bool m_cached;  ///< write the output state to the cache?
+
+        uint64_t m_hash;     ///< content hash (inputs chained with the previous stage)
+        Status m_status;     ///< processing status
+        double m_time;       ///< simulated duration
+        double m_wall_time;  ///< wall-clock time
+
+        friend class StagePipeline;
+    };
+
+    /// Create a pipeline with systems obtained from the given factory and checkpoints cached in the given directory.
+    StagePipeline(SystemFactory factory, const std::string& cache_dir) : m_factory(factory), m_cache_dir(cache_dir) {}
+
+    /// Append a stage with the specified name and return it for configuration.
+    Stage& AddStage(const std::string& name) {
+        m_stages.push_back(std::unique_ptr<Stage>(new Stage(name)));
+        return *m_stages.back();
+    }
+
+    /// Return the number of stages.
+    int GetNumStages() const { return (int)m_stages.size(); }
+
+    /// Return the specified stage.
+    const Stage& GetStage(int index) const { return *m_stages[index]; }
+
+    /// Return the checkpoint file of the specified stage (valid after Run()).
+    std::string GetCheckpointFile(int index) const {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "_%016llx.dat", (unsigned long long)m_stages[index]->m_hash);
+        return m_cache_dir + "/" + m_stages[index]->m_name + buf;
+    }
+
+    /// Run the pipeline, skipping the stages up to the last one with a cached output state.
+    /// Return false if the cache directory cannot be created or a checkpoint cannot be written.
+    bool Run() {
+        int num_stages = (int)m_stages.size();
+
+        // Content hashes (chained) and the last stage with a cached output.
+        uint64_t hash = kOffsetBasis;
+        int first = 0;
+        for (int i = 0; i < num_stages; i++) {
+            Stage& s = *m_stages[i];
+            std::ostringstream key;
+            key.precision(17);
+            key << s.m_name << "|" << s.m_step << "|" << s.m_time_min << "|" << s.m_time_max << "|" << s.m_inputs;
+            hash = Hash(key.str(), hash);
+            s.m_hash = hash;
+            s.m_status = NOT_RUN;
+            s.m_time = 0;
+            s.m_wall_time = 0;
+        }
+        for (int i = 0; i < num_stages; i++) {
+            if (!m_stages[i]->m_cached)
+                break;
+            if (filesystem::path(GetCheckpointFile(i)).exists())
+                first = i + 1;
+        }
+
+        if (!filesystem::path(m_cache_dir).exists() && !filesystem::create_directory(filesystem::path(m_cache_dir))) {
+            std::cout << "[StagePipeline] error creating directory " << m_cache_dir << std::endl;
+            return false;
+        }
+
+        // Load the last cached output state.
+        m_system.reset(m_factory());
+        for (int i = 0; i < first; i++)
+            m_stages[i]->m_status = SKIPPED;
+        if (first > 0) {
+            std::string file = GetCheckpointFile(first - 1);
+            std::cout << "[StagePipeline] output of stage " << first << " (" << m_stages[first - 1]->m_name
+                      << ") cached;  read " << file << std::endl;
+            chrono::utils::ReadCheckpoint(m_system.get(), file);
+        }
+
+        for (int i = first; i < num_stages; i++) {
+            Stage& s = *m_stages[i];
+            std::cout << "[StagePipeline] stage " << i + 1 << " / " << num_stages << " (" << s.m_name << ")"
+                      << std::endl;
+
+            chrono::ChTimer<double> timer;
+            timer.start();
+
+            m_system->SetChTime(0);
+            if (s.m_entry)
+                s.m_entry(m_system.get());
+
+            double time = 0;
+            while (time < s.m_time_max) {
+                m_system->DoStepDynamics(s.m_step);
+                time += s.m_step;
+                if (s.m_step_fun)
+                    s.m_step_fun(m_system.get(), time);
+                if (s.m_exit && time >= s.m_time_min && s.m_exit(m_system.get(), time))
+                    break;
+            }
+            s.m_time = time;
+
+            if (s.m_cached) {
+                // Write to a temporary file first, so that an interrupted run leaves no partial checkpoint.
+                std::string file = GetCheckpointFile(i);
+                std::string tmp = file + ".tmp";
+                chrono::utils::WriteCheckpoint(m_system.get(), tmp);
+                if (std::rename(tmp.c_str(), file.c_str()) != 0) {
+                    std::cout << "[StagePipeline] error writing " << file << std::endl;
+                    return false;
+                }
+            }
+
+            timer.stop();
+            s.m_wall_time = timer();
+            s.m_status = RUN;
+            std::cout << "[StagePipeline] stage " << i + 1 << " (" << s.m_name << ") done:  time " << time
+                      << "  wall time " << s.m_wall_time << " s" << std::endl;
+        }
+
+        return true;
+    }
+
+    /// Return the system holding the output state of the last stage (valid after Run()).
+    chrono::ChSystemParallel* GetSystem() const { return m_system.get(); }
+
+    /// Print the status, content hash, simulated time, and wall-clock time of each stage.
+    void PrintSummary() const {
+        static const char* status[] = {"not run", "cached", "run"};
+        for (const auto& s : m_stages) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)s->m_hash);
+            std::cout << "  " << s->m_name << "  " << buf << "  " << status[s->m_status] << "  time " << s->m_time
+                      << "  wall time " << s->m_wall_time << std::endl;
+        }
+    }
+
+  private:
+    static const uint64_t kOffsetBasis = 14695981039346656037ULL;
+    static const uint64_t kPrime = 1099511628211ULL;
+
+    /// FNV-1a hash of a string, continuing from the given hash.
+    static uint64_t Hash(const std::string& text, uint64_t hash) {
+        for (unsigned char c : text) {
+            hash ^= c;
+            hash *= kPrime;
+        }
+        return hash;
+    }
+
+    SystemFactory m_factory;
+    std::string m_cache_dir;
+    std::vector<std::unique_ptr<Stage>> m_stages;
+    std::unique_ptr<chrono::ChSystemParallel> m_system;
+};
+
+#endif
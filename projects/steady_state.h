@@ -0,0 +1,128 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Streaming steady-state detection for a sampled signal (e.g. the drawbar pull
+// or the wheel torque during one slip segment of a single wheel test).
+//
+// The samples are grouped in consecutive time blocks of fixed duration; for
+// each block the mean and standard deviation are accumulated on the fly
+// (Welford). The signal is considered steady when the means of the last two
+// complete blocks differ by less than a relative tolerance of their magnitude
+// plus an absolute tolerance. Only the statistics of the last two blocks are
+// kept.
+//
+// Usage:
+//   SteadyStateDetector dp(0.25, 0.05);
+//   dp.Reset(time);
+//   while (...) {
+//       ...
+//       dp.Add(time, force);
+//       if (dp.IsSteady()) ...
+//   }
+//   double mean = dp.GetMean();
+//
+// =============================================================================
+
+#ifndef STEADY_STATE_H
+#define STEADY_STATE_H
+
+#include <cmath>
+
+class SteadyStateDetector {
+  public:
+    /// Use blocks of the given duration and the given tolerances on the difference of successive block means.
+    SteadyStateDetector(double block = 0.25, double rel_tol = 0.05, double abs_tol = 0)
+        : m_block(block), m_rel_tol(rel_tol), m_abs_tol(abs_tol) {
+        Reset(0);
+    }
+
+    /// Set the block duration and the tolerances.
+    void SetParameters(double block, double rel_tol, double abs_tol) {
+        m_block = block;
+        m_rel_tol = rel_tol;
+        m_abs_tol = abs_tol;
+    }
+
+    /// Discard all statistics; the first block starts at the given time.
+    void Reset(double time) {
+        m_start = time;
+        m_num_blocks = 0;
+        m_cur = Block();
+        m_last = Block();
+        m_prev = Block();
+    }
+
+    /// Add a sample of the signal at the given time.
+    void Add(double time, double value) {
+        while (time >= m_start + m_block) {
+            if (m_cur.n > 0) {
+                m_prev = m_last;
+                m_last = m_cur;
+                m_num_blocks++;
+            }
+            m_cur = Block();
+            m_start += m_block;
+        }
+        m_cur.n++;
+        double delta = value - m_cur.mean;
+        m_cur.mean += delta / m_cur.n;
+        m_cur.m2 += delta * (value - m_cur.mean);
+    }
+
+    /// Return the number of complete blocks.
+    int GetNumBlocks() const { return m_num_blocks; }
+
+    /// Return true if the means of the last two complete blocks agree within the tolerances.
+    bool IsSteady() const {
+        if (m_num_blocks < 2)
+            return false;
+        double tol = m_rel_tol * 0.5 * (std::abs(m_last.mean) + std::abs(m_prev.mean)) + m_abs_tol;
+        return std::abs(m_last.mean - m_prev.mean) <= tol;
+    }
+
+    /// Return the mean over the last two complete blocks (the current block if none is complete).
+    double GetMean() const {
+        if (m_num_blocks == 0)
+            return m_cur.mean;
+        if (m_num_blocks == 1)
+            return m_last.mean;
+        return (m_last.n * m_last.mean + m_prev.n * m_prev.mean) / (m_last.n + m_prev.n);
+    }
+
+    /// Return the standard deviation of the samples in the last complete block (the current block if none).
+    double GetStdDev() const {
+        const Block& b = (m_num_blocks == 0) ? m_cur : m_last;
+        return b.n > 1 ? std::sqrt(b.m2 / (b.n - 1)) : 0;
+    }
+
+  private:
+    /// Running statistics of one block.
+    struct Block {
+        Block() : n(0), mean(0), m2(0) {}
+        int n;        ///< number of samples
+        double mean;  ///< mean
+        double m2;    ///< sum of squared deviations from the mean
+    };
+
+    double m_block;    ///< block duration
+    double m_rel_tol;  ///< relative tolerance on successive block means
+    double m_abs_tol;  ///< absolute tolerance on successive block means
+    double m_start;    ///< start time of the current block
+    int m_num_blocks;  ///< number of complete blocks
+    Block m_cur;       ///< current block
+    Block m_last;      ///< last complete block
+    Block m_prev;      ///< complete block before the last
+};
+
+#endif
@@ -0,0 +1,215 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// Per-step profiling of a Chrono::Parallel simulation.
+//
+// A StepProfiler records, after each step, the step, collision (broad and
+// narrow phase), update, and advance (solver + integration) times, as well as
+// the number of contacts, solver iterations, and solver residual. Values for
+// the most recent steps are kept in fixed-size ring buffers, from which rolling
+// averages and percentiles are computed on demand; cumulative totals and
+// maxima are kept for the entire run.
+//
+// Console output is rate-limited (by default, at most one line per second of
+// wall-clock time, showing rolling averages), so that printing does not
+// distort the timing of short steps. Optionally, one fixed-width line per step
+// can be written to an output file. A summary is printed at the end of the run.
+//
+// Usage:
+//   StepProfiler profiler(system);
+//   while (...) {
+//       system->DoStepDynamics(step_size);
+//       profiler.Record();
+//   }
+//   profiler.PrintSummary();
+//
+// =============================================================================
+
+#ifndef STEP_PROFILER_H
+#define STEP_PROFILER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "chrono/core/ChStream.h"
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+class StepProfiler {
+  public:
+    /// Quantities recorded at each step.
+    enum Quantity {
+        STEP = 0,    ///< total step time (s)
+        BROAD,       ///< broad-phase collision detection time (s)
+        NARROW,      ///< narrow-phase collision detection time (s)
+        UPDATE,      ///< system update time (s)
+        ADVANCE,     ///< solver and integration time (s)
+        CONTACTS,    ///< number of contacts
+        ITERATIONS,  ///< number of solver iterations
+        RESIDUAL,    ///< solver residual
+        NUM_QUANTITIES
+    };
+
+    /// Construct a profiler for the given system, keeping the last 'window' steps.
+    StepProfiler(chrono::ChSystemParallel* system, int window = 1000)
+        : m_system(system),
+          m_window(std::max(1, window)),
+          m_head(0),
+          m_count(0),
+          m_num_steps(0),
+          m_interval(1.0),
+          m_ofile(nullptr),
+          m_header(false) {
+        for (int q = 0; q < NUM_QUANTITIES; q++) {
+            m_buffer[q].resize(m_window, 0.0);
+            m_window_sum[q] = 0;
+            m_total[q] = 0;
+            m_max[q] = 0;
+        }
+        m_last_print = std::chrono::steady_clock::now();
+    }
+
+    /// Set the minimum wall-clock interval (in seconds) between console output lines (default: 1).
+    /// A negative value disables console output; a value of 0 prints a line after every step.
+    void SetOutputInterval(double seconds) { m_interval = seconds; }
+
+    /// Write one fixed-width line per step to the specified file (default: none).
+    void SetOutputFile(chrono::ChStreamOutAsciiFile* ofile) { m_ofile = ofile; }
+
+    /// Record the statistics of the last step. Must be called after each step.
+    void Record() {
+        const auto& solver = m_system->data_manager->measures.solver;
+        double values[NUM_QUANTITIES];
+        values[STEP] = m_system->GetTimerStep();
+        values[BROAD] = m_system->GetTimerCollisionBroad();
+        values[NARROW] = m_system->GetTimerCollisionNarrow();
+        values[UPDATE] = m_system->GetTimerUpdate();
+        values[ADVANCE] = m_system->GetTimerAdvance();
+        values[CONTACTS] = m_system->GetNcontacts();
+        values[ITERATIONS] = solver.total_iteration;
+        values[RESIDUAL] = solver.residual;
+
+        bool full = (m_count == m_window);
+        for (int q = 0; q < NUM_QUANTITIES; q++) {
+            if (full)
+                m_window_sum[q] -= m_buffer[q][m_head];
+            m_buffer[q][m_head] = values[q];
+            m_window_sum[q] += values[q];
+            m_total[q] += values[q];
+            m_max[q] = std::max(m_max[q], values[q]);
+        }
+        m_head = (m_head + 1) % m_window;
+        if (!full)
+            m_count++;
+        m_num_steps++;
+
+        if (m_ofile) {
+            char buf[200];
+            sprintf(buf, "%8.5f  %7.4f  %7.4f  %7.4f  %7.4f  %7.4f  %7d  %7d  %7d  %7.4f\n", m_system->GetChTime(),
+                    values[STEP], values[BROAD], values[NARROW], values[ADVANCE], values[UPDATE],
+                    m_system->GetNbodies(), (int)values[CONTACTS], (int)values[ITERATIONS], values[RESIDUAL]);
+            *m_ofile << buf;
+        }
+
+        if (m_interval < 0)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        if (std::chrono::duration<double>(now - m_last_print).count() < m_interval)
+            return;
+        m_last_print = now;
+        PrintLine();
+    }
+
+    /// Return the number of recorded steps.
+    int GetNumSteps() const { return m_num_steps; }
+
+    /// Return the cumulative value of the specified quantity over all recorded steps.
+    double GetTotal(Quantity q) const { return m_total[q]; }
+
+    /// Return the average value of the specified quantity over all recorded steps.
+    double GetAverage(Quantity q) const { return m_num_steps > 0 ? m_total[q] / m_num_steps : 0; }
+
+    /// Return the maximum value of the specified quantity over all recorded steps.
+    double GetMax(Quantity q) const { return m_max[q]; }
+
+    /// Return the average value of the specified quantity over the steps in the current window.
+    double GetRollingAverage(Quantity q) const { return m_count > 0 ? m_window_sum[q] / m_count : 0; }
+
+    /// Return the specified percentile (0 to 100) of a quantity over the steps in the current window.
+    double GetPercentile(Quantity q, double p) const {
+        if (m_count == 0)
+            return 0;
+        m_scratch.assign(m_buffer[q].begin(), m_buffer[q].begin() + m_count);
+        size_t k = (size_t)std::round(std::min(100.0, std::max(0.0, p)) / 100 * (m_count - 1));
+        std::nth_element(m_scratch.begin(), m_scratch.begin() + k, m_scratch.end());
+        return m_scratch[k];
+    }
+
+    /// Print a summary of the run: totals over all steps and distribution over the current window.
+    void PrintSummary() const {
+        if (m_num_steps == 0)
+            return;
+        double total_step = m_total[STEP];
+        printf("\nStep profile: %d steps, total %.4f s (percentiles over the last %d steps)\n", m_num_steps,
+               total_step, m_count);
+        printf("  %-10s | %10s | %6s | %10s | %10s | %10s | %10s\n", "", "TOTAL (s)", "%", "AVG (ms)", "P50 (ms)",
+               "P95 (ms)", "MAX (ms)");
+        static const char* names[] = {"step", "broad", "narrow", "update", "advance"};
+        for (int q = STEP; q <= ADVANCE; q++) {
+            printf("  %-10s | %10.4f | %6.1f | %10.4f | %10.4f | %10.4f | %10.4f\n", names[q], m_total[q],
+                   total_step > 0 ? 100 * m_total[q] / total_step : 0.0, 1000 * GetAverage((Quantity)q),
+                   1000 * GetPercentile((Quantity)q, 50), 1000 * GetPercentile((Quantity)q, 95), 1000 * m_max[q]);
+        }
+        printf("  contacts:   avg %.1f  max %.0f\n", GetAverage(CONTACTS), m_max[CONTACTS]);
+        printf("  iterations: avg %.1f  max %.0f\n", GetAverage(ITERATIONS), m_max[ITERATIONS]);
+        printf("  residual:   avg %.4g  max %.4g\n\n", GetAverage(RESIDUAL), m_max[RESIDUAL]);
+    }
+
+  private:
+    /// Print rolling averages to the console (preceded by a header the first time).
+    void PrintLine() {
+        if (!m_header) {
+            printf("    TIME    |  STEPS  |    STEP |   BROAD |  NARROW |  UPDATE | ADVANCE |");
+            printf(" CONTACTS|   ITERS |   RESID\n");
+            m_header = true;
+        }
+        printf("  %9.5f | %7d | %7.4f | %7.4f | %7.4f | %7.4f | %7.4f | %7.0f | %7.1f | %7.4f\n",
+               m_system->GetChTime(), m_num_steps, 1000 * GetRollingAverage(STEP), 1000 * GetRollingAverage(BROAD),
+               1000 * GetRollingAverage(NARROW), 1000 * GetRollingAverage(UPDATE), 1000 * GetRollingAverage(ADVANCE),
+               GetRollingAverage(CONTACTS), GetRollingAverage(ITERATIONS), GetRollingAverage(RESIDUAL));
+        fflush(stdout);
+    }
+
+    chrono::ChSystemParallel* m_system;
+
+    int m_window;     ///< number of steps kept in the ring buffers
+    int m_head;       ///< position of the next entry in the ring buffers
+    int m_count;      ///< number of valid entries in the ring buffers
+    int m_num_steps;  ///< total number of recorded steps
+
+    std::vector<double> m_buffer[NUM_QUANTITIES];  ///< ring buffers (last m_window steps)
+    double m_window_sum[NUM_QUANTITIES];           ///< sums over the ring buffers
+    double m_total[NUM_QUANTITIES];                ///< sums over all steps
+    double m_max[NUM_QUANTITIES];                  ///< maxima over all steps
+    mutable std::vector<double> m_scratch;         ///< scratch space for percentiles
+
+    double m_interval;                                   ///< minimum interval between console lines
+    std::chrono::steady_clock::time_point m_last_print;  ///< time of the last console line
+    chrono::ChStreamOutAsciiFile* m_ofile;               ///< optional per-step output file
+    bool m_header;                                       ///< console header printed?
+};
+
+#endif
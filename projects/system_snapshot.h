@@ -0,0 +1,376 @@
+// =============================================================================
+// PROJECT CHRONO - http://projectchrono.org
+//
+// Copyright (c) 2016 projectchrono.org
+// All right reserved.
+//
+// Use of this source code is governed by a BSD-style license that can be found
+// in the LICENSE file at the top level of the distribution and at
+// http://projectchrono.org/license-chrono.txt.
+//
+// =============================================================================
+// Authors: Radu Serban
+// =============================================================================
+//
+// In-memory snapshot of the bodies of a Chrono::Parallel system.
+//
+// A SystemSnapshot records the same information as utils::WriteCheckpoint
+// (identifier, flags, collision family, mass properties, state, contact
+// material, and the collision shapes inferred from the visualization assets),
+// but keeps it in memory. It can then be restored any number of times into new
+// systems, e.g. to run many tests from the same settled granular bed without
+// writing and parsing checkpoint files:
+// - captured contact materials with identical properties are merged (states
+//   read with utils::ReadCheckpoint have one material per body); each restore
+//   creates its own copy of every merged material, which can be edited before
+//   the bodies are added to the system;
+// - runs of consecutive spheres with the same radius, mass, and material are
+//   restored as a ParticleBatch.
+// Links are not captured: a snapshot is meant for states without joints (such
+// as a settled bed); joints are created by the caller after restoring. The
+// system time is not modified.
+//
+// Usage:
+//   SystemSnapshot settled;
+//   settled.Capture(system);
+//   ...
+//   settled.Restore(new_system, [&](std::shared_ptr<ChMaterialSurface> mat, int identifier) {
+//       if (identifier > 0)
+//           mat->SetFriction(mu);
+//   });
+//
+// =============================================================================
+
+#ifndef SYSTEM_SNAPSHOT_H
+#define SYSTEM_SNAPSHOT_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "chrono/assets/ChBoxShape.h"
+#include "chrono/assets/ChCapsuleShape.h"
+#include "chrono/assets/ChConeShape.h"
+#include "chrono/assets/ChCylinderShape.h"
+#include "chrono/assets/ChEllipsoidShape.h"
+#include "chrono/assets/ChRoundedBoxShape.h"
+#include "chrono/assets/ChRoundedCylinderShape.h"
+#include "chrono/assets/ChSphereShape.h"
+#include "chrono/utils/ChUtilsCreators.h"
+
+#include "chrono_parallel/collision/ChCollisionModelParallel.h"
+#include "chrono_parallel/physics/ChSystemParallel.h"
+
+#include "particle_batch.h"
+
+class SystemSnapshot {
+  public:
+    /// Function called on each restored contact material, with the identifier of the first body using it.
+    typedef std::function<void(std::shared_ptr<chrono::ChMaterialSurface> mat, int identifier)> MaterialCallback;
+
+    SystemSnapshot() : m_num_skipped(0) {}
+
+    /// Record the state of all bodies in the specified system.
+    void Capture(chrono::ChSystemParallel* system) {
+        m_bodies.clear();
+        m_materials.clear();
+        m_num_skipped = 0;
+
+        std::map<std::vector<float>, int> material_index;
+        m_bodies.reserve(system->Get_bodylist().size());
+
+        for (auto body : system->Get_bodylist()) {
+            BodyData b;
+            b.identifier = body->GetIdentifier();
+            b.fixed = body->GetBodyFixed();
+            b.collide = body->GetCollide();
+            b.family_group = body->GetCollisionModel()->GetFamilyGroup();
+            b.family_mask = body->GetCollisionModel()->GetFamilyMask();
+            b.mass = body->GetMass();
+            b.inertia = body->GetInertiaXX();
+            b.pos = body->GetPos();
+            b.rot = body->GetRot();
+            b.pos_dt = body->GetPos_dt();
+            b.wvel_loc = body->GetWvel_loc();
+
+            auto mat = body->GetMaterialSurfaceBase();
+            auto key = MaterialKey(mat);
+            auto it = material_index.find(key);
+            if (it == material_index.end()) {
+                it = material_index.insert({key, (int)m_materials.size()}).first;
+                m_materials.push_back({mat, b.identifier});
+            }
+            b.material = it->second;
+
+            for (auto asset : body->GetAssets()) {
+                auto visual = std::dynamic_pointer_cast<chrono::ChVisualization>(asset);
+                if (!visual)
+                    continue;
+                ShapeData s;
+                s.pos = visual->Pos;
+                s.rot = visual->Rot.Get_A_quaternion();
+                if (!GetShape(asset, s)) {
+                    m_num_skipped++;
+                    continue;
+                }
+                b.shapes.push_back(s);
+            }
+
+            m_bodies.push_back(b);
+        }
+    }
+
+    /// Create the captured bodies in the specified system (in the captured order).
+    /// If provided, the callback is invoked on each contact material copy before any body is added.
+    void Restore(chrono::ChSystemParallel* system, MaterialCallback edit = nullptr) const {
+        // Body construction uses global (non thread-safe) counters; serialize concurrent restores.
+        std::lock_guard<std::recursive_mutex> lock(GetConstructionMutex());
+
+        std::vector<std::shared_ptr<chrono::ChMaterialSurface>> materials;
+        for (const auto& m : m_materials) {
+            materials.push_back(CopyMaterial(m.material));
+            if (edit)
+                edit(materials.back(), m.identifier);
+        }
+
+        chrono::collision::ChCollisionModelParallel default_model;
+        short int default_group = default_model.GetFamilyGroup();
+        short int default_mask = default_model.GetFamilyMask();
+
+        size_t i = 0;
+        while (i < m_bodies.size()) {
+            // Find a run of consecutive spheres that can be restored as a batch.
+            size_t n = 0;
+            while (i + n < m_bodies.size() && IsBatchable(m_bodies[i + n], default_group, default_mask) &&
+                   (n == 0 || Matches(m_bodies[i], m_bodies[i + n], (int)n)))
+                n++;
+
+            if (n > 1) {
+                RestoreBatch(system, materials, i, n);
+                i += n;
+            } else {
+                RestoreBody(system, materials, m_bodies[i]);
+                i++;
+            }
+        }
+    }
+
+    /// Return the mutex serializing body construction in concurrent restores. Lock it to create additional Chrono
+    /// objects (systems, bodies, links) while other threads may be restoring snapshots. The mutex is recursive, so
+    /// it can be held across a call to Restore.
+    static std::recursive_mutex& GetConstructionMutex() {
+        static std::recursive_mutex construction_mutex;
+        return construction_mutex;
+    }
+
+    /// Return the number of captured bodies.
+    size_t GetNumBodies() const { return m_bodies.size(); }
+
+    /// Return the number of visualization assets that could not be converted to collision shapes.
+    int GetNumSkippedShapes() const { return m_num_skipped; }
+
+  private:
+    struct ShapeData {
+        chrono::collision::ShapeType type;
+        chrono::ChVector<> dims;  ///< shape dimensions (meaning depends on type)
+        double srad;              ///< sphere-swept radius (rounded shapes)
+        chrono::ChVector<> pos;
+        chrono::ChQuaternion<> rot;
+    };
+
+    struct BodyData {
+        int identifier;
+        bool fixed;
+        bool collide;
+        short int family_group;
+        short int family_mask;
+        double mass;
+        chrono::ChVector<> inertia;
+        chrono::ChVector<> pos;
+        chrono::ChQuaternion<> rot;
+        chrono::ChVector<> pos_dt;
+        chrono::ChVector<> wvel_loc;
+        int material;  ///< index in the list of captured materials
+        std::vector<ShapeData> shapes;
+    };
+
+    struct MaterialData {
+        std::shared_ptr<chrono::ChMaterialSurface> material;
+        int identifier;  ///< identifier of the first body using this material
+    };
+
+    /// Infer the collision shape from a visualization asset (as done by utils::WriteCheckpoint).
+    static bool GetShape(std::shared_ptr<chrono::ChAsset> asset, ShapeData& s) {
+        using namespace chrono;
+        s.srad = 0;
+        if (auto sphere = std::dynamic_pointer_cast<ChSphereShape>(asset)) {
+            s.type = collision::SPHERE;
+            s.dims = ChVector<>(sphere->GetSphereGeometry().rad, 0, 0);
+        } else if (auto ellipsoid = std::dynamic_pointer_cast<ChEllipsoidShape>(asset)) {
+            s.type = collision::ELLIPSOID;
+            s.dims = ellipsoid->GetEllipsoidGeometry().rad;
+        } else if (auto box = std::dynamic_pointer_cast<ChBoxShape>(asset)) {
+            s.type = collision::BOX;
+            s.dims = box->GetBoxGeometry().Size;
+        } else if (auto capsule = std::dynamic_pointer_cast<ChCapsuleShape>(asset)) {
+            s.type = collision::CAPSULE;
+            s.dims = ChVector<>(capsule->GetCapsuleGeometry().rad, capsule->GetCapsuleGeometry().hlen, 0);
+        } else if (auto cylinder = std::dynamic_pointer_cast<ChCylinderShape>(asset)) {
+            s.type = collision::CYLINDER;
+            s.dims = ChVector<>(cylinder->GetCylinderGeometry().rad, cylinder->GetCylinderGeometry().p1.y(), 0);
+        } else if (auto cone = std::dynamic_pointer_cast<ChConeShape>(asset)) {
+            s.type = collision::CONE;
+            s.dims = ChVector<>(cone->GetConeGeometry().rad.x(), cone->GetConeGeometry().rad.y(), 0);
+        } else if (auto rbox = std::dynamic_pointer_cast<ChRoundedBoxShape>(asset)) {
+            s.type = collision::ROUNDEDBOX;
+            s.dims = rbox->GetRoundedBoxGeometry().Size;
+            s.srad = rbox->GetRoundedBoxGeometry().radsphere;
+        } else if (auto rcyl = std::dynamic_pointer_cast<ChRoundedCylinderShape>(asset)) {
+            s.type = collision::ROUNDEDCYL;
+            s.dims = ChVector<>(rcyl->GetRoundedCylinderGeometry().rad, rcyl->GetRoundedCylinderGeometry().hlen, 0);
+            s.srad = rcyl->GetRoundedCylinderGeometry().radsphere;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    /// Contact method and property values of a material (materials with the same key are merged).
+    static std::vector<float> MaterialKey(std::shared_ptr<chrono::ChMaterialSurface> mat) {
+        if (auto nsc = std::dynamic_pointer_cast<chrono::ChMaterialSurfaceNSC>(mat)) {
+            return {0,
+                    nsc->GetSfriction(),
+                    nsc->GetKfriction(),
+                    nsc->GetRollingFriction(),
+                    nsc->GetSpinningFriction(),
+                    nsc->GetRestitution(),
+                    nsc->GetCohesion(),
+                    nsc->GetDampingF(),
+                    nsc->GetCompliance(),
+                    nsc->GetComplianceT(),
+                    nsc->GetComplianceRolling(),
+                    nsc->GetComplianceSpinning()};
+        }
+        if (auto smc = std::dynamic_pointer_cast<chrono::ChMaterialSurfaceSMC>(mat)) {
+            return {1,
+                    smc->GetYoungModulus(),
+                    smc->GetPoissonRatio(),
+                    smc->GetSfriction(),
+                    smc->GetKfriction(),
+                    smc->GetRestitution(),
+                    smc->GetAdhesion(),
+                    smc->GetAdhesionMultDMT(),
+                    smc->GetKn(),
+                    smc->GetKt(),
+                    smc->GetGn(),
+                    smc->GetGt()};
+        }
+        return {-1};
+    }
+
+    static std::shared_ptr<chrono::ChMaterialSurface> CopyMaterial(std::shared_ptr<chrono::ChMaterialSurface> mat) {
+        if (auto nsc = std::dynamic_pointer_cast<chrono::ChMaterialSurfaceNSC>(mat))
+            return chrono_types::make_shared<chrono::ChMaterialSurfaceNSC>(*nsc);
+        if (auto smc = std::dynamic_pointer_cast<chrono::ChMaterialSurfaceSMC>(mat))
+            return chrono_types::make_shared<chrono::ChMaterialSurfaceSMC>(*smc);
+        return mat;
+    }
+
+    /// A body can be part of a batch if it is a free, colliding body with a single centered sphere.
+    static bool IsBatchable(const BodyData& b, short int default_group, short int default_mask) {
+        return !b.fixed && b.collide && b.shapes.size() == 1 && b.shapes[0].type == chrono::collision::SPHERE &&
+               b.shapes[0].pos == chrono::VNULL && b.family_group == default_group && b.family_mask == default_mask;
+    }
+
+    /// Check whether body 'b' can be batched with the run starting at body 'first', at the given offset.
+    static bool Matches(const BodyData& first, const BodyData& b, int offset) {
+        return b.identifier == first.identifier + offset && b.material == first.material && b.mass == first.mass &&
+               b.shapes[0].dims.x() == first.shapes[0].dims.x();
+    }
+
+    void RestoreBatch(chrono::ChSystemParallel* system,
+                      const std::vector<std::shared_ptr<chrono::ChMaterialSurface>>& materials,
+                      size_t start,
+                      size_t num) const {
+        const BodyData& first = m_bodies[start];
+        double radius = first.shapes[0].dims.x();
+        double density = first.mass / ((4.0 / 3) * chrono::CH_C_PI * radius * radius * radius);
+
+        std::vector<chrono::ChVector<>> positions(num);
+        for (size_t k = 0; k < num; k++)
+            positions[k] = m_bodies[start + k].pos;
+
+        ParticleBatch batch(system, positions, radius, density, materials[first.material], first.identifier);
+
+#pragma omp parallel for
+        for (int k = 0; k < (int)num; k++) {
+            const BodyData& b = m_bodies[start + k];
+            auto body = batch.GetBody(k);
+            body->SetRot(b.rot);
+            body->SetPos_dt(b.pos_dt);
+            body->SetWvel_loc(b.wvel_loc);
+        }
+    }
+
+    void RestoreBody(chrono::ChSystemParallel* system,
+                     const std::vector<std::shared_ptr<chrono::ChMaterialSurface>>& materials,
+                     const BodyData& b) const {
+        using namespace chrono;
+        auto body = std::shared_ptr<ChBody>(system->NewBody());
+        body->SetIdentifier(b.identifier);
+        body->SetMass(b.mass);
+        body->SetInertiaXX(b.inertia);
+        body->SetPos(b.pos);
+        body->SetRot(b.rot);
+        body->SetPos_dt(b.pos_dt);
+        body->SetWvel_loc(b.wvel_loc);
+        body->SetBodyFixed(b.fixed);
+        body->SetCollide(b.collide);
+        body->SetMaterialSurface(materials[b.material]);
+
+        body->GetCollisionModel()->ClearModel();
+        for (const auto& s : b.shapes) {
+            switch (s.type) {
+                case collision::SPHERE:
+                    utils::AddSphereGeometry(body.get(), s.dims.x(), s.pos, s.rot);
+                    break;
+                case collision::ELLIPSOID:
+                    utils::AddEllipsoidGeometry(body.get(), s.dims, s.pos, s.rot);
+                    break;
+                case collision::BOX:
+                    utils::AddBoxGeometry(body.get(), s.dims, s.pos, s.rot);
+                    break;
+                case collision::CAPSULE:
+                    utils::AddCapsuleGeometry(body.get(), s.dims.x(), s.dims.y(), s.pos, s.rot);
+                    break;
+                case collision::CYLINDER:
+                    utils::AddCylinderGeometry(body.get(), s.dims.x(), s.dims.y(), s.pos, s.rot);
+                    break;
+                case collision::CONE:
+                    utils::AddConeGeometry(body.get(), s.dims.x(), s.dims.y(), s.pos, s.rot);
+                    break;
+                case collision::ROUNDEDBOX:
+                    utils::AddRoundedBoxGeometry(body.get(), s.dims, s.srad, s.pos, s.rot);
+                    break;
+                case collision::ROUNDEDCYL:
+                    utils::AddRoundedCylinderGeometry(body.get(), s.dims.x(), s.dims.y(), s.srad, s.pos, s.rot);
+                    break;
+                default:
+                    break;
+            }
+        }
+        body->GetCollisionModel()->SetFamilyGroup(b.family_group);
+        body->GetCollisionModel()->SetFamilyMask(b.family_mask);
+        body->GetCollisionModel()->BuildModel();
+
+        system->AddBody(body);
+    }
+
+    std::vector<BodyData> m_bodies;         ///< captured bodies
+    std::vector<MaterialData> m_materials;  ///< captured contact materials (merged by value)
+    int m_num_skipped;                      ///< visualization assets without a matching collision shape
+};
+
+#endif
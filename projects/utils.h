@@ -26,36 +26,4 @@ static inline void progressbar(unsigned int x, unsigned int n, unsigned int w =
   std::cout << "]\r" << std::flush;
 }
 
-// =============================================================================
-// Utility function to print to console a few important step statistics
-
-static inline void TimingOutput(chrono::ChSystem* mSys, chrono::ChStreamOutAsciiFile* ofile = NULL) {
-  double TIME = mSys->GetChTime();
-  double STEP = mSys->GetTimerStep();
-  double BROD = mSys->GetTimerCollisionBroad();
-  double NARR = mSys->GetTimerCollisionNarrow();
-  double SOLVER = mSys->GetTimerSolver();
-  double UPDT = mSys->GetTimerUpdate();
-  double RESID = 0;
-  int REQ_ITS = 0;
-  int BODS = mSys->GetNbodies();
-  int CNTC = mSys->GetNcontacts();
-  if (chrono::ChSystemParallel* parallel_sys = dynamic_cast<chrono::ChSystemParallel*>(mSys)) {
-      RESID = std::static_pointer_cast<chrono::ChIterativeSolverParallel>(mSys->GetSolver())->GetResidual();
-      REQ_ITS = std::static_pointer_cast<chrono::ChIterativeSolverParallel>(mSys->GetSolver())->GetTotalIterations();
-      BODS = parallel_sys->GetNbodies();
-      CNTC = parallel_sys->GetNcontacts();
-  }
-
-  if (ofile) {
-      char buf[200];
-      sprintf(buf, "%8.5f  %7.4f  %7.4f  %7.4f  %7.4f  %7.4f  %7d  %7d  %7d  %7.4f\n", TIME, STEP, BROD, NARR, SOLVER,
-              UPDT, BODS, CNTC, REQ_ITS, RESID);
-      *ofile << buf;
-  }
-
-  printf("   %8.5f | %7.4f | %7.4f | %7.4f | %7.4f | %7.4f | %7d | %7d | %7d | %7.4f\n", TIME, STEP, BROD, NARR, SOLVER,
-         UPDT, BODS, CNTC, REQ_ITS, RESID);
-}
-
 #endif
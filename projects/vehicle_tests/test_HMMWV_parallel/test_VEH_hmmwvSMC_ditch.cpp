@@ -52,6 +52,8 @@
 #include "chrono_opengl/ChOpenGLWindow.h"
 #endif
 
+#include "../../active_region.h"
+#include "../../step_profiler.h"
 #include "../../utils.h"
 
 using namespace chrono;
@@ -154,6 +156,13 @@ int max_iteration_bilateral = 1000;
 ChSystemSMC::ContactForceModel contact_force_model = ChSystemSMC::ContactForceModel::Hooke;
 ChSystemSMC::TangentialDisplacementModel tangential_displ_mode = ChSystemSMC::TangentialDisplacementModel::OneStep;
 
+// Activity region. If enabled, only particles near the vehicle (a box around the chassis, enlarged by a margin
+// and extended along the chassis velocity over the look-ahead time) are collided and integrated.
+bool active_region = true;
+ChVector<> region_hdims(2.5, 1.2, 1.0);
+ChVector<> region_margin(0.5, 0.5, 0.5);
+double region_lookahead = 0.25;
+
 // Periodically monitor maximum bilateral constraint violation
 bool monitor_bilaterals = false;
 int bilateral_frame_interval = 100;
@@ -510,9 +519,13 @@ int main(int argc, char* argv[]) {
     // Specify active box.
     // -------------------
 
-    system->GetSettings()->collision.use_aabb_active = true;
-    system->GetSettings()->collision.aabb_min = real3(-hdimX - 2 * hlen, -hdimY, 0);
-    system->GetSettings()->collision.aabb_max = real3(hdimX + 2 * hlen, hdimY, 2 * hdimZ);
+    // Static box over the entire terrain until the vehicle is created; then (if enabled) a region following
+    // the vehicle chassis.
+    ActiveRegion region(system);
+    region.SetDefaultRegion(ChVector<>(-hdimX - 2 * hlen, -hdimY, 0), ChVector<>(hdimX + 2 * hlen, hdimY, 2 * hdimZ));
+    region.SetMargin(region_margin);
+    region.SetLookahead(region_lookahead);
+    region.Initialize();
 
 // -----------------------
 // Start the simulation.
@@ -536,6 +549,8 @@ int main(int argc, char* argv[]) {
     double exec_time = 0;
     int num_contacts = 0;
 
+    StepProfiler profiler(system);
+
     while (time < time_end) {
         // If enabled, output data for PovRay postprocessing.
         if (sim_frame == next_out_frame) {
@@ -546,6 +561,7 @@ int main(int argc, char* argv[]) {
             cout << "     Time:           " << time << endl;
             cout << "     Speed:          " << speed << endl;
             cout << "     Avg. contacts:  " << num_contacts / out_steps << endl;
+            cout << "     Active bodies:  " << region.GetNumActive() << " / " << region.GetNumColliding() << endl;
             cout << "     Execution time: " << exec_time << endl;
 
             if (povray_output) {
@@ -566,6 +582,8 @@ int main(int argc, char* argv[]) {
             ////AdjustGroundGeometry(ground, max_height);
             CreatePlatform(system, max_height);
             CreateVehicleAssembly(system, max_height);
+            if (active_region)
+                region.AddTrackedBody(vehicle_assembly->GetVehicle()->GetChassisBody(), region_hdims);
         }
 
         // Update vehicle
@@ -584,7 +602,8 @@ int main(int argc, char* argv[]) {
 #endif
 
         ////progressbar(out_steps + sim_frame - next_out_frame + 1, out_steps);
-        TimingOutput(system);
+        profiler.Record();
+        region.Update();
 
         // Periodically display maximum constraint violation
         if (monitor_bilaterals && sim_frame % bilateral_frame_interval == 0) {
@@ -600,6 +619,8 @@ int main(int argc, char* argv[]) {
     }
 
     // Final stats
+    profiler.PrintSummary();
+    cout << "Avg. active fraction: " << region.GetAverageActiveFraction() << endl;
     cout << "==================================" << endl;
     cout << "Simulation time:   " << exec_time << endl;
     cout << "Number of threads: " << threads << endl;
@@ -57,6 +57,8 @@
 #include "chrono_thirdparty/filesystem/path.h"
 
 // Utilities
+#include "../../active_region.h"
+#include "../../auto_binning.h"
 #include "../../utils.h"
 
 using namespace chrono;
@@ -144,6 +146,14 @@ int max_iteration_spinning = 0;
 
 float contact_recovery_speed = 12;
 
+// Activity region. If enabled, once the vehicle is released only particles near the vehicle (a box around the
+// chassis, enlarged by a margin and extended along the chassis velocity over the look-ahead time) are collided
+// and integrated. All particles are active during the hold time (settling).
+bool active_region = true;
+ChVector<> region_hdims(3.0, 1.6, 1.0);
+ChVector<> region_margin(0.5, 0.5, 0.5);
+double region_lookahead = 0.25;
+
 // Periodically monitor maximum bilateral constraint violation
 bool monitor_bilaterals = false;
 int bilateral_frame_interval = 100;
@@ -268,14 +278,16 @@ int main(int argc, char* argv[]) {
     system.GetSettings()->collision.narrowphase_algorithm = NarrowPhaseType::NARROWPHASE_HYBRID_MPR;
     system.GetSettings()->collision.collision_envelope = 0.001;
 
-    system.GetSettings()->collision.bins_per_axis = vec3(10, 10, 10);
+    // Broad-phase bins: initial estimate from the terrain container, re-evaluated as the vehicle moves
+    AutoBinning binning(&system);
+    binning.SetUpdateInterval(500);
+    binning.Initialize(ChVector<>(-hdimX, -hdimY, 0), ChVector<>(hdimX, hdimY, 2 * hdimZ), 2 * r_g);
 
-    int factor = 2;
-    int binsX = (int)std::ceil(hdimX / r_g) / factor;
-    int binsY = (int)std::ceil(hdimY / r_g) / factor;
-    int binsZ = 1;
-    system.GetSettings()->collision.bins_per_axis = vec3(binsX, binsY, binsZ);
-    std::cout << "broad-phase bins: " << binsX << " x " << binsY << " x " << binsZ << std::endl;
+    // Activity region (inactive until the vehicle is released)
+    ActiveRegion region(&system);
+    region.SetMargin(region_margin);
+    region.SetLookahead(region_lookahead);
+    region.Initialize();
 
     // ------------------
     // Create the terrain
@@ -456,6 +468,8 @@ int main(int argc, char* argv[]) {
             std::cout << "     Sim frame:      " << sim_frame << std::endl;
             std::cout << "     Time:           " << time << std::endl;
             std::cout << "     Avg. contacts:  " << num_contacts / out_steps << std::endl;
+            std::cout << "     Active bodies:  " << region.GetNumActive() << " / " << region.GetNumColliding()
+                      << std::endl;
             std::cout << "     Throttle input: " << throttle_input << std::endl;
             std::cout << "     Braking input:  " << braking_input << std::endl;
             std::cout << "     Steering input: " << steering_input << std::endl;
@@ -478,6 +492,8 @@ int main(int argc, char* argv[]) {
         if (vehicle->GetChassis()->IsFixed() && time > time_hold) {
             std::cout << std::endl << "Release vehicle t = " << time << std::endl;
             vehicle->GetChassisBody()->SetBodyFixed(false);
+            if (active_region)
+                region.AddTrackedBody(vehicle->GetChassisBody(), region_hdims);
         }
 
         // Update modules (process inputs from other modules)
@@ -492,6 +508,8 @@ int main(int argc, char* argv[]) {
 		driver_steering.Advance(time_step);
         powertrain->Advance(time_step);
         vehicle->Advance(time_step);
+        binning.Update();
+        region.Update();
 
 #ifdef CHRONO_OPENGL
         if (gl_window.Active())
@@ -518,6 +536,7 @@ int main(int argc, char* argv[]) {
     std::cout << "==================================" << std::endl;
     std::cout << "Simulation time:   " << exec_time << std::endl;
     std::cout << "Number of threads: " << threads << std::endl;
+    std::cout << "Avg. active fraction: " << region.GetAverageActiveFraction() << std::endl;
 
     csv.write_to_file(out_dir + "/output.dat");
 